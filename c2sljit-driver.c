@@ -3,6 +3,8 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 
 #include "mir-alloc.h"
 #include "mir-alloc-default.c"
@@ -43,11 +45,13 @@ static void usage (const char *prog) {
            "  -w           Suppress warnings\n"
            "  -e code      Compile and run code string\n"
            "  -O1          Enable all optimizations\n"
+           "  -O2          -O1 plus the linear IR passes (-fopt-lir -fopt-licm\n"
+           "               -fopt-unroll -fopt-lvn)\n"
            "  -fopt-cmp-branch     Comparison-branch fusion\n"
            "  -fopt-mem-operands   Direct memory/imm operands\n"
            "  -fopt-reg-cache      Register caching in basic blocks\n"
            "  -fopt-strength-reduce  Strength reduction (mul/div/mod)\n"
-           "  -fopt-magic-div      Magic number division (x86-64)\n"
+           "  -fopt-magic-div      Magic number division (64-bit targets)\n"
            "  -fopt-commute        Commutative operand swap\n"
            "  -fopt-smart-regs     Cache-aware temp reg allocation\n"
            "  -fopt-defer-store    Deferred write-back\n"
@@ -57,6 +61,15 @@ static void usage (const char *prog) {
            "  -fopt-addr-cache     Address register caching\n"
            "  -fopt-fmadd          Fused multiply-add (ARM64)\n"
            "  -fopt-float-field-cache  Float field load CSE\n"
+           "  -fopt-lir            Linear IR with global register allocation\n"
+           "  -fopt-licm           Loop-invariant code motion (with -fopt-lir)\n"
+           "  -fopt-unroll         Counted loop unrolling (with -fopt-lir)\n"
+           "  -fopt-lvn            Local value numbering (with -fopt-lir)\n"
+           "  -finstances[=N]      Globals in per-instance data blocks; run main\n"
+           "                       N times, each time in a fresh instance\n"
+           "  -flow-memory         Release compile-time memory as early as possible\n"
+           "  -fstream             Generate each function once it is parsed and free\n"
+           "                       its AST\n"
            "  -h           Show this help\n",
            prog);
 }
@@ -72,6 +85,7 @@ int main (int argc, char *argv[]) {
   int n_macros = 0, n_includes = 0;
   const char *source_file = NULL;
   const char *eval_code = NULL;
+  int n_runs = 1;
 
   for (int i = 1; i < argc; i++) {
     if (strcmp (argv[i], "-E") == 0) {
@@ -119,7 +133,23 @@ int main (int argc, char *argv[]) {
       opts.opt_fmadd_p = 1;
     } else if (strcmp (argv[i], "-fopt-float-field-cache") == 0) {
       opts.opt_float_field_cache_p = 1;
-    } else if (strcmp (argv[i], "-O1") == 0) {
+    } else if (strcmp (argv[i], "-fopt-lir") == 0) {
+      opts.opt_lir_p = 1;
+    } else if (strcmp (argv[i], "-fopt-licm") == 0) {
+      opts.opt_licm_p = 1;
+    } else if (strcmp (argv[i], "-fopt-unroll") == 0) {
+      opts.opt_unroll_p = 1;
+    } else if (strcmp (argv[i], "-fopt-lvn") == 0) {
+      opts.opt_lvn_p = 1;
+    } else if (strncmp (argv[i], "-finstances", 11) == 0
+               && (argv[i][11] == '\0' || argv[i][11] == '=')) {
+      opts.instances_p = 1;
+      if (argv[i][11] == '=' && (n_runs = atoi (argv[i] + 12)) < 1) n_runs = 1;
+    } else if (strcmp (argv[i], "-flow-memory") == 0) {
+      opts.low_memory_p = 1;
+    } else if (strcmp (argv[i], "-fstream") == 0) {
+      opts.stream_p = 1;
+    } else if (strcmp (argv[i], "-O1") == 0 || strcmp (argv[i], "-O2") == 0) {
       opts.opt_mem_operands_p = 1;
       opts.opt_reg_cache_p = opts.opt_cmp_branch_p = 1;
       opts.opt_strength_reduce_p = opts.opt_commute_p = 1;
@@ -128,12 +158,12 @@ int main (int argc, char *argv[]) {
       opts.opt_ind_cache_p = opts.opt_inline_p = 1;
       opts.opt_float_chain_p = opts.opt_addr_cache_p = 1;
       opts.opt_float_field_cache_p = 1;
+      if (argv[i][2] == '2')
+        opts.opt_lir_p = opts.opt_licm_p = opts.opt_unroll_p = opts.opt_lvn_p = 1;
 #if defined(__aarch64__) || defined(_M_ARM64)
       opts.opt_fmadd_p = 1;
 #endif
-#if defined(__x86_64__) || defined(_M_X64)
       opts.opt_magic_div_p = 1;
-#endif
     } else if (strncmp (argv[i], "-D", 2) == 0) {
       const char *macro = argv[i] + 2;
       if (*macro == '\0' && i + 1 < argc) macro = argv[++i];
@@ -206,8 +236,18 @@ int main (int argc, char *argv[]) {
       c2sljit_finish (ctx);
       return 1;
     }
-    struct file_getc_data fgd = {.f = f};
-    success = c2sljit_compile (ctx, &opts, file_getc, &fgd, source_file, NULL);
+    /* Regular files are mapped and read as a whole */
+    struct stat st;
+    void *map = MAP_FAILED;
+    if (fstat (fileno (f), &st) == 0 && S_ISREG (st.st_mode) && st.st_size > 0)
+      map = mmap (NULL, (size_t) st.st_size, PROT_READ, MAP_PRIVATE, fileno (f), 0);
+    if (map != MAP_FAILED) {
+      success = c2sljit_compile_buffer (ctx, &opts, map, (size_t) st.st_size, source_file);
+      munmap (map, (size_t) st.st_size);
+    } else {
+      struct file_getc_data fgd = {.f = f};
+      success = c2sljit_compile (ctx, &opts, file_getc, &fgd, source_file, NULL);
+    }
     fclose (f);
   }
 
@@ -215,9 +255,15 @@ int main (int argc, char *argv[]) {
   if (success && !opts.prepro_only_p && !opts.syntax_only_p) {
     /* Execute main() */
     c2sljit_main_func_t main_func = c2sljit_get_main (ctx);
+    c2sljit_module_t module = c2sljit_get_module (ctx);
     if (main_func != NULL) {
-      ret = main_func (0, NULL);
-      if (opts.verbose_p) fprintf (stderr, "main() returned %d\n", ret);
+      for (int run = 0; run < n_runs; run++) {
+        c2sljit_instance_t inst = opts.instances_p ? c2sljit_instantiate (ctx, module) : NULL;
+        if (inst != NULL) c2sljit_set_instance (ctx, module, inst);
+        ret = main_func (0, NULL);
+        if (opts.verbose_p) fprintf (stderr, "main() returned %d\n", ret);
+        if (inst != NULL) c2sljit_free_instance (ctx, module, inst);
+      }
     } else {
       fprintf (stderr, "c2sljit: main() not found\n");
       ret = 1;
@@ -9,12 +9,13 @@
    o generation pass producing sljit code
 
    The compiler implements C11 standard w/o C11 optional features:
-   atomic, complex, variable size arrays. */
+   complex, variable size arrays. */
 
 #include <assert.h>
 #include <string.h>
 #include <ctype.h>
 #include <float.h>
+#include <limits.h>
 #include <stdlib.h>
 #include <stdio.h>
 #include <stdarg.h>
@@ -23,6 +24,13 @@
 #include <math.h>
 #include <wchar.h>
 #include <dlfcn.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#ifdef __GLIBC__
+#include <malloc.h>
+#endif
 #include "mir-alloc.h"
 #include "mir-compat.h"
 #include "time.h"
@@ -71,15 +79,21 @@ static const pos_t no_pos = {NULL, -1, -1};
 
 typedef struct c2m_ctx *c2m_ctx_t;
 
+/* A stream reads its source either from a buffer (block input) or
+   through a get function.  Lines of a buffer are used in place when they
+   need no translation, otherwise they are copied into LN. */
 typedef struct stream {
-  FILE *f;                        /* the current file, NULL for top-level or string stream */
   const char *fname;              /* NULL only for preprocessor string stream */
-  int (*getc_func) (c2m_ctx_t);   /* get function for top-level or string stream */
-  VARR (char) * ln;               /* stream current line in reverse order */
+  int (*getc_func) (c2m_ctx_t);   /* get function for top-level stream without buffer */
+  const char *buf_curr, *buf_end; /* the rest of the source buffer, NULL if none */
+  VARR (char) * text;             /* the buffer contents of a file stream */
+  VARR (char) * ln;               /* translated current line */
+  const char *ln_start, *ln_curr, *ln_end; /* the current line and its unread part */
+  VARR (char) * back;             /* chars pushed back before the line start */
   pos_t pos;                      /* includes file name used for reports */
-  fpos_t fpos;                    /* file pos to resume file stream */
-  const char *start, *curr;       /* non NULL only for string stream  */
   int ifs_length_at_stream_start; /* length of ifs at the stream start */
+  int guard_state;                /* include guard detection state, see GUARD_START */
+  const char *guard_id;           /* macro of #ifndef enclosing the whole stream */
 } *stream_t;
 
 DEF_VARR (stream_t);
@@ -97,7 +111,6 @@ typedef struct {
 
 typedef struct {
   str_t str;
-  size_t key, flags;
 } tab_str_t;
 
 DEF_HTAB (tab_str_t);
@@ -120,6 +133,24 @@ typedef struct {
 } symbol_t;
 
 DEF_HTAB (symbol_t);
+DEF_VARR (symbol_t);
+
+/* A definition of a regular or tag identifier in an open scope: */
+typedef struct {
+  node_t scope, def_node, aux_node;
+  unsigned depth; /* of the scope */
+} shadow_t;
+
+DEF_VARR (shadow_t);
+
+/* The shadow stack of an identifier, the innermost definition is the last: */
+typedef struct {
+  enum symbol_mode mode;
+  node_t id;
+  VARR (shadow_t) * defs;
+} visible_t;
+
+DEF_HTAB (visible_t);
 
 struct init_object {
   struct type *container_type;
@@ -138,8 +169,6 @@ typedef struct parse_ctx *parse_ctx_t;
 typedef struct check_ctx *check_ctx_t;
 typedef struct gen_ctx *gen_ctx_t;
 
-DEF_VARR (pos_t);
-
 struct c2m_ctx {
   MIR_context_t ctx;
   struct c2sljit_options *options;
@@ -148,21 +177,26 @@ struct c2m_ctx {
   VARR (char_ptr_t) * system_headers;
   const char **header_dirs, **system_header_dirs;
   void (*error_func) (c2m_ctx_t, C_error_code_t code, const char *message);
-  VARR (void_ptr_t) * reg_memory;
+  struct reg_chunk *reg_chunks;      /* arena freed at the end of each compile */
+  struct reg_chunk *reg_free_chunks; /* chunks kept for reuse */
+  struct reg_chunk *reg_body_chunks; /* arena of the function body being streamed */
+  int reg_body_p;                    /* the allocations go to the body arena */
+  VARR (void_ptr_t) * str_memory;  /* strings of str_tab, kept across compiles */
   VARR (stream_t) * streams; /* stack of streams */
   stream_t cs, eof_s;        /* current stream and stream corresponding the last EOF */
   HTAB (tab_str_t) * str_tab;
-  HTAB (tab_str_t) * str_key_tab;
   str_t empty_str;
-  unsigned curr_uid;
+  VARR (char_ptr_t) * node_fnames; /* file names of the node positions */
+  size_t node_fname_last;
   int (*c_getc) (void *); /* c2mir interface get function */
   void *c_getc_data;
   unsigned n_errors, n_warnings;
   VARR (char) * symbol_text, *temp_string;
   VARR (token_t) * recorded_tokens, *buffered_tokens;
+  size_t dropped_tokens_num; /* parse tokens already dropped from recorded_tokens */
   node_t top_scope;
   HTAB (symbol_t) * symbol_tab;
-  VARR (pos_t) * node_positions;
+  HTAB (visible_t) * visible_tab;
   VARR (node_t) * call_nodes;
   VARR (node_t) * containing_anon_members;
   VARR (init_object_t) * init_object_path;
@@ -170,7 +204,12 @@ struct c2m_ctx {
   struct pre_ctx *pre_ctx;
   struct parse_ctx *parse_ctx;
   struct check_ctx *check_ctx;
-  struct gen_ctx *gen_ctx;
+  struct gen_ctx *gen_ctx; /* module of the last compile */
+  struct gen_ctx *modules; /* loaded modules, see c2sljit_unload */
+  unsigned snapshots_num;  /* live snapshots, they refer to str_tab strings */
+  int compiled_p;          /* a compile was started in the context */
+  struct c2sljit_snapshot *env_snapshot; /* the standard macros and macro commands */
+  VARR (char) * env_key;                 /* the options env_snapshot was made with */
 };
 
 typedef struct c2m_ctx *c2m_ctx_t;
@@ -181,14 +220,18 @@ typedef struct c2m_ctx *c2m_ctx_t;
 #define header_dirs c2m_ctx->header_dirs
 #define system_header_dirs c2m_ctx->system_header_dirs
 #define error_func c2m_ctx->error_func
-#define reg_memory c2m_ctx->reg_memory
+#define reg_chunks c2m_ctx->reg_chunks
+#define reg_free_chunks c2m_ctx->reg_free_chunks
+#define reg_body_chunks c2m_ctx->reg_body_chunks
+#define reg_body_p c2m_ctx->reg_body_p
+#define str_memory c2m_ctx->str_memory
 #define str_tab c2m_ctx->str_tab
 #define streams c2m_ctx->streams
 #define cs c2m_ctx->cs
 #define eof_s c2m_ctx->eof_s
-#define str_key_tab c2m_ctx->str_key_tab
 #define empty_str c2m_ctx->empty_str
-#define curr_uid c2m_ctx->curr_uid
+#define node_fnames c2m_ctx->node_fnames
+#define node_fname_last c2m_ctx->node_fname_last
 #define c_getc c2m_ctx->c_getc
 #define c_getc_data c2m_ctx->c_getc_data
 #define n_errors c2m_ctx->n_errors
@@ -196,10 +239,11 @@ typedef struct c2m_ctx *c2m_ctx_t;
 #define symbol_text c2m_ctx->symbol_text
 #define temp_string c2m_ctx->temp_string
 #define recorded_tokens c2m_ctx->recorded_tokens
+#define dropped_tokens_num c2m_ctx->dropped_tokens_num
 #define buffered_tokens c2m_ctx->buffered_tokens
 #define top_scope c2m_ctx->top_scope
 #define symbol_tab c2m_ctx->symbol_tab
-#define node_positions c2m_ctx->node_positions
+#define visible_tab c2m_ctx->visible_tab
 #define call_nodes c2m_ctx->call_nodes
 #define containing_anon_members c2m_ctx->containing_anon_members
 #define init_object_path c2m_ctx->init_object_path
@@ -345,57 +389,152 @@ static inline MIR_alloc_t c2m_alloc (c2m_ctx_t c2m_ctx) {
   return MIR_get_alloc (c2m_ctx->ctx);
 }
 
+/* Frontend objects (AST nodes, tokens, types and attributes) are
+   allocated from a bump-pointer arena and freed in bulk.  A mark is the
+   arena position: the chunk base plus the used bytes of the chunk.  The
+   base of a chunk is the base of the previous one plus its size, so marks
+   grow with the allocations. */
+#define REG_CHUNK_SIZE (64 * 1024)
+#define REG_ALIGN 16
+#define REG_FREE_CHUNKS_MAX 64 /* chunks kept for the next compiles */
+
+typedef struct reg_chunk {
+  struct reg_chunk *next; /* the previous chunk or the next free one */
+  size_t size, used, base;
+} *reg_chunk_t;
+
+#define REG_CHUNK_HEADER ((sizeof (struct reg_chunk) + REG_ALIGN - 1) & ~(size_t) (REG_ALIGN - 1))
+
+static reg_chunk_t reg_chunk_new (c2m_ctx_t c2m_ctx, size_t s) {
+  size_t size = REG_CHUNK_HEADER + s;
+  reg_chunk_t chunk;
+
+  if (size <= REG_CHUNK_SIZE && (chunk = reg_free_chunks) != NULL) {
+    reg_free_chunks = chunk->next;
+  } else {
+    if (size < REG_CHUNK_SIZE) size = REG_CHUNK_SIZE;
+    if ((chunk = MIR_malloc (c2m_alloc (c2m_ctx), size)) == NULL)
+      alloc_error (c2m_ctx, "no memory");
+    chunk->size = size;
+  }
+  chunk->used = REG_CHUNK_HEADER;
+  chunk->base = reg_chunks == NULL ? 0 : reg_chunks->base + reg_chunks->size;
+  chunk->next = reg_chunks;
+  reg_chunks = chunk;
+  return chunk;
+}
+
 static void *reg_malloc (c2m_ctx_t c2m_ctx, size_t s) {
-  MIR_alloc_t alloc = c2m_alloc (c2m_ctx);
-  void *mem = MIR_malloc (alloc, s);
+  reg_chunk_t chunk = reg_chunks;
+  void *mem;
 
-  if (mem == NULL) alloc_error (c2m_ctx, "no memory");
-  VARR_PUSH (void_ptr_t, reg_memory, mem);
+  s = (s + REG_ALIGN - 1) & ~(size_t) (REG_ALIGN - 1);
+  if (chunk == NULL || chunk->used + s > chunk->size) chunk = reg_chunk_new (c2m_ctx, s);
+  mem = (char *) chunk + chunk->used;
+  chunk->used += s;
   return mem;
 }
 
+/* Free the arena memory allocated after MARK.  Standard chunks are kept
+   for reuse up to REG_FREE_CHUNKS_MAX. */
 static void reg_memory_pop (c2m_ctx_t c2m_ctx, size_t mark) {
   MIR_alloc_t alloc = c2m_alloc (c2m_ctx);
-  while (VARR_LENGTH (void_ptr_t, reg_memory) > mark)
-    MIR_free (alloc, VARR_POP (void_ptr_t, reg_memory));
+  reg_chunk_t chunk, free_chunk;
+  size_t n_free = 0;
+
+  for (free_chunk = reg_free_chunks; free_chunk != NULL; free_chunk = free_chunk->next) n_free++;
+  while ((chunk = reg_chunks) != NULL && chunk->base >= mark) {
+    reg_chunks = chunk->next;
+    if (chunk->size != REG_CHUNK_SIZE || n_free >= REG_FREE_CHUNKS_MAX) {
+      MIR_free (alloc, chunk);
+    } else {
+      chunk->next = reg_free_chunks;
+      reg_free_chunks = chunk;
+      n_free++;
+    }
+  }
+  if (chunk != NULL) chunk->used = mark - chunk->base;
+}
+
+static size_t reg_memory_mark (c2m_ctx_t c2m_ctx) {
+  return reg_chunks == NULL ? 0 : reg_chunks->base + reg_chunks->used;
+}
+
+/* Free the chunks kept for reuse */
+static void reg_memory_trim (c2m_ctx_t c2m_ctx) {
+  MIR_alloc_t alloc = c2m_alloc (c2m_ctx);
+  reg_chunk_t chunk;
+
+  while ((chunk = reg_free_chunks) != NULL) {
+    reg_free_chunks = chunk->next;
+    MIR_free (alloc, chunk);
+  }
+}
+
+/* The streaming compilation allocates the objects of a function body
+   from a separate arena, released when the function code is generated.
+   The switch exchanges the lists of the two arenas. */
+static void reg_body_switch (c2m_ctx_t c2m_ctx, int body_p) {
+  reg_chunk_t temp;
+
+  assert (reg_body_p != body_p);
+  SWAP (reg_chunks, reg_body_chunks, temp);
+  reg_body_p = body_p;
 }
 
-static size_t MIR_UNUSED reg_memory_mark (c2m_ctx_t c2m_ctx) {
-  return VARR_LENGTH (void_ptr_t, reg_memory);
+static void reg_body_release (c2m_ctx_t c2m_ctx) {
+  assert (!reg_body_p);
+  reg_body_switch (c2m_ctx, TRUE);
+  reg_memory_pop (c2m_ctx, 0);
+  reg_body_switch (c2m_ctx, FALSE);
+}
+
+/* Keep the body arena: its chunks go on top of the main arena, so they
+   are freed with it. */
+static void reg_body_keep (c2m_ctx_t c2m_ctx) {
+  reg_chunk_t chunk, next, prev = NULL;
+
+  assert (!reg_body_p);
+  for (chunk = reg_body_chunks; chunk != NULL; chunk = next) { /* oldest first */
+    next = chunk->next;
+    chunk->next = prev;
+    prev = chunk;
+  }
+  for (chunk = prev; chunk != NULL; chunk = next) {
+    next = chunk->next;
+    chunk->base = reg_chunks == NULL ? 0 : reg_chunks->base + reg_chunks->size;
+    chunk->next = reg_chunks;
+    reg_chunks = chunk;
+  }
+  reg_body_chunks = NULL;
 }
+
 static void reg_memory_finish (c2m_ctx_t c2m_ctx) {
+  reg_body_release (c2m_ctx);
   reg_memory_pop (c2m_ctx, 0);
-  VARR_DESTROY (void_ptr_t, reg_memory);
+  reg_memory_trim (c2m_ctx);
 }
 
 static void reg_memory_init (c2m_ctx_t c2m_ctx) {
-  MIR_alloc_t alloc = c2m_alloc (c2m_ctx);
-  VARR_CREATE (void_ptr_t, reg_memory, alloc, 4096);
+  reg_chunks = reg_free_chunks = reg_body_chunks = NULL;
+  reg_body_p = FALSE;
 }
 
 static int char_is_signed_p (void) { return MIR_CHAR_MAX == MIR_SCHAR_MAX; }
 
-enum str_flag { FLAG_EXT = 1, FLAG_C89, FLAG_EXT89 };
-
 static int str_eq (tab_str_t str1, tab_str_t str2, void *arg MIR_UNUSED) {
   return str1.str.len == str2.str.len && memcmp (str1.str.s, str2.str.s, str1.str.len) == 0;
 }
 static htab_hash_t str_hash (tab_str_t str, void *arg MIR_UNUSED) {
   return (htab_hash_t) mir_hash (str.str.s, str.str.len, 0x42);
 }
-static int str_key_eq (tab_str_t str1, tab_str_t str2, void *arg MIR_UNUSED) {
-  return str1.key == str2.key;
-}
-static htab_hash_t str_key_hash (tab_str_t str, void *arg MIR_UNUSED) {
-  return (htab_hash_t) mir_hash64 (str.key, 0x24);
-}
 
 static str_t uniq_cstr (c2m_ctx_t c2m_ctx, const char *str);
 
 static void str_init (c2m_ctx_t c2m_ctx) {
   MIR_alloc_t alloc = c2m_alloc (c2m_ctx);
+  VARR_CREATE (void_ptr_t, str_memory, alloc, 1024);
   HTAB_CREATE (tab_str_t, str_tab, alloc, 1000, str_hash, str_eq, NULL);
-  HTAB_CREATE (tab_str_t, str_key_tab, alloc, 200, str_key_hash, str_key_eq, NULL);
   empty_str = uniq_cstr (c2m_ctx, "");
 }
 
@@ -409,34 +548,27 @@ static int str_exists_p (c2m_ctx_t c2m_ctx, const char *s, size_t len, tab_str_t
   return TRUE;
 }
 
-static tab_str_t str_add (c2m_ctx_t c2m_ctx, const char *s, size_t len, size_t key, size_t flags,
-                          int key_p) {
+static tab_str_t str_add (c2m_ctx_t c2m_ctx, const char *s, size_t len) {
   char *heap_s;
   tab_str_t el, str;
 
   if (str_exists_p (c2m_ctx, s, len, &el)) return el;
-  heap_s = reg_malloc (c2m_ctx, len);
+  if ((heap_s = MIR_malloc (c2m_alloc (c2m_ctx), len)) == NULL) alloc_error (c2m_ctx, "no memory");
+  VARR_PUSH (void_ptr_t, str_memory, heap_s);
   memcpy (heap_s, s, len);
   str.str.s = heap_s;
   str.str.len = len;
-  str.key = key;
-  str.flags = flags;
   HTAB_DO (tab_str_t, str_tab, str, HTAB_INSERT, el);
-  if (key_p) HTAB_DO (tab_str_t, str_key_tab, str, HTAB_INSERT, el);
   return str;
 }
 
-static const char *str_find_by_key (c2m_ctx_t c2m_ctx, size_t key) {
-  tab_str_t el, str;
-
-  str.key = key;
-  if (!HTAB_DO (tab_str_t, str_key_tab, str, HTAB_FIND, el)) return NULL;
-  return el.str.s;
-}
-
 static void str_finish (c2m_ctx_t c2m_ctx) {
+  MIR_alloc_t alloc = c2m_alloc (c2m_ctx);
+
   HTAB_DESTROY (tab_str_t, str_tab);
-  HTAB_DESTROY (tab_str_t, str_key_tab);
+  while (VARR_LENGTH (void_ptr_t, str_memory) != 0)
+    MIR_free (alloc, VARR_POP (void_ptr_t, str_memory));
+  VARR_DESTROY (void_ptr_t, str_memory);
 }
 
 static void *c2sljit_calloc (c2m_ctx_t c2m_ctx, size_t size) {
@@ -459,9 +591,27 @@ void c2sljit_init (MIR_context_t ctx) {
   str_init (c2m_ctx);
 }
 
+static void gen_finish (c2m_ctx_t c2m_ctx, gen_ctx_t gen_ctx);
+static void compile_finish (c2m_ctx_t c2m_ctx, int keep_p);
+static void snapshot_free (c2m_ctx_t c2m_ctx, struct c2sljit_snapshot *snap);
+
+/* Unload all modules.  The compile state cleared by the last compile is
+   kept with its capacity, as are the interned strings and the snapshot of
+   the standard macros, see env_snapshot. */
+void c2sljit_reset (MIR_context_t ctx) {
+  c2m_ctx_t c2m_ctx = *c2m_ctx_loc (ctx);
+
+  if (c2m_ctx == NULL) return;
+  while (c2m_ctx->modules != NULL) gen_finish (c2m_ctx, c2m_ctx->modules);
+}
+
 void c2sljit_finish (MIR_context_t ctx) {
   struct c2m_ctx **c2m_ctx_ptr = c2m_ctx_loc (ctx), *c2m_ctx = *c2m_ctx_ptr;
 
+  while (c2m_ctx->modules != NULL) gen_finish (c2m_ctx, c2m_ctx->modules);
+  if (c2m_ctx->env_snapshot != NULL) snapshot_free (c2m_ctx, c2m_ctx->env_snapshot);
+  if (c2m_ctx->env_key != NULL) VARR_DESTROY (char, c2m_ctx->env_key);
+  compile_finish (c2m_ctx, FALSE);
   str_finish (c2m_ctx);
   reg_memory_finish (c2m_ctx);
   free (c2m_ctx);
@@ -607,9 +757,18 @@ typedef enum {
 DEF_DLIST_LINK (node_t);
 DEF_DLIST_TYPE (node_t);
 
+/* The node position is packed next to the code: the file name is kept as
+   an index in node_fnames, the line and column saturate at the field
+   limits.  This keeps the node at 48 bytes.  */
+#define NODE_LNO_MAX ((1 << 23) - 1)
+#define NODE_LN_POS_MAX ((1 << 11) - 1)
+#define NODE_FNAMES_MAX (1 << 20)
+
 struct node {
-  node_code_t code;
-  unsigned uid;
+  unsigned code : 8; /* node_code_t */
+  int lno : 24;      /* position line, negative for no position */
+  unsigned fname_num : 20;
+  int ln_pos : 12;
   void *attr; /* used a scope for parser and as an attribute after */
   DLIST_LINK (node_t) op_link;
   union {
@@ -627,14 +786,39 @@ struct node {
 };
 
 static pos_t get_node_pos (c2m_ctx_t c2m_ctx, node_t n) {
-  return VARR_GET (pos_t, node_positions, n->uid);
+  pos_t pos;
+
+  if (n->lno < 0) return no_pos;
+  pos.fname = VARR_GET (char_ptr_t, node_fnames, n->fname_num);
+  pos.lno = n->lno;
+  pos.ln_pos = n->ln_pos;
+  return pos;
 }
 
 #define POS(n) get_node_pos (c2m_ctx, n)
 
 static void set_node_pos (c2m_ctx_t c2m_ctx, node_t n, pos_t pos) {
-  while (n->uid >= VARR_LENGTH (pos_t, node_positions)) VARR_PUSH (pos_t, node_positions, no_pos);
-  VARR_SET (pos_t, node_positions, n->uid, pos);
+  size_t i;
+
+  n->lno = pos.lno < 0 ? -1 : pos.lno > NODE_LNO_MAX ? NODE_LNO_MAX : pos.lno;
+  n->ln_pos = pos.ln_pos < 0 ? -1 : pos.ln_pos > NODE_LN_POS_MAX ? NODE_LN_POS_MAX : pos.ln_pos;
+  if (pos.lno < 0) return;
+  /* Nodes mostly come in runs from the same file: try the last one first */
+  i = node_fname_last;
+  if (i >= VARR_LENGTH (char_ptr_t, node_fnames)
+      || VARR_GET (char_ptr_t, node_fnames, i) != pos.fname) {
+    for (i = 0; i < VARR_LENGTH (char_ptr_t, node_fnames); i++)
+      if (VARR_GET (char_ptr_t, node_fnames, i) == pos.fname) break;
+    if (i == VARR_LENGTH (char_ptr_t, node_fnames)) {
+      if (i >= NODE_FNAMES_MAX) { /* out of file numbers: drop the position */
+        n->lno = n->ln_pos = -1;
+        return;
+      }
+      VARR_PUSH (char_ptr_t, node_fnames, pos.fname);
+    }
+    node_fname_last = i;
+  }
+  n->fname_num = (unsigned) i;
 }
 
 DEF_DLIST_CODE (node_t, op_link);
@@ -649,7 +833,7 @@ struct token {
 };
 
 static node_t add_pos (c2m_ctx_t c2m_ctx, node_t n, pos_t p) {
-  if (POS (n).lno < 0) set_node_pos (c2m_ctx, n, p);
+  if (n->lno < 0) set_node_pos (c2m_ctx, n, p);
   return n;
 }
 
@@ -679,10 +863,10 @@ static node_t new_node (c2m_ctx_t c2m_ctx, node_code_t nc) {
   node_t n = reg_malloc (c2m_ctx, sizeof (struct node));
 
   n->code = nc;
-  n->uid = curr_uid++;
   DLIST_INIT (node_t, n->u.ops);
   n->attr = NULL;
-  set_node_pos (c2m_ctx, n, no_pos);
+  n->fname_num = 0;
+  n->lno = n->ln_pos = -1;
   return n;
 }
 
@@ -809,10 +993,10 @@ static node_t get_op (node_t n, int nop) {
 }
 
 static str_t uniq_cstr (c2m_ctx_t c2m_ctx, const char *str) {
-  return str_add (c2m_ctx, str, strlen (str) + 1, T_STR, 0, FALSE).str;
+  return str_add (c2m_ctx, str, strlen (str) + 1).str;
 }
 static str_t uniq_str (c2m_ctx_t c2m_ctx, const char *str, size_t len) {
-  return str_add (c2m_ctx, str, len, T_STR, 0, FALSE).str;
+  return str_add (c2m_ctx, str, len).str;
 }
 
 static token_t new_token (c2m_ctx_t c2m_ctx, pos_t pos, const char *repr, int token_code,
@@ -828,10 +1012,13 @@ static token_t new_token (c2m_ctx_t c2m_ctx, pos_t pos, const char *repr, int to
   return token;
 }
 
+/* The identifier node of the copy is created only when the token is output
+   (see pptoken2token), as most of copied identifiers are macro names and parameters. */
 static token_t copy_token (c2m_ctx_t c2m_ctx, token_t t, pos_t pos) {
   token_t token = new_token (c2m_ctx, pos, t->repr, t->code, t->node_code);
 
-  if (t->node != NULL) token->node = copy_node_with_pos (c2m_ctx, t->node, pos);
+  if (t->node != NULL && t->node->code != N_ID)
+    token->node = copy_node_with_pos (c2m_ctx, t->node, pos);
   return token;
 }
 
@@ -854,6 +1041,91 @@ static void print_pos (FILE *f, pos_t pos, int col_p) {
   if (col_p) fprintf (f, ":%d: ", pos.ln_pos);
 }
 
+/* Keywords are recognized by a perfect hash of the identifier chars 1, 2, the last one and the
+   length.  The table was generated for the hash, regenerate it when a keyword is added. */
+typedef struct {
+  const char *name;
+  size_t len;
+  token_code_t code;
+} keyword_t;
+
+#define KEYWORD_MAX_LEN 14
+#define KEYWORD_TAB_SIZE 128
+#define KEYWORD_HASH(s, len)                                                                 \
+  (((unsigned char) (s)[1] * 2 + (unsigned char) (s)[2] * 2 + (unsigned char) (s)[(len) - 1] * 28 \
+    + (len) * 3)                                                                             \
+   % KEYWORD_TAB_SIZE)
+
+static const keyword_t keyword_tab[KEYWORD_TAB_SIZE] = {
+[0] = {"sizeof", 6, T_SIZEOF},
+  [2] = {"auto", 4, T_AUTO},
+  [6] = {"_Alignas", 8, T_ALIGNAS},
+  [8] = {"do", 2, T_DO},
+  [10] = {"long", 4, T_LONG},
+  [12] = {"typeof", 6, T_TYPEOF},
+  [14] = {"struct", 6, T_STRUCT},
+  [15] = {"typedef", 7, T_TYPEDEF},
+  [16] = {"static", 6, T_STATIC},
+  [18] = {"__inline__", 10, T_INLINE},
+  [22] = {"char", 4, T_CHAR},
+  [26] = {"_Alignof", 8, T_ALIGNOF},
+  [28] = {"_Complex", 8, T_COMPLEX},
+  [29] = {"_Noreturn", 9, T_NO_RETURN},
+  [34] = {"signed", 6, T_SIGNED},
+  [40] = {"register", 8, T_REGISTER},
+  [42] = {"__restrict__", 12, T_RESTRICT},
+  [44] = {"void", 4, T_VOID},
+  [46] = {"__thread", 8, T_THREAD_LOCAL},
+  [50] = {"switch", 6, T_SWITCH},
+  [52] = {"__inline", 8, T_INLINE},
+  [61] = {"while", 5, T_WHILE},
+  [62] = {"enum", 4, T_ENUM},
+  [64] = {"case", 4, T_CASE},
+  [65] = {"_Bool", 5, T_BOOL},
+  [67] = {"for", 3, T_FOR},
+  [68] = {"_Generic", 8, T_GENERIC},
+  [69] = {"union", 5, T_UNION},
+  [74] = {"unsigned", 8, T_UNSIGNED},
+  [76] = {"return", 6, T_RETURN},
+  [82] = {"inline", 6, T_INLINE},
+  [83] = {"_Atomic", 7, T_ATOMIC},
+  [86] = {"else", 4, T_ELSE},
+  [90] = {"volatile", 8, T_VOLATILE},
+  [91] = {"default", 7, T_DEFAULT},
+  [94] = {"continue", 8, T_CONTINUE},
+  [102] = {"double", 6, T_DOUBLE},
+  [104] = {"_Static_assert", 14, T_STATIC_ASSERT},
+  [109] = {"short", 5, T_SHORT},
+  [111] = {"_Thread_local", 13, T_THREAD_LOCAL},
+  [112] = {"__restrict", 10, T_RESTRICT},
+  [113] = {"break", 5, T_BREAK},
+  [114] = {"extern", 6, T_EXTERN},
+  [117] = {"float", 5, T_FLOAT},
+  [118] = {"goto", 4, T_GOTO},
+  [120] = {"restrict", 8, T_RESTRICT},
+  [121] = {"const", 5, T_CONST},
+  [122] = {"if", 2, T_IF},
+  [125] = {"int", 3, T_INT},
+};
+
+/* Return the keyword code of identifier S of length LEN or T_ID.  */
+static int keyword_code (const char *s, size_t len) {
+  const keyword_t *kw;
+
+  if (len < 2 || len > KEYWORD_MAX_LEN) return T_ID;
+  kw = &keyword_tab[KEYWORD_HASH (s, len)];
+  if (kw->len != len || memcmp (kw->name, s, len) != 0) return T_ID;
+  return kw->code;
+}
+
+static const char *keyword_name (int token_code) {
+  for (size_t i = 0; i < KEYWORD_TAB_SIZE; i++)
+    if (keyword_tab[i].name != NULL && keyword_tab[i].code == (token_code_t) token_code
+        && keyword_tab[i].name[1] != '_') /* not a GNU alternative keyword */
+      return keyword_tab[i].name;
+  return NULL;
+}
+
 static const char *get_token_name (c2m_ctx_t c2m_ctx, int token_code) {
   const char *s;
 
@@ -875,7 +1147,7 @@ static const char *get_token_name (c2m_ctx_t c2m_ctx, int token_code) {
   case T_UNOP: return "unary op";
   case T_DOTS: return "...";
   default:
-    if ((s = str_find_by_key (c2m_ctx, token_code)) != NULL) return s;
+    if ((s = keyword_name (token_code)) != NULL) return s;
     if (isprint (token_code))
       sprintf (temp_str_buff, "%c", token_code);
     else
@@ -918,60 +1190,77 @@ static void warning (c2m_ctx_t c2m_ctx, pos_t pos, const char *format, ...) {
 static void init_streams (c2m_ctx_t c2m_ctx) {
   MIR_alloc_t alloc = c2m_alloc (c2m_ctx);
   cs = eof_s = NULL;
-  VARR_CREATE (stream_t, streams, alloc, 32);
+  if (streams == NULL) VARR_CREATE (stream_t, streams, alloc, 32);
 }
 
 static void free_stream (stream_t s) {
   VARR_DESTROY (char, s->ln);
+  if (s->text != NULL) VARR_DESTROY (char, s->text);
+  if (s->back != NULL) VARR_DESTROY (char, s->back);
   free (s);
 }
 
-static void finish_streams (c2m_ctx_t c2m_ctx) {
+static void finish_streams (c2m_ctx_t c2m_ctx, int keep_p) {
   if (eof_s != NULL) free_stream (eof_s);
+  eof_s = NULL;
   if (streams == NULL) return;
   while (VARR_LENGTH (stream_t, streams) != 0) free_stream (VARR_POP (stream_t, streams));
-  VARR_DESTROY (stream_t, streams);
+  if (!keep_p) VARR_DESTROY (stream_t, streams);
 }
 
-static stream_t new_stream (MIR_alloc_t alloc, FILE *f, const char *fname, int (*getc_func) (c2m_ctx_t)) {
+/* States of a stream for include guard detection: nothing but white
+   spaces so far, inside #ifndef ID, only white spaces after its #endif,
+   and no guard. */
+enum { GUARD_START, GUARD_IN, GUARD_END, GUARD_NONE };
+
+static stream_t new_stream (MIR_alloc_t alloc, const char *fname, int (*getc_func) (c2m_ctx_t)) {
   stream_t s = MIR_malloc (alloc, sizeof (struct stream));
 
   VARR_CREATE (char, s->ln, alloc, 128);
-  s->f = f;
   s->fname = s->pos.fname = fname;
   s->pos.lno = 0;
   s->pos.ln_pos = 0;
   s->ifs_length_at_stream_start = 0;
-  s->start = s->curr = NULL;
+  s->guard_state = GUARD_START;
+  s->guard_id = NULL;
   s->getc_func = getc_func;
+  s->buf_curr = s->buf_end = NULL;
+  s->text = s->back = NULL;
+  s->ln_start = s->ln_curr = s->ln_end = NULL;
   return s;
 }
 
-static void add_stream (c2m_ctx_t c2m_ctx, FILE *f, const char *fname,
+/* Add a stream reading LEN bytes at BUF, or through GETC_FUNC if BUF is NULL */
+static void add_stream (c2m_ctx_t c2m_ctx, const char *fname, const char *buf, size_t len,
                         int (*getc_func) (c2m_ctx_t)) {
   assert (fname != NULL);
   MIR_alloc_t alloc = c2m_alloc (c2m_ctx);
-  if (cs != NULL && cs->f != NULL && cs->f != stdin) {
-    fgetpos (cs->f, &cs->fpos);
-    fclose (cs->f);
-    cs->f = NULL;
+  cs = new_stream (alloc, fname, getc_func);
+  if (buf != NULL) {
+    cs->buf_curr = buf;
+    cs->buf_end = buf + len;
   }
-  cs = new_stream (alloc, f, fname, getc_func);
   VARR_PUSH (stream_t, streams, cs);
 }
 
-static int str_getc (c2m_ctx_t c2m_ctx) {
-  if (*cs->curr == '\0') return EOF;
-  return *cs->curr++;
+/* Add a stream for file F, reading it whole at once */
+static void add_file_stream (c2m_ctx_t c2m_ctx, FILE *f, const char *fname) {
+  MIR_alloc_t alloc = c2m_alloc (c2m_ctx);
+  VARR (char) * text;
+  char block[8192];
+  size_t n;
+
+  VARR_CREATE (char, text, alloc, 8192);
+  while ((n = fread (block, 1, sizeof (block), f)) != 0) VARR_PUSH_ARR (char, text, block, n);
+  fclose (f);
+  add_stream (c2m_ctx, fname, VARR_ADDR (char, text), VARR_LENGTH (char, text), NULL);
+  cs->text = text;
 }
 
 static void add_string_stream (c2m_ctx_t c2m_ctx, const char *pos_fname, const char *str) {
-  add_stream (c2m_ctx, NULL, pos_fname, str_getc);
-  cs->start = cs->curr = str;
+  add_stream (c2m_ctx, pos_fname, str, strlen (str), NULL);
 }
 
-static int string_stream_p (stream_t s) { return s->getc_func != NULL; }
-
 static void change_stream_pos (c2m_ctx_t c2m_ctx, pos_t pos) { cs->pos = pos; }
 
 static void remove_trigraphs (c2m_ctx_t c2m_ctx) {
@@ -1005,67 +1294,90 @@ static void remove_trigraphs (c2m_ctx_t c2m_ctx) {
   VARR_TRUNC (char, cs->ln, to);
 }
 
-static int ln_get (c2m_ctx_t c2m_ctx) {
-  if (cs->f == NULL) return cs->getc_func (c2m_ctx); /* top level */
-  return fgetc (cs->f);
+static void set_line (stream_t s, const char *start, const char *end) {
+  s->ln_start = s->ln_curr = start;
+  s->ln_end = end;
 }
 
-static char *reverse (VARR (char) * v) {
-  char *addr = VARR_ADDR (char, v);
-  int i, j, temp, last = (int) VARR_LENGTH (char, v) - 1;
+static void set_ln_line (stream_t s) {
+  set_line (s, VARR_ADDR (char, s->ln), VARR_ADDR (char, s->ln) + VARR_LENGTH (char, s->ln));
+}
 
-  if (last >= 0 && addr[last] == '\0') last--;
-  for (i = last, j = 0; i > j; i--, j++) SWAP (addr[i], addr[j], temp);
-  return addr;
+/* Return TRUE if [S, END) contains a trigraph start */
+static int trigraph_start_p (const char *s, const char *end) {
+  while ((s = memchr (s, '?', end - s)) != NULL)
+    if (++s < end && *s == '?') return TRUE;
+  return FALSE;
 }
 
 static int get_line (c2m_ctx_t c2m_ctx) { /* translation phase 1 and 2 */
-  int c, eof_p = 0;
+  const char *start = cs->buf_curr, *end;
+  int c, eof_p;
 
   VARR_TRUNC (char, cs->ln, 0);
-  for (c = ln_get (c2m_ctx); c != EOF && c != '\n'; c = ln_get (c2m_ctx))
-    VARR_PUSH (char, cs->ln, c);
+  if (start != NULL) { /* block input */
+    if (start == cs->buf_end) return FALSE;
+    end = memchr (start, '\n', cs->buf_end - start);
+    if ((eof_p = end == NULL)) {
+      end = cs->buf_end;
+    } else if ((end == start || end[-1] != '\r') && !trigraph_start_p (start, end)) {
+      cs->buf_curr = end + 1;
+      set_line (cs, start, end + 1);
+      return TRUE;
+    }
+    cs->buf_curr = eof_p ? end : end + 1;
+    VARR_PUSH_ARR (char, cs->ln, start, end - start);
+  } else {
+    for (c = cs->getc_func (c2m_ctx); c != EOF && c != '\n'; c = cs->getc_func (c2m_ctx))
+      VARR_PUSH (char, cs->ln, c);
+    eof_p = c == EOF;
+  }
   if (VARR_LENGTH (char, cs->ln) != 0 && VARR_LAST (char, cs->ln) == '\r') VARR_POP (char, cs->ln);
-  eof_p = c == EOF;
   if (eof_p) {
     if (VARR_LENGTH (char, cs->ln) == 0) return FALSE;
-    if (c != '\n')
-      (c2m_options->pedantic_p ? error : warning) (c2m_ctx, cs->pos, "no end of line at file end");
+    (c2m_options->pedantic_p ? error : warning) (c2m_ctx, cs->pos, "no end of line at file end");
   }
   remove_trigraphs (c2m_ctx);
   VARR_PUSH (char, cs->ln, '\n');
-  reverse (cs->ln);
+  set_ln_line (cs);
   return TRUE;
 }
 
 static int cs_get (c2m_ctx_t c2m_ctx) {
-  size_t len = VARR_LENGTH (char, cs->ln);
-
   for (;;) {
-    if (len == 2 && VARR_GET (char, cs->ln, 1) == '\\') {
-      assert (VARR_GET (char, cs->ln, 0) == '\n');
-    } else if (len > 0) {
+    if (cs->back != NULL && VARR_LENGTH (char, cs->back) != 0) {
+      cs->pos.ln_pos++;
+      return VARR_POP (char, cs->back);
+    }
+    if (cs->ln_end - cs->ln_curr == 2 && cs->ln_curr[0] == '\\') {
+      assert (cs->ln_curr[1] == '\n');
+    } else if (cs->ln_curr != cs->ln_end) {
       cs->pos.ln_pos++;
-      return VARR_POP (char, cs->ln);
+      return *cs->ln_curr++;
     }
     if (cs->fname == NULL || !get_line (c2m_ctx)) return EOF;
-    len = VARR_LENGTH (char, cs->ln);
-    assert (len > 0);
     cs->pos.ln_pos = 0;
     cs->pos.lno++;
   }
 }
 
+/* The line can be source text, so only the same char is put back into it */
 static void cs_unget (c2m_ctx_t c2m_ctx, int c) {
   cs->pos.ln_pos--;
-  VARR_PUSH (char, cs->ln, c);
+  if ((cs->back == NULL || VARR_LENGTH (char, cs->back) == 0) && cs->ln_curr != cs->ln_start
+      && cs->ln_curr[-1] == (char) c) {
+    cs->ln_curr--;
+    return;
+  }
+  if (cs->back == NULL) VARR_CREATE (char, cs->back, c2m_alloc (c2m_ctx), 16);
+  VARR_PUSH (char, cs->back, c);
 }
 
 static void set_string_stream (c2m_ctx_t c2m_ctx, const char *str, pos_t pos,
                                void (*transform) (const char *, VARR (char) *)) {
   MIR_alloc_t alloc = c2m_alloc (c2m_ctx);
   /* read from string str */
-  cs = new_stream (alloc, NULL, NULL, NULL);
+  cs = new_stream (alloc, NULL, NULL);
   VARR_PUSH (stream_t, streams, cs);
   cs->pos = pos;
   if (transform != NULL) {
@@ -1073,10 +1385,11 @@ static void set_string_stream (c2m_ctx_t c2m_ctx, const char *str, pos_t pos,
   } else {
     for (; *str != '\0'; str++) VARR_PUSH (char, cs->ln, *str);
   }
+  set_ln_line (cs);
 }
 
 static void remove_string_stream (c2m_ctx_t c2m_ctx) {
-  assert (cs->f == NULL && cs->f == NULL);
+  assert (cs->fname == NULL);
   free_stream (VARR_POP (stream_t, streams));
   cs = VARR_LAST (stream_t, streams);
 }
@@ -1292,6 +1605,96 @@ static token_t new_id_token (c2m_ctx_t c2m_ctx, pos_t pos, const char *id_str) {
   return token;
 }
 
+/* Punctuators starting with the same char go together, the longest first. */
+typedef struct {
+  const char *repr;
+  int len, code;
+  node_code_t node_code;
+} punct_t;
+
+static const punct_t punct_tab[] = {
+  {"~", 1, T_UNOP, N_BITWISE_NOT},
+  {"++", 2, T_INCDEC, N_INC},
+  {"+=", 2, T_ASSIGN, N_ADD_ASSIGN},
+  {"+", 1, T_ADDOP, N_ADD},
+  {"--", 2, T_INCDEC, N_DEC},
+  {"-=", 2, T_ASSIGN, N_SUB_ASSIGN},
+  {"->", 2, T_ARROW, N_DEREF_FIELD},
+  {"-", 1, T_ADDOP, N_SUB},
+  {"==", 2, T_EQNE, N_EQ},
+  {"=", 1, '=', N_ASSIGN},
+  {"<<=", 3, T_ASSIGN, N_LSH_ASSIGN},
+  {"<<", 2, T_SH, N_LSH},
+  {"<=", 2, T_CMP, N_LE},
+  {"<:", 2, '[', N_IGNORE},
+  {"<%", 2, '{', N_IGNORE},
+  {"<", 1, T_CMP, N_LT},
+  {">>=", 3, T_ASSIGN, N_RSH_ASSIGN},
+  {">>", 2, T_SH, N_RSH},
+  {">=", 2, T_CMP, N_GE},
+  {">", 1, T_CMP, N_GT},
+  {"*=", 2, T_ASSIGN, N_MUL_ASSIGN},
+  {"*", 1, '*', N_MUL},
+  {"/=", 2, T_ASSIGN, N_DIV_ASSIGN},
+  {"/", 1, T_DIVOP, N_DIV},
+  {"%:%:", 4, T_DBLNO, N_IGNORE},
+  {"%=", 2, T_ASSIGN, N_MOD_ASSIGN},
+  {"%>", 2, '}', N_IGNORE},
+  {"%:", 2, '#', N_IGNORE},
+  {"%", 1, T_DIVOP, N_MOD},
+  {"&=", 2, T_ASSIGN, N_AND_ASSIGN},
+  {"&&", 2, T_ANDAND, N_ANDAND},
+  {"&", 1, '&', N_AND},
+  {"|=", 2, T_ASSIGN, N_OR_ASSIGN},
+  {"||", 2, T_OROR, N_OROR},
+  {"|", 1, '|', N_OR},
+  {"^=", 2, T_ASSIGN, N_XOR_ASSIGN},
+  {"^", 1, '^', N_XOR},
+  {"!=", 2, T_EQNE, N_NE},
+  {"!", 1, T_UNOP, N_NOT},
+  {":>", 2, ']', N_IGNORE},
+  {":", 1, ':', N_IGNORE},
+  {"##", 2, T_DBLNO, N_IGNORE},
+  {"#", 1, '#', N_IGNORE},
+  {"...", 3, T_DOTS, N_IGNORE},
+  {".", 1, '.', N_FIELD},
+  {",", 1, ',', N_COMMA},
+  {"[", 1, '[', N_IND},
+  {";", 1, ';', N_IGNORE},
+  {"?", 1, '?', N_IGNORE},
+  {"(", 1, '(', N_IGNORE},
+  {")", 1, ')', N_IGNORE},
+  {"{", 1, '{', N_IGNORE},
+  {"}", 1, '}', N_IGNORE},
+  {"]", 1, ']', N_IGNORE},
+};
+
+/* 1 + index in punct_tab of the first punctuator starting with the char, 0 if there is none: */
+static const unsigned char punct_start[UCHAR_MAX + 1] = {
+  ['~'] = 1, ['+'] = 2, ['-'] = 5, ['='] = 9, ['<'] = 11, ['>'] = 17, ['*'] = 21, ['/'] = 23,
+  ['%'] = 25, ['&'] = 30, ['|'] = 33, ['^'] = 36, ['!'] = 38, [':'] = 40, ['#'] = 42, ['.'] = 44,
+  [','] = 46, ['['] = 47, [';'] = 48, ['?'] = 49, ['('] = 50, [')'] = 51, ['{'] = 52, ['}'] = 53,
+  [']'] = 54,
+};
+
+/* Scan the longest punctuator starting with START_C which has been read already. */
+static token_t get_punct_token (c2m_ctx_t c2m_ctx, int start_c) {
+  const punct_t *p = &punct_tab[punct_start[start_c] - 1];
+  pos_t pos = cs->pos;
+  int i, chars[4], n = 1;
+
+  chars[0] = start_c;
+  for (;; p++) {
+    assert (p->repr[0] == start_c);
+    while (n < p->len) chars[n++] = cs_get (c2m_ctx);
+    for (i = 1; i < p->len && chars[i] == p->repr[i]; i++)
+      ;
+    if (i == p->len) break;
+  }
+  while (n > p->len) cs_unget (c2m_ctx, chars[--n]);
+  return new_token (c2m_ctx, pos, p->repr, p->code, p->node_code);
+}
+
 static token_t get_next_pptoken_1 (c2m_ctx_t c2m_ctx, int header_p) {
   int start_c, curr_c, nl_p, comment_char, wide_type;
   pos_t pos;
@@ -1395,224 +1798,24 @@ static token_t get_next_pptoken_1 (c2m_ctx_t c2m_ctx, int header_p) {
       assert (curr_c != '\n');
       cs_unget (c2m_ctx, curr_c);
       return new_token (c2m_ctx, cs->pos, "\\", '\\', N_IGNORE);
-    case '~': return new_token (c2m_ctx, cs->pos, "~", T_UNOP, N_BITWISE_NOT);
-    case '+':
-    case '-':
-      pos = cs->pos;
-      curr_c = cs_get (c2m_ctx);
-      if (curr_c == start_c) {
-        if (start_c == '+')
-          return new_token (c2m_ctx, pos, "++", T_INCDEC, N_INC);
-        else
-          return new_token (c2m_ctx, pos, "--", T_INCDEC, N_DEC);
-      } else if (curr_c == '=') {
-        if (start_c == '+')
-          return new_token (c2m_ctx, pos, "+=", T_ASSIGN, N_ADD_ASSIGN);
-        else
-          return new_token (c2m_ctx, pos, "-=", T_ASSIGN, N_SUB_ASSIGN);
-      } else if (start_c == '-' && curr_c == '>') {
-        return new_token (c2m_ctx, pos, "->", T_ARROW, N_DEREF_FIELD);
-      } else {
-        cs_unget (c2m_ctx, curr_c);
-        if (start_c == '+')
-          return new_token (c2m_ctx, pos, "+", T_ADDOP, N_ADD);
-        else
-          return new_token (c2m_ctx, pos, "-", T_ADDOP, N_SUB);
-      }
-      assert (FALSE);
-    case '=':
-      pos = cs->pos;
-      curr_c = cs_get (c2m_ctx);
-      if (curr_c == '=') {
-        return new_token (c2m_ctx, pos, "==", T_EQNE, N_EQ);
-      } else {
-        cs_unget (c2m_ctx, curr_c);
-        return new_token (c2m_ctx, pos, "=", '=', N_ASSIGN);
-      }
-      assert (FALSE);
-    case '<':
-    case '>':
-      pos = cs->pos;
-      curr_c = cs_get (c2m_ctx);
-      if (curr_c == start_c) {
-        curr_c = cs_get (c2m_ctx);
-        if (curr_c == '=') {
-          if (start_c == '<')
-            return new_token (c2m_ctx, pos, "<<=", T_ASSIGN, N_LSH_ASSIGN);
-          else
-            return new_token (c2m_ctx, pos, ">>=", T_ASSIGN, N_RSH_ASSIGN);
-        } else {
-          cs_unget (c2m_ctx, curr_c);
-          if (start_c == '<')
-            return new_token (c2m_ctx, pos, "<<", T_SH, N_LSH);
-          else
-            return new_token (c2m_ctx, pos, ">>", T_SH, N_RSH);
-        }
-      } else if (curr_c == '=') {
-        if (start_c == '<')
-          return new_token (c2m_ctx, pos, "<=", T_CMP, N_LE);
-        else
-          return new_token (c2m_ctx, pos, ">=", T_CMP, N_GE);
-      } else if (start_c == '<' && curr_c == ':') {
-        return new_token (c2m_ctx, pos, "<:", '[', N_IGNORE);
-      } else if (start_c == '<' && curr_c == '%') {
-        return new_token (c2m_ctx, pos, "<%", '{', N_IGNORE);
-      } else {
-        cs_unget (c2m_ctx, curr_c);
-        if (start_c == '<')
-          return new_token (c2m_ctx, pos, "<", T_CMP, N_LT);
-        else
-          return new_token (c2m_ctx, pos, ">", T_CMP, N_GT);
-      }
-      assert (FALSE);
-    case '*':
-      pos = cs->pos;
-      curr_c = cs_get (c2m_ctx);
-      if (curr_c == '=') {
-        return new_token (c2m_ctx, pos, "*=", T_ASSIGN, N_MUL_ASSIGN);
-      } else {
-        cs_unget (c2m_ctx, curr_c);
-        return new_token (c2m_ctx, pos, "*", '*', N_MUL);
-      }
-      assert (FALSE);
-    case '/':
-      pos = cs->pos;
-      curr_c = cs_get (c2m_ctx);
-      assert (curr_c != '/' && curr_c != '*');
-      if (curr_c == '=') return new_token (c2m_ctx, pos, "/=", T_ASSIGN, N_DIV_ASSIGN);
-      assert (curr_c != '*' && curr_c != '/'); /* we already processed comments */
-      cs_unget (c2m_ctx, curr_c);
-      return new_token (c2m_ctx, pos, "/", T_DIVOP, N_DIV);
-    case '%':
-      pos = cs->pos;
-      curr_c = cs_get (c2m_ctx);
-      if (curr_c == '=') {
-        return new_token (c2m_ctx, pos, "%=", T_ASSIGN, N_MOD_ASSIGN);
-      } else if (curr_c == '>') {
-        return new_token (c2m_ctx, pos, "%>", '}', N_IGNORE);
-      } else if (curr_c == ':') {
-        curr_c = cs_get (c2m_ctx);
-        if (curr_c != '%') {
-          cs_unget (c2m_ctx, curr_c);
-          return new_token (c2m_ctx, pos, "%:", '#', N_IGNORE);
-        } else {
-          curr_c = cs_get (c2m_ctx);
-          if (curr_c == ':')
-            return new_token (c2m_ctx, pos, "%:%:", T_DBLNO, N_IGNORE);
-          else {
-            cs_unget (c2m_ctx, '%');
-            cs_unget (c2m_ctx, curr_c);
-            return new_token (c2m_ctx, pos, "%:", '#', N_IGNORE);
-          }
-        }
-      } else {
-        cs_unget (c2m_ctx, curr_c);
-        return new_token (c2m_ctx, pos, "%", T_DIVOP, N_MOD);
-      }
-      assert (FALSE);
-    case '&':
-    case '|':
-      pos = cs->pos;
-      curr_c = cs_get (c2m_ctx);
-      if (curr_c == '=') {
-        if (start_c == '&')
-          return new_token (c2m_ctx, pos, "&=", T_ASSIGN, N_AND_ASSIGN);
-        else
-          return new_token (c2m_ctx, pos, "|=", T_ASSIGN, N_OR_ASSIGN);
-      } else if (curr_c == start_c) {
-        if (start_c == '&')
-          return new_token (c2m_ctx, pos, "&&", T_ANDAND, N_ANDAND);
-        else
-          return new_token (c2m_ctx, pos, "||", T_OROR, N_OROR);
-      } else {
-        cs_unget (c2m_ctx, curr_c);
-        if (start_c == '&')
-          return new_token (c2m_ctx, pos, "&", start_c, N_AND);
-        else
-          return new_token (c2m_ctx, pos, "|", start_c, N_OR);
-      }
-      assert (FALSE);
-    case '^':
-    case '!':
-      pos = cs->pos;
-      curr_c = cs_get (c2m_ctx);
-      if (curr_c == '=') {
-        if (start_c == '^')
-          return new_token (c2m_ctx, pos, "^=", T_ASSIGN, N_XOR_ASSIGN);
-        else
-          return new_token (c2m_ctx, pos, "!=", T_EQNE, N_NE);
-      } else {
-        cs_unget (c2m_ctx, curr_c);
-        if (start_c == '^')
-          return new_token (c2m_ctx, pos, "^", '^', N_XOR);
-        else
-          return new_token (c2m_ctx, pos, "!", T_UNOP, N_NOT);
-      }
-      assert (FALSE);
-    case ';': return new_token (c2m_ctx, cs->pos, ";", curr_c, N_IGNORE);
-    case '?': return new_token (c2m_ctx, cs->pos, "?", curr_c, N_IGNORE);
-    case '(': return new_token (c2m_ctx, cs->pos, "(", curr_c, N_IGNORE);
-    case ')': return new_token (c2m_ctx, cs->pos, ")", curr_c, N_IGNORE);
-    case '{': return new_token (c2m_ctx, cs->pos, "{", curr_c, N_IGNORE);
-    case '}': return new_token (c2m_ctx, cs->pos, "}", curr_c, N_IGNORE);
-    case ']': return new_token (c2m_ctx, cs->pos, "]", curr_c, N_IGNORE);
+    case '~': case '+': case '-': case '=': case '<': case '>': case '*': case '/': case '%':
+    case '&': case '|': case '^': case '!': case ';': case '?': case '(': case ')': case '{':
+    case '}': case ']': case ':': case '#': case ',': case '[':
+      return get_punct_token (c2m_ctx, start_c); /* comments are already processed */
     case EOF: {
       pos = cs->pos;
       if (eof_s != NULL) free_stream (eof_s);
-      if (eof_s != cs && cs->f != stdin && cs->f != NULL) {
-        fclose (cs->f);
-        cs->f = NULL;
-      }
       eof_s = VARR_LENGTH (stream_t, streams) == 0 ? NULL : VARR_POP (stream_t, streams);
       if (VARR_LENGTH (stream_t, streams) == 0) {
         return new_token (c2m_ctx, pos, "<EOU>", T_EOU, N_IGNORE);
       }
       cs = VARR_LAST (stream_t, streams);
-      if (cs->f == NULL && cs->fname != NULL && !string_stream_p (cs)) {
-        if ((cs->f = fopen (cs->fname, "rb")) == NULL) {
-          if (c2m_options->message_file != NULL)
-            fprintf (c2m_options->message_file, "cannot reopen file %s -- good bye\n", cs->fname);
-          longjmp (c2m_ctx->env, 1);  // ???
-        }
-        fsetpos (cs->f, &cs->fpos);
-      }
       return new_token (c2m_ctx, cs->pos, "<EOF>", T_EOFILE, N_IGNORE);
     }
-    case ':':
-      curr_c = cs_get (c2m_ctx);
-      if (curr_c == '>') {
-        return new_token (c2m_ctx, cs->pos, ":>", ']', N_IGNORE);
-      } else {
-        cs_unget (c2m_ctx, curr_c);
-        return new_token (c2m_ctx, cs->pos, ":", ':', N_IGNORE);
-      }
-    case '#':
-      curr_c = cs_get (c2m_ctx);
-      if (curr_c == '#') {
-        return new_token (c2m_ctx, cs->pos, "##", T_DBLNO, N_IGNORE);
-      } else {
-        cs_unget (c2m_ctx, curr_c);
-        return new_token (c2m_ctx, cs->pos, "#", '#', N_IGNORE);
-      }
-    case ',': return new_token (c2m_ctx, cs->pos, ",", ',', N_COMMA);
-    case '[': return new_token (c2m_ctx, cs->pos, "[", '[', N_IND);
     case '.':
-      pos = cs->pos;
       curr_c = cs_get (c2m_ctx);
-      if (curr_c == '.') {
-        curr_c = cs_get (c2m_ctx);
-        if (curr_c == '.') {
-          return new_token (c2m_ctx, pos, "...", T_DOTS, N_IGNORE);
-        } else {
-          cs_unget (c2m_ctx, '.');
-          cs_unget (c2m_ctx, curr_c);
-          return new_token (c2m_ctx, pos, ".", '.', N_FIELD);
-        }
-      } else if (!isdigit (curr_c)) {
-        cs_unget (c2m_ctx, curr_c);
-        return new_token (c2m_ctx, pos, ".", '.', N_FIELD);
-      }
       cs_unget (c2m_ctx, curr_c);
+      if (!isdigit (curr_c)) return get_punct_token (c2m_ctx, '.');
       curr_c = '.';
       /* falls through */
     case '0':
@@ -1792,19 +1995,19 @@ static void destringify (const char *repr, VARR (char) * to) {
       VARR_PUSH (char, to, repr[i]);
 }
 
-/* TS - vector, T defines position for empty vector */
-static token_t token_stringify (c2m_ctx_t c2m_ctx, token_t t, VARR (token_t) * ts) {
-  if (VARR_LENGTH (token_t, ts) != 0) t = VARR_GET (token_t, ts, 0);
+/* TS - array of LEN tokens, T defines position for empty array */
+static token_t token_stringify (c2m_ctx_t c2m_ctx, token_t t, token_t *ts, size_t len) {
+  if (len != 0) t = ts[0];
   t = new_node_token (c2m_ctx, t->pos, "", T_STR, new_str_node (c2m_ctx, N_STR, empty_str, t->pos));
   VARR_TRUNC (char, temp_string, 0);
   for (const char *s = t->repr; *s != 0; s++) VARR_PUSH (char, temp_string, *s);
   VARR_PUSH (char, temp_string, '"');
-  for (size_t i = 0; i < VARR_LENGTH (token_t, ts); i++)
-    if (VARR_GET (token_t, ts, i)->code == ' ' || VARR_GET (token_t, ts, i)->code == '\n') {
+  for (size_t i = 0; i < len; i++)
+    if (ts[i]->code == ' ' || ts[i]->code == '\n') {
       VARR_PUSH (char, temp_string, ' ');
     } else {
-      for (const char *s = VARR_GET (token_t, ts, i)->repr; *s != 0; s++) {
-        int c = VARR_LENGTH (token_t, ts) == i + 1 ? '\0' : VARR_GET (token_t, ts, i + 1)->repr[0];
+      for (const char *s = ts[i]->repr; *s != 0; s++) {
+        int c = len == i + 1 ? '\0' : ts[i + 1]->repr[0];
 
         /* It is an implementation defined behaviour analogous GCC/Clang (see set_string_val): */
         if (*s == '\"'
@@ -1854,11 +2057,16 @@ static token_t pptoken2token (c2m_ctx_t c2m_ctx, token_t t, int id2kw_p) {
           && t->code != T_EOP && t->code != T_EOFILE && t->code != T_EOU && t->code != T_PLM
           && t->code != T_RDBLNO);
   if (t->code == T_NO_MACRO_IDENT) t->code = T_ID;
+  if (t->code == T_ID && t->node == NULL) { /* copied identifier, repr is unique */
+    str_t str = {t->repr, strlen (t->repr) + 1};
+
+    t->node = new_str_node (c2m_ctx, N_ID, str, t->pos);
+  }
   if (t->code == T_ID && id2kw_p) {
-    tab_str_t str = str_add (c2m_ctx, t->repr, strlen (t->repr) + 1, T_STR, 0, FALSE);
+    int code = keyword_code (t->repr, strlen (t->repr));
 
-    if (str.key != T_STR) {
-      t->code = (int) str.key;
+    if (code != T_ID) {
+      t->code = code;
       t->node_code = N_IGNORE;
       t->node = NULL;
     }
@@ -1975,23 +2183,47 @@ typedef struct ifstate {
 
 DEF_VARR (ifstate_t);
 
-typedef VARR (token_t) * token_arr_t;
+typedef struct token_slice {
+  size_t start, len;
+} token_slice_t;
 
-DEF_VARR (token_arr_t);
+DEF_VARR (token_slice_t);
 
 typedef struct macro_call {
   macro_t macro;
   pos_t pos;
-  /* Var array of arguments, each arg is var array of tokens, NULL for args absence: */
-  VARR (token_arr_t) * args;
+  /* Arguments as slices of the tokens read for them.  Only # and __has_include make an
+     argument copy, and only the argument uses are copied to be rescanned: */
+  VARR (token_t) * arg_tokens;
+  VARR (token_slice_t) * args;
   int repl_pos;                 /* position in macro replacement */
   VARR (token_t) * repl_buffer; /* LIST:(token nodes)* */
 } *macro_call_t;
 
 DEF_VARR (macro_call_t);
 
+/* Resolution of #include NAME in a file BASE (NULL for <NAME>) */
+typedef struct include_path {
+  const char *base, *name;
+  int quote_p;
+  const char *fname, *content; /* the result */
+} include_path_t;
+
+DEF_HTAB (include_path_t);
+
+/* A file whose whole contents are inside #ifndef ID ... #endif */
+typedef struct include_guard {
+  const char *fname, *id;
+} include_guard_t;
+
+DEF_HTAB (include_guard_t);
+DEF_VARR (include_guard_t);
+
 struct pre_ctx {
   VARR (char_ptr_t) * once_include_files;
+  VARR (char_ptr_t) * include_files; /* files read from disk, for snapshots */
+  HTAB (include_path_t) * include_path_tab;
+  HTAB (include_guard_t) * include_guard_tab;
   VARR (token_t) * temp_tokens;
   HTAB (macro_t) * macro_tab;
   VARR (macro_t) * macros;
@@ -2002,14 +2234,22 @@ struct pre_ctx {
   char date_str[50], time_str[50], date_str_repr[50], time_str_repr[50];
   VARR (token_t) * output_buffer;
   VARR (macro_call_t) * macro_call_stack;
+  VARR (macro_call_t) * free_macro_calls; /* finished calls kept with their buffers */
   VARR (token_t) * pre_expr;
   token_t pre_last_token;
   pos_t actual_pre_pos;
   unsigned long pptokens_num;
   void (*pre_out_token_func) (c2m_ctx_t c2m_ctx, token_t);
+  /* Pulling tokens: top-level processing stops when recorded_tokens gets
+     longer than pull_tokens_num.  The line start flag is kept in between. */
+  size_t pull_tokens_num;
+  int pull_p, pull_newln_p, pull_end_p;
 };
 
 #define once_include_files pre_ctx->once_include_files
+#define include_files pre_ctx->include_files
+#define include_path_tab pre_ctx->include_path_tab
+#define include_guard_tab pre_ctx->include_guard_tab
 #define temp_tokens pre_ctx->temp_tokens
 #define macro_tab pre_ctx->macro_tab
 #define macros pre_ctx->macros
@@ -2023,11 +2263,16 @@ struct pre_ctx {
 #define time_str_repr pre_ctx->time_str_repr
 #define output_buffer pre_ctx->output_buffer
 #define macro_call_stack pre_ctx->macro_call_stack
+#define free_macro_calls pre_ctx->free_macro_calls
 #define pre_expr pre_ctx->pre_expr
 #define pre_last_token pre_ctx->pre_last_token
 #define actual_pre_pos pre_ctx->actual_pre_pos
 #define pptokens_num pre_ctx->pptokens_num
 #define pre_out_token_func pre_ctx->pre_out_token_func
+#define pull_tokens_num pre_ctx->pull_tokens_num
+#define pull_p pre_ctx->pull_p
+#define pull_newln_p pre_ctx->pull_newln_p
+#define pull_end_p pre_ctx->pull_end_p
 
 static int pre_skip_if_part_p (c2m_ctx_t c2m_ctx) {
   pre_ctx_t pre_ctx = c2m_ctx->pre_ctx;
@@ -2066,11 +2311,8 @@ static void new_std_macro (c2m_ctx_t c2m_ctx, const char *id_str) {
 
 static void init_macros (c2m_ctx_t c2m_ctx) {
   MIR_alloc_t alloc = c2m_alloc (c2m_ctx);
-  pre_ctx_t pre_ctx = c2m_ctx->pre_ctx;
   VARR (token_t) * params;
 
-  VARR_CREATE (macro_t, macros, alloc, 2048);
-  HTAB_CREATE (macro_t, macro_tab, alloc, 2048, macro_hash, macro_eq, NULL);
   /* Standard macros : */
   new_std_macro (c2m_ctx, "__DATE__");
   new_std_macro (c2m_ctx, "__TIME__");
@@ -2101,7 +2343,7 @@ static macro_t new_macro (c2m_ctx_t c2m_ctx, token_t id, VARR (token_t) * params
   return m;
 }
 
-static void finish_macros (c2m_ctx_t c2m_ctx) {
+static void finish_macros (c2m_ctx_t c2m_ctx, int keep_p) {
   pre_ctx_t pre_ctx = c2m_ctx->pre_ctx;
   if (macros != NULL) {
     while (VARR_LENGTH (macro_t, macros) != 0) {
@@ -2111,34 +2353,50 @@ static void finish_macros (c2m_ctx_t c2m_ctx) {
       if (m->replacement != NULL) VARR_DESTROY (token_t, m->replacement);
       free (m);
     }
-    VARR_DESTROY (macro_t, macros);
+    if (!keep_p) VARR_DESTROY (macro_t, macros);
   }
-  if (macro_tab != NULL) HTAB_DESTROY (macro_t, macro_tab);
+  if (macro_tab == NULL) return;
+  if (keep_p)
+    HTAB_CLEAR (macro_t, macro_tab);
+  else
+    HTAB_DESTROY (macro_t, macro_tab);
 }
 
-static macro_call_t new_macro_call (MIR_alloc_t alloc, macro_t m, pos_t pos) {
-  macro_call_t mc = malloc (sizeof (struct macro_call));
+static macro_call_t new_macro_call (c2m_ctx_t c2m_ctx, macro_t m, pos_t pos) {
+  MIR_alloc_t alloc = c2m_alloc (c2m_ctx);
+  pre_ctx_t pre_ctx = c2m_ctx->pre_ctx;
+  macro_call_t mc;
 
+  if (VARR_LENGTH (macro_call_t, free_macro_calls) != 0) {
+    mc = VARR_POP (macro_call_t, free_macro_calls);
+  } else {
+    mc = malloc (sizeof (struct macro_call));
+    VARR_CREATE (token_t, mc->arg_tokens, alloc, 64);
+    VARR_CREATE (token_slice_t, mc->args, alloc, 16);
+    VARR_CREATE (token_t, mc->repl_buffer, alloc, 64);
+  }
   mc->macro = m;
   mc->pos = pos;
   mc->repl_pos = 0;
-  mc->args = NULL;
-  VARR_CREATE (token_t, mc->repl_buffer, alloc, 64);
   return mc;
 }
 
-static void free_macro_call (macro_call_t mc) {
+static void destroy_macro_call (macro_call_t mc) {
+  VARR_DESTROY (token_t, mc->arg_tokens);
+  VARR_DESTROY (token_slice_t, mc->args);
   VARR_DESTROY (token_t, mc->repl_buffer);
-  if (mc->args != NULL) {
-    while (VARR_LENGTH (token_arr_t, mc->args) != 0) {
-      VARR (token_t) *arg = VARR_POP (token_arr_t, mc->args);
-      VARR_DESTROY (token_t, arg);
-    }
-    VARR_DESTROY (token_arr_t, mc->args);
-  }
   free (mc);
 }
 
+static void free_macro_call (c2m_ctx_t c2m_ctx, macro_call_t mc) {
+  pre_ctx_t pre_ctx = c2m_ctx->pre_ctx;
+
+  VARR_TRUNC (token_t, mc->arg_tokens, 0);
+  VARR_TRUNC (token_slice_t, mc->args, 0);
+  VARR_TRUNC (token_t, mc->repl_buffer, 0);
+  VARR_PUSH (macro_call_t, free_macro_calls, mc);
+}
+
 static ifstate_t new_ifstate (int skip_p, int true_p, int else_p, pos_t if_pos) {
   ifstate_t ifstate = malloc (sizeof (struct ifstate));
 
@@ -2155,13 +2413,50 @@ static void pop_ifstate (c2m_ctx_t c2m_ctx) {
   free (ifstate);
 }
 
+static htab_hash_t include_path_hash (include_path_t path, void *arg MIR_UNUSED) {
+  uint64_t h = mir_hash (path.name, strlen (path.name), path.quote_p);
+
+  return (htab_hash_t) (path.base == NULL ? h : mir_hash (path.base, strlen (path.base), h));
+}
+
+static int include_path_eq (include_path_t path1, include_path_t path2, void *arg MIR_UNUSED) {
+  return (path1.quote_p == path2.quote_p && strcmp (path1.name, path2.name) == 0
+          && (path1.base == path2.base
+              || (path1.base != NULL && path2.base != NULL
+                  && strcmp (path1.base, path2.base) == 0)));
+}
+
+static htab_hash_t include_guard_hash (include_guard_t guard, void *arg MIR_UNUSED) {
+  return (htab_hash_t) mir_hash (guard.fname, strlen (guard.fname), 0x67);
+}
+
+static int include_guard_eq (include_guard_t guard1, include_guard_t guard2,
+                             void *arg MIR_UNUSED) {
+  return strcmp (guard1.fname, guard2.fname) == 0;
+}
+
 static void pre_init (c2m_ctx_t c2m_ctx) {
   MIR_alloc_t alloc = c2m_alloc (c2m_ctx);
   pre_ctx_t pre_ctx;
   time_t t, time_loc;
   struct tm *tm, tm_loc MIR_UNUSED;
 
-  c2m_ctx->pre_ctx = pre_ctx = c2sljit_calloc (c2m_ctx, sizeof (struct pre_ctx));
+  if ((pre_ctx = c2m_ctx->pre_ctx) == NULL) { /* otherwise kept from the previous compile */
+    c2m_ctx->pre_ctx = pre_ctx = c2sljit_calloc (c2m_ctx, sizeof (struct pre_ctx));
+    VARR_CREATE (char_ptr_t, once_include_files, alloc, 64);
+    VARR_CREATE (char_ptr_t, include_files, alloc, 64);
+    HTAB_CREATE (include_path_t, include_path_tab, alloc, 256, include_path_hash,
+                 include_path_eq, NULL);
+    HTAB_CREATE (include_guard_t, include_guard_tab, alloc, 256, include_guard_hash,
+                 include_guard_eq, NULL);
+    VARR_CREATE (token_t, temp_tokens, alloc, 128);
+    VARR_CREATE (token_t, output_buffer, alloc, 2048);
+    VARR_CREATE (macro_t, macros, alloc, 2048);
+    HTAB_CREATE (macro_t, macro_tab, alloc, 2048, macro_hash, macro_eq, NULL);
+    VARR_CREATE (ifstate_t, ifs, alloc, 512);
+    VARR_CREATE (macro_call_t, macro_call_stack, alloc, 512);
+    VARR_CREATE (macro_call_t, free_macro_calls, alloc, 64);
+  }
   no_out_p = skip_if_part_p = FALSE;
   t = time (&time_loc);
 #if defined(_WIN32)
@@ -2180,32 +2475,66 @@ static void pre_init (c2m_ctx_t c2m_ctx) {
   date_str[strlen (date_str) - 1] = '\0';
   strcpy (time_str, time_str_repr + 1);
   time_str[strlen (time_str) - 1] = '\0';
-  VARR_CREATE (char_ptr_t, once_include_files, alloc, 64);
-  VARR_CREATE (token_t, temp_tokens, alloc, 128);
-  VARR_CREATE (token_t, output_buffer, alloc, 2048);
   init_macros (c2m_ctx);
-  VARR_CREATE (ifstate_t, ifs, alloc, 512);
-  VARR_CREATE (macro_call_t, macro_call_stack, alloc, 512);
 }
 
-static void pre_finish (c2m_ctx_t c2m_ctx) {
+/* Free the preprocessor state.  If KEEP_P, only clear it keeping the
+   containers with their capacity for the next compile. */
+static void pre_finish (c2m_ctx_t c2m_ctx, int keep_p) {
   pre_ctx_t pre_ctx;
 
   if (c2m_ctx == NULL || (pre_ctx = c2m_ctx->pre_ctx) == NULL) return;
+  finish_macros (c2m_ctx, keep_p);
+  if (keep_p) {
+    VARR_TRUNC (char_ptr_t, once_include_files, 0);
+    VARR_TRUNC (char_ptr_t, include_files, 0);
+    HTAB_CLEAR (include_path_t, include_path_tab);
+    HTAB_CLEAR (include_guard_t, include_guard_tab);
+    VARR_TRUNC (token_t, temp_tokens, 0);
+    VARR_TRUNC (token_t, output_buffer, 0);
+    while (VARR_LENGTH (ifstate_t, ifs) != 0) pop_ifstate (c2m_ctx);
+    while (VARR_LENGTH (macro_call_t, macro_call_stack) != 0)
+      free_macro_call (c2m_ctx, VARR_POP (macro_call_t, macro_call_stack));
+    return;
+  }
   if (once_include_files != NULL) VARR_DESTROY (char_ptr_t, once_include_files);
+  if (include_files != NULL) VARR_DESTROY (char_ptr_t, include_files);
+  if (include_path_tab != NULL) HTAB_DESTROY (include_path_t, include_path_tab);
+  if (include_guard_tab != NULL) HTAB_DESTROY (include_guard_t, include_guard_tab);
   if (temp_tokens != NULL) VARR_DESTROY (token_t, temp_tokens);
   if (output_buffer != NULL) VARR_DESTROY (token_t, output_buffer);
-  finish_macros (c2m_ctx);
   if (ifs != NULL) {
     while (VARR_LENGTH (ifstate_t, ifs) != 0) pop_ifstate (c2m_ctx);
     VARR_DESTROY (ifstate_t, ifs);
   }
   if (macro_call_stack != NULL) {
     while (VARR_LENGTH (macro_call_t, macro_call_stack) != 0)
-      free_macro_call (VARR_POP (macro_call_t, macro_call_stack));
+      destroy_macro_call (VARR_POP (macro_call_t, macro_call_stack));
     VARR_DESTROY (macro_call_t, macro_call_stack);
   }
+  if (free_macro_calls != NULL) {
+    while (VARR_LENGTH (macro_call_t, free_macro_calls) != 0)
+      destroy_macro_call (VARR_POP (macro_call_t, free_macro_calls));
+    VARR_DESTROY (macro_call_t, free_macro_calls);
+  }
   free (c2m_ctx->pre_ctx);
+  c2m_ctx->pre_ctx = NULL;
+}
+
+/* Return TRUE if FNAME was included before and its guard macro is still
+   defined, so including it again would produce nothing. */
+static int guarded_include_p (c2m_ctx_t c2m_ctx, const char *fname) {
+  pre_ctx_t pre_ctx = c2m_ctx->pre_ctx;
+  include_guard_t guard, tab_guard;
+  struct token id;
+  struct macro macro;
+  macro_t tab_m;
+
+  guard.fname = fname;
+  if (!HTAB_DO (include_guard_t, include_guard_tab, guard, HTAB_FIND, tab_guard)) return FALSE;
+  id.repr = tab_guard.id;
+  macro.id = &id;
+  return HTAB_DO (macro_t, macro_tab, &macro, HTAB_FIND, tab_m);
 }
 
 static void add_include_stream (c2m_ctx_t c2m_ctx, const char *fname, const char *content,
@@ -2216,15 +2545,18 @@ static void add_include_stream (c2m_ctx_t c2m_ctx, const char *fname, const char
   for (size_t i = 0; i < VARR_LENGTH (char_ptr_t, once_include_files); i++)
     if (strcmp (fname, VARR_GET (char_ptr_t, once_include_files, i)) == 0) return;
   assert (fname != NULL);
+  if (guarded_include_p (c2m_ctx, fname)) return;
   if (content == NULL && (f = fopen (fname, "rb")) == NULL) {
     if (c2m_options->message_file != NULL)
       error (c2m_ctx, err_pos, "error in opening file %s", fname);
     longjmp (c2m_ctx->env, 1);  // ???
   }
-  if (content == NULL)
-    add_stream (c2m_ctx, f, fname, NULL);
-  else
+  if (content == NULL) {
+    add_file_stream (c2m_ctx, f, fname);
+    VARR_PUSH (char_ptr_t, include_files, fname);
+  } else {
     add_string_stream (c2m_ctx, fname, content);
+  }
   cs->ifs_length_at_stream_start = (int) VARR_LENGTH (ifstate_t, ifs);
 }
 
@@ -2408,17 +2740,17 @@ static void push_back (c2m_ctx_t c2m_ctx, VARR (token_t) * tokens) {
 #endif
 }
 
-static void copy_and_push_back (c2m_ctx_t c2m_ctx, VARR (token_t) * tokens, pos_t pos) {
+static void copy_and_push_back (c2m_ctx_t c2m_ctx, token_t *tokens, size_t len, pos_t pos) {
 #ifdef C2MIR_PREPRO_DEBUG
   pre_ctx_t pre_ctx = c2m_ctx->pre_ctx;
   fprintf (stderr, "# copy & push back (macro call depth %d):",
            VARR_LENGTH (macro_call_t, macro_call_stack));
 #endif
-  for (int i = (int) VARR_LENGTH (token_t, tokens) - 1; i >= 0; i--) {
+  for (int i = (int) len - 1; i >= 0; i--) {
 #ifdef C2MIR_PREPRO_DEBUG
-    fprintf (stderr, " <%s>", get_token_str (VARR_GET (token_t, tokens, i)));
+    fprintf (stderr, " <%s>", get_token_str (tokens[i]));
 #endif
-    unget_next_pptoken (c2m_ctx, copy_token (c2m_ctx, VARR_GET (token_t, tokens, i), pos));
+    unget_next_pptoken (c2m_ctx, copy_token (c2m_ctx, tokens[i], pos));
   }
 #ifdef C2MIR_PREPRO_DEBUG
   fprintf (stderr, "\n");
@@ -2427,11 +2759,9 @@ static void copy_and_push_back (c2m_ctx_t c2m_ctx, VARR (token_t) * tokens, pos_
 }
 
 static int file_found_p (const char *name) {
-  FILE *f;
+  struct stat st;
 
-  if ((f = fopen (name, "r")) == NULL) return FALSE;
-  fclose (f);
-  return TRUE;
+  return stat (name, &st) == 0 && (st.st_mode & S_IFMT) != S_IFDIR;
 }
 
 static const char *get_full_name (c2m_ctx_t c2m_ctx, const char *base, const char *name,
@@ -2468,7 +2798,7 @@ static const char *get_full_name (c2m_ctx_t c2m_ctx, const char *base, const cha
   return VARR_ADDR (char, temp_string);
 }
 
-static const char *get_include_fname (c2m_ctx_t c2m_ctx, token_t t, const char **content) {
+static const char *find_include_fname (c2m_ctx_t c2m_ctx, token_t t, const char **content) {
   const char *fullname, *name;
 
   *content = NULL;
@@ -2498,6 +2828,25 @@ static const char *get_include_fname (c2m_ctx_t c2m_ctx, token_t t, const char *
   return name;
 }
 
+/* Return the file name for #include token T, remembering it for the same
+   name included again from the same file (any file for <...>). */
+static const char *get_include_fname (c2m_ctx_t c2m_ctx, token_t t, const char **content) {
+  pre_ctx_t pre_ctx = c2m_ctx->pre_ctx;
+  include_path_t path, tab_path;
+
+  path.name = t->node->u.s.s;
+  path.quote_p = t->repr[0] == '"';
+  path.base = path.quote_p ? cs->fname : NULL;
+  if (HTAB_DO (include_path_t, include_path_tab, path, HTAB_FIND, tab_path)) {
+    *content = tab_path.content;
+    return tab_path.fname;
+  }
+  path.fname = find_include_fname (c2m_ctx, t, &path.content);
+  HTAB_DO (include_path_t, include_path_tab, path, HTAB_INSERT, tab_path);
+  *content = path.content;
+  return path.fname;
+}
+
 static int digits_p (const char *str) {
   while ('0' <= *str && *str <= '9') str++;
   return *str == '\0';
@@ -2591,21 +2940,20 @@ static void pop_macro_call (c2m_ctx_t c2m_ctx) {
   fprintf (stderr, "finish call of macro %s\n", mc->macro->id->repr);
 #endif
   mc->macro->ignore_p = FALSE;
-  free_macro_call (mc);
+  free_macro_call (c2m_ctx, mc);
 }
 
 static void find_args (c2m_ctx_t c2m_ctx, macro_call_t mc) { /* we have just read a parenthesis */
-  MIR_alloc_t alloc = c2m_alloc (c2m_ctx);
   macro_t m;
   token_t t;
   int va_p, level = 0;
   size_t params_len;
-  VARR (token_arr_t) * args;
-  VARR (token_t) * arg, *temp_arr;
+  token_slice_t arg;
+  VARR (token_slice_t) *args = mc->args;
+  VARR (token_t) *arg_tokens = mc->arg_tokens;
 
   m = mc->macro;
-  VARR_CREATE (token_arr_t, args, alloc, 16);
-  VARR_CREATE (token_t, arg, alloc, 16);
+  arg.start = 0;
   params_len = VARR_LENGTH (token_t, m->params);
   va_p = params_len == 1 && VARR_GET (token_t, m->params, 0)->code == T_DOTS;
 #ifdef C2MIR_PREPRO_DEBUG
@@ -2628,16 +2976,17 @@ static void find_args (c2m_ctx_t c2m_ctx, macro_call_t mc) { /* we have just rea
       break;
     if (level == 0 && t->code == ')') break;
     if (level == 0 && !va_p && t->code == ',') {
-      VARR_PUSH (token_arr_t, args, arg);
+      arg.len = VARR_LENGTH (token_t, arg_tokens) - arg.start;
+      VARR_PUSH (token_slice_t, args, arg);
 #ifdef C2MIR_PREPRO_DEBUG
-      fprintf (stderr, "\n#    arg %d:", VARR_LENGTH (token_arr_t, args));
+      fprintf (stderr, "\n#    arg %d:", VARR_LENGTH (token_slice_t, args));
 #endif
-      VARR_CREATE (token_t, arg, alloc, 16);
-      if (VARR_LENGTH (token_arr_t, args) == params_len - 1
+      arg.start = VARR_LENGTH (token_t, arg_tokens);
+      if (VARR_LENGTH (token_slice_t, args) == params_len - 1
           && strcmp (VARR_GET (token_t, m->params, params_len - 1)->repr, "...") == 0)
         va_p = 1;
     } else {
-      VARR_PUSH (token_t, arg, t);
+      VARR_PUSH (token_t, arg_tokens, t);
       if (t->code == ')')
         level--;
       else if (t->code == '(')
@@ -2654,34 +3003,25 @@ static void find_args (c2m_ctx_t c2m_ctx, macro_call_t mc) { /* we have just rea
 #endif
     unget_next_pptoken (c2m_ctx, t);
   }
-  VARR_PUSH (token_arr_t, args, arg);
-  if (params_len == 0 && VARR_LENGTH (token_arr_t, args) == 1) {
-    token_arr_t arr = VARR_GET (token_arr_t, args, 0);
-
-    if (VARR_LENGTH (token_t, arr) == 0
-        || (VARR_LENGTH (token_t, arr) == 1 && VARR_GET (token_t, arr, 0)->code == ' ')) {
-      temp_arr = VARR_POP (token_arr_t, args);
-      VARR_DESTROY (token_t, temp_arr);
-      mc->args = args;
+  arg.len = VARR_LENGTH (token_t, arg_tokens) - arg.start;
+  VARR_PUSH (token_slice_t, args, arg);
+  if (params_len == 0 && VARR_LENGTH (token_slice_t, args) == 1) {
+    if (arg.len == 0 || (arg.len == 1 && VARR_GET (token_t, arg_tokens, arg.start)->code == ' ')) {
+      VARR_POP (token_slice_t, args);
       return;
     }
   }
-  if (VARR_LENGTH (token_arr_t, args) > params_len) {
-    arg = VARR_GET (token_arr_t, args, params_len);
-    if (VARR_LENGTH (token_t, arg) != 0) t = VARR_GET (token_t, arg, 0);
-    while (VARR_LENGTH (token_arr_t, args) > params_len) {
-      temp_arr = VARR_POP (token_arr_t, args);
-      VARR_DESTROY (token_t, temp_arr);
-    }
+  if (VARR_LENGTH (token_slice_t, args) > params_len) {
+    arg = VARR_GET (token_slice_t, args, params_len);
+    if (arg.len != 0) t = VARR_GET (token_t, arg_tokens, arg.start);
+    VARR_TRUNC (token_slice_t, args, params_len);
     error (c2m_ctx, t->pos, "too many args for call of macro %s", m->id->repr);
-  } else if (VARR_LENGTH (token_arr_t, args) < params_len) {
-    for (; VARR_LENGTH (token_arr_t, args) < params_len;) {
-      VARR_CREATE (token_t, arg, alloc, 16);
-      VARR_PUSH (token_arr_t, args, arg);
-    }
+  } else if (VARR_LENGTH (token_slice_t, args) < params_len) {
+    arg.start = VARR_LENGTH (token_t, arg_tokens);
+    arg.len = 0;
+    while (VARR_LENGTH (token_slice_t, args) < params_len) VARR_PUSH (token_slice_t, args, arg);
     error (c2m_ctx, t->pos, "not enough args for call of macro %s", m->id->repr);
   }
-  mc->args = args;
 }
 
 static token_t token_concat (c2m_ctx_t c2m_ctx, token_t t1, token_t t2) {
@@ -2690,13 +3030,12 @@ static token_t token_concat (c2m_ctx_t c2m_ctx, token_t t1, token_t t2) {
   VARR_TRUNC (char, temp_string, 0);
   add_to_temp_string (c2m_ctx, t1->repr);
   add_to_temp_string (c2m_ctx, t2->repr);
-  reverse (temp_string);
   set_string_stream (c2m_ctx, VARR_ADDR (char, temp_string), t1->pos, NULL);
   t = get_next_pptoken (c2m_ctx);
   next = get_next_pptoken (c2m_ctx);
   while (next->code == T_EOU) next = get_next_pptoken (c2m_ctx);
   if (next->code != T_EOFILE) {
-    error (c2m_ctx, t1->pos, "wrong result of ##: %s", reverse (temp_string));
+    error (c2m_ctx, t1->pos, "wrong result of ##: %s", VARR_ADDR (char, temp_string));
     remove_string_stream (c2m_ctx);
   }
   return t;
@@ -2719,9 +3058,8 @@ static void add_arg_tokens (VARR (token_t) * to, VARR (token_t) * from) {
   VARR_TRUNC (token_t, from, start);
 }
 
-static void add_tokens (VARR (token_t) * to, VARR (token_t) * from) {
-  for (size_t i = 0; i < VARR_LENGTH (token_t, from); i++)
-    add_token (to, VARR_GET (token_t, from, i));
+static void add_tokens (VARR (token_t) * to, token_t *from, size_t len) {
+  for (size_t i = 0; i < len; i++) add_token (to, from[i]);
 }
 
 static void del_tokens (VARR (token_t) * tokens, int from, int len) {
@@ -2785,8 +3123,8 @@ static VARR (token_t) * do_concat (c2m_ctx_t c2m_ctx, VARR (token_t) * tokens) {
 
 static void process_replacement (c2m_ctx_t c2m_ctx, macro_call_t mc) {
   macro_t m;
-  token_t t, *m_repl;
-  VARR (token_t) * arg;
+  token_t t, *m_repl, *arg_addr;
+  token_slice_t *arg;
   int i, m_repl_len, sharp_pos, copy_p;
 
   m = mc->macro;
@@ -2813,17 +3151,19 @@ static void process_replacement (c2m_ctx_t c2m_ctx, macro_call_t mc) {
     if (t->code == T_ID) {
       i = find_param (m->params, t->repr);
       if (i >= 0) {
-        arg = VARR_GET (token_arr_t, mc->args, i);
+        arg = VARR_ADDR (token_slice_t, mc->args) + i;
+        arg_addr = VARR_ADDR (token_t, mc->arg_tokens) + arg->start;
         if (sharp_pos >= 0) {
           del_tokens (mc->repl_buffer, sharp_pos, -1);
-          if (VARR_LENGTH (token_t, arg) != 0
-              && (VARR_GET (token_t, arg, 0)->code == ' '
-                  || VARR_GET (token_t, arg, 0)->code == '\n'))
-            del_tokens (arg, 0, 1);
-          if (VARR_LENGTH (token_t, arg) != 0
-              && (VARR_LAST (token_t, arg)->code == ' ' || VARR_LAST (token_t, arg)->code == '\n'))
-            VARR_POP (token_t, arg);
-          t = token_stringify (c2m_ctx, mc->macro->id, arg);
+          if (arg->len != 0 && (arg_addr[0]->code == ' ' || arg_addr[0]->code == '\n')) {
+            arg->start++;
+            arg->len--;
+            arg_addr++;
+          }
+          if (arg->len != 0
+              && (arg_addr[arg->len - 1]->code == ' ' || arg_addr[arg->len - 1]->code == '\n'))
+            arg->len--;
+          t = token_stringify (c2m_ctx, mc->macro->id, arg_addr, arg->len);
           copy_p = FALSE;
         } else if ((mc->repl_pos >= 2 && m_repl[mc->repl_pos - 2]->code == T_RDBLNO)
                    || (mc->repl_pos >= 3 && m_repl[mc->repl_pos - 2]->code == ' '
@@ -2831,14 +3171,12 @@ static void process_replacement (c2m_ctx_t c2m_ctx, macro_call_t mc) {
                    || (mc->repl_pos < m_repl_len && m_repl[mc->repl_pos]->code == T_RDBLNO)
                    || (mc->repl_pos + 1 < m_repl_len && m_repl[mc->repl_pos + 1]->code == T_RDBLNO
                        && m_repl[mc->repl_pos]->code == ' ')) {
-          if (VARR_LENGTH (token_t, arg) == 0
-              || (VARR_LENGTH (token_t, arg) == 1
-                  && (VARR_GET (token_t, arg, 0)->code == ' '
-                      || VARR_GET (token_t, arg, 0)->code == '\n'))) {
+          if (arg->len == 0
+              || (arg->len == 1 && (arg_addr[0]->code == ' ' || arg_addr[0]->code == '\n'))) {
             t = new_token (c2m_ctx, t->pos, "", T_PLM, N_IGNORE);
             copy_p = FALSE;
           } else {
-            add_tokens (mc->repl_buffer, arg);
+            add_tokens (mc->repl_buffer, arg_addr, arg->len);
             continue;
           }
         } else {
@@ -2846,7 +3184,7 @@ static void process_replacement (c2m_ctx_t c2m_ctx, macro_call_t mc) {
 #ifdef C2MIR_PREPRO_DEBUG
           fprintf (stderr, "# push back <EOA> for macro %s call\n", mc->macro->id->repr);
 #endif
-          copy_and_push_back (c2m_ctx, arg, mc->pos);
+          copy_and_push_back (c2m_ctx, arg_addr, arg->len, mc->pos);
           unget_next_pptoken (c2m_ctx, new_token (c2m_ctx, t->pos, "", T_BOA, N_IGNORE));
 #ifdef C2MIR_PREPRO_DEBUG
           fprintf (stderr, "# push back <BOA> for macro %s call\n", mc->macro->id->repr);
@@ -2864,11 +3202,6 @@ static void process_replacement (c2m_ctx_t c2m_ctx, macro_call_t mc) {
   }
 }
 
-static void prepare_pragma_string (const char *repr, VARR (char) * to) {
-  destringify (repr, to);
-  reverse (to);
-}
-
 static int process_pragma (c2m_ctx_t c2m_ctx, token_t t) {
   pre_ctx_t pre_ctx = c2m_ctx->pre_ctx;
   token_t t1, t2;
@@ -2906,7 +3239,7 @@ static int process_pragma (c2m_ctx_t c2m_ctx, token_t t) {
     push_back (c2m_ctx, temp_tokens);
     return FALSE;
   }
-  set_string_stream (c2m_ctx, t2->repr, t2->pos, prepare_pragma_string);
+  set_string_stream (c2m_ctx, t2->repr, t2->pos, destringify);
   VARR_TRUNC (token_t, temp_tokens, 0);
   for (t1 = get_next_pptoken (c2m_ctx); t1->code != T_EOFILE; t1 = get_next_pptoken (c2m_ctx))
     VARR_PUSH (token_t, temp_tokens, t1);
@@ -3012,7 +3345,7 @@ static void process_directive (c2m_ctx_t c2m_ctx) {
   MIR_alloc_t alloc = c2m_alloc (c2m_ctx);
   pre_ctx_t pre_ctx = c2m_ctx->pre_ctx;
   token_t t, t1;
-  int true_p;
+  int true_p, guard_state;
   VARR (token_t) * temp_buffer;
   pos_t pos;
   struct macro macro;
@@ -3028,6 +3361,13 @@ static void process_directive (c2m_ctx_t c2m_ctx) {
     return;
   }
   VARR_CREATE (token_t, temp_buffer, alloc, 64);
+  /* Only #ifndef at the stream start and its #endif can form a guard: */
+  if ((guard_state = cs->guard_state) == GUARD_START || guard_state == GUARD_END)
+    cs->guard_state = GUARD_NONE;
+  else if (guard_state == GUARD_IN
+           && (int) VARR_LENGTH (ifstate_t, ifs) == cs->ifs_length_at_stream_start + 1
+           && (strcmp (t->repr, "else") == 0 || strcmp (t->repr, "elif") == 0))
+    cs->guard_state = GUARD_NONE;
   if (strcmp (t->repr, "ifdef") == 0 || strcmp (t->repr, "ifndef") == 0) {
     t1 = t;
     if (VARR_LENGTH (ifstate_t, ifs) != 0 && VARR_LAST (ifstate_t, ifs)->skip_p) {
@@ -3042,6 +3382,11 @@ static void process_directive (c2m_ctx_t c2m_ctx) {
       } else {
         macro.id = t;
         skip_if_part_p = HTAB_DO (macro_t, macro_tab, &macro, HTAB_FIND, tab_macro);
+        if (guard_state == GUARD_START && strcmp (t1->repr, "ifndef") == 0
+            && (int) VARR_LENGTH (ifstate_t, ifs) == cs->ifs_length_at_stream_start) {
+          cs->guard_state = GUARD_IN;
+          cs->guard_id = t->repr;
+        }
       }
       t = get_next_pptoken (c2m_ctx);
       if (t->code != '\n') {
@@ -3063,6 +3408,9 @@ static void process_directive (c2m_ctx_t c2m_ctx) {
       error (c2m_ctx, t1->pos, "unmatched #%s", t1->repr);
     else if (strcmp (t1->repr, "endif") == 0) {
       pop_ifstate (c2m_ctx);
+      if (cs->guard_state == GUARD_IN
+          && (int) VARR_LENGTH (ifstate_t, ifs) == cs->ifs_length_at_stream_start)
+        cs->guard_state = GUARD_END;
       skip_if_part_p = VARR_LENGTH (ifstate_t, ifs) == 0 ? 0 : VARR_LAST (ifstate_t, ifs)->skip_p;
     } else if (VARR_LAST (ifstate_t, ifs)->else_p) {
       error (c2m_ctx, t1->pos, "repeated #else");
@@ -3570,7 +3918,6 @@ static struct val eval (c2m_ctx_t c2m_ctx, node_t tree) {
 }
 
 static macro_call_t try_param_macro_call (c2m_ctx_t c2m_ctx, macro_t m, token_t macro_id) {
-  MIR_alloc_t alloc = c2m_alloc (c2m_ctx);
   pre_ctx_t pre_ctx = c2m_ctx->pre_ctx;
   macro_call_t mc;
   token_t t1 = get_next_pptoken (c2m_ctx), t2 = NULL;
@@ -3589,7 +3936,7 @@ static macro_call_t try_param_macro_call (c2m_ctx_t c2m_ctx, macro_t m, token_t
     out_token (c2m_ctx, macro_id);
     return NULL;
   }
-  mc = new_macro_call (alloc, m, macro_id->pos);
+  mc = new_macro_call (c2m_ctx, m, macro_id->pos);
   find_args (c2m_ctx, mc);
   VARR_PUSH (macro_call_t, macro_call_stack, mc);
   return mc;
@@ -3605,17 +3952,91 @@ static macro_call_t try_param_macro_call (c2m_ctx_t c2m_ctx, macro_t m, token_t
 #define PROP_EQ "__builtin_prop_eq"
 #define PROP_NE "__builtin_prop_ne"
 
-static void processing (c2m_ctx_t c2m_ctx, int ignore_directive_p) {
-  MIR_alloc_t alloc = c2m_alloc (c2m_ctx);
-  pre_ctx_t pre_ctx = c2m_ctx->pre_ctx;
-  token_t t;
-  struct macro macro_struct;
-  macro_t m;
-  macro_call_t mc;
-  int newln_p;
+/* GCC atomic builtins.  ORDER_ARG is the index of the memory order argument
+   or -1 for __sync builtins with their fixed ordering ORDER. */
+enum atomic_kind {
+  ATOMIC_LOAD,
+  ATOMIC_STORE,
+  ATOMIC_XCHG,
+  ATOMIC_CAS,      /* __atomic_compare_exchange_n: bool, updates *expected on failure */
+  ATOMIC_CAS_VAL,  /* __sync_val_compare_and_swap: old value */
+  ATOMIC_CAS_BOOL, /* __sync_bool_compare_and_swap: bool */
+  ATOMIC_FETCH_OP, /* old value */
+  ATOMIC_OP_FETCH, /* new value */
+  ATOMIC_FENCE,
+  ATOMIC_SIGNAL_FENCE,
+};
 
-  for (newln_p = TRUE;;) { /* Main loop. */
-    t = get_next_pptoken (c2m_ctx);
+#define ATOMIC_RELAXED 0
+#define ATOMIC_CONSUME 1
+#define ATOMIC_ACQUIRE 2
+#define ATOMIC_RELEASE 3
+#define ATOMIC_ACQ_REL 4
+#define ATOMIC_SEQ_CST 5
+
+struct atomic_builtin {
+  const char *name;
+  enum atomic_kind kind;
+  node_code_t op; /* N_ADD etc for FETCH_OP and OP_FETCH */
+  int nargs, order_arg, order;
+};
+
+static const struct atomic_builtin atomic_builtins[] = {
+  {"__atomic_load_n", ATOMIC_LOAD, N_IGNORE, 2, 1, 0},
+  {"__atomic_store_n", ATOMIC_STORE, N_IGNORE, 3, 2, 0},
+  {"__atomic_exchange_n", ATOMIC_XCHG, N_IGNORE, 3, 2, 0},
+  {"__atomic_compare_exchange_n", ATOMIC_CAS, N_IGNORE, 6, 4, 0},
+  {"__atomic_fetch_add", ATOMIC_FETCH_OP, N_ADD, 3, 2, 0},
+  {"__atomic_fetch_sub", ATOMIC_FETCH_OP, N_SUB, 3, 2, 0},
+  {"__atomic_fetch_and", ATOMIC_FETCH_OP, N_AND, 3, 2, 0},
+  {"__atomic_fetch_or", ATOMIC_FETCH_OP, N_OR, 3, 2, 0},
+  {"__atomic_fetch_xor", ATOMIC_FETCH_OP, N_XOR, 3, 2, 0},
+  {"__atomic_add_fetch", ATOMIC_OP_FETCH, N_ADD, 3, 2, 0},
+  {"__atomic_sub_fetch", ATOMIC_OP_FETCH, N_SUB, 3, 2, 0},
+  {"__atomic_and_fetch", ATOMIC_OP_FETCH, N_AND, 3, 2, 0},
+  {"__atomic_or_fetch", ATOMIC_OP_FETCH, N_OR, 3, 2, 0},
+  {"__atomic_xor_fetch", ATOMIC_OP_FETCH, N_XOR, 3, 2, 0},
+  {"__atomic_thread_fence", ATOMIC_FENCE, N_IGNORE, 1, 0, 0},
+  {"__atomic_signal_fence", ATOMIC_SIGNAL_FENCE, N_IGNORE, 1, 0, 0},
+  {"__sync_fetch_and_add", ATOMIC_FETCH_OP, N_ADD, 2, -1, ATOMIC_SEQ_CST},
+  {"__sync_fetch_and_sub", ATOMIC_FETCH_OP, N_SUB, 2, -1, ATOMIC_SEQ_CST},
+  {"__sync_fetch_and_and", ATOMIC_FETCH_OP, N_AND, 2, -1, ATOMIC_SEQ_CST},
+  {"__sync_fetch_and_or", ATOMIC_FETCH_OP, N_OR, 2, -1, ATOMIC_SEQ_CST},
+  {"__sync_fetch_and_xor", ATOMIC_FETCH_OP, N_XOR, 2, -1, ATOMIC_SEQ_CST},
+  {"__sync_add_and_fetch", ATOMIC_OP_FETCH, N_ADD, 2, -1, ATOMIC_SEQ_CST},
+  {"__sync_sub_and_fetch", ATOMIC_OP_FETCH, N_SUB, 2, -1, ATOMIC_SEQ_CST},
+  {"__sync_and_and_fetch", ATOMIC_OP_FETCH, N_AND, 2, -1, ATOMIC_SEQ_CST},
+  {"__sync_or_and_fetch", ATOMIC_OP_FETCH, N_OR, 2, -1, ATOMIC_SEQ_CST},
+  {"__sync_xor_and_fetch", ATOMIC_OP_FETCH, N_XOR, 2, -1, ATOMIC_SEQ_CST},
+  {"__sync_lock_test_and_set", ATOMIC_XCHG, N_IGNORE, 2, -1, ATOMIC_ACQUIRE},
+  {"__sync_lock_release", ATOMIC_STORE, N_IGNORE, 1, -1, ATOMIC_RELEASE},
+  {"__sync_val_compare_and_swap", ATOMIC_CAS_VAL, N_IGNORE, 3, -1, ATOMIC_SEQ_CST},
+  {"__sync_bool_compare_and_swap", ATOMIC_CAS_BOOL, N_IGNORE, 3, -1, ATOMIC_SEQ_CST},
+  {"__sync_synchronize", ATOMIC_FENCE, N_IGNORE, 0, -1, ATOMIC_SEQ_CST},
+};
+
+static const struct atomic_builtin *find_atomic_builtin (const char *name) {
+  if (strncmp (name, "__atomic_", 9) != 0 && strncmp (name, "__sync_", 7) != 0) return NULL;
+  for (size_t i = 0; i < sizeof (atomic_builtins) / sizeof (atomic_builtins[0]); i++)
+    if (strcmp (atomic_builtins[i].name, name) == 0) return &atomic_builtins[i];
+  return NULL;
+}
+
+static void processing (c2m_ctx_t c2m_ctx, int ignore_directive_p) {
+  pre_ctx_t pre_ctx = c2m_ctx->pre_ctx;
+  token_t t;
+  struct macro macro_struct;
+  macro_t m;
+  macro_call_t mc;
+  int newln_p;
+
+  for (newln_p = ignore_directive_p || pull_newln_p;;) { /* Main loop. */
+    if (!ignore_directive_p && pull_p
+        && VARR_LENGTH (token_t, recorded_tokens) > pull_tokens_num) {
+      pull_newln_p = newln_p;
+      return;
+    }
+    t = get_next_pptoken (c2m_ctx);
     if (t->code == T_EOP) return; /* end of processing */
     if (newln_p && !ignore_directive_p && t->code == '#') {
       process_directive (c2m_ctx);
@@ -3636,6 +4057,13 @@ static void processing (c2m_ctx_t c2m_ctx, int ignore_directive_p) {
       if (t->code == T_EOU) return;
       while ((int) VARR_LENGTH (ifstate_t, ifs) > eof_s->ifs_length_at_stream_start)
         pop_ifstate (c2m_ctx);
+      if (eof_s->guard_state == GUARD_END && eof_s->fname != NULL) {
+        include_guard_t guard, tab_guard;
+
+        guard.fname = eof_s->fname;
+        guard.id = eof_s->guard_id;
+        HTAB_DO (include_guard_t, include_guard_tab, guard, HTAB_REPLACE, tab_guard);
+      }
       skip_if_part_p = VARR_LENGTH (ifstate_t, ifs) == 0 ? 0 : VARR_LAST (ifstate_t, ifs)->skip_p;
       newln_p = TRUE;
       continue;
@@ -3644,6 +4072,8 @@ static void processing (c2m_ctx_t c2m_ctx, int ignore_directive_p) {
       newln_p = TRUE;
       continue;
     }
+    if (cs->guard_state == GUARD_START || cs->guard_state == GUARD_END)
+      cs->guard_state = GUARD_NONE;
     newln_p = FALSE;
     if (t->code == T_EOR) {  // finish macro call
       pop_macro_call (c2m_ctx);
@@ -3698,18 +4128,20 @@ static void processing (c2m_ctx_t c2m_ctx, int ignore_directive_p) {
         out_token (c2m_ctx, t);
       } else if (strcmp (t->repr, "__has_include") == 0) {
         int res;
-        VARR (token_t) * arg;
+        token_slice_t arg;
         const char *name, *content;
-        FILE *f;
 
         if ((mc = try_param_macro_call (c2m_ctx, m, t)) != NULL) {
           unget_next_pptoken (c2m_ctx, new_token (c2m_ctx, t->pos, "", T_EOR, N_IGNORE));
-          if (VARR_LENGTH (token_arr_t, mc->args) != 1) {
+          if (VARR_LENGTH (token_slice_t, mc->args) != 1) {
             res = 0;
           } else {
-            arg = VARR_LAST (token_arr_t, mc->args);
-            if ((name = get_header_name (c2m_ctx, arg, t->pos, &content)) != NULL) {
-              res = content != NULL || ((f = fopen (name, "r")) != NULL && !fclose (f)) ? 1 : 0;
+            arg = VARR_LAST (token_slice_t, mc->args);
+            VARR_TRUNC (token_t, temp_tokens, 0); /* the header name is made in place */
+            for (size_t i = 0; i < arg.len; i++)
+              VARR_PUSH (token_t, temp_tokens, VARR_GET (token_t, mc->arg_tokens, arg.start + i));
+            if ((name = get_header_name (c2m_ctx, temp_tokens, t->pos, &content)) != NULL) {
+              res = content != NULL || file_found_p (name) ? 1 : 0;
             } else {
               error (c2m_ctx, t->pos, "wrong arg of predefined __has_include");
               res = 0;
@@ -3722,23 +4154,23 @@ static void processing (c2m_ctx_t c2m_ctx, int ignore_directive_p) {
       } else if (strcmp (t->repr, "__has_builtin") == 0) {
         int res;
         size_t i, len;
-        VARR (token_t) * arg;
+        token_t *arg;
 
         res = 0;
         if ((mc = try_param_macro_call (c2m_ctx, m, t)) != NULL) {
           unget_next_pptoken (c2m_ctx, new_token (c2m_ctx, t->pos, "", T_EOR, N_IGNORE));
-          if (VARR_LENGTH (token_arr_t, mc->args) != 1) {
+          if (VARR_LENGTH (token_slice_t, mc->args) != 1) {
             error (c2m_ctx, t->pos, "wrong number of args for __has_builtin");
           } else {
-            arg = VARR_LAST (token_arr_t, mc->args);
-            len = VARR_LENGTH (token_t, arg);
+            arg = VARR_ADDR (token_t, mc->arg_tokens) + VARR_LAST (token_slice_t, mc->args).start;
+            len = VARR_LAST (token_slice_t, mc->args).len;
             i = 0;
-            if (i < len && VARR_GET (token_t, arg, i)->code == ' ') i++;
-            if (i >= len || (t = VARR_GET (token_t, arg, i))->code != T_ID) {
+            if (i < len && arg[i]->code == ' ') i++;
+            if (i >= len || (t = arg[i])->code != T_ID) {
               error (c2m_ctx, t->pos, "__has_builtin requires identifier");
             } else {
               i++;
-              if (i < len && VARR_GET (token_t, arg, i)->code == ' ') i++;
+              if (i < len && arg[i]->code == ' ') i++;
               if (i != len)
                 error (c2m_ctx, t->pos, "garbage after identifier in __has_builtin");
               else
@@ -3746,7 +4178,7 @@ static void processing (c2m_ctx_t c2m_ctx, int ignore_directive_p) {
                        || strcmp (t->repr, MUL_OVERFLOW) == 0 || strcmp (t->repr, EXPECT) == 0
                        || strcmp (t->repr, JCALL) == 0 || strcmp (t->repr, JRET) == 0
                        || strcmp (t->repr, PROP_SET) == 0 || strcmp (t->repr, PROP_EQ) == 0
-                       || strcmp (t->repr, PROP_NE) == 0);
+                       || strcmp (t->repr, PROP_NE) == 0 || find_atomic_builtin (t->repr) != NULL);
             }
           }
           m->ignore_p = TRUE;
@@ -3768,9 +4200,12 @@ static void processing (c2m_ctx_t c2m_ctx, int ignore_directive_p) {
 #ifdef C2MIR_PREPRO_DEBUG
       fprintf (stderr, "# push back <EOR>\n");
 #endif
-      mc = new_macro_call (alloc, m, t->pos);
-      add_tokens (mc->repl_buffer, m->replacement);
-      copy_and_push_back (c2m_ctx, do_concat (c2m_ctx, mc->repl_buffer), mc->pos);
+      mc = new_macro_call (c2m_ctx, m, t->pos);
+      add_tokens (mc->repl_buffer, VARR_ADDR (token_t, m->replacement),
+                  VARR_LENGTH (token_t, m->replacement));
+      do_concat (c2m_ctx, mc->repl_buffer);
+      copy_and_push_back (c2m_ctx, VARR_ADDR (token_t, mc->repl_buffer),
+                          VARR_LENGTH (token_t, mc->repl_buffer), mc->pos);
       m->ignore_p = TRUE;
       VARR_PUSH (macro_call_t, macro_call_stack, mc);
     } else if ((mc = try_param_macro_call (c2m_ctx, m, t)) != NULL) { /* macro with parameters */
@@ -3880,7 +4315,9 @@ static void common_pre_out (c2m_ctx_t c2m_ctx, token_t t) {
   (c2m_options->prepro_only_p ? pre_text_out : pre_out) (c2m_ctx, t);
 }
 
-static void pre (c2m_ctx_t c2m_ctx) {
+/* Start preprocessing.  With PULL_P, the tokens are produced on demand
+   by pre_pull, otherwise all of them at once. */
+static void pre_start (c2m_ctx_t c2m_ctx, int pull_mode_p) {
   pre_ctx_t pre_ctx = c2m_ctx->pre_ctx;
 
   pre_last_token = NULL;
@@ -3889,21 +4326,42 @@ static void pre (c2m_ctx_t c2m_ctx) {
   actual_pre_pos.ln_pos = 0;
   pre_out_token_func = common_pre_out;
   pptokens_num = 0;
-  VARR_TRUNC (char_ptr_t, once_include_files, 0);
+  pull_p = pull_mode_p;
+  pull_newln_p = TRUE;
+  pull_end_p = FALSE;
+}
+
+/* Add at least one parse token to recorded_tokens, the final T_EOFILE
+   last.  Return FALSE if all tokens have been produced already. */
+static int pre_pull (c2m_ctx_t c2m_ctx) {
+  pre_ctx_t pre_ctx = c2m_ctx->pre_ctx;
+
+  if (pull_end_p) return FALSE;
+  pull_tokens_num = VARR_LENGTH (token_t, recorded_tokens);
   if (!c2m_options->no_prepro_p) {
     processing (c2m_ctx, FALSE);
+    if (pull_p && VARR_LENGTH (token_t, recorded_tokens) > pull_tokens_num) return TRUE;
   } else {
     for (;;) {
       token_t t = get_next_pptoken (c2m_ctx);
 
       if (t->code == T_EOFILE || t->code == T_EOU) break;
       pre_out_token_func (c2m_ctx, t);
+      if (pull_p && VARR_LENGTH (token_t, recorded_tokens) > pull_tokens_num) return TRUE;
     }
   }
   pre_out_token_func (c2m_ctx, NULL);
+  pull_end_p = TRUE;
   if (c2m_options->verbose_p && c2m_options->message_file != NULL)
     fprintf (c2m_options->message_file, "    preprocessor tokens -- %lu, parse tokens -- %lu\n",
-             pptokens_num, (unsigned long) VARR_LENGTH (token_t, recorded_tokens));
+             pptokens_num,
+             (unsigned long) (dropped_tokens_num + VARR_LENGTH (token_t, recorded_tokens)));
+  return TRUE;
+}
+
+static void pre (c2m_ctx_t c2m_ctx) {
+  pre_start (c2m_ctx, FALSE);
+  pre_pull (c2m_ctx);
 }
 
 /* ------------------------- Preprocessor End ------------------------------ */
@@ -3914,6 +4372,7 @@ typedef struct {
 } tpname_t;
 
 DEF_HTAB (tpname_t);
+DEF_VARR (tpname_t);
 
 struct parse_ctx {
   int record_level;
@@ -3921,6 +4380,8 @@ struct parse_ctx {
   token_t curr_token;
   node_t curr_scope;
   HTAB (tpname_t) * tpname_tab;
+  HTAB (tpname_t) * tpname_memo_tab; /* typedef_p of names looked up from the scope */
+  VARR (tpname_t) * body_tpnames;    /* added in the streamed function body */
 };
 
 #define record_level parse_ctx->record_level
@@ -3929,13 +4390,40 @@ struct parse_ctx {
 #define curr_token parse_ctx->curr_token
 #define curr_scope parse_ctx->curr_scope
 #define tpname_tab parse_ctx->tpname_tab
+#define tpname_memo_tab parse_ctx->tpname_memo_tab
+#define body_tpnames parse_ctx->body_tpnames
 
 static struct node err_struct;
 static const node_t err_node = &err_struct;
 
+/* Tokens read before the current one are dropped when no record is
+   active and there are at least this many of them. */
+#define DROP_TOKENS_THRESHOLD 1024
+
+static void drop_read_tokens (c2m_ctx_t c2m_ctx) {
+  parse_ctx_t parse_ctx = c2m_ctx->parse_ctx;
+  size_t n = next_token_index - 1, len = VARR_LENGTH (token_t, recorded_tokens);
+  token_t *addr = VARR_ADDR (token_t, recorded_tokens);
+
+  memmove (addr, addr + n, (len - n) * sizeof (token_t));
+  VARR_TRUNC (token_t, recorded_tokens, len - n);
+  dropped_tokens_num += n;
+  next_token_index = 1;
+}
+
 static void read_token (c2m_ctx_t c2m_ctx) {
   parse_ctx_t parse_ctx = c2m_ctx->parse_ctx;
+  int body_p = reg_body_p;
+  size_t len;
 
+  if (body_p) reg_body_switch (c2m_ctx, FALSE); /* tokens outlive the function bodies */
+  /* A string can be concatenated with the next one, so wait for the next: */
+  while (((len = VARR_LENGTH (token_t, recorded_tokens)) <= next_token_index
+          || (len == next_token_index + 1 && VARR_LAST (token_t, recorded_tokens)->code == T_STR))
+         && pre_pull (c2m_ctx))
+    ;
+  if (body_p) reg_body_switch (c2m_ctx, TRUE);
+  if (record_level == 0 && next_token_index > DROP_TOKENS_THRESHOLD) drop_read_tokens (c2m_ctx);
   curr_token = VARR_GET (token_t, recorded_tokens, next_token_index);
   next_token_index++;
 }
@@ -3994,37 +4482,79 @@ static void tpname_init (c2m_ctx_t c2m_ctx) {
   MIR_alloc_t alloc = c2m_alloc (c2m_ctx);
   parse_ctx_t parse_ctx = c2m_ctx->parse_ctx;
 
+  if (tpname_tab != NULL) return; /* kept from the previous compile */
   HTAB_CREATE (tpname_t, tpname_tab, alloc, 1000, tpname_hash, tpname_eq, NULL);
+  HTAB_CREATE (tpname_t, tpname_memo_tab, alloc, 1000, tpname_hash, tpname_eq, NULL);
+  VARR_CREATE (tpname_t, body_tpnames, alloc, 0);
 }
 
-static int tpname_find (c2m_ctx_t c2m_ctx, node_t id, node_t scope, tpname_t *res) {
+static tpname_t tpname_add (c2m_ctx_t c2m_ctx, node_t id, node_t scope, int typedef_p) {
   parse_ctx_t parse_ctx = c2m_ctx->parse_ctx;
-  int found_p;
   tpname_t el, tpname;
 
   tpname.id = id;
   tpname.scope = scope;
-  found_p = HTAB_DO (tpname_t, tpname_tab, tpname, HTAB_FIND, el);
-  if (res != NULL && found_p) *res = el;
-  return found_p;
+  tpname.typedef_p = typedef_p;
+  if (HTAB_DO (tpname_t, tpname_tab, tpname, HTAB_FIND, el)) return el;
+  HTAB_DO (tpname_t, tpname_tab, tpname, HTAB_INSERT, el);
+  HTAB_DO (tpname_t, tpname_memo_tab, tpname, HTAB_DELETE, el);
+  if (reg_body_p) VARR_PUSH (tpname_t, body_tpnames, tpname);
+  return tpname;
 }
 
-static tpname_t tpname_add (c2m_ctx_t c2m_ctx, node_t id, node_t scope, int typedef_p) {
+/* Return TRUE if ID is a typedef name in the current scope.  The scope walk stops at
+   the nearest scope having a memoized answer, so the identifiers of deeply nested
+   blocks are classified in amortized constant time.  Names are added only to the
+   current scope and a left scope is never entered again, so an addition can make
+   stale only the answer memoized for its own scope. */
+static int tpname_typedef_p (c2m_ctx_t c2m_ctx, node_t id) {
   parse_ctx_t parse_ctx = c2m_ctx->parse_ctx;
+  node_t scope;
   tpname_t el, tpname;
 
   tpname.id = id;
-  tpname.scope = scope;
-  tpname.typedef_p = typedef_p;
-  if (HTAB_DO (tpname_t, tpname_tab, tpname, HTAB_FIND, el)) return el;
-  HTAB_DO (tpname_t, tpname_tab, tpname, HTAB_INSERT, el);
-  return el;
+  tpname.typedef_p = FALSE;
+  for (scope = curr_scope;; scope = scope->attr) {
+    tpname.scope = scope;
+    if (HTAB_DO (tpname_t, tpname_tab, tpname, HTAB_FIND, el)
+        || HTAB_DO (tpname_t, tpname_memo_tab, tpname, HTAB_FIND, el)) {
+      tpname.typedef_p = el.typedef_p;
+      break;
+    }
+    if (scope == NULL) break;
+  }
+  if (scope != curr_scope) {
+    tpname.scope = curr_scope;
+    HTAB_DO (tpname_t, tpname_memo_tab, tpname, HTAB_INSERT, el);
+  }
+  return tpname.typedef_p;
+}
+
+/* Remove the names of the released function body or, if KEEP_P, only
+   forget them. */
+static void tpname_release_body (c2m_ctx_t c2m_ctx, int keep_p) {
+  parse_ctx_t parse_ctx = c2m_ctx->parse_ctx;
+  tpname_t el;
+
+  if (!keep_p)
+    for (size_t i = 0; i < VARR_LENGTH (tpname_t, body_tpnames); i++)
+      HTAB_DO (tpname_t, tpname_tab, VARR_GET (tpname_t, body_tpnames, i), HTAB_DELETE, el);
+  VARR_TRUNC (tpname_t, body_tpnames, 0);
+  HTAB_CLEAR (tpname_t, tpname_memo_tab); /* it refers to the body scopes */
 }
 
-static void tpname_finish (c2m_ctx_t c2m_ctx) {
+static void tpname_finish (c2m_ctx_t c2m_ctx, int keep_p) {
   parse_ctx_t parse_ctx = c2m_ctx->parse_ctx;
 
+  if (keep_p) {
+    HTAB_CLEAR (tpname_t, tpname_tab);
+    HTAB_CLEAR (tpname_t, tpname_memo_tab);
+    VARR_TRUNC (tpname_t, body_tpnames, 0);
+    return;
+  }
   if (tpname_tab != NULL) HTAB_DESTROY (tpname_t, tpname_tab);
+  if (tpname_memo_tab != NULL) HTAB_DESTROY (tpname_t, tpname_memo_tab);
+  if (body_tpnames != NULL) VARR_DESTROY (tpname_t, body_tpnames);
 }
 
 #define P(f)                                                 \
@@ -4112,6 +4642,60 @@ static node_t try_arg_f (c2m_ctx_t c2m_ctx, nonterm_arg_func_t f, node_t arg) {
 #define TRY(f) try_f (c2m_ctx, f)
 #define TRY_A(f, arg) try_arg_f (c2m_ctx, f, arg)
 
+/* Return the token after the current one without reading it. */
+static token_t peek_token (c2m_ctx_t c2m_ctx) {
+  parse_ctx_t parse_ctx = c2m_ctx->parse_ctx;
+  int body_p = reg_body_p;
+
+  if (body_p) reg_body_switch (c2m_ctx, FALSE);
+  while (VARR_LENGTH (token_t, recorded_tokens) <= next_token_index && pre_pull (c2m_ctx))
+    ;
+  if (body_p) reg_body_switch (c2m_ctx, TRUE);
+  return VARR_GET (token_t, recorded_tokens, next_token_index);
+}
+
+/* Lookahead classification of a first token: the tries of declarations, type names and
+   labels are done only when it can start them.  So the common statements and
+   parenthesized expressions are parsed without backtracking. */
+static int type_name_start_p (c2m_ctx_t c2m_ctx, token_t t) {
+  switch (t->code) {
+  case T_VOID: case T_CHAR: case T_SHORT: case T_INT: case T_LONG: case T_FLOAT:
+  case T_DOUBLE: case T_SIGNED: case T_UNSIGNED: case T_BOOL: case T_COMPLEX:
+  case T_STRUCT: case T_UNION: case T_ENUM: case T_CONST: case T_RESTRICT:
+  case T_VOLATILE: case T_ATOMIC: return TRUE;
+  case T_ID: return tpname_typedef_p (c2m_ctx, t->node);
+  default: return FALSE;
+  }
+}
+
+static int decl_start_p (c2m_ctx_t c2m_ctx) {
+  parse_ctx_t parse_ctx = c2m_ctx->parse_ctx;
+
+  switch (curr_token->code) {
+  case ';': case T_STATIC_ASSERT: case T_ALIGNAS: case T_TYPEDEF: case T_EXTERN:
+  case T_STATIC: case T_AUTO: case T_REGISTER: case T_THREAD_LOCAL: case T_INLINE:
+  case T_NO_RETURN: return TRUE;
+  case T_ID:
+    if (strcmp (curr_token->node->u.s.s, "__attribute__") == 0
+        || strcmp (curr_token->node->u.s.s, "__mirc_attribute__") == 0)
+      return TRUE;
+    /* fall through */
+  default: return type_name_start_p (c2m_ctx, curr_token);
+  }
+}
+
+static int label_start_p (c2m_ctx_t c2m_ctx) {
+  parse_ctx_t parse_ctx = c2m_ctx->parse_ctx;
+
+  return C (T_CASE) || C (T_DEFAULT) || (C (T_ID) && peek_token (c2m_ctx)->code == ':');
+}
+
+static int par_type_name_start_p (c2m_ctx_t c2m_ctx) {
+  parse_ctx_t parse_ctx = c2m_ctx->parse_ctx;
+
+  return C ('(') && type_name_start_p (c2m_ctx, peek_token (c2m_ctx));
+}
+
 D (compound_stmt);
 
 /* Expressions: */
@@ -4230,7 +4814,7 @@ D (unary_expr) {
   node_code_t code;
   pos_t pos;
 
-  if ((r = TRY (par_type_name)) != err_node) {
+  if (par_type_name_start_p (c2m_ctx) && (r = TRY (par_type_name)) != err_node) {
     t = r;
     if (!MP ('{', pos)) {
       P (unary_expr);
@@ -4243,7 +4827,7 @@ D (unary_expr) {
     }
     return r;
   } else if (MP (T_SIZEOF, pos)) {
-    if ((r = TRY (par_type_name)) != err_node) {
+    if (par_type_name_start_p (c2m_ctx) && (r = TRY (par_type_name)) != err_node) {
       r = new_pos_node1 (c2m_ctx, N_SIZEOF, pos, r);
       return r;
     }
@@ -4548,11 +5132,6 @@ D (sc_spec) {
   } else if (MP (T_REGISTER, pos)) {
     r = new_pos_node (c2m_ctx, N_REGISTER, pos);
   } else if (MP (T_THREAD_LOCAL, pos)) {
-    if (c2m_options->pedantic_p)
-      error (c2m_ctx, pos, "Thread local is not implemented");
-    else
-      warning (c2m_ctx, pos,
-               "Thread local is not implemented -- program might not work as assumed");
     r = new_pos_node (c2m_ctx, N_THREAD_LOCAL, pos);
   } else {
     if (record_level == 0) syntax_error (c2m_ctx, "a storage specifier");
@@ -4590,11 +5169,10 @@ DA (type_spec) {
   } else if (MP (T_COMPLEX, pos)) {
     if (record_level == 0) error (c2m_ctx, pos, "complex numbers are not supported");
     return err_node;
-  } else if (MP (T_ATOMIC, pos)) { /* atomic-type-specifier */
+  } else if (MP (T_ATOMIC, pos)) { /* atomic-type-specifier: the type name node itself */
     PT ('(');
     P (type_name);
     PT (')');
-    error (c2m_ctx, pos, "Atomic types are not supported");
   } else if ((struct_p = MP (T_STRUCT, pos)) || MP (T_UNION, pos)) {
     /* struct-or-union-specifier, struct-or-union */
     if (!MN (T_ID, op1)) {
@@ -4718,14 +5296,13 @@ D (struct_declaration) {
 
 D (spec_qual_list) {
   parse_ctx_t parse_ctx = c2m_ctx->parse_ctx;
-  node_t list, op, r, arg = NULL;
+  node_t list, op, arg = NULL;
   int first_p;
 
   list = new_node (c2m_ctx, N_LIST);
   for (first_p = TRUE;; first_p = FALSE) {
-    if (C (T_CONST) || C (T_RESTRICT) || C (T_VOLATILE) || C (T_ATOMIC)) {
-      P (type_qual);
-      op = r;
+    if ((C (T_CONST) || C (T_RESTRICT) || C (T_VOLATILE) || C (T_ATOMIC))
+        && (op = TRY (type_qual)) != err_node) {
     } else if ((op = TRY_A (type_spec, arg)) != err_node) {
       arg = op;
     } else if (first_p) {
@@ -4750,6 +5327,11 @@ D (type_qual) {
   } else if (MP (T_VOLATILE, pos)) {
     r = new_pos_node (c2m_ctx, N_VOLATILE, pos);
   } else if (MP (T_ATOMIC, pos)) {
+    /* _Atomic immediately followed by ( is a type specifier */
+    if (C ('(')) {
+      if (record_level == 0) syntax_error (c2m_ctx, "a type qualifier");
+      return err_node;
+    }
     r = new_pos_node (c2m_ctx, N_ATOMIC, pos);
   } else {
     if (record_level == 0) syntax_error (c2m_ctx, "a type qualifier");
@@ -5064,18 +5646,10 @@ D (direct_abstract_declarator) {
 
 D (typedef_name) {
   parse_ctx_t parse_ctx = c2m_ctx->parse_ctx;
-  node_t scope, r;
-  tpname_t tpn;
+  node_t r;
 
   PTN (T_ID);
-  for (scope = curr_scope;; scope = scope->attr) {
-    if (tpname_find (c2m_ctx, r, scope, &tpn)) {
-      if (!tpn.typedef_p) break;
-      return r;
-    }
-    if (scope == NULL) break;
-  }
-  return err_node;
+  return tpname_typedef_p (c2m_ctx, r) ? r : err_node;
 }
 
 D (initializer) {
@@ -5191,7 +5765,7 @@ D (stmt) {
   pos_t pos;
 
   l = new_node (c2m_ctx, N_LIST);
-  while ((op1 = TRY (label)) != err_node) {
+  while (label_start_p (c2m_ctx) && (op1 = TRY (label)) != err_node) {
     op_append (c2m_ctx, l, op1);
   }
   if (C ('{')) {
@@ -5242,7 +5816,7 @@ D (stmt) {
     n = new_pos_node (c2m_ctx, N_FOR, pos);
     n->attr = curr_scope;
     curr_scope = n;
-    if ((r = TRY (declaration)) != err_node) {
+    if (decl_start_p (c2m_ctx) && (r = TRY (declaration)) != err_node) {
       op1 = r;
       curr_scope = n->attr;
     } else {
@@ -5344,7 +5918,7 @@ D (compound_stmt) {
   n->attr = curr_scope;
   curr_scope = n;
   while (!C ('}') && !C (T_EOFILE)) { /* block-item-list, block_item */
-    if ((r = TRY (declaration)) != err_node) {
+    if (decl_start_p (c2m_ctx) && (r = TRY (declaration)) != err_node) {
     } else {
       PE (stmt, err1);
     }
@@ -5365,13 +5939,20 @@ err0:
   return err_node;
 }
 
+static void stream_start (c2m_ctx_t c2m_ctx, node_t module);
+static void stream_ext_decl (c2m_ctx_t c2m_ctx, node_t r);
+static void stream_finish (c2m_ctx_t c2m_ctx);
+
 D (transl_unit) {
   parse_ctx_t parse_ctx = c2m_ctx->parse_ctx;
-  node_t list, ds, d, dl, r, func, param_list, p, par_declarator, id;
+  node_t list, module, last, ds, d, dl, r, func, param_list, p, par_declarator, id;
+  int stream_p = c2m_options->stream_p;
 
   // curr_token->code = ';'; /* for error recovery */
   read_token (c2m_ctx);
   list = new_node (c2m_ctx, N_LIST);
+  module = NULL;
+  if (stream_p) stream_start (c2m_ctx, module = new_node1 (c2m_ctx, N_MODULE, list));
   while (!C (T_EOFILE)) { /* external-declaration */
     if ((r = TRY (declaration)) != err_node) {
     } else {
@@ -5402,18 +5983,27 @@ D (transl_unit) {
           }
         }
       }
-      P (compound_stmt);
+      if (stream_p) reg_body_switch (c2m_ctx, TRUE);
+      r = compound_stmt (c2m_ctx, no_err_p);
+      if (stream_p) reg_body_switch (c2m_ctx, FALSE);
+      if (r == err_node) return r;
       r = new_pos_node4 (c2m_ctx, N_FUNC_DEF, POS (d), ds, d, dl, r);
       curr_scope = d->attr;
     }
+    last = NL_TAIL (list->u.ops);
     op_flat_append (c2m_ctx, list, r);
+    if (stream_p)
+      for (r = last == NULL ? NL_HEAD (list->u.ops) : NL_NEXT (last); r != NULL; r = NL_NEXT (r))
+        stream_ext_decl (c2m_ctx, r);
     continue;
   decl_err:
     curr_scope = d->attr;
   err:
     error_recovery (c2m_ctx, 0, "<declarator>");
   }
-  return new_node1 (c2m_ctx, N_MODULE, list);
+  if (!stream_p) return new_node1 (c2m_ctx, N_MODULE, list);
+  stream_finish (c2m_ctx);
+  return module;
 }
 
 static void fatal_error (c2m_ctx_t c2m_ctx, C_error_code_t code MIR_UNUSED, const char *message) {
@@ -5421,71 +6011,21 @@ static void fatal_error (c2m_ctx_t c2m_ctx, C_error_code_t code MIR_UNUSED, cons
   longjmp (c2m_ctx->env, 1);
 }
 
-static void kw_add (c2m_ctx_t c2m_ctx, const char *name, token_code_t tc, size_t flags) {
-  str_add (c2m_ctx, name, strlen (name) + 1, tc, flags, TRUE);
-}
-
 static void parse_init (c2m_ctx_t c2m_ctx) {
   MIR_alloc_t alloc = c2m_alloc (c2m_ctx);
   parse_ctx_t parse_ctx;
 
-  c2m_ctx->parse_ctx = parse_ctx = c2sljit_calloc (c2m_ctx, sizeof (struct parse_ctx));
+  if ((parse_ctx = c2m_ctx->parse_ctx) == NULL) { /* otherwise kept from the previous compile */
+    c2m_ctx->parse_ctx = parse_ctx = c2sljit_calloc (c2m_ctx, sizeof (struct parse_ctx));
+    VARR_CREATE (token_t, recorded_tokens, alloc, 32);
+    VARR_CREATE (token_t, buffered_tokens, alloc, 32);
+  }
   curr_scope = NULL;
   error_func = fatal_error;
   record_level = 0;
-  curr_uid = 0;
   init_streams (c2m_ctx);
-  VARR_CREATE (token_t, recorded_tokens, alloc, 32);
-  VARR_CREATE (token_t, buffered_tokens, alloc, 32);
+  dropped_tokens_num = 0;
   pre_init (c2m_ctx);
-  kw_add (c2m_ctx, "_Bool", T_BOOL, 0);
-  kw_add (c2m_ctx, "_Complex", T_COMPLEX, 0);
-  kw_add (c2m_ctx, "_Alignas", T_ALIGNAS, 0);
-  kw_add (c2m_ctx, "_Alignof", T_ALIGNOF, 0);
-  kw_add (c2m_ctx, "_Atomic", T_ATOMIC, 0);
-  kw_add (c2m_ctx, "_Generic", T_GENERIC, 0);
-  kw_add (c2m_ctx, "_Noreturn", T_NO_RETURN, 0);
-  kw_add (c2m_ctx, "_Static_assert", T_STATIC_ASSERT, 0);
-  kw_add (c2m_ctx, "_Thread_local", T_THREAD_LOCAL, 0);
-  kw_add (c2m_ctx, "auto", T_AUTO, 0);
-  kw_add (c2m_ctx, "break", T_BREAK, 0);
-  kw_add (c2m_ctx, "case", T_CASE, 0);
-  kw_add (c2m_ctx, "char", T_CHAR, 0);
-  kw_add (c2m_ctx, "const", T_CONST, 0);
-  kw_add (c2m_ctx, "continue", T_CONTINUE, 0);
-  kw_add (c2m_ctx, "default", T_DEFAULT, 0);
-  kw_add (c2m_ctx, "do", T_DO, 0);
-  kw_add (c2m_ctx, "double", T_DOUBLE, 0);
-  kw_add (c2m_ctx, "else", T_ELSE, 0);
-  kw_add (c2m_ctx, "enum", T_ENUM, 0);
-  kw_add (c2m_ctx, "extern", T_EXTERN, 0);
-  kw_add (c2m_ctx, "float", T_FLOAT, 0);
-  kw_add (c2m_ctx, "for", T_FOR, 0);
-  kw_add (c2m_ctx, "goto", T_GOTO, 0);
-  kw_add (c2m_ctx, "if", T_IF, 0);
-  kw_add (c2m_ctx, "inline", T_INLINE, FLAG_EXT89);
-  kw_add (c2m_ctx, "int", T_INT, 0);
-  kw_add (c2m_ctx, "long", T_LONG, 0);
-  kw_add (c2m_ctx, "register", T_REGISTER, 0);
-  kw_add (c2m_ctx, "restrict", T_RESTRICT, FLAG_C89);
-  kw_add (c2m_ctx, "return", T_RETURN, 0);
-  kw_add (c2m_ctx, "short", T_SHORT, 0);
-  kw_add (c2m_ctx, "signed", T_SIGNED, 0);
-  kw_add (c2m_ctx, "sizeof", T_SIZEOF, 0);
-  kw_add (c2m_ctx, "static", T_STATIC, 0);
-  kw_add (c2m_ctx, "struct", T_STRUCT, 0);
-  kw_add (c2m_ctx, "switch", T_SWITCH, 0);
-  kw_add (c2m_ctx, "typedef", T_TYPEDEF, 0);
-  kw_add (c2m_ctx, "typeof", T_TYPEOF, FLAG_EXT);
-  kw_add (c2m_ctx, "union", T_UNION, 0);
-  kw_add (c2m_ctx, "unsigned", T_UNSIGNED, 0);
-  kw_add (c2m_ctx, "void", T_VOID, 0);
-  kw_add (c2m_ctx, "volatile", T_VOLATILE, 0);
-  kw_add (c2m_ctx, "while", T_WHILE, 0);
-  kw_add (c2m_ctx, "__restrict", T_RESTRICT, FLAG_EXT);
-  kw_add (c2m_ctx, "__restrict__", T_RESTRICT, FLAG_EXT);
-  kw_add (c2m_ctx, "__inline", T_INLINE, FLAG_EXT);
-  kw_add (c2m_ctx, "__inline__", T_INLINE, FLAG_EXT);
   tpname_init (c2m_ctx);
 }
 
@@ -5506,14 +6046,20 @@ static node_t parse (c2m_ctx_t c2m_ctx) {
   return transl_unit (c2m_ctx, FALSE);
 }
 
-static void parse_finish (c2m_ctx_t c2m_ctx) {
+static void parse_finish (c2m_ctx_t c2m_ctx, int keep_p) {
   if (c2m_ctx == NULL || c2m_ctx->parse_ctx == NULL) return;
+  pre_finish (c2m_ctx, keep_p);
+  tpname_finish (c2m_ctx, keep_p);
+  finish_streams (c2m_ctx, keep_p);
+  if (keep_p) {
+    VARR_TRUNC (token_t, recorded_tokens, 0);
+    VARR_TRUNC (token_t, buffered_tokens, 0);
+    return;
+  }
   if (recorded_tokens != NULL) VARR_DESTROY (token_t, recorded_tokens);
   if (buffered_tokens != NULL) VARR_DESTROY (token_t, buffered_tokens);
-  pre_finish (c2m_ctx);
-  tpname_finish (c2m_ctx);
-  finish_streams (c2m_ctx);
   free (c2m_ctx->parse_ctx);
+  c2m_ctx->parse_ctx = NULL;
 }
 
 #undef P
@@ -5575,6 +6121,10 @@ struct check_ctx {
   node_t curr_func_def, curr_loop, curr_loop_switch;
   mir_size_t curr_call_arg_area_offset;
   VARR (node_t) * context_stack;
+  VARR (symbol_t) * scope_symbols; /* the symbols of the open scopes in order of insertion */
+  VARR (symbol_t) * body_symbols;  /* local to the streamed function definition */
+  int body_record_p;               /* the function definition symbols go to body_symbols */
+  int body_ref_p;                  /* the module scope refers to the function body */
 };
 
 #define curr_scope check_ctx->curr_scope
@@ -5594,6 +6144,10 @@ struct check_ctx {
 #define curr_loop_switch check_ctx->curr_loop_switch
 #define curr_call_arg_area_offset check_ctx->curr_call_arg_area_offset
 #define context_stack check_ctx->context_stack
+#define scope_symbols check_ctx->scope_symbols
+#define body_symbols check_ctx->body_symbols
+#define body_record_p check_ctx->body_record_p
+#define body_ref_p check_ctx->body_ref_p
 
 static int supported_alignment_p (mir_llong align MIR_UNUSED) { return TRUE; }  // ???
 
@@ -5610,10 +6164,83 @@ static htab_hash_t symbol_hash (symbol_t s, void *arg MIR_UNUSED) {
 
 static void symbol_clear (symbol_t sym, void *arg MIR_UNUSED) { VARR_DESTROY (node_t, sym.defs); }
 
+static int visible_eq (visible_t v1, visible_t v2, void *arg MIR_UNUSED) {
+  return v1.mode == v2.mode && v1.id->u.s.s == v2.id->u.s.s;
+}
+
+static htab_hash_t visible_hash (visible_t v, void *arg MIR_UNUSED) {
+  return (htab_hash_t) (mir_hash_finish (mir_hash_step (
+    mir_hash_step (mir_hash_init (0x42), (uint64_t) v.mode), (uint64_t) v.id->u.s.s)));
+}
+
+static void visible_clear (visible_t v, void *arg MIR_UNUSED) { VARR_DESTROY (shadow_t, v.defs); }
+
 static void symbol_init (c2m_ctx_t c2m_ctx) {
   MIR_alloc_t alloc = c2m_alloc (c2m_ctx);
   HTAB_CREATE_WITH_FREE_FUNC (symbol_t, symbol_tab, alloc, 5000, symbol_hash, symbol_eq, symbol_clear,
                               NULL);
+  HTAB_CREATE_WITH_FREE_FUNC (visible_t, visible_tab, alloc, 5000, visible_hash, visible_eq,
+                              visible_clear, NULL);
+}
+
+static unsigned scope_depth (node_t scope);
+
+/* Return the shadow stack of ID in MODE creating it if CREATE_P. */
+static VARR (shadow_t) * visible_defs (c2m_ctx_t c2m_ctx, enum symbol_mode mode, node_t id,
+                                       int create_p) {
+  MIR_alloc_t alloc = c2m_alloc (c2m_ctx);
+  visible_t el, visible;
+
+  visible.mode = mode;
+  visible.id = id;
+  if (HTAB_DO (visible_t, visible_tab, visible, HTAB_FIND, el)) return el.defs;
+  if (!create_p) return NULL;
+  VARR_CREATE (shadow_t, visible.defs, alloc, 4);
+  HTAB_DO (visible_t, visible_tab, visible, HTAB_INSERT, el);
+  return visible.defs;
+}
+
+/* Put the symbol definition on its shadow stack.  Usually it is the innermost one but a
+   definition can also go to an outer scope, e.g. an extern declaration in a block. */
+static void visible_push (c2m_ctx_t c2m_ctx, symbol_t symbol) {
+  VARR (shadow_t) *defs = visible_defs (c2m_ctx, symbol.mode, symbol.id, TRUE);
+  shadow_t *addr, shadow;
+  size_t i;
+
+  shadow.scope = symbol.scope;
+  shadow.def_node = symbol.def_node;
+  shadow.aux_node = symbol.aux_node;
+  shadow.depth = scope_depth (symbol.scope);
+  VARR_PUSH (shadow_t, defs, shadow);
+  addr = VARR_ADDR (shadow_t, defs);
+  for (i = VARR_LENGTH (shadow_t, defs) - 1; i > 0 && addr[i - 1].depth > shadow.depth; i--)
+    addr[i] = addr[i - 1];
+  addr[i] = shadow;
+}
+
+/* Remove the symbols of SCOPE being closed from their shadow stacks. */
+static void visible_pop_scope (c2m_ctx_t c2m_ctx, node_t scope, size_t start) {
+  check_ctx_t check_ctx = c2m_ctx->check_ctx;
+  VARR (shadow_t) * defs;
+  shadow_t *addr;
+  symbol_t symbol;
+  size_t i, j, len, n = start;
+
+  for (i = start; i < VARR_LENGTH (symbol_t, scope_symbols); i++) {
+    symbol = VARR_GET (symbol_t, scope_symbols, i);
+    if (symbol.scope != scope) { /* a symbol of an outer scope */
+      VARR_SET (symbol_t, scope_symbols, n++, symbol);
+      continue;
+    }
+    defs = visible_defs (c2m_ctx, symbol.mode, symbol.id, FALSE);
+    addr = VARR_ADDR (shadow_t, defs);
+    len = VARR_LENGTH (shadow_t, defs);
+    for (j = len; addr[j - 1].scope != scope; j--)
+      ;
+    for (; j < len; j++) addr[j - 1] = addr[j];
+    VARR_POP (shadow_t, defs);
+  }
+  VARR_TRUNC (symbol_t, scope_symbols, n);
 }
 
 static int symbol_find (c2m_ctx_t c2m_ctx, enum symbol_mode mode, node_t id, node_t scope,
@@ -5632,6 +6259,7 @@ static int symbol_find (c2m_ctx_t c2m_ctx, enum symbol_mode mode, node_t id, nod
 static void symbol_insert (c2m_ctx_t c2m_ctx, enum symbol_mode mode, node_t id, node_t scope,
                            node_t def_node, node_t aux_node) {
   MIR_alloc_t alloc = c2m_alloc (c2m_ctx);
+  check_ctx_t check_ctx = c2m_ctx->check_ctx;
   symbol_t el, symbol;
 
   symbol.mode = mode;
@@ -5642,12 +6270,22 @@ static void symbol_insert (c2m_ctx_t c2m_ctx, enum symbol_mode mode, node_t id,
   VARR_CREATE (node_t, symbol.defs, alloc, 4);
   VARR_PUSH (node_t, symbol.defs, def_node);
   HTAB_DO (symbol_t, symbol_tab, symbol, HTAB_INSERT, el);
+  if (mode != S_LABEL) { /* labels are never looked up in outer scopes */
+    VARR_PUSH (symbol_t, scope_symbols, symbol);
+    visible_push (c2m_ctx, symbol);
+  }
+  if (!body_record_p) return;
+  if (scope != top_scope)
+    VARR_PUSH (symbol_t, body_symbols, symbol);
+  else if (reg_body_p)
+    body_ref_p = TRUE;
 }
 
 static void symbol_def_replace (c2m_ctx_t c2m_ctx, symbol_t symbol, node_t def_node) {
   MIR_alloc_t alloc = c2m_alloc (c2m_ctx);
   symbol_t el;
   VARR (node_t) * defs;
+  VARR (shadow_t) * shadows;
 
   VARR_CREATE (node_t, defs, alloc, 4);
   for (size_t i = 0; i < VARR_LENGTH (node_t, symbol.defs); i++)
@@ -5655,10 +6293,34 @@ static void symbol_def_replace (c2m_ctx_t c2m_ctx, symbol_t symbol, node_t def_n
   symbol.defs = defs;
   symbol.def_node = def_node;
   HTAB_DO (symbol_t, symbol_tab, symbol, HTAB_REPLACE, el);
+  if (symbol.mode == S_LABEL) return;
+  shadows = visible_defs (c2m_ctx, symbol.mode, symbol.id, FALSE);
+  for (size_t i = 0; i < VARR_LENGTH (shadow_t, shadows); i++)
+    if (VARR_GET (shadow_t, shadows, i).scope == symbol.scope)
+      VARR_ADDR (shadow_t, shadows)[i].def_node = def_node;
+}
+
+/* Remove the local symbols of the function definition whose body is
+   released or, if KEEP_P, only forget them. */
+static void symbol_release_body (c2m_ctx_t c2m_ctx, int keep_p) {
+  check_ctx_t check_ctx = c2m_ctx->check_ctx;
+  symbol_t el;
+
+  if (!keep_p)
+    for (size_t i = 0; i < VARR_LENGTH (symbol_t, body_symbols); i++)
+      HTAB_DO (symbol_t, symbol_tab, VARR_GET (symbol_t, body_symbols, i), HTAB_DELETE, el);
+  VARR_TRUNC (symbol_t, body_symbols, 0);
+  body_ref_p = FALSE;
 }
 
-static void symbol_finish (c2m_ctx_t c2m_ctx) {
+static void symbol_finish (c2m_ctx_t c2m_ctx, int keep_p) {
+  if (keep_p) {
+    HTAB_CLEAR (symbol_t, symbol_tab);
+    HTAB_CLEAR (visible_t, visible_tab);
+    return;
+  }
   if (symbol_tab != NULL) HTAB_DESTROY (symbol_t, symbol_tab);
+  if (visible_tab != NULL) HTAB_DESTROY (visible_t, visible_tab);
 }
 
 enum basic_type get_int_basic_type (size_t s) {
@@ -5880,8 +6542,14 @@ struct node_scope {
   unsigned func_scope_num;
   mir_size_t size, offset, call_arg_area_size;
   node_t scope;
+  unsigned depth;       /* the module scope depth is 1 */
+  size_t symbols_start; /* the scope symbols start in scope_symbols */
 };
 
+static unsigned scope_depth (node_t scope) {
+  return scope == NULL ? 0 : ((struct node_scope *) scope->attr)->depth;
+}
+
 struct decl {
   /* true if address is taken, reg can be used or is used: */
   unsigned addr_p : 1, reg_p : 1, asm_p : 1, used_p : 1;
@@ -6444,13 +7112,17 @@ static void create_node_scope (c2m_ctx_t c2m_ctx, node_t node) {
   ns->offset = ns->size = ns->call_arg_area_size = 0;
   node->attr = ns;
   ns->scope = curr_scope;
+  ns->depth = scope_depth (curr_scope) + 1;
+  ns->symbols_start = VARR_LENGTH (symbol_t, scope_symbols);
   curr_scope = node;
 }
 
 static void finish_scope (c2m_ctx_t c2m_ctx) {
   check_ctx_t check_ctx = c2m_ctx->check_ctx;
+  struct node_scope *ns = curr_scope->attr;
 
-  curr_scope = ((struct node_scope *) curr_scope->attr)->scope;
+  visible_pop_scope (c2m_ctx, curr_scope, ns->symbols_start);
+  curr_scope = ns->scope;
 }
 
 static void set_type_qual (c2m_ctx_t c2m_ctx, node_t r, struct type_qual *tq,
@@ -6464,6 +7136,7 @@ static void set_type_qual (c2m_ctx_t c2m_ctx, node_t r, struct type_qual *tq,
         error (c2m_ctx, POS (n), "restrict requires a pointer");
       break;
     case N_VOLATILE: tq->volatile_p = TRUE; break;
+    case N_TYPE: /* _Atomic (type-name) */
     case N_ATOMIC:
       tq->atomic_p = TRUE;
       if (tmode == TM_ARR)
@@ -6487,17 +7160,20 @@ static void check_type_duplication (c2m_ctx_t c2m_ctx, struct type *type, node_t
 
 static node_t find_def (c2m_ctx_t c2m_ctx, enum symbol_mode mode, node_t id, node_t scope,
                         node_t *aux_node) {
-  symbol_t sym;
+  VARR (shadow_t) *defs = visible_defs (c2m_ctx, mode, id, FALSE);
+  unsigned depth = scope_depth (scope);
+  shadow_t *addr;
+  size_t i;
 
-  for (;;) {
-    if (!symbol_find (c2m_ctx, mode, id, scope, &sym)) {
-      if (scope == NULL) return NULL;
-      scope = ((struct node_scope *) scope->attr)->scope;
-    } else {
-      if (aux_node) *aux_node = sym.aux_node;
-      return sym.def_node;
-    }
-  }
+  /* SCOPE is an open one.  So all definitions on the shadow stack up to its depth are
+     visible in it.  The deeper ones are usually members of the current struct: */
+  if (defs == NULL) return NULL;
+  addr = VARR_ADDR (shadow_t, defs);
+  for (i = VARR_LENGTH (shadow_t, defs); i > 0 && addr[i - 1].depth > depth; i--)
+    ;
+  if (i == 0) return NULL;
+  if (aux_node) *aux_node = addr[i - 1].aux_node;
+  return addr[i - 1].def_node;
 }
 
 static node_t process_tag (c2m_ctx_t c2m_ctx, node_t r, node_t id, node_t decl_list) {
@@ -6536,6 +7212,7 @@ static node_t process_tag (c2m_ctx_t c2m_ctx, node_t r, node_t id, node_t decl_l
 
 static void def_symbol (c2m_ctx_t c2m_ctx, enum symbol_mode mode, node_t id, node_t scope,
                         node_t def_node, node_code_t linkage) {
+  check_ctx_t check_ctx = c2m_ctx->check_ctx;
   symbol_t sym;
   struct decl_spec tab_decl_spec, decl_spec;
 
@@ -6544,7 +7221,8 @@ static void def_symbol (c2m_ctx_t c2m_ctx, enum symbol_mode mode, node_t id, nod
   assert (scope->code == N_MODULE || scope->code == N_BLOCK || scope->code == N_STRUCT
           || scope->code == N_UNION || scope->code == N_FUNC || scope->code == N_FOR);
   decl_spec = ((decl_t) def_node->attr)->decl_spec;
-  if (decl_spec.thread_local_p && !decl_spec.static_p && !decl_spec.extern_p)
+  if (decl_spec.thread_local_p && !decl_spec.static_p && !decl_spec.extern_p
+      && scope->code != N_MODULE)
     error (c2m_ctx, POS (id), "auto %s is declared as thread local", id->u.s.s);
   if (!symbol_find (c2m_ctx, mode, id, scope, &sym)) {
     symbol_insert (c2m_ctx, mode, id, scope, def_node, NULL);
@@ -6573,6 +7251,7 @@ static void def_symbol (c2m_ctx_t c2m_ctx, enum symbol_mode mode, node_t id, nod
       || (decl_spec.linkage == N_STATIC && linkage == N_EXTERN))
     warning (c2m_ctx, POS (id), "%s defined with external and internal linkage", id->u.s.s);
   VARR_PUSH (node_t, sym.defs, def_node);
+  if (reg_body_p && scope == top_scope) body_ref_p = TRUE;
   if (incomplete_type_p (c2m_ctx, tab_decl_spec.type)) symbol_def_replace (c2m_ctx, sym, def_node);
 }
 
@@ -6757,6 +7436,26 @@ static struct decl_spec check_decl_spec (c2m_ctx_t c2m_ctx, node_t r, node_t dec
       else
         error (c2m_ctx, POS (n), "double with short");
       break;
+    case N_TYPE: { /* _Atomic (type-name) */
+      struct decl_spec *decl_spec;
+
+      set_type_pos_node (type, n);
+      check (c2m_ctx, n, r);
+      decl_spec = n->attr;
+      if (type->mode != TM_BASIC || type->u.basic_type != TP_UNDEF || size != 0 || sign != 0)
+        error (c2m_ctx, POS (n), "_Atomic type with another type");
+      else if (decl_spec->type->mode != TM_ARR && decl_spec->type->mode != TM_FUNC
+               && type_qual_eq_p (&decl_spec->type->type_qual, &zero_type_qual))
+        *type = *decl_spec->type;
+      else {
+        error (c2m_ctx, POS (n), "_Atomic type of %s",
+               decl_spec->type->mode == TM_ARR    ? "array"
+               : decl_spec->type->mode == TM_FUNC ? "function"
+                                                  : "qualified type");
+        type->u.basic_type = TP_INT;
+      }
+      break;
+    }
     case N_ID: {
       node_t def = find_def (c2m_ctx, S_REGULAR, n, skip_struct_scopes (curr_scope), NULL);
       decl_t decl;
@@ -7359,8 +8058,10 @@ static node_t get_adjacent_member (node_t member, int next_p) {
   return member;
 }
 
-static int update_init_object_path (c2m_ctx_t c2m_ctx, size_t mark, struct type *value_type,
-                                    int list_p) {
+static int init_compatible_string_p (node_t n, struct type *el_type);
+
+static int update_init_object_path (c2m_ctx_t c2m_ctx, size_t mark, node_t value,
+                                    struct type *value_type, int list_p) {
   init_object_t init_object;
   struct type *el_type;
   node_t size_node;
@@ -7413,6 +8114,9 @@ static int update_init_object_path (c2m_ctx_t c2m_ctx, size_t mark, struct type
               init_object);
     if (list_p || scalar_type_p (el_type) || void_type_p (el_type)) return TRUE;
     assert (el_type->mode == TM_ARR || el_type->mode == TM_STRUCT || el_type->mode == TM_UNION);
+    /* A string initializes the whole sub-array */
+    if (el_type->mode == TM_ARR && init_compatible_string_p (value, el_type->u.arr_type->el_type))
+      return TRUE;
     if (el_type->mode != TM_ARR && value_type != NULL
         && el_type->u.tag_type == value_type->u.tag_type)
       return TRUE;
@@ -7454,7 +8158,8 @@ static int update_path_and_do (c2m_ctx_t c2m_ctx, int go_inside_p,
   struct type *el_type;
   struct expr *value_expr = value->attr;
 
-  if (!update_init_object_path (c2m_ctx, mark, value_expr == NULL ? NULL : value_expr->type,
+  if (!update_init_object_path (c2m_ctx, mark, value,
+                                value_expr == NULL ? NULL : value_expr->type,
                                 !go_inside_p || value->code == N_LIST
                                   || value->code == N_COMPOUND_LITERAL)) {
     error (c2m_ctx, pos, "excess elements in %s initializer", detail);
@@ -7523,7 +8228,8 @@ static int check_const_addr_p (c2m_ctx_t c2m_ctx, node_t r, node_t *base, mir_ll
       *deref = 0;
     } else if (e->u.lvalue_node == NULL
                || ((decl = e->u.lvalue_node->attr)->scope != top_scope
-                   && decl->decl_spec.linkage != N_IGNORE)) {
+                   && decl->decl_spec.linkage != N_IGNORE)
+               || decl->decl_spec.thread_local_p) { /* each thread has its own object */
       return FALSE;
     } else {
       *base = e->def_node;
@@ -8350,14 +9056,17 @@ static void add__func__def (c2m_ctx_t c2m_ctx, node_t func_block, str_t func_nam
   NL_PREPEND (NL_EL (func_block->u.ops, 1)->u.ops, decl);
 }
 
-/* Sort by decl scope nesting (more nested scope has a bigger UID) and decl size. */
+/* Sort by decl scope nesting (more nested scope is created later, so it has
+   a bigger number) and decl size. */
 static int decl_cmp (const void *v1, const void *v2) {
   const decl_t d1 = *(const decl_t *) v1, d2 = *(const decl_t *) v2;
   struct type *t1 = d1->decl_spec.type, *t2 = d2->decl_spec.type;
   mir_size_t s1 = raw_type_size (d1->c2m_ctx, t1), s2 = raw_type_size (d2->c2m_ctx, t2);
+  unsigned n1 = ((struct node_scope *) d1->scope->attr)->func_scope_num;
+  unsigned n2 = ((struct node_scope *) d2->scope->attr)->func_scope_num;
 
-  if (d1->scope->uid < d2->scope->uid) return -1;
-  if (d1->scope->uid > d2->scope->uid) return 1;
+  if (n1 < n2) return -1;
+  if (n1 > n2) return 1;
   if (s1 < s2) return -1;
   if (s1 > s2) return 1;
   return 0;
@@ -9190,9 +9899,11 @@ static void check (c2m_ctx_t c2m_ctx, node_t r, node_t context) {
     int builtin_call_p, alloca_p = FALSE, va_arg_p = FALSE, va_start_p = FALSE;
     int add_overflow_p = FALSE, sub_overflow_p = FALSE, mul_overflow_p = FALSE, expect_p = FALSE;
     int jcall_p = FALSE, jret_p = FALSE, prop_set_p = FALSE, prop_eq_p = FALSE, prop_ne_p = FALSE;
+    const struct atomic_builtin *atomic = NULL;
 
     op1 = NL_HEAD (r->u.ops);
     if (op1->code == N_ID) {
+      atomic = find_atomic_builtin (op1->u.s.s);
       alloca_p = str_eq_p (op1->u.s.s, ALLOCA);
       add_overflow_p = strcmp (op1->u.s.s, ADD_OVERFLOW) == 0;
       sub_overflow_p = strcmp (op1->u.s.s, SUB_OVERFLOW) == 0;
@@ -9207,7 +9918,7 @@ static void check (c2m_ctx_t c2m_ctx, node_t r, node_t context) {
     if (op1->code == N_ID && find_def (c2m_ctx, S_REGULAR, op1, curr_scope, NULL) == NULL) {
       va_arg_p = str_eq_p (op1->u.s.s, BUILTIN_VA_ARG);
       va_start_p = str_eq_p (op1->u.s.s, BUILTIN_VA_START);
-      if (!va_arg_p && !va_start_p && !alloca_p) {
+      if (!va_arg_p && !va_start_p && !alloca_p && atomic == NULL) {
         /* N_SPEC_DECL (N_SHARE (N_LIST (N_INT)), N_DECL (N_ID, N_FUNC (N_LIST)), N_IGNORE,
            N_IGNORE, N_IGNORE) */
         spec_list = new_node (c2m_ctx, N_LIST);
@@ -9230,7 +9941,7 @@ static void check (c2m_ctx_t c2m_ctx, node_t r, node_t context) {
     }
     builtin_call_p = alloca_p || va_arg_p || va_start_p || add_overflow_p || sub_overflow_p
                      || mul_overflow_p || expect_p || jcall_p || jret_p || prop_set_p || prop_eq_p
-                     || prop_ne_p;
+                     || prop_ne_p || atomic != NULL;
     if (!builtin_call_p || jcall_p) VARR_PUSH (node_t, call_nodes, r);
     arg_list = NL_NEXT (op1);
     if (builtin_call_p) {
@@ -9260,7 +9971,8 @@ static void check (c2m_ctx_t c2m_ctx, node_t r, node_t context) {
               || (jret_p && NL_LENGTH (arg_list->u.ops) != 1)
               || (va_arg_p && NL_LENGTH (arg_list->u.ops) != 2)
               || (prop_set_p && NL_LENGTH (arg_list->u.ops) != 2)
-              || ((prop_eq_p || prop_ne_p) && NL_LENGTH (arg_list->u.ops) != 2))) {
+              || ((prop_eq_p || prop_ne_p) && NL_LENGTH (arg_list->u.ops) != 2)
+              || (atomic != NULL && NL_LENGTH (arg_list->u.ops) != atomic->nargs))) {
         error (c2m_ctx, POS (op1), "wrong number of arguments in %s call", op1->u.s.s);
       } else {
         /* first argument type ??? */
@@ -9318,6 +10030,32 @@ static void check (c2m_ctx_t c2m_ctx, node_t r, node_t context) {
             error (c2m_ctx, POS (arg), "calling non-void function in %s", JCALL);
             break;
           }
+        } else if (atomic != NULL) {
+          if (atomic->kind != ATOMIC_FENCE && atomic->kind != ATOMIC_SIGNAL_FENCE) {
+            arg = NL_HEAD (arg_list->u.ops);
+            e2 = arg->attr;
+            t2 = e2->type;
+            if (t2->mode != TM_PTR
+                || (!integer_type_p (t2->u.ptr_type) && t2->u.ptr_type->mode != TM_PTR)) {
+              error (c2m_ctx, POS (arg), "1st argument of %s should be a pointer to integer or pointer",
+                     op1->u.s.s);
+            } else if (raw_type_size (c2m_ctx, t2->u.ptr_type) > sizeof (mir_long)) {
+              error (c2m_ctx, POS (arg), "unsupported operand size in %s", op1->u.s.s);
+            } else if (atomic->kind == ATOMIC_CAS_BOOL || atomic->kind == ATOMIC_CAS) {
+              res_type.u.basic_type = TP_BOOL;
+            } else if (atomic->kind != ATOMIC_STORE) {
+              res_type = *t2->u.ptr_type;
+              clear_type_qual (&res_type.type_qual);
+            }
+            if (atomic->kind == ATOMIC_CAS
+                && ((struct expr *) NL_EL (arg_list->u.ops, 1)->attr)->type->mode != TM_PTR)
+              error (c2m_ctx, POS (arg), "2nd argument of %s should be a pointer", op1->u.s.s);
+          }
+          if (atomic->order_arg >= 0) {
+            arg = NL_EL (arg_list->u.ops, atomic->order_arg);
+            if (!integer_type_p (((struct expr *) arg->attr)->type))
+              error (c2m_ctx, POS (arg), "non-integer memory order in %s call", op1->u.s.s);
+          }
         } else if (prop_set_p || prop_eq_p || prop_ne_p) {
           arg = NL_HEAD (arg_list->u.ops);
           e2 = arg->attr;
@@ -9603,7 +10341,7 @@ static void check (c2m_ctx_t c2m_ctx, node_t r, node_t context) {
         || str_eq_p (id->u.s.s, BUILTIN_VA_ARG) || strcmp (id->u.s.s, ADD_OVERFLOW) == 0
         || strcmp (id->u.s.s, SUB_OVERFLOW) == 0 || strcmp (id->u.s.s, MUL_OVERFLOW) == 0
         || strcmp (id->u.s.s, EXPECT) == 0 || strcmp (id->u.s.s, JCALL) == 0
-        || strcmp (id->u.s.s, JRET) == 0) {
+        || strcmp (id->u.s.s, JRET) == 0 || find_atomic_builtin (id->u.s.s) != NULL) {
       error (c2m_ctx, POS (id), "%s is a builtin function", id->u.s.s);
       break;
     }
@@ -9681,6 +10419,7 @@ static void check (c2m_ctx_t c2m_ctx, node_t r, node_t context) {
       error (c2m_ctx, POS (param_id), "declaration for parameter %s but no such parameter",
              param_id->u.s.s);
     }
+    if (c2m_options->stream_p) reg_body_switch (c2m_ctx, TRUE);
     add__func__def (c2m_ctx, block, id->u.s);
     check (c2m_ctx, block, r);
     /* Process all label uses: */
@@ -9704,6 +10443,7 @@ static void check (c2m_ctx_t c2m_ctx, node_t r, node_t context) {
     ns = block->attr;
     ns->size = round_size (ns->size, MAX_ALIGNMENT);
     ns->size += ns->call_arg_area_size;
+    if (c2m_options->stream_p) reg_body_switch (c2m_ctx, FALSE);
     break;
   }
   case N_TYPE: {
@@ -10039,12 +10779,9 @@ static void check (c2m_ctx_t c2m_ctx, node_t r, node_t context) {
   VARR_POP (node_t, context_stack);
 }
 
-static void do_context (c2m_ctx_t c2m_ctx, node_t r) {
+static void check_incomplete_decls (c2m_ctx_t c2m_ctx) {
   check_ctx_t check_ctx = c2m_ctx->check_ctx;
 
-  VARR_TRUNC (node_t, call_nodes, 0);
-  VARR_TRUNC (node_t, possible_incomplete_decls, 0);
-  check (c2m_ctx, r, NULL);
   for (size_t i = 0; i < VARR_LENGTH (node_t, possible_incomplete_decls); i++) {
     node_t spec_decl = VARR_GET (node_t, possible_incomplete_decls, i);
     decl_t decl = spec_decl->attr;
@@ -10053,35 +10790,89 @@ static void do_context (c2m_ctx_t c2m_ctx, node_t r) {
   }
 }
 
+static void do_context (c2m_ctx_t c2m_ctx, node_t r) {
+  check_ctx_t check_ctx = c2m_ctx->check_ctx;
+
+  VARR_TRUNC (node_t, call_nodes, 0);
+  VARR_TRUNC (node_t, possible_incomplete_decls, 0);
+  check (c2m_ctx, r, NULL);
+  check_incomplete_decls (c2m_ctx);
+}
+
+/* The streaming compilation checks MODULE by its external declarations
+   as they are parsed.  The context stack and the scope are the ones of
+   the check of the whole module. */
+static void context_start (c2m_ctx_t c2m_ctx, node_t module) {
+  check_ctx_t check_ctx = c2m_ctx->check_ctx;
+
+  VARR_TRUNC (node_t, call_nodes, 0);
+  VARR_TRUNC (node_t, possible_incomplete_decls, 0);
+  VARR_PUSH (node_t, context_stack, NULL);
+  create_node_scope (c2m_ctx, module);
+  top_scope = curr_scope;
+  VARR_PUSH (node_t, context_stack, module);
+}
+
+static void context_ext_decl (c2m_ctx_t c2m_ctx, node_t r) {
+  check (c2m_ctx, r, NL_HEAD (top_scope->u.ops));
+}
+
+static void context_end (c2m_ctx_t c2m_ctx) {
+  check_ctx_t check_ctx = c2m_ctx->check_ctx;
+
+  VARR_POP (node_t, context_stack);
+  finish_scope (c2m_ctx);
+  VARR_POP (node_t, context_stack);
+  check_incomplete_decls (c2m_ctx);
+}
+
 static void context_init (c2m_ctx_t c2m_ctx) {
   MIR_alloc_t alloc = c2m_alloc (c2m_ctx);
   check_ctx_t check_ctx;
 
-  c2m_ctx->check_ctx = check_ctx = c2sljit_calloc (c2m_ctx, sizeof (struct check_ctx));
+  if ((check_ctx = c2m_ctx->check_ctx) == NULL) { /* otherwise kept from the previous compile */
+    c2m_ctx->check_ctx = check_ctx = c2sljit_calloc (c2m_ctx, sizeof (struct check_ctx));
+    VARR_CREATE (node_t, context_stack, alloc, 64);
+    VARR_CREATE (node_t, label_uses, alloc, 0);
+    symbol_init (c2m_ctx);
+    HTAB_CREATE (case_t, case_tab, alloc, 100, case_hash, case_eq, NULL);
+    VARR_CREATE (decl_t, func_decls_for_allocation, alloc, 1024);
+    VARR_CREATE (node_t, possible_incomplete_decls, alloc, 512);
+    VARR_CREATE (symbol_t, scope_symbols, alloc, 512);
+    VARR_CREATE (symbol_t, body_symbols, alloc, 0);
+  }
   n_i1_node = new_i_node (c2m_ctx, 1, no_pos);
-  VARR_CREATE (node_t, context_stack, alloc, 64);
   check (c2m_ctx, n_i1_node, NULL);
   func_block_scope = curr_scope = NULL;
-  VARR_CREATE (node_t, label_uses, alloc, 0);
-  symbol_init (c2m_ctx);
   in_params_p = FALSE;
   curr_unnamed_anon_struct_union_member = NULL;
-  HTAB_CREATE (case_t, case_tab, alloc, 100, case_hash, case_eq, NULL);
-  VARR_CREATE (decl_t, func_decls_for_allocation, alloc, 1024);
-  VARR_CREATE (node_t, possible_incomplete_decls, alloc, 512);
+  body_record_p = body_ref_p = FALSE;
 }
 
-static void context_finish (c2m_ctx_t c2m_ctx) {
+static void context_finish (c2m_ctx_t c2m_ctx, int keep_p) {
   check_ctx_t check_ctx;
 
   if (c2m_ctx == NULL || (check_ctx = c2m_ctx->check_ctx) == NULL) return;
+  symbol_finish (c2m_ctx, keep_p);
+  if (keep_p) {
+    VARR_TRUNC (node_t, context_stack, 0);
+    VARR_TRUNC (node_t, label_uses, 0);
+    HTAB_CLEAR (case_t, case_tab);
+    VARR_TRUNC (decl_t, func_decls_for_allocation, 0);
+    VARR_TRUNC (node_t, possible_incomplete_decls, 0);
+    VARR_TRUNC (symbol_t, scope_symbols, 0);
+    VARR_TRUNC (symbol_t, body_symbols, 0);
+    return;
+  }
   if (context_stack != NULL) VARR_DESTROY (node_t, context_stack);
   if (label_uses != NULL) VARR_DESTROY (node_t, label_uses);
-  symbol_finish (c2m_ctx);
   if (case_tab != NULL) HTAB_DESTROY (case_t, case_tab);
   if (func_decls_for_allocation != NULL) VARR_DESTROY (decl_t, func_decls_for_allocation);
   if (possible_incomplete_decls != NULL) VARR_DESTROY (node_t, possible_incomplete_decls);
+  if (scope_symbols != NULL) VARR_DESTROY (symbol_t, scope_symbols);
+  if (body_symbols != NULL) VARR_DESTROY (symbol_t, body_symbols);
   free (c2m_ctx->check_ctx);
+  c2m_ctx->check_ctx = NULL;
 }
 
 /* ------------------------ Context Checker Finish ---------------------------- */
@@ -10141,24 +10932,98 @@ static op_t void_op = {.decl = NULL, .kind = OPK_NONE, .reg = 0, .imm = 0, .base
 typedef struct compiled_func {
   const char *name;
   void *code;
-  struct sljit_compiler *comp;
 } compiled_func_t;
 
 DEF_VARR (compiled_func_t);
 
 /* ---- Function slot for indirect calls (supports forward/recursive references) ---- */
 
-#define MAX_FUNC_SLOTS 256
-
-struct func_slot {
+/* Slots are allocated one by one: code refers to &code_addr. */
+typedef struct func_slot {
   const char *name;
   void *code_addr; /* filled after sljit_generate_code */
   node_t func_def; /* Opt 13: AST node for inlinable functions */
   int inlinable;   /* Opt 13: marked during prescan */
+} *func_slot_t;
+
+DEF_HTAB (func_slot_t);
+
+/* ---- Global variable table ---- */
+
+typedef struct global_var {
+  decl_t decl;
+  void *addr;                /* NULL if the global lives in an image */
+  struct data_image *image;  /* &tls or &inst when addressed from a block */
+  sljit_sw image_offset;
+} global_var_t;
+
+DEF_HTAB (global_var_t);
+
+/* ---- Label table for goto and switch support ---- */
+
+typedef struct label_entry {
+  node_t target;              /* statement node (used as key) */
+  struct sljit_label *label;  /* sljit label, set when the statement is emitted */
+  struct sljit_jump **pending; /* forward jumps waiting to be patched */
+  int n_pending, pending_cap;
+} *label_entry_t;
+
+DEF_HTAB (label_entry_t);
+
+/* ---- Data arena: string literals and global variables ---- */
+
+/* Addresses of data are baked into the code, so chunks never move.  They
+   are mapped directly: untouched pages of zero-initialized data cost
+   nothing, and read-only chunks are sealed once generation is done. */
+#define DATA_CHUNK_SIZE (64 * 1024)
+
+struct data_chunk {
+  struct data_chunk *next;
+  size_t size, used; /* including this header */
+  int sealed_p;
+};
+
+struct data_seg {
+  struct data_chunk *chunks; /* most recent first */
 };
 
+/* Pooled string literal: identical bytes share one read-only copy. */
+typedef struct {
+  const char *s;
+  size_t len;
+} pool_str_t;
+
+DEF_HTAB (pool_str_t);
+
+/* Element of a global's initializer: INIT goes OFFSET bytes into the
+   object.  MEMBER_DECL is the initialized member, used for bit-fields. */
+typedef struct {
+  mir_size_t offset;
+  decl_t member_decl;
+  struct type *el_type;
+  node_t init;
+} init_el_t;
+
+DEF_VARR (init_el_t);
+
+/* Pointer to a function or global stored in initialized data, written
+   when all of them have addresses.  The pointer lives at OFFSET in
+   IMAGE's initial block, or at address OFFSET if IMAGE is NULL. */
+typedef struct {
+  struct data_image *image;
+  sljit_sw offset;
+  node_t target; /* a function or variable definition */
+  sljit_sw addend;
+  pos_t pos;
+} data_reloc_t;
+
+DEF_VARR (data_reloc_t);
+DEF_VARR (sljit_sw);
+
 /* ---- gen_ctx: code generation state ---- */
 
+struct lir_ctx; /* Opt 18 */
+
 struct gen_ctx {
   struct sljit_compiler *compiler;  /* current function's compiler */
   VARR (compiled_func_t) *compiled_funcs;
@@ -10228,33 +11093,41 @@ struct gen_ctx {
   sljit_sw call_save_offset; /* stack offset for saving call arguments */
   int call_arg_slots;         /* number of arg slots allocated (4 or 10) */
   sljit_sw call_temp_offset; /* stack offset for temp arg eval (above func_save) */
+  int call_temp_level;        /* temp arg areas in use by enclosing calls */
   sljit_sw spill_base_offset; /* stack offset for binary_arith spill area */
   sljit_sw call_ret_base;   /* stack offset for saving call return values */
   int call_ret_slot;        /* next available return value save slot */
   int float_spill_depth;    /* current nesting depth for float binary op spills */
-  /* Persistent data buffer for string literals and global variables */
-  char *data_buf;
-  sljit_sw data_buf_size;
-  sljit_sw data_buf_used;
-  /* Global variable table */
-#define MAX_GLOBALS 256
-  struct global_var {
-    decl_t decl;
-    void *addr;
-  } globals[MAX_GLOBALS];
-  int n_globals;
-  /* Function slots for indirect calls (supports forward/recursive refs) */
-  struct func_slot func_slots[MAX_FUNC_SLOTS];
-  int n_func_slots;
-  /* Label table for goto support */
-#define MAX_LABELS 64
-  struct label_entry {
-    node_t target;            /* N_LABEL AST node (used as key) */
-    struct sljit_label *label; /* sljit label, set when N_LABEL is emitted */
-    struct sljit_jump *pending[8]; /* forward gotos waiting to be patched */
-    int n_pending;
-  } labels[MAX_LABELS];
-  int n_labels;
+  /* Data arena: string literals and const globals, initialized globals,
+     and zero-initialized globals */
+  struct data_seg rodata, data, bss;
+  HTAB (pool_str_t) * str_pool;
+  /* Static initializers: elements of the current one and pointers
+     waiting for addresses */
+  VARR (init_el_t) * init_els;
+  VARR (data_reloc_t) * data_relocs;
+  /* Global variable table, keyed by decl */
+  HTAB (global_var_t) * globals;
+  /* Globals addressed from a block fetched at run time: thread-local ones
+     (a block per thread) and, in instance mode, the others (a block per
+     instance, see c2sljit_instantiate).  Initialized globals are at
+     positive offsets from the block base, zero-initialized ones below it. */
+  struct data_image {
+    char *init;            /* initial contents of the initialized part */
+    sljit_sw size, cap;
+    sljit_sw bss_size;     /* size of the zero-initialized part */
+    pthread_key_t key;     /* the calling thread's block */
+    int key_p;
+    void *default_block;   /* instances: used by threads without an instance */
+    VARR (sljit_sw) * relocs; /* offsets of pointers into the block itself */
+  } tls, inst;
+  int instances_p;             /* compiled in instance mode */
+  sljit_s32 tls_reg, inst_reg; /* saved registers holding the blocks, or 0 */
+  /* Function slots for indirect calls (supports forward/recursive refs),
+     keyed by name */
+  HTAB (func_slot_t) * func_slots;
+  /* Labels of the current function, keyed by target node */
+  HTAB (label_entry_t) * labels;
 
   /* Opt 12: array index address cache (2-entry, per basic block) */
 #define IND_CACHE_ENTRIES 2
@@ -10293,6 +11166,17 @@ struct gen_ctx {
     op_t return_value;
     int returned;
   } inline_ctx;
+
+  /* Statement expression: its last statement gives the value */
+  struct {
+    int depth;  /* of nested statement expressions being generated */
+    node_t last;
+    op_t value;
+  } stmt_expr;
+
+  struct lir_ctx *lir; /* Opt 18: linear IR state, NULL unless opt_lir_p */
+  struct gen_ctx *next_module; /* in c2m_ctx->modules */
+  char *names; /* low-memory mode: own copy of the function names */
 };
 
 /* Accessor macros (gen_ctx is a local variable in each function, not a macro) */
@@ -10310,73 +11194,313 @@ static int sljit_type_size (struct type *type) {
 static void invalidate_reg_in_cache (c2m_ctx_t c2m_ctx, sljit_s32 reg);
 static void invalidate_float_reg_cache (c2m_ctx_t c2m_ctx);
 static void invalidate_float_reg_in_cache (c2m_ctx_t c2m_ctx, sljit_s32 freg);
-static void *find_compiled_func (c2m_ctx_t c2m_ctx, const char *name);
+static void *find_compiled_func (gen_ctx_t gen_ctx, const char *name);
 static int node_has_ops (node_code_t code);
 
-/* ---- Data buffer helpers ---- */
-
-static void *data_alloc (c2m_ctx_t c2m_ctx, sljit_sw size, int align) {
-  gen_ctx_t gen_ctx = c2m_ctx->gen_ctx;
-  /* Align */
-  sljit_sw offset = (gen_ctx->data_buf_used + align - 1) & ~(align - 1);
-  sljit_sw needed = offset + size;
-  if (needed > gen_ctx->data_buf_size) {
-    sljit_sw new_size = gen_ctx->data_buf_size == 0 ? 4096 : gen_ctx->data_buf_size * 2;
-    while (new_size < needed) new_size *= 2;
-    gen_ctx->data_buf = realloc (gen_ctx->data_buf, new_size);
-    gen_ctx->data_buf_size = new_size;
+/* ---- Data arena helpers ---- */
+
+/* Allocate SIZE zero bytes in SEG.  Objects larger than a chunk get their
+   own mapping. */
+static void *data_alloc (c2m_ctx_t c2m_ctx, struct data_seg *seg, sljit_sw size, int align) {
+  struct data_chunk *chunk = seg->chunks;
+  size_t offset = 0;
+
+  if (chunk != NULL) offset = (chunk->used + align - 1) & ~(size_t) (align - 1);
+  if (chunk == NULL || offset + size > chunk->size) {
+    size_t page = (size_t) sysconf (_SC_PAGESIZE);
+    size_t chunk_size = sizeof (struct data_chunk) + 16 + (size_t) size;
+    void *mem;
+
+    if (chunk_size < DATA_CHUNK_SIZE) chunk_size = DATA_CHUNK_SIZE;
+    chunk_size = (chunk_size + page - 1) & ~(page - 1);
+    mem = mmap (NULL, chunk_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (mem == MAP_FAILED) (*MIR_get_error_func (c2m_ctx->ctx)) (MIR_alloc_error, "no memory");
+    chunk = mem;
+    chunk->size = chunk_size;
+    chunk->used = sizeof (struct data_chunk);
+    if (seg->chunks != NULL && !seg->chunks->sealed_p && chunk_size > DATA_CHUNK_SIZE) {
+      /* A big object: keep allocating from the current chunk.  A sealed
+         chunk is read-only, so its link can not change: the new chunk
+         goes first then. */
+      chunk->next = seg->chunks->next;
+      seg->chunks->next = chunk;
+    } else {
+      chunk->next = seg->chunks;
+      seg->chunks = chunk;
+    }
+    offset = (chunk->used + align - 1) & ~(size_t) (align - 1);
   }
-  void *ptr = gen_ctx->data_buf + offset;
-  gen_ctx->data_buf_used = offset + size;
-  return ptr;
+  chunk->used = offset + size;
+  return (char *) chunk + offset;
 }
 
-/* ---- Function slot helpers ---- */
+/* Make the chunks of SEG read-only.  Later allocations use new chunks. */
+static void data_seal (struct data_seg *seg) {
+  for (struct data_chunk *chunk = seg->chunks; chunk != NULL; chunk = chunk->next)
+    if (!chunk->sealed_p) {
+      chunk->used = chunk->size;
+      chunk->sealed_p = TRUE;
+      mprotect (chunk, chunk->size, PROT_READ);
+    }
+}
 
-static struct func_slot *find_func_slot (c2m_ctx_t c2m_ctx, const char *name) {
-  gen_ctx_t gen_ctx = c2m_ctx->gen_ctx;
-  for (int i = 0; i < gen_ctx->n_func_slots; i++) {
-    if (strcmp (gen_ctx->func_slots[i].name, name) == 0) return &gen_ctx->func_slots[i];
+static void data_free (struct data_seg *seg) {
+  for (struct data_chunk *chunk = seg->chunks, *next; chunk != NULL; chunk = next) {
+    next = chunk->next;
+    munmap (chunk, chunk->size);
   }
-  return NULL;
+  seg->chunks = NULL;
 }
 
-static struct func_slot *add_func_slot (c2m_ctx_t c2m_ctx, const char *name) {
-  gen_ctx_t gen_ctx = c2m_ctx->gen_ctx;
-  if (gen_ctx->n_func_slots >= MAX_FUNC_SLOTS) return NULL;
-  struct func_slot *s = &gen_ctx->func_slots[gen_ctx->n_func_slots++];
-  s->name = name;
-  s->code_addr = NULL;
-  s->func_def = NULL;
-  s->inlinable = 0;
-  return s;
+static htab_hash_t pool_str_hash (pool_str_t str, void *arg MIR_UNUSED) {
+  return (htab_hash_t) mir_hash (str.s, str.len, 0x5e);
 }
 
-/* ---- Label table helpers for goto support ---- */
+static int pool_str_eq (pool_str_t str1, pool_str_t str2, void *arg MIR_UNUSED) {
+  return str1.len == str2.len && memcmp (str1.s, str2.s, str1.len) == 0;
+}
 
-static struct label_entry *find_label (c2m_ctx_t c2m_ctx, node_t target) {
+/* Return the read-only copy of LEN bytes S, shared by identical literals. */
+static const char *data_string (c2m_ctx_t c2m_ctx, const char *s, size_t len) {
   gen_ctx_t gen_ctx = c2m_ctx->gen_ctx;
-  for (int i = 0; i < gen_ctx->n_labels; i++)
-    if (gen_ctx->labels[i].target == target) return &gen_ctx->labels[i];
-  return NULL;
+  pool_str_t str, tab_str;
+  char *copy;
+
+  str.s = s;
+  str.len = len;
+  if (HTAB_DO (pool_str_t, gen_ctx->str_pool, str, HTAB_FIND, tab_str)) return tab_str.s;
+  copy = data_alloc (c2m_ctx, &gen_ctx->rodata, (sljit_sw) len, 1);
+  memcpy (copy, s, len);
+  str.s = copy;
+  HTAB_DO (pool_str_t, gen_ctx->str_pool, str, HTAB_INSERT, tab_str);
+  return copy;
+}
+
+/* ---- Data image helpers (thread-local and instance globals) ---- */
+
+/* Reserve SIZE bytes of IMAGE for an object with initial contents if
+   INIT_P, setting *OFFSET to their offset from the block base.  Return
+   FALSE if no thread key can be created.  Thread-local blocks die with
+   their threads, instances are owned by the embedder. */
+static int image_alloc (c2m_ctx_t c2m_ctx, struct data_image *image, sljit_sw size, int align,
+                        int init_p, sljit_sw *offset_ptr) {
+  sljit_sw offset = (image->size + align - 1) & ~(sljit_sw) (align - 1);
+
+  if (!image->key_p) {
+    if (pthread_key_create (&image->key, image == &c2m_ctx->gen_ctx->tls ? free : NULL) != 0)
+      return FALSE;
+    image->key_p = TRUE;
+  }
+  if (!init_p) { /* the zero-initialized part grows down from the base */
+    image->bss_size = (image->bss_size + size + align - 1) & ~(sljit_sw) (align - 1);
+    *offset_ptr = -image->bss_size;
+    return TRUE;
+  }
+  if (offset + size > image->cap) {
+    sljit_sw new_cap = image->cap == 0 ? 256 : image->cap * 2;
+    char *init;
+
+    while (new_cap < offset + size) new_cap *= 2;
+    if ((init = realloc (image->init, new_cap)) == NULL)
+      (*MIR_get_error_func (c2m_ctx->ctx)) (MIR_alloc_error, "no memory");
+    image->init = init;
+    memset (image->init + image->cap, 0, new_cap - image->cap);
+    image->cap = new_cap;
+  }
+  image->size = offset + size;
+  *offset_ptr = offset;
+  return TRUE;
 }
 
-static struct label_entry *get_or_add_label (c2m_ctx_t c2m_ctx, node_t target) {
-  struct label_entry *le = find_label (c2m_ctx, target);
-  if (le != NULL) return le;
-  gen_ctx_t gen_ctx = c2m_ctx->gen_ctx;
-  if (gen_ctx->n_labels >= MAX_LABELS) return NULL;
-  le = &gen_ctx->labels[gen_ctx->n_labels++];
-  le->target = target;
-  le->label = NULL;
-  le->n_pending = 0;
-  return le;
+/* Offset of the base in a block of IMAGE, keeping the base aligned. */
+static sljit_sw image_base_offset (struct data_image *image) {
+  return (image->bss_size + 15) & ~(sljit_sw) 15;
 }
 
-/* Opt 8: check if a register is currently in the cache.  Returns cache index or -1. */
-static int find_reg_in_cache (c2m_ctx_t c2m_ctx, sljit_s32 reg) {
-  gen_ctx_t gen_ctx = c2m_ctx->gen_ctx;
-  for (int i = 0; i < gen_ctx->reg_cache_count; i++) {
+/* A new block of IMAGE holding the initial values of its globals.  The
+   block is the start of the allocation, which is also what the thread
+   keys keep and what gets freed.  Only the initialized part is copied:
+   calloc gives the zero-initialized one, without touching the pages of
+   big ones.  Pointers to the block's own globals are kept as offsets in
+   the initial contents and rebased here. */
+static void *image_new_block (struct data_image *image) {
+  sljit_sw base_offset = image_base_offset (image);
+  char *block = calloc (1, base_offset + image->size == 0 ? 1 : base_offset + image->size);
+  char *base = block + base_offset;
+  sljit_sw ptr;
+
+  if (block == NULL) return NULL;
+  memcpy (base, image->init, image->size);
+  for (size_t i = 0; i < VARR_LENGTH (sljit_sw, image->relocs); i++) {
+    sljit_sw offset = VARR_GET (sljit_sw, image->relocs, i);
+    memcpy (&ptr, base + offset, sizeof (ptr));
+    ptr += (sljit_sw) base;
+    memcpy (base + offset, &ptr, sizeof (ptr));
+  }
+  return block;
+}
+
+/* Called by generated code on entry of functions using thread-local
+   globals: return the base of the calling thread's block, creating the
+   block on the thread's first use.  The generated code has no way to
+   recover from a missing block, so running out of memory aborts. */
+static void *tls_block (struct data_image *tls) {
+  char *block = pthread_getspecific (tls->key);
+
+  if (block == NULL) {
+    if ((block = image_new_block (tls)) == NULL) {
+      fprintf (stderr, "c2sljit: no memory for the thread-local globals of a new thread\n");
+      abort ();
+    }
+    pthread_setspecific (tls->key, block);
+  }
+  return block + image_base_offset (tls);
+}
+
+/* Likewise for the other globals in instance mode: return the instance
+   bound to the calling thread by c2sljit_set_instance. */
+static void *inst_block (struct data_image *inst) {
+  char *block = pthread_getspecific (inst->key);
+
+  if (block == NULL && (block = inst->default_block) == NULL) return NULL;
+  return block + image_base_offset (inst);
+}
+
+/* Return TRUE if expression tree N refers to a global living in IMAGE. */
+static int image_ref_p (c2m_ctx_t c2m_ctx, node_t n, struct data_image *image) {
+  if (n == NULL) return FALSE;
+  if (n->code == N_ID) {
+    struct expr *e = n->attr;
+    decl_t decl = e != NULL && e->u.lvalue_node != NULL ? e->u.lvalue_node->attr : NULL;
+    if (decl == NULL || decl->scope != top_scope || decl->decl_spec.type->mode == TM_FUNC)
+      return FALSE;
+    if (decl->decl_spec.thread_local_p) return image == &c2m_ctx->gen_ctx->tls;
+    return image == &c2m_ctx->gen_ctx->inst && c2m_options->instances_p;
+  }
+  if (!node_has_ops (n->code)) return FALSE;
+  for (node_t child = NL_HEAD (n->u.ops); child != NULL; child = NL_NEXT (child))
+    if (image_ref_p (c2m_ctx, child, image)) return TRUE;
+  return FALSE;
+}
+
+/* ---- Function slot helpers ---- */
+
+static htab_hash_t func_slot_hash (func_slot_t slot, void *arg MIR_UNUSED) {
+  return (htab_hash_t) mir_hash (slot->name, strlen (slot->name), 0x3c);
+}
+
+static int func_slot_eq (func_slot_t slot1, func_slot_t slot2, void *arg MIR_UNUSED) {
+  return strcmp (slot1->name, slot2->name) == 0;
+}
+
+static void func_slot_free (func_slot_t slot, void *arg) { MIR_free ((MIR_alloc_t) arg, slot); }
+
+static void func_slot_forget (func_slot_t slot, void *arg MIR_UNUSED) {
+  slot->name = NULL;
+  slot->func_def = NULL;
+}
+
+static struct func_slot *find_func_slot (c2m_ctx_t c2m_ctx, const char *name) {
+  struct func_slot key;
+  func_slot_t slot;
+
+  key.name = name;
+  return HTAB_DO (func_slot_t, c2m_ctx->gen_ctx->func_slots, &key, HTAB_FIND, slot) ? slot : NULL;
+}
+
+static struct func_slot *add_func_slot (c2m_ctx_t c2m_ctx, const char *name) {
+  gen_ctx_t gen_ctx = c2m_ctx->gen_ctx;
+  struct func_slot *s = find_func_slot (c2m_ctx, name);
+  if (s != NULL) return s;
+  s = c2sljit_calloc (c2m_ctx, sizeof (struct func_slot));
+  s->name = name;
+  HTAB_DO (func_slot_t, gen_ctx->func_slots, s, HTAB_INSERT, s);
+  return s;
+}
+
+/* Return the slot of function designator ID.  The streaming compilation
+   calls the functions which can be defined later in the module through
+   slots holding the process symbols until the definitions.  Variadic
+   process functions are still called directly. */
+static struct func_slot *get_callee_slot (c2m_ctx_t c2m_ctx, node_t id) {
+  struct func_slot *slot = find_func_slot (c2m_ctx, id->u.s.s);
+  struct expr *e = id->attr;
+  struct type *type;
+  void *addr;
+
+  if (slot != NULL || !c2m_options->stream_p || e == NULL || e->u.lvalue_node != NULL)
+    return slot;
+  type = e->type->mode == TM_PTR ? e->type->u.ptr_type : e->type;
+  if (type->mode != TM_FUNC) return NULL;
+  addr = dlsym (RTLD_DEFAULT, id->u.s.s);
+  if (addr != NULL && type->u.func_type->dots_p) return NULL;
+  slot = add_func_slot (c2m_ctx, id->u.s.s);
+  slot->code_addr = addr;
+  return slot;
+}
+
+/* ---- Global variable table helpers ---- */
+
+static htab_hash_t global_var_hash (global_var_t gv, void *arg MIR_UNUSED) {
+  return (htab_hash_t) mir_hash64 ((uint64_t) (uintptr_t) gv.decl, 0x6b);
+}
+
+static int global_var_eq (global_var_t gv1, global_var_t gv2, void *arg MIR_UNUSED) {
+  return gv1.decl == gv2.decl;
+}
+
+/* Find the global defined by DECL, returning FALSE if it is not one. */
+static int find_global (c2m_ctx_t c2m_ctx, decl_t decl, global_var_t *gv) {
+  global_var_t key;
+
+  key.decl = decl;
+  return HTAB_DO (global_var_t, c2m_ctx->gen_ctx->globals, key, HTAB_FIND, *gv);
+}
+
+/* ---- Label table helpers for goto support ---- */
+
+static htab_hash_t label_entry_hash (label_entry_t le, void *arg MIR_UNUSED) {
+  return (htab_hash_t) mir_hash64 ((uint64_t) (uintptr_t) le->target, 0x1d);
+}
+
+static int label_entry_eq (label_entry_t le1, label_entry_t le2, void *arg MIR_UNUSED) {
+  return le1->target == le2->target;
+}
+
+static void label_entry_free (label_entry_t le, void *arg) {
+  free (le->pending);
+  MIR_free ((MIR_alloc_t) arg, le);
+}
+
+static struct label_entry *get_or_add_label (c2m_ctx_t c2m_ctx, node_t target) {
+  gen_ctx_t gen_ctx = c2m_ctx->gen_ctx;
+  struct label_entry key, *le;
+
+  key.target = target;
+  if (HTAB_DO (label_entry_t, gen_ctx->labels, &key, HTAB_FIND, le)) return le;
+  le = c2sljit_calloc (c2m_ctx, sizeof (struct label_entry));
+  le->target = target;
+  HTAB_DO (label_entry_t, gen_ctx->labels, le, HTAB_INSERT, le);
+  return le;
+}
+
+/* Jump J goes to LE: set it now or when LE's label is emitted. */
+static void jump_to_label (struct label_entry *le, struct sljit_jump *j) {
+  if (le->label != NULL) {
+    sljit_set_label (j, le->label);
+    return;
+  }
+  if (le->n_pending >= le->pending_cap) {
+    le->pending_cap = le->pending_cap == 0 ? 4 : le->pending_cap * 2;
+    le->pending = realloc (le->pending, le->pending_cap * sizeof (struct sljit_jump *));
+  }
+  le->pending[le->n_pending++] = j;
+}
+
+/* Opt 8: check if a register is currently in the cache.  Returns cache index or -1. */
+static int find_reg_in_cache (c2m_ctx_t c2m_ctx, sljit_s32 reg) {
+  gen_ctx_t gen_ctx = c2m_ctx->gen_ctx;
+  for (int i = 0; i < gen_ctx->reg_cache_count; i++) {
     if (gen_ctx->reg_cache[i].reg == reg) return i;
   }
   return -1;
@@ -10388,13 +11512,25 @@ static int find_reg_in_cache (c2m_ctx_t c2m_ctx, sljit_s32 reg) {
 #define N_TEMP_REGS_DEFAULT 6
 #define N_FLOAT_TEMP_REGS 6  /* FR0..FR5 */
 
+/* Opt 8: whether get_temp_reg skips the registers holding cached values.
+   Temps are only safe for as many allocations as there are registers in
+   the cycle, so the cached ones are skipped only while enough remain. */
+#define MIN_SMART_TEMP_REGS 4
+
+static int smart_temp_regs_p (c2m_ctx_t c2m_ctx) {
+  gen_ctx_t gen_ctx = c2m_ctx->gen_ctx;
+  int limit = gen_ctx->n_scratch_regs > 0 ? gen_ctx->n_scratch_regs : N_TEMP_REGS_DEFAULT;
+
+  return (c2m_options->opt_smart_regs_p && c2m_options->opt_reg_cache_p
+          && gen_ctx->reg_cache_count > 0 && limit - gen_ctx->reg_cache_count >= MIN_SMART_TEMP_REGS);
+}
+
 static sljit_s32 get_temp_reg (c2m_ctx_t c2m_ctx) {
   gen_ctx_t gen_ctx = c2m_ctx->gen_ctx;
   int limit = gen_ctx->n_scratch_regs > 0 ? gen_ctx->n_scratch_regs : N_TEMP_REGS_DEFAULT;
 
   /* Opt 8: try to find a temp register that is NOT in the cache */
-  if (c2m_options->opt_smart_regs_p && c2m_options->opt_reg_cache_p
-      && gen_ctx->reg_cache_count > 0) {
+  if (smart_temp_regs_p (c2m_ctx)) {
     for (int i = 0; i < limit; i++) {
       int idx = (gen_ctx->next_temp_reg + i) % limit;
       sljit_s32 candidate = SLJIT_R0 + idx;
@@ -10418,6 +11554,10 @@ static sljit_s32 get_temp_reg (c2m_ctx_t c2m_ctx) {
 
 static void reset_temp_regs (c2m_ctx_t c2m_ctx) {
   gen_ctx_t gen_ctx = c2m_ctx->gen_ctx;
+  /* Opt 13: statements of an inlined body continue the caller's expression,
+     whose temps (the argument values among them) are still live.  So do
+     the statements of a statement expression. */
+  if (gen_ctx->inline_ctx.active || gen_ctx->stmt_expr.depth != 0) return;
   gen_ctx->next_temp_reg = 0;
   gen_ctx->next_float_reg = 0;
   /* Opt 15: scratch regs recycled — invalidate addr register cache */
@@ -10511,10 +11651,8 @@ static sljit_s32 find_cached_reg (c2m_ctx_t c2m_ctx, decl_t decl) {
 }
 
 static int is_global_decl (c2m_ctx_t c2m_ctx, decl_t decl) {
-  gen_ctx_t gen_ctx = c2m_ctx->gen_ctx;
-  for (int i = 0; i < gen_ctx->n_globals; i++)
-    if (gen_ctx->globals[i].decl == decl) return 1;
-  return 0;
+  global_var_t gv;
+  return find_global (c2m_ctx, decl, &gv);
 }
 
 static void cache_reg (c2m_ctx_t c2m_ctx, decl_t decl, sljit_s32 reg) {
@@ -10588,8 +11726,30 @@ static void cache_reg_dirty (c2m_ctx_t c2m_ctx, decl_t decl, sljit_s32 reg, slji
   }
 }
 
+/* Opt 9: can the store of SIZE bytes to DST be left in the register cache?
+   Dirty entries are written back to the frame slot of a whole variable, so
+   fields and globals are stored at once. */
+static int defer_store_p (c2m_ctx_t c2m_ctx, op_t dst, int size) {
+  decl_t decl = dst.decl;
+
+  return (c2m_options->opt_defer_store_p && c2m_options->opt_reg_cache_p && dst.kind == OPK_MEM
+          && dst.base == SLJIT_SP && decl != NULL && !decl->addr_p && decl->scope != NULL
+          && decl->scope->code != N_STRUCT && decl->scope->code != N_UNION
+          && !is_global_decl (c2m_ctx, decl) && size >= (int) sizeof (sljit_sw));
+}
+
 static void invalidate_cached_var (c2m_ctx_t c2m_ctx, decl_t decl) {
   gen_ctx_t gen_ctx = c2m_ctx->gen_ctx;
+  /* Opt 12: addresses cached for a promoted index var are stale once it changes */
+  for (int i = 0; i < gen_ctx->n_reg_vars; i++) {
+    if (gen_ctx->reg_vars[i].decl != decl) continue;
+    for (int ci = 0; ci < IND_CACHE_ENTRIES; ci++)
+      if (gen_ctx->ind_cache[ci].valid && gen_ctx->ind_cache[ci].index_reg == gen_ctx->reg_vars[i].reg) {
+        gen_ctx->ind_cache[ci].valid = 0;
+        gen_ctx->addr_cache[ci].reg = -1;
+      }
+    break;
+  }
   for (int i = 0; i < gen_ctx->reg_cache_count; i++) {
     if (gen_ctx->reg_cache[i].decl == decl) {
       /* Opt 9: flush dirty entry before eviction */
@@ -10998,6 +12158,12 @@ static op_t force_freg (c2m_ctx_t c2m_ctx, op_t op, int is_f32) {
 
 static op_t var_op (c2m_ctx_t c2m_ctx, decl_t decl) {
   gen_ctx_t gen_ctx = c2m_ctx->gen_ctx;
+  /* Opt 13: a parameter of an inlined body is bound to its argument slot */
+  if (gen_ctx->inline_ctx.active) {
+    for (int i = 0; i < gen_ctx->inline_ctx.n_params; i++) {
+      if (gen_ctx->inline_ctx.param_decls[i] == decl) return gen_ctx->inline_ctx.param_values[i];
+    }
+  }
   /* Check if this variable is promoted to a saved register */
   for (int i = 0; i < gen_ctx->n_reg_vars; i++) {
     if (gen_ctx->reg_vars[i].decl == decl)
@@ -11011,10 +12177,12 @@ static op_t var_op (c2m_ctx_t c2m_ctx, decl_t decl) {
                      .reg = gen_ctx->float_reg_vars[i].reg, .imm = 0, .base = 0};
   }
   /* Check global variable table */
-  for (int i = 0; i < gen_ctx->n_globals; i++) {
-    if (gen_ctx->globals[i].decl == decl)
-      return (op_t){.decl = decl, .kind = OPK_MEM, .reg = 0,
-                     .imm = (sljit_sw) gen_ctx->globals[i].addr, .base = 0};
+  global_var_t gv;
+  if (find_global (c2m_ctx, decl, &gv)) {
+    if (gv.image != NULL)
+      return (op_t){.decl = decl, .kind = OPK_MEM, .reg = 0, .imm = gv.image_offset,
+                     .base = gv.image == &gen_ctx->tls ? gen_ctx->tls_reg : gen_ctx->inst_reg};
+    return (op_t){.decl = decl, .kind = OPK_MEM, .reg = 0, .imm = (sljit_sw) gv.addr, .base = 0};
   }
   /* Local variables are at SLJIT_SP + offset (computed by context checker) */
   return (op_t){.decl = decl,
@@ -11031,18 +12199,32 @@ static int is_comparison_node (node_t n) {
          || n->code == N_GT || n->code == N_GE;
 }
 
-static sljit_s32 comparison_cond (node_code_t code) {
+static sljit_s32 comparison_cond (node_code_t code, int unsigned_p) {
   switch (code) {
   case N_EQ: return SLJIT_EQUAL;
   case N_NE: return SLJIT_NOT_EQUAL;
-  case N_LT: return SLJIT_SIG_LESS;
-  case N_LE: return SLJIT_SIG_LESS_EQUAL;
-  case N_GT: return SLJIT_SIG_GREATER;
-  case N_GE: return SLJIT_SIG_GREATER_EQUAL;
+  case N_LT: return unsigned_p ? SLJIT_LESS : SLJIT_SIG_LESS;
+  case N_LE: return unsigned_p ? SLJIT_LESS_EQUAL : SLJIT_SIG_LESS_EQUAL;
+  case N_GT: return unsigned_p ? SLJIT_GREATER : SLJIT_SIG_GREATER;
+  case N_GE: return unsigned_p ? SLJIT_GREATER_EQUAL : SLJIT_SIG_GREATER_EQUAL;
   default: return SLJIT_EQUAL;
   }
 }
 
+/* Integer comparison R is unsigned when the common type of its operands is
+   unsigned or when they are pointers. */
+static int comparison_unsigned_p (node_t r) {
+  node_t left = NL_HEAD (r->u.ops), right = NL_NEXT (left);
+  struct expr *left_e = left->attr, *right_e = right->attr;
+  struct type t;
+
+  if (left_e == NULL || right_e == NULL || left_e->type == NULL || right_e->type == NULL)
+    return FALSE;
+  if (!arithmetic_type_p (left_e->type) || !arithmetic_type_p (right_e->type)) return TRUE;
+  t = arithmetic_conversion (left_e->type, right_e->type);
+  return !signed_integer_type_p (&t);
+}
+
 static sljit_s32 invert_sljit_cond (sljit_s32 cond) {
   switch (cond) {
   case SLJIT_EQUAL: return SLJIT_NOT_EQUAL;
@@ -11141,6 +12323,55 @@ static struct magic_signed compute_signed_magic32 (int32_t d) {
   return (struct magic_signed){.magic = magic, .shift = p - 32};
 }
 
+/* Magic number for signed 64-bit division by constant d > 1: the quotient
+   is the high word of x * MAGIC (plus x when MAGIC is negative as a signed
+   word), arithmetically shifted right by SHIFT, plus one if negative. */
+static struct magic_signed compute_signed_magic64 (int64_t d) {
+  uint64_t ad = (uint64_t) d, two_p = (uint64_t) 1 << 63;
+  uint64_t anc = two_p - 1 - two_p % ad;
+  uint64_t q1 = two_p / anc, r1 = two_p - q1 * anc;
+  uint64_t q2 = two_p / ad, r2 = two_p - q2 * ad, delta;
+  int p = 63;
+  do {
+    p++;
+    q1 = 2 * q1;
+    r1 = 2 * r1;
+    if (r1 >= anc) { q1++; r1 -= anc; }
+    q2 = 2 * q2;
+    r2 = 2 * r2;
+    if (r2 >= ad) { q2++; r2 -= ad; }
+    delta = ad - r2;
+  } while (q1 < delta || (q1 == delta && r1 == 0));
+  return (struct magic_signed){.magic = (int64_t) (q2 + 1), .shift = p - 64};
+}
+
+/* Magic number for unsigned 64-bit division by constant 1 < d < 2^63
+   (Granlund-Montgomery): with l = ceil(log2(d)), t = high word of x * MAGIC,
+   the quotient is (t + ((x - t) >> 1)) >> (SHIFT = l - 1). */
+struct magic_unsigned {
+  uint64_t magic;
+  int shift;
+};
+
+static struct magic_unsigned compute_unsigned_magic64 (uint64_t d) {
+  int l = 0;
+  uint64_t r, q = 0;
+
+  while (l < 64 && ((uint64_t) 1 << l) < d) l++;
+  /* magic = floor (2^64 * (2^l - d) / d) + 1 by long division, 2^l - d < d */
+  r = ((uint64_t) 1 << l) - d;
+  for (int i = 0; i < 64; i++) {
+    int carry = (r >> 63) != 0;
+    r <<= 1;
+    q <<= 1;
+    if (carry || r >= d) {
+      r -= d;
+      q |= 1;
+    }
+  }
+  return (struct magic_unsigned){.magic = q + 1, .shift = l - 1};
+}
+
 /* Emit optimized multiply by constant.  Returns OPK_NONE if not handled. */
 static op_t emit_mul_by_constant (c2m_ctx_t c2m_ctx, sljit_s32 src_reg, sljit_sw val, int op32) {
   gen_ctx_t gen_ctx = c2m_ctx->gen_ctx;
@@ -11251,12 +12482,47 @@ static op_t emit_signed_mod_pow2 (c2m_ctx_t c2m_ctx, sljit_s32 src_reg, int log2
   return (op_t){.decl = NULL, .kind = OPK_REG, .reg = dst, .imm = 0, .base = 0};
 }
 
+/* Emit signed 64-bit div by constant > 1 using the high word of a widening
+   multiplication (SLJIT_LMUL_SW clobbers R0 and R1, so SRC_REG must be
+   another register).  Returns OPK_NONE if not handled. */
+static op_t emit_signed_div_magic64 (c2m_ctx_t c2m_ctx, sljit_s32 src_reg, sljit_sw divisor) {
+  gen_ctx_t gen_ctx = c2m_ctx->gen_ctx;
+  struct magic_signed m;
+  sljit_s32 dst, tmp;
+
+  if (src_reg == SLJIT_R0 || src_reg == SLJIT_R1)
+    return (op_t){.decl = NULL, .kind = OPK_NONE, .reg = 0, .imm = 0, .base = 0};
+  m = compute_signed_magic64 ((int64_t) divisor);
+  sljit_emit_op1 (compiler, SLJIT_MOV, SLJIT_R0, 0, src_reg, 0);
+  sljit_emit_op1 (compiler, SLJIT_MOV, SLJIT_R1, 0, SLJIT_IMM, (sljit_sw) m.magic);
+  sljit_emit_op0 (compiler, SLJIT_LMUL_SW);
+  invalidate_reg_in_cache (c2m_ctx, SLJIT_R0);
+  invalidate_reg_in_cache (c2m_ctx, SLJIT_R1);
+  dst = get_temp_reg (c2m_ctx);
+  tmp = get_temp_reg (c2m_ctx);
+  if (dst == src_reg || tmp == src_reg || tmp == SLJIT_R1) {
+    dst = SLJIT_R1;
+    tmp = SLJIT_R0;
+  }
+  if (dst != SLJIT_R1) sljit_emit_op1 (compiler, SLJIT_MOV, dst, 0, SLJIT_R1, 0);
+  if (m.magic < 0) sljit_emit_op2 (compiler, SLJIT_ADD, dst, 0, dst, 0, src_reg, 0);
+  if (m.shift > 0) sljit_emit_op2 (compiler, SLJIT_ASHR, dst, 0, dst, 0, SLJIT_IMM, m.shift);
+  /* Round toward zero: add 1 to negative quotients */
+  sljit_emit_op2 (compiler, SLJIT_LSHR, tmp, 0, dst, 0, SLJIT_IMM, 63);
+  sljit_emit_op2 (compiler, SLJIT_ADD, dst, 0, dst, 0, tmp, 0);
+  return (op_t){.decl = NULL, .kind = OPK_REG, .reg = dst, .imm = 0, .base = 0};
+}
+
 /* Emit signed div by non-power-of-2 constant using magic number multiplication.
    For 32-bit: sign-extend to 64, multiply by magic (64-bit), ASHR by 32+S.
    Returns OPK_NONE if not handled (e.g. 64-bit operands). */
 static op_t emit_signed_div_magic (c2m_ctx_t c2m_ctx, sljit_s32 src_reg, sljit_sw divisor, int op32) {
   gen_ctx_t gen_ctx = c2m_ctx->gen_ctx;
-  if (!op32) return (op_t){.decl = NULL, .kind = OPK_NONE, .reg = 0, .imm = 0, .base = 0};
+  /* The sequences below need 64-bit registers; 32-bit targets keep the
+     hardware division */
+  if (sizeof (sljit_sw) < 8)
+    return (op_t){.decl = NULL, .kind = OPK_NONE, .reg = 0, .imm = 0, .base = 0};
+  if (!op32) return emit_signed_div_magic64 (c2m_ctx, src_reg, divisor);
   struct magic_signed m = compute_signed_magic32 ((int32_t) divisor);
   sljit_s32 dst = get_temp_reg (c2m_ctx);
   sljit_s32 tmp = get_temp_reg (c2m_ctx);
@@ -11266,9 +12532,10 @@ static op_t emit_signed_div_magic (c2m_ctx_t c2m_ctx, sljit_s32 src_reg, sljit_s
   sljit_emit_op2 (compiler, SLJIT_MUL, dst, 0, dst, 0, SLJIT_IMM, m.magic);
   /* Arithmetic right-shift by 32+shift to get quotient */
   sljit_emit_op2 (compiler, SLJIT_ASHR, dst, 0, dst, 0, SLJIT_IMM, 32 + m.shift);
-  /* Sign correction: add 1 if quotient is negative (round toward zero) */
+  /* Sign correction: add 1 if quotient is negative (round toward zero); the
+     32-bit add leaves the upper half as the hardware division would */
   sljit_emit_op2 (compiler, SLJIT_LSHR, tmp, 0, dst, 0, SLJIT_IMM, 63);
-  sljit_emit_op2 (compiler, SLJIT_ADD, dst, 0, dst, 0, tmp, 0);
+  sljit_emit_op2 (compiler, SLJIT_ADD | op32, dst, 0, dst, 0, tmp, 0);
   return (op_t){.decl = NULL, .kind = OPK_REG, .reg = dst, .imm = 0, .base = 0};
 }
 
@@ -11285,6 +12552,55 @@ static op_t emit_signed_mod_magic (c2m_ctx_t c2m_ctx, sljit_s32 src_reg, sljit_s
   return (op_t){.decl = NULL, .kind = OPK_REG, .reg = dst, .imm = 0, .base = 0};
 }
 
+/* Emit unsigned div by constant > 1 using the high word of a widening
+   multiplication (SLJIT_LMUL_UW clobbers R0 and R1, so SRC_REG must be
+   another register).  A 32-bit operand is zero-extended, so the high word
+   of x * ceil (2^64 / d) is exact; a 64-bit one uses compute_unsigned_magic64.
+   Returns OPK_NONE if not handled. */
+static op_t emit_unsigned_div_magic (c2m_ctx_t c2m_ctx, sljit_s32 src_reg, sljit_sw divisor,
+                                     int op32) {
+  gen_ctx_t gen_ctx = c2m_ctx->gen_ctx;
+  uint64_t d = op32 ? (uint32_t) divisor : (uint64_t) divisor;
+  struct magic_unsigned mu;
+  sljit_s32 dst;
+
+  if (sizeof (sljit_sw) < 8 || src_reg == SLJIT_R0 || src_reg == SLJIT_R1 || d <= 1
+      || (d >> 63) != 0)
+    return (op_t){.decl = NULL, .kind = OPK_NONE, .reg = 0, .imm = 0, .base = 0};
+  mu = op32 ? (struct magic_unsigned){.magic = UINT64_MAX / d + 1, .shift = 0}
+            : compute_unsigned_magic64 (d);
+  sljit_emit_op1 (compiler, op32 ? SLJIT_MOV_U32 : SLJIT_MOV, SLJIT_R0, 0, src_reg, 0);
+  sljit_emit_op1 (compiler, SLJIT_MOV, SLJIT_R1, 0, SLJIT_IMM, (sljit_sw) mu.magic);
+  sljit_emit_op0 (compiler, SLJIT_LMUL_UW);
+  invalidate_reg_in_cache (c2m_ctx, SLJIT_R0);
+  invalidate_reg_in_cache (c2m_ctx, SLJIT_R1);
+  dst = SLJIT_R1;
+  if (!op32) { /* q = (t + ((x - t) >> 1)) >> shift with t in R1 */
+    dst = SLJIT_R0;
+    sljit_emit_op2 (compiler, SLJIT_SUB, dst, 0, src_reg, 0, SLJIT_R1, 0);
+    sljit_emit_op2 (compiler, SLJIT_LSHR, dst, 0, dst, 0, SLJIT_IMM, 1);
+    sljit_emit_op2 (compiler, SLJIT_ADD, dst, 0, dst, 0, SLJIT_R1, 0);
+    if (mu.shift > 0) sljit_emit_op2 (compiler, SLJIT_LSHR, dst, 0, dst, 0, SLJIT_IMM, mu.shift);
+  }
+  sljit_s32 res = get_temp_reg (c2m_ctx);
+  if (res == src_reg) return (op_t){.decl = NULL, .kind = OPK_REG, .reg = dst, .imm = 0, .base = 0};
+  if (res != dst) sljit_emit_op1 (compiler, SLJIT_MOV, res, 0, dst, 0);
+  return (op_t){.decl = NULL, .kind = OPK_REG, .reg = res, .imm = 0, .base = 0};
+}
+
+/* Emit unsigned mod by constant: mod = x - (x/d)*d using magic div. */
+static op_t emit_unsigned_mod_magic (c2m_ctx_t c2m_ctx, sljit_s32 src_reg, sljit_sw divisor,
+                                     int op32) {
+  op_t q = emit_unsigned_div_magic (c2m_ctx, src_reg, divisor, op32);
+  if (q.kind == OPK_NONE) return q;
+  gen_ctx_t gen_ctx = c2m_ctx->gen_ctx;
+  sljit_s32 dst = get_temp_reg (c2m_ctx);
+  if (dst == src_reg) dst = q.reg;
+  sljit_emit_op2 (compiler, SLJIT_MUL | op32, dst, 0, q.reg, 0, SLJIT_IMM, divisor);
+  sljit_emit_op2 (compiler, SLJIT_SUB | op32, dst, 0, src_reg, 0, dst, 0);
+  return (op_t){.decl = NULL, .kind = OPK_REG, .reg = dst, .imm = 0, .base = 0};
+}
+
 /* ---- Helper: set up R0/R1 for DIV/MOD avoiding clobber conflicts ---- */
 static void setup_divmod_regs (c2m_ctx_t c2m_ctx, sljit_s32 l_reg, sljit_s32 rv_reg) {
   gen_ctx_t gen_ctx = c2m_ctx->gen_ctx;
@@ -11374,6 +12690,98 @@ static int expr_has_call (node_t n) {
   return 0;
 }
 
+/* Depth of call nesting in an expression subtree: a call whose arguments
+   contain calls is one deeper than the deepest of them. */
+static int call_nesting (node_t n) {
+  int depth = 0;
+
+  if (n == NULL || n->code == N_IGNORE || !node_has_ops (n->code)) return 0;
+  for (node_t c = NL_HEAD (n->u.ops); c != NULL; c = NL_NEXT (c)) {
+    int d = call_nesting (c);
+    if (d > depth) depth = d;
+  }
+  return n->code == N_CALL ? depth + 1 : depth;
+}
+
+/* Check if an expression subtree contains an integer division or remainder,
+   which use R0 and R1 as fixed operands. */
+static int expr_has_divmod (node_t n) {
+  if (n == NULL || n->code == N_IGNORE) return 0;
+  if (n->code == N_DIV || n->code == N_MOD || n->code == N_DIV_ASSIGN || n->code == N_MOD_ASSIGN) {
+    struct expr *e = n->attr;
+    if (e == NULL || e->type == NULL || !is_float_type (e->type)) return 1;
+  }
+  if (!node_has_ops (n->code)) return 0;
+  for (node_t c = NL_HEAD (n->u.ops); c != NULL; c = NL_NEXT (c))
+    if (expr_has_divmod (c)) return 1;
+  return 0;
+}
+
+/* Estimate of temp register allocations for an integer expression: one per
+   node, two more for the offset and address of an indexing, and all of them
+   for a call.  Stops counting at LIMIT. */
+static int expr_int_allocs (node_t n, int limit) {
+  int allocs;
+
+  if (n == NULL || n->code == N_IGNORE) return 0;
+  if (n->code == N_CALL) return limit;
+  allocs = n->code == N_IND ? 3 : 1;
+  if (!node_has_ops (n->code)) return allocs;
+  for (node_t c = NL_HEAD (n->u.ops); c != NULL && allocs < limit; c = NL_NEXT (c))
+    allocs += expr_int_allocs (c, limit - allocs);
+  return allocs;
+}
+
+/* Return how many temps get_temp_reg can hand out before it returns REG
+   again.  Opt 8 skips the registers holding cached values. */
+static int temp_reg_room (c2m_ctx_t c2m_ctx, sljit_s32 reg) {
+  gen_ctx_t gen_ctx = c2m_ctx->gen_ctx;
+  int limit = gen_ctx->n_scratch_regs > 0 ? gen_ctx->n_scratch_regs : N_TEMP_REGS_DEFAULT;
+  int smart_p = smart_temp_regs_p (c2m_ctx);
+  int room = 0;
+
+  for (int i = 0; i < limit; i++) {
+    sljit_s32 candidate = SLJIT_R0 + (gen_ctx->next_temp_reg + i) % limit;
+    if (candidate == reg) break;
+    if (!smart_p || find_reg_in_cache (c2m_ctx, candidate) < 0) room++;
+  }
+  return room;
+}
+
+/* Save left operand *L of a binary operation to the spill area when it is in
+   a scratch register that evaluating RIGHT can clobber: by a function call,
+   by a division when *L is in R0 or R1, or by using up all temps so that the
+   round-robin allocation comes back to *L.  The slot stays reserved until the
+   caller releases it after RIGHT; returns TRUE if it was taken. */
+static int protect_left_operand (c2m_ctx_t c2m_ctx, op_t *l, node_t right) {
+  gen_ctx_t gen_ctx = c2m_ctx->gen_ctx;
+  int limit = gen_ctx->n_scratch_regs > 0 ? gen_ctx->n_scratch_regs : N_TEMP_REGS_DEFAULT;
+  sljit_sw spill_off;
+
+  if (l->kind != OPK_REG || l->reg < SLJIT_R0 || l->reg >= SLJIT_R0 + limit
+      || (expr_int_allocs (right, limit) <= temp_reg_room (c2m_ctx, l->reg)
+          && ((l->reg != SLJIT_R0 && l->reg != SLJIT_R1) || !expr_has_divmod (right))))
+    return FALSE;
+  spill_off = gen_ctx->spill_base_offset
+              + gen_ctx->float_spill_depth++ * (sljit_sw) sizeof (sljit_sw);
+  sljit_emit_op1 (compiler, SLJIT_MOV, SLJIT_MEM1 (SLJIT_SP), spill_off, l->reg, 0);
+  *l = (op_t){.decl = NULL, .kind = OPK_MEM, .reg = 0, .imm = spill_off, .base = SLJIT_SP};
+  return TRUE;
+}
+
+static sljit_s32 get_temp_reg_avoiding (c2m_ctx_t c2m_ctx, const sljit_s32 *avoid, int n);
+
+/* Reload the left operand spilled by protect_left_operand into a temp
+   which does not hold the right operand RV. */
+static op_t reload_left_operand (c2m_ctx_t c2m_ctx, op_t l, op_t rv) {
+  gen_ctx_t gen_ctx = c2m_ctx->gen_ctx;
+  sljit_s32 avoid = rv.kind == OPK_REG ? rv.reg : rv.kind == OPK_MEM ? rv.base : 0;
+  sljit_s32 reg = get_temp_reg_avoiding (c2m_ctx, &avoid, 1);
+
+  sljit_emit_op1 (compiler, SLJIT_MOV, reg, 0, SLJIT_MEM1 (l.base), l.imm);
+  return (op_t){.decl = NULL, .kind = OPK_REG, .reg = reg, .imm = 0, .base = 0};
+}
+
 /* Opt 14: estimate max float temp register allocations for an expression.
    Returns an upper bound on get_float_temp_reg calls gen() would make. */
 static int expr_float_allocs (node_t n) {
@@ -11477,9 +12885,11 @@ static struct sljit_jump *emit_cond_branch (c2m_ctx_t c2m_ctx, node_t cond_node,
     }
     int cmp32 = (left_e && left_e->type && sljit_type_size (left_e->type) == 4) ? SLJIT_32 : 0;
     op_t l = gen (c2m_ctx, left, TRUE);
+    int spill_p = protect_left_operand (c2m_ctx, &l, right);
     op_t rv = gen_right_operand (c2m_ctx, right);
-    l = force_reg (c2m_ctx, l);
-    sljit_s32 cond = comparison_cond (cond_node->code);
+    l = spill_p ? reload_left_operand (c2m_ctx, l, rv) : force_reg (c2m_ctx, l);
+    gen_ctx->float_spill_depth -= spill_p;
+    sljit_s32 cond = comparison_cond (cond_node->code, comparison_unsigned_p (cond_node));
     if (invert) cond = invert_sljit_cond (cond);
     if (rv.kind == OPK_MEM)
       return sljit_emit_cmp (compiler, cond | cmp32, l.reg, 0, SLJIT_MEM1 (rv.base), rv.imm);
@@ -11492,86 +12902,542 @@ static struct sljit_jump *emit_cond_branch (c2m_ctx_t c2m_ctx, node_t cond_node,
                           0);
 }
 
-/* ---- Expression code generation ---- */
+/* ---- Atomics: GCC builtins and C11 _Atomic objects ---- */
 
-static op_t gen (c2m_ctx_t c2m_ctx, node_t r, int val_p) {
+/* Read-modify-write sequences are sljit_emit_atomic_load/store retry loops
+   (locked cmpxchg on x86, LL/SC or CAS elsewhere).  Memory ordering uses the
+   trailing fence mapping: a barrier before release stores and after acquire
+   loads, plus one after sequentially consistent stores.  x86 keeps plain
+   loads and stores ordered and its locked instructions are full barriers. */
+#if defined(SLJIT_CONFIG_X86) && SLJIT_CONFIG_X86
+#define ATOMIC_TSO_P 1
+#else
+#define ATOMIC_TSO_P 0
+#endif
+
+static void emit_atomic_release (c2m_ctx_t c2m_ctx, int order) {
   gen_ctx_t gen_ctx = c2m_ctx->gen_ctx;
-  struct expr *e = r->attr;
-  struct type *type = e != NULL ? e->type : NULL;
+  if (!ATOMIC_TSO_P && (order == ATOMIC_RELEASE || order == ATOMIC_ACQ_REL || order == ATOMIC_SEQ_CST))
+    sljit_emit_op0 (compiler, SLJIT_MEMORY_BARRIER);
+}
 
-  switch (r->code) {
-  /* ---- Integer constants ---- */
-  case N_I:
-    return (op_t){.decl = NULL, .kind = OPK_IMM, .reg = 0, .imm = (sljit_sw) r->u.l, .base = 0};
-  case N_L:
-    return (op_t){.decl = NULL, .kind = OPK_IMM, .reg = 0, .imm = (sljit_sw) r->u.l, .base = 0};
-  case N_LL:
-    return (op_t){.decl = NULL, .kind = OPK_IMM, .reg = 0, .imm = (sljit_sw) r->u.ll, .base = 0};
-  case N_U:
-  case N_UL:
-    return (op_t){
-      .decl = NULL, .kind = OPK_IMM, .reg = 0, .imm = (sljit_sw) r->u.ul, .base = 0};
-  case N_ULL:
-    return (op_t){
-      .decl = NULL, .kind = OPK_IMM, .reg = 0, .imm = (sljit_sw) r->u.ull, .base = 0};
-  case N_CH:
-    return (op_t){
-      .decl = NULL, .kind = OPK_IMM, .reg = 0, .imm = (sljit_sw) r->u.ch, .base = 0};
+static void emit_atomic_acquire (c2m_ctx_t c2m_ctx, int order) {
+  gen_ctx_t gen_ctx = c2m_ctx->gen_ctx;
+  if (!ATOMIC_TSO_P && order != ATOMIC_RELAXED && order != ATOMIC_RELEASE)
+    sljit_emit_op0 (compiler, SLJIT_MEMORY_BARRIER);
+}
 
-  /* ---- String literal ---- */
-  case N_STR: {
-    /* Copy string bytes into persistent data buffer, return address as immediate */
-    size_t len = r->u.s.len;
-    char *dst = data_alloc (c2m_ctx, len, 1);
-    memcpy (dst, r->u.s.s, len);
-    return (op_t){.decl = NULL, .kind = OPK_IMM, .reg = 0, .imm = (sljit_sw) dst, .base = 0};
-  }
+static int atomic_order (const struct atomic_builtin *ab, node_t args) {
+  struct expr *e;
 
-  /* ---- Float/double constants ---- */
-  case N_F: {
-    sljit_s32 freg = get_float_temp_reg (c2m_ctx);
-    sljit_emit_fset32 (compiler, freg, r->u.f);
-    return (op_t){.decl = NULL, .kind = OPK_FREG, .reg = freg, .imm = 0, .base = 0};
-  }
-  case N_D: {
-    sljit_s32 freg = get_float_temp_reg (c2m_ctx);
-    sljit_emit_fset64 (compiler, freg, r->u.d);
-    return (op_t){.decl = NULL, .kind = OPK_FREG, .reg = freg, .imm = 0, .base = 0};
-  }
-  case N_LD: {
-    /* Treat long double as double (sljit only supports F32/F64) */
-    sljit_s32 freg = get_float_temp_reg (c2m_ctx);
-    sljit_emit_fset64 (compiler, freg, (double) r->u.ld);
-    return (op_t){.decl = NULL, .kind = OPK_FREG, .reg = freg, .imm = 0, .base = 0};
+  if (ab->order_arg < 0) return ab->order;
+  e = NL_EL (args->u.ops, ab->order_arg)->attr;
+  if (!e->const_p || e->c.i_val < ATOMIC_RELAXED || e->c.i_val > ATOMIC_SEQ_CST)
+    return ATOMIC_SEQ_CST; /* non-constant orders are treated as the strongest one */
+  return (int) e->c.i_val;
+}
+
+static sljit_s32 atomic_mov_op (int size) {
+  return size == 1 ? SLJIT_MOV_U8 : size == 2 ? SLJIT_MOV_U16 : size == 4 ? SLJIT_MOV_U32 : SLJIT_MOV;
+}
+
+/* Sign or zero extend the SIZE-byte value in REG to the full register. */
+static void atomic_extend (c2m_ctx_t c2m_ctx, sljit_s32 reg, int size, int signed_p) {
+  gen_ctx_t gen_ctx = c2m_ctx->gen_ctx;
+  sljit_s32 op;
+
+  if (size >= (int) sizeof (sljit_sw)) return;
+  op = size == 1 ? (signed_p ? SLJIT_MOV_S8 : SLJIT_MOV_U8)
+       : size == 2 ? (signed_p ? SLJIT_MOV_S16 : SLJIT_MOV_U16)
+                   : (signed_p ? SLJIT_MOV_S32 : SLJIT_MOV_U32);
+  sljit_emit_op1 (compiler, op, reg, 0, reg, 0);
+}
+
+/* Scratch register other than the N registers in AVOID. */
+static sljit_s32 get_temp_reg_avoiding (c2m_ctx_t c2m_ctx, const sljit_s32 *avoid, int n) {
+  for (;;) {
+    sljit_s32 reg = get_temp_reg (c2m_ctx);
+    int i;
+
+    for (i = 0; i < n && avoid[i] != reg; i++)
+      ;
+    if (i == n) return reg;
   }
+}
 
-  /* ---- Identifier reference ---- */
-  case N_ID: {
-    decl_t decl = e->u.lvalue_node != NULL ? e->u.lvalue_node->attr : NULL;
-    if (decl == NULL) {
-      /* Function reference — for now return as immediate (address) */
-      return void_op;
+/* Register holding the address of memory operand LV. */
+static sljit_s32 atomic_addr_reg (c2m_ctx_t c2m_ctx, op_t lv) {
+  gen_ctx_t gen_ctx = c2m_ctx->gen_ctx;
+  sljit_s32 reg;
+
+  if (lv.kind == OPK_REG) return lv.reg;
+  if (lv.base != 0 && lv.base != SLJIT_SP && lv.imm == 0) return lv.base;
+  reg = get_temp_reg (c2m_ctx);
+  if (lv.base == 0)
+    sljit_emit_op1 (compiler, SLJIT_MOV, reg, 0, SLJIT_IMM, lv.imm);
+  else if (lv.base == SLJIT_SP)
+    sljit_get_local_base (compiler, reg, 0, lv.imm);
+  else
+    sljit_emit_op2 (compiler, SLJIT_ADD, reg, 0, lv.base, 0, SLJIT_IMM, lv.imm);
+  return reg;
+}
+
+/* Can evaluating R reuse the scratch registers holding earlier results? */
+static int atomic_operand_clobbers_p (node_t r) {
+  struct expr *e = r->attr;
+
+  return e == NULL || !e->const_p;
+}
+
+/* Evaluate the N expressions starting with ARG into registers (or
+   immediates).  The scratch registers are recycled, so a result is
+   spilled while the following operands are evaluated and reloaded into a
+   register distinct from the other operands afterwards. */
+static void gen_atomic_operands (c2m_ctx_t c2m_ctx, node_t arg, int n, op_t *ops) {
+  gen_ctx_t gen_ctx = c2m_ctx->gen_ctx;
+  int spilled[3] = {FALSE, FALSE, FALSE}, n_spilled = 0;
+
+  assert (n <= 3);
+  for (int i = 0; i < n; i++, arg = NL_NEXT (arg)) {
+    int clobber_p = FALSE;
+
+    ops[i] = gen (c2m_ctx, arg, TRUE);
+    if (ops[i].kind != OPK_IMM) ops[i] = force_reg (c2m_ctx, ops[i]);
+    for (node_t next = NL_NEXT (arg); i + 1 < n && next != NULL && !clobber_p;
+         next = NL_NEXT (next))
+      clobber_p = atomic_operand_clobbers_p (next);
+    if (clobber_p && ops[i].kind == OPK_REG) {
+      sljit_sw off = gen_ctx->spill_base_offset
+                     + gen_ctx->float_spill_depth++ * (sljit_sw) sizeof (sljit_sw);
+      sljit_emit_op1 (compiler, SLJIT_MOV, SLJIT_MEM1 (SLJIT_SP), off, ops[i].reg, 0);
+      ops[i] = (op_t){.decl = NULL, .kind = OPK_MEM, .reg = 0, .imm = off, .base = SLJIT_SP};
+      spilled[i] = TRUE;
+      n_spilled++;
+    }
+  }
+  for (int i = 0; i < n; i++) {
+    sljit_s32 avoid[3];
+    int n_avoid = 0;
+
+    if (!spilled[i]) continue;
+    for (int j = 0; j < n; j++)
+      if (j != i && ops[j].kind == OPK_REG) avoid[n_avoid++] = ops[j].reg;
+    ops[i].reg = get_temp_reg_avoiding (c2m_ctx, avoid, n_avoid);
+    sljit_emit_op1 (compiler, SLJIT_MOV, ops[i].reg, 0, SLJIT_MEM1 (SLJIT_SP), ops[i].imm);
+    ops[i] = (op_t){.decl = NULL, .kind = OPK_REG, .reg = ops[i].reg, .imm = 0, .base = 0};
+  }
+  gen_ctx->float_spill_depth -= n_spilled;
+}
+
+/* Retry loop replacing the SIZE-byte value OLD at ADDR by OLD CODE VAL, or by
+   VAL for N_IGNORE.  Returns the register holding the new value when NEW_P,
+   otherwise the old one, extended to the full register. */
+static sljit_s32 emit_atomic_rmw (c2m_ctx_t c2m_ctx, sljit_s32 addr, op_t val, node_code_t code,
+                                  int size, int signed_p, int order, int new_p) {
+  gen_ctx_t gen_ctx = c2m_ctx->gen_ctx;
+  sljit_s32 mov_op = atomic_mov_op (size), op32 = size == 4 ? SLJIT_32 : 0, op;
+  sljit_s32 avoid[3] = {addr, val.kind == OPK_REG ? val.reg : addr, 0};
+  sljit_s32 old = get_temp_reg_avoiding (c2m_ctx, avoid, 2), new_val, v;
+  sljit_sw vw = val.kind == OPK_IMM ? val.imm : 0;
+  struct sljit_label *retry;
+
+  avoid[2] = old;
+  new_val = get_temp_reg_avoiding (c2m_ctx, avoid, 3);
+  v = val.kind == OPK_IMM ? SLJIT_IMM : val.reg;
+  emit_atomic_release (c2m_ctx, order);
+  retry = sljit_emit_label (compiler);
+  sljit_emit_atomic_load (compiler, mov_op, old, addr);
+  switch (code) {
+  case N_IGNORE: sljit_emit_op1 (compiler, SLJIT_MOV, new_val, 0, v, vw); break;
+  case N_RSH:
+    if (signed_p && size < 4) { /* shift the sign extended value */
+      sljit_emit_op1 (compiler, size == 1 ? SLJIT_MOV_S8 : SLJIT_MOV_S16, new_val, 0, old, 0);
+      sljit_emit_op2 (compiler, SLJIT_ASHR, new_val, 0, new_val, 0, v, vw);
+    } else {
+      sljit_emit_op2 (compiler, (signed_p ? SLJIT_ASHR : SLJIT_LSHR) | op32, new_val, 0, old, 0, v,
+                      vw);
     }
-    /* Opt 13: check inline parameter binding */
-    if (gen_ctx->inline_ctx.active) {
-      for (int i = 0; i < gen_ctx->inline_ctx.n_params; i++) {
-        if (gen_ctx->inline_ctx.param_decls[i] == decl)
-          return gen_ctx->inline_ctx.param_values[i];
-      }
+    break;
+  default:
+    op = code == N_ADD   ? SLJIT_ADD
+         : code == N_SUB ? SLJIT_SUB
+         : code == N_AND ? SLJIT_AND
+         : code == N_OR  ? SLJIT_OR
+         : code == N_XOR ? SLJIT_XOR
+         : code == N_MUL ? SLJIT_MUL
+                         : SLJIT_SHL;
+    sljit_emit_op2 (compiler, op | op32, new_val, 0, old, 0, v, vw);
+    break;
+  }
+  sljit_emit_atomic_store (compiler, mov_op | SLJIT_SET_ATOMIC_STORED, new_val, addr, old);
+  sljit_set_label (sljit_emit_jump (compiler, SLJIT_ATOMIC_NOT_STORED), retry);
+  emit_atomic_acquire (c2m_ctx, order);
+  if (new_p) old = new_val;
+  atomic_extend (c2m_ctx, old, size, signed_p);
+  return old;
+}
+
+/* Compare and swap of the SIZE-byte value at ADDR with EXPECTED and DESIRED.
+   Returns the register holding 1 on success and 0 otherwise; *OLD_REG gets
+   the zero extended previous value. */
+static sljit_s32 emit_atomic_cas (c2m_ctx_t c2m_ctx, sljit_s32 addr, sljit_s32 expected,
+                                  sljit_s32 desired, int size, int order, sljit_s32 *old_reg) {
+  gen_ctx_t gen_ctx = c2m_ctx->gen_ctx;
+  sljit_s32 mov_op = atomic_mov_op (size);
+  sljit_s32 avoid[4] = {addr, expected, desired, 0};
+  sljit_s32 old = get_temp_reg_avoiding (c2m_ctx, avoid, 3), res;
+  struct sljit_label *retry;
+  struct sljit_jump *fail, *done;
+
+  avoid[3] = old;
+  res = get_temp_reg_avoiding (c2m_ctx, avoid, 4);
+  if (size < (int) sizeof (sljit_sw)) { /* compare with the zero extended memory value */
+    sljit_emit_op1 (compiler, mov_op, res, 0, expected, 0);
+    expected = res;
+  }
+  emit_atomic_release (c2m_ctx, order);
+  retry = sljit_emit_label (compiler);
+  sljit_emit_atomic_load (compiler, mov_op, old, addr);
+  fail = sljit_emit_cmp (compiler, SLJIT_NOT_EQUAL, old, 0, expected, 0);
+  sljit_emit_atomic_store (compiler, mov_op | SLJIT_SET_ATOMIC_STORED, desired, addr, old);
+  sljit_set_label (sljit_emit_jump (compiler, SLJIT_ATOMIC_NOT_STORED), retry);
+  sljit_emit_op1 (compiler, SLJIT_MOV, res, 0, SLJIT_IMM, 1);
+  done = sljit_emit_jump (compiler, SLJIT_JUMP);
+  sljit_set_label (fail, sljit_emit_label (compiler));
+  sljit_emit_op1 (compiler, SLJIT_MOV, res, 0, SLJIT_IMM, 0);
+  sljit_set_label (done, sljit_emit_label (compiler));
+  emit_atomic_acquire (c2m_ctx, order);
+  *old_reg = old;
+  return res;
+}
+
+static op_t gen_atomic_builtin (c2m_ctx_t c2m_ctx, node_t r, const struct atomic_builtin *ab) {
+  gen_ctx_t gen_ctx = c2m_ctx->gen_ctx;
+  node_t args = NL_NEXT (NL_HEAD (r->u.ops)), arg = NL_HEAD (args->u.ops);
+  int order = atomic_order (ab, args), size, signed_p, n_ops;
+  struct type *type;
+  sljit_s32 addr, res, old;
+  op_t ops[3];
+
+  if (ab->kind == ATOMIC_SIGNAL_FENCE) return void_op; /* the generator does not reorder memory accesses */
+  if (ab->kind == ATOMIC_FENCE) {
+    if (order == ATOMIC_SEQ_CST || (!ATOMIC_TSO_P && order != ATOMIC_RELAXED))
+      sljit_emit_op0 (compiler, SLJIT_MEMORY_BARRIER);
+    return void_op;
+  }
+  type = ((struct expr *) arg->attr)->type->u.ptr_type;
+  size = sljit_type_size (type);
+  signed_p = signed_integer_type_p (type);
+  n_ops = ab->kind == ATOMIC_LOAD || ab->nargs == 1                  ? 1
+          : ab->kind >= ATOMIC_CAS && ab->kind <= ATOMIC_CAS_BOOL ? 3
+                                                                  : 2;
+  gen_atomic_operands (c2m_ctx, arg, n_ops, ops);
+  addr = ops[0].reg;
+  switch (ab->kind) {
+  case ATOMIC_LOAD:
+    res = get_temp_reg_avoiding (c2m_ctx, &addr, 1);
+    sljit_emit_op1 (compiler, atomic_mov_op (size), res, 0, SLJIT_MEM1 (addr), 0);
+    emit_atomic_acquire (c2m_ctx, order);
+    atomic_extend (c2m_ctx, res, size, signed_p);
+    break;
+  case ATOMIC_STORE:
+    if (ab->nargs == 1) ops[1] = (op_t){.decl = NULL, .kind = OPK_IMM, .reg = 0, .imm = 0, .base = 0};
+    emit_atomic_release (c2m_ctx, order);
+    sljit_emit_op1 (compiler, atomic_mov_op (size), SLJIT_MEM1 (addr), 0,
+                    ops[1].kind == OPK_IMM ? SLJIT_IMM : ops[1].reg, ops[1].imm);
+    if (order == ATOMIC_SEQ_CST) sljit_emit_op0 (compiler, SLJIT_MEMORY_BARRIER);
+    return void_op;
+  case ATOMIC_XCHG:
+    res = emit_atomic_rmw (c2m_ctx, addr, ops[1], N_IGNORE, size, signed_p, order, FALSE);
+    break;
+  case ATOMIC_FETCH_OP:
+  case ATOMIC_OP_FETCH:
+    res = emit_atomic_rmw (c2m_ctx, addr, ops[1], ab->op, size, signed_p, order,
+                           ab->kind == ATOMIC_OP_FETCH);
+    break;
+  default: {
+    sljit_s32 expected, avoid[3] = {addr, 0, 0};
+
+    for (int i = 1; i < 3; i++) {
+      if (ops[i].kind == OPK_IMM) ops[i] = force_reg (c2m_ctx, ops[i]);
+      avoid[i] = ops[i].reg;
+    }
+    if (ab->kind != ATOMIC_CAS) {
+      expected = ops[1].reg;
+    } else { /* the expected value is in memory */
+      expected = get_temp_reg_avoiding (c2m_ctx, avoid, 3);
+      sljit_emit_op1 (compiler, atomic_mov_op (size), expected, 0, SLJIT_MEM1 (ops[1].reg), 0);
+    }
+    res = emit_atomic_cas (c2m_ctx, addr, expected, ops[2].reg, size, order, &old);
+    if (ab->kind == ATOMIC_CAS) {
+      struct sljit_jump *ok = sljit_emit_cmp (compiler, SLJIT_NOT_EQUAL, res, 0, SLJIT_IMM, 0);
+      sljit_emit_op1 (compiler, atomic_mov_op (size), SLJIT_MEM1 (ops[1].reg), 0, old, 0);
+      sljit_set_label (ok, sljit_emit_label (compiler));
+    } else if (ab->kind == ATOMIC_CAS_VAL) {
+      atomic_extend (c2m_ctx, old, size, signed_p);
+      res = old;
     }
-    op_t v = var_op (c2m_ctx, decl);
-    /* Array decay: return address of the first element (arrays aren't loadable values) */
-    if (val_p && decl->decl_spec.type != NULL && decl->decl_spec.type->mode == TM_ARR) {
-      sljit_s32 dst = get_temp_reg (c2m_ctx);
-      if (v.kind == OPK_MEM && v.base == 0) {
-        sljit_emit_op1 (compiler, SLJIT_MOV, dst, 0, SLJIT_IMM, v.imm);
-      } else if (v.kind == OPK_MEM) {
-        sljit_get_local_base (compiler, dst, 0, v.imm);
+    break;
+  }
+  }
+  return (op_t){.decl = NULL, .kind = OPK_REG, .reg = res, .imm = 0, .base = 0};
+}
+
+/* Is R an _Atomic integer or pointer lvalue in memory other threads can
+   reach?  Locals whose address is never taken keep the usual code. */
+static int shared_atomic_lvalue_p (c2m_ctx_t c2m_ctx, node_t r) {
+  struct expr *e = r->attr;
+  decl_t decl;
+
+  if (e == NULL || e->type == NULL || !e->type->type_qual.atomic_p
+      || (!integer_type_p (e->type) && e->type->mode != TM_PTR)
+      || raw_type_size (c2m_ctx, e->type) > sizeof (sljit_sw))
+    return FALSE;
+  for (;;) {
+    switch (r->code) {
+    case N_IND:
+    case N_DEREF:
+    case N_DEREF_FIELD: return TRUE;
+    case N_FIELD: r = NL_HEAD (r->u.ops); break;
+    case N_ID:
+      e = r->attr;
+      decl = e->u.lvalue_node != NULL ? e->u.lvalue_node->attr : NULL;
+      return decl != NULL && (decl->addr_p || is_global_decl (c2m_ctx, decl));
+    default: return FALSE;
+    }
+  }
+}
+
+static op_t gen_atomic_load (c2m_ctx_t c2m_ctx, node_t r) {
+  gen_ctx_t gen_ctx = c2m_ctx->gen_ctx;
+  struct type *type = ((struct expr *) r->attr)->type;
+  sljit_s32 addr = atomic_addr_reg (c2m_ctx, gen (c2m_ctx, r, FALSE));
+  sljit_s32 res = get_temp_reg_avoiding (c2m_ctx, &addr, 1);
+  int size = sljit_type_size (type);
+
+  sljit_emit_op1 (compiler, atomic_mov_op (size), res, 0, SLJIT_MEM1 (addr), 0);
+  emit_atomic_acquire (c2m_ctx, ATOMIC_SEQ_CST);
+  atomic_extend (c2m_ctx, res, size, signed_integer_type_p (type));
+  return (op_t){.decl = NULL, .kind = OPK_REG, .reg = res, .imm = 0, .base = 0};
+}
+
+/* Can assignment R to a shared _Atomic object become one atomic operation? */
+static int atomic_update_p (node_t r) {
+  node_t right;
+
+  switch (r->code) {
+  case N_INC:
+  case N_DEC:
+  case N_POST_INC:
+  case N_POST_DEC: return TRUE;
+  case N_ASSIGN:
+  case N_ADD_ASSIGN:
+  case N_SUB_ASSIGN:
+  case N_MUL_ASSIGN:
+  case N_AND_ASSIGN:
+  case N_OR_ASSIGN:
+  case N_XOR_ASSIGN:
+  case N_LSH_ASSIGN:
+  case N_RSH_ASSIGN:
+    right = NL_NEXT (NL_HEAD (r->u.ops));
+    return (integer_type_p (((struct expr *) right->attr)->type)
+            || ((struct expr *) right->attr)->type->mode == TM_PTR);
+  default: return FALSE; /* division and floating point operands */
+  }
+}
+
+/* Sequentially consistent store or read-modify-write for assignment R. */
+static op_t gen_atomic_update (c2m_ctx_t c2m_ctx, node_t r) {
+  gen_ctx_t gen_ctx = c2m_ctx->gen_ctx;
+  node_t left = NL_HEAD (r->u.ops), right = NL_NEXT (left);
+  struct type *type = ((struct expr *) left->attr)->type;
+  int size = sljit_type_size (type), signed_p = signed_integer_type_p (type), new_p = TRUE;
+  sljit_sw step = type->mode == TM_PTR ? (sljit_sw) type_size (c2m_ctx, type->u.ptr_type) : 1;
+  sljit_s32 addr = atomic_addr_reg (c2m_ctx, gen (c2m_ctx, left, FALSE)), res;
+  node_code_t code;
+  op_t val;
+
+  switch (r->code) {
+  case N_INC:
+  case N_DEC:
+  case N_POST_INC:
+  case N_POST_DEC:
+    code = r->code == N_INC || r->code == N_POST_INC ? N_ADD : N_SUB;
+    new_p = r->code == N_INC || r->code == N_DEC;
+    val = (op_t){.decl = NULL, .kind = OPK_IMM, .reg = 0, .imm = step, .base = 0};
+    break;
+  default:
+    code = r->code == N_ASSIGN       ? N_IGNORE
+           : r->code == N_ADD_ASSIGN ? N_ADD
+           : r->code == N_SUB_ASSIGN ? N_SUB
+           : r->code == N_MUL_ASSIGN ? N_MUL
+           : r->code == N_AND_ASSIGN ? N_AND
+           : r->code == N_OR_ASSIGN  ? N_OR
+           : r->code == N_XOR_ASSIGN ? N_XOR
+           : r->code == N_LSH_ASSIGN ? N_LSH
+                                     : N_RSH;
+    if (atomic_operand_clobbers_p (right)) { /* keep the address in the spill area */
+      sljit_sw off = gen_ctx->spill_base_offset
+                     + gen_ctx->float_spill_depth * (sljit_sw) sizeof (sljit_sw);
+      gen_ctx->float_spill_depth++;
+      sljit_emit_op1 (compiler, SLJIT_MOV, SLJIT_MEM1 (SLJIT_SP), off, addr, 0);
+      val = gen (c2m_ctx, right, TRUE);
+      if (val.kind != OPK_IMM) val = force_reg (c2m_ctx, val);
+      addr = get_temp_reg_avoiding (c2m_ctx, &val.reg, val.kind == OPK_REG);
+      sljit_emit_op1 (compiler, SLJIT_MOV, addr, 0, SLJIT_MEM1 (SLJIT_SP), off);
+      gen_ctx->float_spill_depth--;
+    } else {
+      val = gen (c2m_ctx, right, TRUE);
+      if (val.kind != OPK_IMM) val = force_reg (c2m_ctx, val);
+    }
+    if (step != 1 && (code == N_ADD || code == N_SUB)) {
+      if (val.kind == OPK_IMM) {
+        val.imm *= step;
       } else {
-        return v;
+        sljit_s32 scaled = get_temp_reg_avoiding (c2m_ctx, &addr, 1);
+        sljit_emit_op2 (compiler, SLJIT_MUL, scaled, 0, val.reg, 0, SLJIT_IMM, step);
+        val.reg = scaled;
+      }
+    }
+    break;
+  }
+  if (code != N_IGNORE) {
+    res = emit_atomic_rmw (c2m_ctx, addr, val, code, size, signed_p, ATOMIC_SEQ_CST, new_p);
+  } else {
+    sljit_s32 avoid[2] = {addr, val.kind == OPK_REG ? val.reg : addr};
+    res = get_temp_reg_avoiding (c2m_ctx, avoid, 2);
+    sljit_emit_op1 (compiler, SLJIT_MOV, res, 0, val.kind == OPK_IMM ? SLJIT_IMM : val.reg, val.imm);
+    atomic_extend (c2m_ctx, res, size, signed_p);
+    sljit_emit_op1 (compiler, atomic_mov_op (size), SLJIT_MEM1 (addr), 0, res, 0);
+    sljit_emit_op0 (compiler, SLJIT_MEMORY_BARRIER);
+  }
+  return (op_t){.decl = NULL, .kind = OPK_REG, .reg = res, .imm = 0, .base = 0};
+}
+
+/* ---- Expression code generation ---- */
+
+/* Address of memory operand V in a register, e.g. for an array operand
+   decaying to a pointer to its first element. */
+static op_t mem_addr_op (c2m_ctx_t c2m_ctx, op_t v) {
+  gen_ctx_t gen_ctx = c2m_ctx->gen_ctx;
+  sljit_s32 dst;
+
+  if (v.kind != OPK_MEM) return v;
+  dst = get_temp_reg (c2m_ctx);
+  if (v.base == 0) {
+    sljit_emit_op1 (compiler, SLJIT_MOV, dst, 0, SLJIT_IMM, v.imm);
+  } else if (v.base == SLJIT_SP) {
+    sljit_get_local_base (compiler, dst, 0, v.imm);
+  } else { /* pointer or thread-local block in a register */
+    sljit_emit_op2 (compiler, SLJIT_ADD, dst, 0, v.base, 0, SLJIT_IMM, v.imm);
+  }
+  return (op_t){.decl = NULL, .kind = OPK_REG, .reg = dst, .imm = 0, .base = 0};
+}
+
+/* Value of integer constant expression E in the width of its type. */
+static sljit_sw const_expr_imm (struct expr *e) {
+  struct type *type = e->type;
+  int signed_p = signed_integer_type_p (type);
+  sljit_sw v = signed_p ? (sljit_sw) e->c.i_val : (sljit_sw) e->c.u_val;
+
+  if (type->mode == TM_BASIC && type->u.basic_type == TP_BOOL) return e->c.u_val != 0;
+  switch (sljit_type_size (type)) {
+  case 1: return signed_p ? (sljit_sw) (int8_t) v : (sljit_sw) (uint8_t) v;
+  case 2: return signed_p ? (sljit_sw) (int16_t) v : (sljit_sw) (uint16_t) v;
+  case 4: return signed_p ? (sljit_sw) (int32_t) v : (sljit_sw) (uint32_t) v;
+  default: return v;
+  }
+}
+
+static op_t gen (c2m_ctx_t c2m_ctx, node_t r, int val_p) {
+  gen_ctx_t gen_ctx = c2m_ctx->gen_ctx;
+  struct expr *e = r->attr;
+  struct type *type = e != NULL ? e->type : NULL;
+
+  /* Integer constant expressions (negated literals, sizeof, enum arithmetic)
+     are immediates rather than 32-bit operations whose upper half would be
+     wrong when the value is widened */
+  if (val_p && e != NULL && e->const_p && type != NULL && integer_type_p (type))
+    return (op_t){.decl = NULL, .kind = OPK_IMM, .reg = 0, .imm = const_expr_imm (e), .base = 0};
+
+  /* C11 _Atomic objects: sequentially consistent accesses */
+  if (type != NULL && type->type_qual.atomic_p) {
+    switch (r->code) {
+    case N_ID:
+    case N_DEREF:
+    case N_IND:
+    case N_FIELD:
+    case N_DEREF_FIELD:
+      if (val_p && shared_atomic_lvalue_p (c2m_ctx, r)) return gen_atomic_load (c2m_ctx, r);
+      break;
+    default:
+      if (atomic_update_p (r) && shared_atomic_lvalue_p (c2m_ctx, NL_HEAD (r->u.ops)))
+        return gen_atomic_update (c2m_ctx, r);
+      break;
+    }
+  }
+  switch (r->code) {
+  /* ---- Integer constants ---- */
+  case N_I:
+    return (op_t){.decl = NULL, .kind = OPK_IMM, .reg = 0, .imm = (sljit_sw) r->u.l, .base = 0};
+  case N_L:
+    return (op_t){.decl = NULL, .kind = OPK_IMM, .reg = 0, .imm = (sljit_sw) r->u.l, .base = 0};
+  case N_LL:
+    return (op_t){.decl = NULL, .kind = OPK_IMM, .reg = 0, .imm = (sljit_sw) r->u.ll, .base = 0};
+  case N_U:
+  case N_UL:
+    return (op_t){
+      .decl = NULL, .kind = OPK_IMM, .reg = 0, .imm = (sljit_sw) r->u.ul, .base = 0};
+  case N_ULL:
+    return (op_t){
+      .decl = NULL, .kind = OPK_IMM, .reg = 0, .imm = (sljit_sw) r->u.ull, .base = 0};
+  case N_CH:
+    return (op_t){
+      .decl = NULL, .kind = OPK_IMM, .reg = 0, .imm = (sljit_sw) r->u.ch, .base = 0};
+
+  /* ---- String literal ---- */
+  case N_STR: {
+    /* Pooled read-only copy of the string bytes, address as immediate */
+    const char *dst = data_string (c2m_ctx, r->u.s.s, r->u.s.len);
+    return (op_t){.decl = NULL, .kind = OPK_IMM, .reg = 0, .imm = (sljit_sw) dst, .base = 0};
+  }
+
+  /* ---- Float/double constants ---- */
+  case N_F: {
+    sljit_s32 freg = get_float_temp_reg (c2m_ctx);
+    sljit_emit_fset32 (compiler, freg, r->u.f);
+    return (op_t){.decl = NULL, .kind = OPK_FREG, .reg = freg, .imm = 0, .base = 0};
+  }
+  case N_D: {
+    sljit_s32 freg = get_float_temp_reg (c2m_ctx);
+    sljit_emit_fset64 (compiler, freg, r->u.d);
+    return (op_t){.decl = NULL, .kind = OPK_FREG, .reg = freg, .imm = 0, .base = 0};
+  }
+  case N_LD: {
+    /* Treat long double as double (sljit only supports F32/F64) */
+    sljit_s32 freg = get_float_temp_reg (c2m_ctx);
+    sljit_emit_fset64 (compiler, freg, (double) r->u.ld);
+    return (op_t){.decl = NULL, .kind = OPK_FREG, .reg = freg, .imm = 0, .base = 0};
+  }
+
+  /* ---- Identifier reference ---- */
+  case N_ID: {
+    decl_t decl = e->u.lvalue_node != NULL ? e->u.lvalue_node->attr : NULL;
+    if (decl == NULL) {
+      /* Function reference — for now return as immediate (address) */
+      return void_op;
+    }
+    /* Opt 13: an inline parameter is read from its argument slot, never from the reg cache */
+    if (gen_ctx->inline_ctx.active) {
+      for (int i = 0; i < gen_ctx->inline_ctx.n_params; i++) {
+        if (gen_ctx->inline_ctx.param_decls[i] == decl)
+          return gen_ctx->inline_ctx.param_values[i];
       }
-      return (op_t){.decl = NULL, .kind = OPK_REG, .reg = dst, .imm = 0, .base = 0};
     }
+    op_t v = var_op (c2m_ctx, decl);
+    /* Array decay: return address of the first element (arrays aren't loadable values) */
+    if (val_p && decl->decl_spec.type != NULL && decl->decl_spec.type->mode == TM_ARR)
+      return mem_addr_op (c2m_ctx, v);
     if (val_p && type != NULL) {
       /* Float variable */
       if (is_float_type (type)) {
@@ -11709,6 +13575,7 @@ static op_t gen (c2m_ctx_t c2m_ctx, node_t r, int val_p) {
       return (op_t){.decl = NULL, .kind = OPK_FREG, .reg = dst, .imm = 0, .base = 0};
     }
     int op32 = (type != NULL && sljit_type_size (type) == 4) ? SLJIT_32 : 0;
+    int unsigned_p = type != NULL && integer_type_p (type) && !signed_integer_type_p (type);
     sljit_s32 saved_dest = gen_ctx->assign_dest;
     gen_ctx->assign_dest = 0;  /* clear so inner ops don't see it */
     node_t left = NL_HEAD (r->u.ops);
@@ -11722,17 +13589,9 @@ static op_t gen (c2m_ctx_t c2m_ctx, node_t r, int val_p) {
     if (r->code == N_DIV || r->code == N_MOD) gen_ctx->assign_dest = SLJIT_R0;
     op_t l = gen (c2m_ctx, left, TRUE);
     if (r->code == N_DIV || r->code == N_MOD) gen_ctx->assign_dest = 0;
-    /* If left is in a scratch register and right contains function calls,
-       save left to stack to prevent clobbering by the call. */
-    if (l.kind == OPK_REG && l.decl == NULL && expr_has_call (right)) {
-      sljit_sw spill_off = gen_ctx->spill_base_offset
-        + gen_ctx->float_spill_depth * (sljit_sw) sizeof (sljit_sw);
-      gen_ctx->float_spill_depth++;
-      sljit_emit_op1 (compiler, SLJIT_MOV, SLJIT_MEM1 (SLJIT_SP), spill_off, l.reg, 0);
-      l = (op_t){.decl = NULL, .kind = OPK_MEM, .reg = 0,
-                  .imm = spill_off, .base = SLJIT_SP};
-      gen_ctx->float_spill_depth--;
-    }
+    /* If left is in a scratch register that right can clobber, save left
+       to stack. */
+    int spill_p = protect_left_operand (c2m_ctx, &l, right);
     sljit_s32 sljit_op;
     int use_mem_opt = (r->code == N_ADD || r->code == N_SUB || r->code == N_MUL
                        || r->code == N_AND || r->code == N_OR || r->code == N_XOR
@@ -11741,7 +13600,8 @@ static op_t gen (c2m_ctx_t c2m_ctx, node_t r, int val_p) {
     op_t rv = use_mem_opt ? gen_right_operand (c2m_ctx, right)
                           : force_reg (c2m_ctx, gen (c2m_ctx, right, TRUE));
     /* Defer force_reg of left until after right is evaluated (protects against call clobber) */
-    l = force_reg (c2m_ctx, l);
+    l = spill_p ? reload_left_operand (c2m_ctx, l, rv) : force_reg (c2m_ctx, l);
+    gen_ctx->float_spill_depth -= spill_p;
     /* Pointer arithmetic: scale integer operand by element size */
     if ((r->code == N_ADD || r->code == N_SUB) && type != NULL && type->mode == TM_PTR) {
       mir_size_t elem_size
@@ -11815,13 +13675,14 @@ static op_t gen (c2m_ctx_t c2m_ctx, node_t r, int val_p) {
     case N_OR: sljit_op = SLJIT_OR; break;
     case N_XOR: sljit_op = SLJIT_XOR; break;
     case N_LSH: sljit_op = SLJIT_SHL; break;
-    case N_RSH: sljit_op = SLJIT_ASHR; break;
+    case N_RSH: sljit_op = unsigned_p ? SLJIT_LSHR : SLJIT_ASHR; break;
     case N_DIV: {
-      /* Opt 6: strength reduce constant signed divide */
+      /* Opt 6: strength reduce constant divide */
       if (c2m_options->opt_strength_reduce_p && rv.kind == OPK_IMM) {
         int log2 = is_power_of_2 (rv.imm);
         if (log2 >= 0) {
-          op_t sr = emit_signed_div_pow2 (c2m_ctx, l.reg, log2, op32);
+          op_t sr = unsigned_p ? emit_unsigned_div_pow2 (c2m_ctx, l.reg, log2, op32)
+                               : emit_signed_div_pow2 (c2m_ctx, l.reg, log2, op32);
           if (saved_dest && sr.reg != saved_dest) {
             sljit_emit_op1 (compiler, SLJIT_MOV, saved_dest, 0, sr.reg, 0);
             sr.reg = saved_dest;
@@ -11829,9 +13690,12 @@ static op_t gen (c2m_ctx_t c2m_ctx, node_t r, int val_p) {
           return sr;
         }
       }
-      /* Opt 6b: magic number division for non-power-of-2 constants */
-      if (c2m_options->opt_magic_div_p && rv.kind == OPK_IMM && rv.imm > 1) {
-        op_t sr = emit_signed_div_magic (c2m_ctx, l.reg, rv.imm, op32);
+      /* Opt 6b: magic number division for non-power-of-2 constants.  The AST
+         generator emits x / c and x % c separately; only local value
+         numbering in the linear IR (-O2) makes them share one sequence. */
+      if (c2m_options->opt_magic_div_p && rv.kind == OPK_IMM && (unsigned_p || rv.imm > 1)) {
+        op_t sr = unsigned_p ? emit_unsigned_div_magic (c2m_ctx, l.reg, rv.imm, op32)
+                             : emit_signed_div_magic (c2m_ctx, l.reg, rv.imm, op32);
         if (sr.kind != OPK_NONE) {
           if (saved_dest && sr.reg != saved_dest) {
             sljit_emit_op1 (compiler, SLJIT_MOV, saved_dest, 0, sr.reg, 0);
@@ -11847,16 +13711,17 @@ static op_t gen (c2m_ctx_t c2m_ctx, node_t r, int val_p) {
         op_t rvf = force_reg (c2m_ctx, rv);
         setup_divmod_regs (c2m_ctx, l.reg, rvf.reg);
       }
-      sljit_emit_op0 (compiler, SLJIT_DIV_SW | op32);
+      sljit_emit_op0 (compiler, (unsigned_p ? SLJIT_DIV_UW : SLJIT_DIV_SW) | op32);
       sljit_emit_op1 (compiler, SLJIT_MOV, dst, 0, SLJIT_R0, 0);
       return (op_t){.decl = NULL, .kind = OPK_REG, .reg = dst, .imm = 0, .base = 0};
     }
     case N_MOD: {
-      /* Opt 6: strength reduce constant signed modulo */
+      /* Opt 6: strength reduce constant modulo */
       if (c2m_options->opt_strength_reduce_p && rv.kind == OPK_IMM) {
         int log2 = is_power_of_2 (rv.imm);
         if (log2 >= 0) {
-          op_t sr = emit_signed_mod_pow2 (c2m_ctx, l.reg, log2, op32);
+          op_t sr = unsigned_p ? emit_unsigned_mod_pow2 (c2m_ctx, l.reg, log2, op32)
+                               : emit_signed_mod_pow2 (c2m_ctx, l.reg, log2, op32);
           if (saved_dest && sr.reg != saved_dest) {
             sljit_emit_op1 (compiler, SLJIT_MOV, saved_dest, 0, sr.reg, 0);
             sr.reg = saved_dest;
@@ -11865,8 +13730,9 @@ static op_t gen (c2m_ctx_t c2m_ctx, node_t r, int val_p) {
         }
       }
       /* Opt 6b: magic number modulo for non-power-of-2 constants */
-      if (c2m_options->opt_magic_div_p && rv.kind == OPK_IMM && rv.imm > 1) {
-        op_t sr = emit_signed_mod_magic (c2m_ctx, l.reg, rv.imm, op32);
+      if (c2m_options->opt_magic_div_p && rv.kind == OPK_IMM && (unsigned_p || rv.imm > 1)) {
+        op_t sr = unsigned_p ? emit_unsigned_mod_magic (c2m_ctx, l.reg, rv.imm, op32)
+                             : emit_signed_mod_magic (c2m_ctx, l.reg, rv.imm, op32);
         if (sr.kind != OPK_NONE) {
           if (saved_dest && sr.reg != saved_dest) {
             sljit_emit_op1 (compiler, SLJIT_MOV, saved_dest, 0, sr.reg, 0);
@@ -11882,7 +13748,7 @@ static op_t gen (c2m_ctx_t c2m_ctx, node_t r, int val_p) {
         op_t rvf = force_reg (c2m_ctx, rv);
         setup_divmod_regs (c2m_ctx, l.reg, rvf.reg);
       }
-      sljit_emit_op0 (compiler, SLJIT_DIVMOD_SW | op32);
+      sljit_emit_op0 (compiler, (unsigned_p ? SLJIT_DIVMOD_UW : SLJIT_DIVMOD_SW) | op32);
       sljit_emit_op1 (compiler, SLJIT_MOV, dst, 0, SLJIT_R1, 0);
       return (op_t){.decl = NULL, .kind = OPK_REG, .reg = dst, .imm = 0, .base = 0};
     }
@@ -11952,10 +13818,12 @@ static op_t gen (c2m_ctx_t c2m_ctx, node_t r, int val_p) {
     /* Integer comparison path */
     int cmp32 = (left_e && left_e->type && sljit_type_size (left_e->type) == 4) ? SLJIT_32 : 0;
     op_t l = gen (c2m_ctx, left, TRUE);
+    int spill_p = protect_left_operand (c2m_ctx, &l, right);
     op_t rv = gen_right_operand (c2m_ctx, right);
-    l = force_reg (c2m_ctx, l);
+    l = spill_p ? reload_left_operand (c2m_ctx, l, rv) : force_reg (c2m_ctx, l);
+    gen_ctx->float_spill_depth -= spill_p;
     sljit_s32 dst = get_temp_reg (c2m_ctx);
-    sljit_s32 cond = comparison_cond (r->code);
+    sljit_s32 cond = comparison_cond (r->code, comparison_unsigned_p (r));
 
     /* Each condition requires the matching SLJIT_SET_* flag */
     sljit_s32 set_flag;
@@ -11966,6 +13834,10 @@ static op_t gen (c2m_ctx_t c2m_ctx, node_t r, int val_p) {
     case SLJIT_SIG_GREATER_EQUAL: set_flag = SLJIT_SET_SIG_LESS; break;
     case SLJIT_SIG_GREATER:
     case SLJIT_SIG_LESS_EQUAL: set_flag = SLJIT_SET_SIG_GREATER; break;
+    case SLJIT_LESS:
+    case SLJIT_GREATER_EQUAL: set_flag = SLJIT_SET_LESS; break;
+    case SLJIT_GREATER:
+    case SLJIT_LESS_EQUAL: set_flag = SLJIT_SET_GREATER; break;
     default: set_flag = SLJIT_SET_Z; break;
     }
     if (rv.kind == OPK_MEM) {
@@ -12029,10 +13901,7 @@ static op_t gen (c2m_ctx_t c2m_ctx, node_t r, int val_p) {
     op_t val = gen (c2m_ctx, right, TRUE);
     if (dst_op.kind == OPK_MEM) {
       /* Opt 9: defer store for word-sized non-addr_p stack vars */
-      if (c2m_options->opt_defer_store_p && c2m_options->opt_reg_cache_p
-          && dst_op.decl != NULL && !dst_op.decl->addr_p
-          && !is_global_decl (c2m_ctx, dst_op.decl)
-          && size >= (int) sizeof (sljit_sw)) {
+      if (defer_store_p (c2m_ctx, dst_op, size)) {
         op_t vr = force_reg (c2m_ctx, val);
         invalidate_cached_var (c2m_ctx, dst_op.decl);
         cache_reg_dirty (c2m_ctx, dst_op.decl, vr.reg, dst_op.imm);
@@ -12155,6 +14024,16 @@ static op_t gen (c2m_ctx_t c2m_ctx, node_t r, int val_p) {
     }
 
     int op32 = (type != NULL && sljit_type_size (type) == 4) ? SLJIT_32 : 0;
+    int unsigned_p = type != NULL && integer_type_p (type) && !signed_integer_type_p (type);
+    int limit = gen_ctx->n_scratch_regs > 0 ? gen_ctx->n_scratch_regs : N_TEMP_REGS_DEFAULT;
+    /* A right operand which can use up the temps (a call, say) is evaluated
+       first: the lvalue address and its current value would not survive it */
+    int right_first_p = expr_int_allocs (right, limit) >= limit, spill_p = FALSE;
+    op_t rv = void_op;
+    if (right_first_p) {
+      rv = gen (c2m_ctx, right, TRUE);
+      spill_p = protect_left_operand (c2m_ctx, &rv, left);
+    }
     op_t dst_op = gen (c2m_ctx, left, FALSE);  /* lvalue */
     invalidate_cached_var (c2m_ctx, dst_op.decl);
     int size = type != NULL ? sljit_type_size (type) : (int) sizeof (sljit_sw);
@@ -12165,8 +14044,12 @@ static op_t gen (c2m_ctx_t c2m_ctx, node_t r, int val_p) {
                       || r->code == N_OR_ASSIGN || r->code == N_XOR_ASSIGN
                       || r->code == N_LSH_ASSIGN || r->code == N_RSH_ASSIGN
                       || r->code == N_DIV_ASSIGN || r->code == N_MOD_ASSIGN);
-    op_t rv = ca_use_mem ? gen_right_operand (c2m_ctx, right)
-                         : force_reg (c2m_ctx, gen (c2m_ctx, right, TRUE));
+    if (!right_first_p)
+      rv = ca_use_mem ? gen_right_operand (c2m_ctx, right)
+                      : force_reg (c2m_ctx, gen (c2m_ctx, right, TRUE));
+    else if (spill_p || !ca_use_mem)
+      rv = force_reg (c2m_ctx, rv);
+    gen_ctx->float_spill_depth -= spill_p;
     /* Pointer arithmetic: scale RHS by element size for += and -= on pointers */
     if ((r->code == N_ADD_ASSIGN || r->code == N_SUB_ASSIGN) && type != NULL
         && type->mode == TM_PTR) {
@@ -12197,9 +14080,7 @@ static op_t gen (c2m_ctx_t c2m_ctx, node_t r, int val_p) {
               sljit_emit_op1 (compiler, SLJIT_MOV, dst_op.reg, 0, sr.reg, 0);
             return (op_t){.decl = NULL, .kind = OPK_REG, .reg = dst_op.reg, .imm = 0, .base = 0};
           }
-          if (c2m_options->opt_defer_store_p && c2m_options->opt_reg_cache_p
-              && dst_op.kind == OPK_MEM && dst_op.decl != NULL && !dst_op.decl->addr_p
-              && size >= (int) sizeof (sljit_sw)) {
+          if (defer_store_p (c2m_ctx, dst_op, size)) {
             cache_reg_dirty (c2m_ctx, dst_op.decl, sr.reg, dst_op.imm);
           } else {
             store_to_mem (c2m_ctx, dst_op, sr, size);
@@ -12214,24 +14095,35 @@ static op_t gen (c2m_ctx_t c2m_ctx, node_t r, int val_p) {
     case N_OR_ASSIGN: sljit_op = SLJIT_OR; break;
     case N_XOR_ASSIGN: sljit_op = SLJIT_XOR; break;
     case N_LSH_ASSIGN: sljit_op = SLJIT_SHL; break;
-    case N_RSH_ASSIGN: sljit_op = SLJIT_ASHR; break;
+    case N_RSH_ASSIGN: sljit_op = unsigned_p ? SLJIT_LSHR : SLJIT_ASHR; break;
     case N_DIV_ASSIGN:
     case N_MOD_ASSIGN: {
+      /* Division and the magic multiplication use R0 and R1: an lvalue
+         address in one of them moves to another temp */
+      if (dst_op.kind == OPK_MEM && (dst_op.base == SLJIT_R0 || dst_op.base == SLJIT_R1)) {
+        sljit_s32 base;
+        do
+          base = get_temp_reg (c2m_ctx);
+        while (base == SLJIT_R0 || base == SLJIT_R1 || base == cur.reg
+               || (rv.kind == OPK_REG && base == rv.reg));
+        sljit_emit_op1 (compiler, SLJIT_MOV, base, 0, dst_op.base, 0);
+        dst_op.base = base;
+      }
       /* Opt 6: strength reduce constant div/mod-assign */
       if (c2m_options->opt_strength_reduce_p && rv.kind == OPK_IMM) {
         int log2 = is_power_of_2 (rv.imm);
         if (log2 >= 0) {
           op_t sr = (r->code == N_DIV_ASSIGN)
-                      ? emit_signed_div_pow2 (c2m_ctx, cur.reg, log2, op32)
-                      : emit_signed_mod_pow2 (c2m_ctx, cur.reg, log2, op32);
+                      ? (unsigned_p ? emit_unsigned_div_pow2 (c2m_ctx, cur.reg, log2, op32)
+                                    : emit_signed_div_pow2 (c2m_ctx, cur.reg, log2, op32))
+                      : (unsigned_p ? emit_unsigned_mod_pow2 (c2m_ctx, cur.reg, log2, op32)
+                                    : emit_signed_mod_pow2 (c2m_ctx, cur.reg, log2, op32));
           if (dst_op.kind == OPK_REG) {
             if (sr.reg != dst_op.reg)
               sljit_emit_op1 (compiler, SLJIT_MOV, dst_op.reg, 0, sr.reg, 0);
             return (op_t){.decl = NULL, .kind = OPK_REG, .reg = dst_op.reg, .imm = 0, .base = 0};
           }
-          if (c2m_options->opt_defer_store_p && c2m_options->opt_reg_cache_p
-              && dst_op.kind == OPK_MEM && dst_op.decl != NULL && !dst_op.decl->addr_p
-              && size >= (int) sizeof (sljit_sw)) {
+          if (defer_store_p (c2m_ctx, dst_op, size)) {
             cache_reg_dirty (c2m_ctx, dst_op.decl, sr.reg, dst_op.imm);
           } else {
             store_to_mem (c2m_ctx, dst_op, sr, size);
@@ -12242,19 +14134,19 @@ static op_t gen (c2m_ctx_t c2m_ctx, node_t r, int val_p) {
         }
       }
       /* Opt 6b: magic number div/mod-assign for non-power-of-2 constants */
-      if (c2m_options->opt_magic_div_p && rv.kind == OPK_IMM && rv.imm > 1) {
+      if (c2m_options->opt_magic_div_p && rv.kind == OPK_IMM && (unsigned_p || rv.imm > 1)) {
         op_t sr = (r->code == N_DIV_ASSIGN)
-                    ? emit_signed_div_magic (c2m_ctx, cur.reg, rv.imm, op32)
-                    : emit_signed_mod_magic (c2m_ctx, cur.reg, rv.imm, op32);
+                    ? (unsigned_p ? emit_unsigned_div_magic (c2m_ctx, cur.reg, rv.imm, op32)
+                                  : emit_signed_div_magic (c2m_ctx, cur.reg, rv.imm, op32))
+                    : (unsigned_p ? emit_unsigned_mod_magic (c2m_ctx, cur.reg, rv.imm, op32)
+                                  : emit_signed_mod_magic (c2m_ctx, cur.reg, rv.imm, op32));
         if (sr.kind != OPK_NONE) {
           if (dst_op.kind == OPK_REG) {
             if (sr.reg != dst_op.reg)
               sljit_emit_op1 (compiler, SLJIT_MOV, dst_op.reg, 0, sr.reg, 0);
             return (op_t){.decl = NULL, .kind = OPK_REG, .reg = dst_op.reg, .imm = 0, .base = 0};
           }
-          if (c2m_options->opt_defer_store_p && c2m_options->opt_reg_cache_p
-              && dst_op.kind == OPK_MEM && dst_op.decl != NULL && !dst_op.decl->addr_p
-              && size >= (int) sizeof (sljit_sw)) {
+          if (defer_store_p (c2m_ctx, dst_op, size)) {
             cache_reg_dirty (c2m_ctx, dst_op.decl, sr.reg, dst_op.imm);
           } else {
             store_to_mem (c2m_ctx, dst_op, sr, size);
@@ -12271,14 +14163,15 @@ static op_t gen (c2m_ctx_t c2m_ctx, node_t r, int val_p) {
         op_t rvf = force_reg (c2m_ctx, rv);
         setup_divmod_regs (c2m_ctx, cur.reg, rvf.reg);
       }
-      sljit_emit_op0 (compiler, (r->code == N_DIV_ASSIGN ? SLJIT_DIV_SW : SLJIT_DIVMOD_SW) | op32);
+      sljit_emit_op0 (compiler, (r->code == N_DIV_ASSIGN ? (unsigned_p ? SLJIT_DIV_UW : SLJIT_DIV_SW)
+                                 : unsigned_p           ? SLJIT_DIVMOD_UW
+                                                        : SLJIT_DIVMOD_SW)
+                                  | op32);
       sljit_emit_op1 (compiler, SLJIT_MOV, res, 0,
                        r->code == N_DIV_ASSIGN ? SLJIT_R0 : SLJIT_R1, 0);
       op_t result = {.decl = NULL, .kind = OPK_REG, .reg = res, .imm = 0, .base = 0};
       if (dst_op.kind == OPK_REG) return result;
-      if (c2m_options->opt_defer_store_p && c2m_options->opt_reg_cache_p
-          && dst_op.kind == OPK_MEM && dst_op.decl != NULL && !dst_op.decl->addr_p
-          && size >= (int) sizeof (sljit_sw)) {
+      if (defer_store_p (c2m_ctx, dst_op, size)) {
         cache_reg_dirty (c2m_ctx, dst_op.decl, res, dst_op.imm);
       } else {
         store_to_mem (c2m_ctx, dst_op, result, size);
@@ -12300,9 +14193,7 @@ static op_t gen (c2m_ctx_t c2m_ctx, node_t r, int val_p) {
     /* Promoted var: already written directly, skip store */
     if (dst_op.kind == OPK_REG) return result;
     /* Opt 9: defer store for compound assignment */
-    if (c2m_options->opt_defer_store_p && c2m_options->opt_reg_cache_p
-        && dst_op.kind == OPK_MEM && dst_op.decl != NULL && !dst_op.decl->addr_p
-        && size >= (int) sizeof (sljit_sw)) {
+    if (defer_store_p (c2m_ctx, dst_op, size)) {
       cache_reg_dirty (c2m_ctx, dst_op.decl, res, dst_op.imm);
     } else {
       store_to_mem (c2m_ctx, dst_op, result, size);
@@ -12337,9 +14228,7 @@ static op_t gen (c2m_ctx_t c2m_ctx, node_t r, int val_p) {
                      SLJIT_IMM, step);
     op_t result = {.decl = NULL, .kind = OPK_REG, .reg = res, .imm = 0, .base = 0};
     /* Opt 9: defer store for pre-inc/dec */
-    if (c2m_options->opt_defer_store_p && c2m_options->opt_reg_cache_p
-        && dst_op.kind == OPK_MEM && dst_op.decl != NULL && !dst_op.decl->addr_p
-        && size >= (int) sizeof (sljit_sw)) {
+    if (defer_store_p (c2m_ctx, dst_op, size)) {
       cache_reg_dirty (c2m_ctx, dst_op.decl, res, dst_op.imm);
     } else {
       store_to_mem (c2m_ctx, dst_op, result, size);
@@ -12381,9 +14270,7 @@ static op_t gen (c2m_ctx_t c2m_ctx, node_t r, int val_p) {
       sljit_emit_op2 (compiler, (r->code == N_POST_INC ? SLJIT_ADD : SLJIT_SUB) | op32, res, 0,
                        cur.reg, 0, SLJIT_IMM, step);
       op_t new_val = {.decl = NULL, .kind = OPK_REG, .reg = res, .imm = 0, .base = 0};
-      if (c2m_options->opt_defer_store_p && c2m_options->opt_reg_cache_p
-          && dst_op.kind == OPK_MEM && dst_op.decl != NULL && !dst_op.decl->addr_p
-          && size >= (int) sizeof (sljit_sw)) {
+      if (defer_store_p (c2m_ctx, dst_op, size)) {
         cache_reg_dirty (c2m_ctx, dst_op.decl, res, dst_op.imm);
       } else {
         store_to_mem (c2m_ctx, dst_op, new_val, size);
@@ -12400,9 +14287,7 @@ static op_t gen (c2m_ctx_t c2m_ctx, node_t r, int val_p) {
                      SLJIT_IMM, step);
     op_t new_val = {.decl = NULL, .kind = OPK_REG, .reg = res, .imm = 0, .base = 0};
     /* Opt 9: defer store for post-inc/dec */
-    if (c2m_options->opt_defer_store_p && c2m_options->opt_reg_cache_p
-        && dst_op.kind == OPK_MEM && dst_op.decl != NULL && !dst_op.decl->addr_p
-        && size >= (int) sizeof (sljit_sw)) {
+    if (defer_store_p (c2m_ctx, dst_op, size)) {
       cache_reg_dirty (c2m_ctx, dst_op.decl, res, dst_op.imm);
     } else {
       store_to_mem (c2m_ctx, dst_op, new_val, size);
@@ -12582,9 +14467,13 @@ static op_t gen (c2m_ctx_t c2m_ctx, node_t r, int val_p) {
                           dst, 0, SLJIT_MEM1 (ptr.reg), 0);
         return (op_t){.decl = NULL, .kind = OPK_FREG, .reg = dst, .imm = 0, .base = 0};
       }
-      sljit_s32 dst = get_temp_reg (c2m_ctx);
-      sljit_emit_op1 (compiler, SLJIT_MOV, dst, 0, SLJIT_MEM1 (ptr.reg), 0);
-      return (op_t){.decl = NULL, .kind = OPK_REG, .reg = dst, .imm = 0, .base = 0};
+      /* An array (the target of a pointer to array) decays to its address */
+      if (type != NULL && type->arr_type != NULL) return ptr;
+      int size = type != NULL ? sljit_type_size (type) : (int) sizeof (sljit_sw);
+      int is_signed = type != NULL && type->mode == TM_BASIC && signed_integer_type_p (type);
+      return load_from_mem (c2m_ctx,
+                            (op_t){.decl = NULL, .kind = OPK_MEM, .reg = 0, .imm = 0, .base = ptr.reg},
+                            size, is_signed);
     }
     /* lvalue: return as MEM operand */
     return (op_t){.decl = NULL, .kind = OPK_MEM, .reg = 0, .imm = 0, .base = ptr.reg};
@@ -12604,6 +14493,8 @@ static op_t gen (c2m_ctx_t c2m_ctx, node_t r, int val_p) {
       op_t result = base_op;
       result.imm += field_offset;
       result.decl = member_decl;
+      /* Array member: decays to its address */
+      if (val_p && type != NULL && type->arr_type != NULL) return mem_addr_op (c2m_ctx, result);
       if (val_p) {
         if (is_float_type (type)) {
           int f32 = is_f32_type (type);
@@ -12664,6 +14555,8 @@ static op_t gen (c2m_ctx_t c2m_ctx, node_t r, int val_p) {
     sljit_sw field_offset = member_decl != NULL ? (sljit_sw) member_decl->offset : 0;
     op_t result
       = (op_t){.decl = member_decl, .kind = OPK_MEM, .reg = 0, .imm = field_offset, .base = ptr.reg};
+    /* Array member: decays to its address */
+    if (val_p && type != NULL && type->arr_type != NULL) return mem_addr_op (c2m_ctx, result);
     if (val_p) {
       if (is_float_type (type)) {
         int f32 = is_f32_type (type);
@@ -12683,9 +14576,12 @@ static op_t gen (c2m_ctx_t c2m_ctx, node_t r, int val_p) {
   case N_IND: {
     node_t arr_node = NL_HEAD (r->u.ops);
     node_t idx_node = NL_NEXT (arr_node);
-    /* Compute element size (stride) from the pointed-to type */
+    /* Compute element size (stride) from the pointed-to type; an element
+       which is an array (a row of a multi-dimensional array) has already
+       been adjusted to a pointer */
+    struct type *elem_type = type != NULL && type->arr_type != NULL ? type->arr_type : type;
     int elem_size = (int) sizeof (sljit_sw);  /* default */
-    if (type != NULL) elem_size = (int) type_size (c2m_ctx, type);
+    if (elem_type != NULL) elem_size = (int) type_size (c2m_ctx, elem_type);
     sljit_s32 addr_reg;
     /* Opt 12: early cache check BEFORE evaluating arr/idx.
        This avoids emitting wasted instructions for arr/idx on cache hit.
@@ -12742,9 +14638,11 @@ static op_t gen (c2m_ctx_t c2m_ctx, node_t r, int val_p) {
     } else {
       /* Evaluate arr and idx normally */
       op_t arr = gen (c2m_ctx, arr_node, TRUE);
+      int spill_p = protect_left_operand (c2m_ctx, &arr, idx_node);
       op_t idx_raw = gen (c2m_ctx, idx_node, TRUE);
       op_t idx = force_reg (c2m_ctx, idx_raw);
-      arr = force_reg (c2m_ctx, arr);
+      arr = spill_p ? reload_left_operand (c2m_ctx, arr, idx) : force_reg (c2m_ctx, arr);
+      gen_ctx->float_spill_depth -= spill_p;
       /* Normal computation: MUL + ADD */
       sljit_s32 offset_reg = get_temp_reg (c2m_ctx);
       sljit_emit_op2 (compiler, SLJIT_MUL, offset_reg, 0, idx.reg, 0, SLJIT_IMM, elem_size);
@@ -12769,6 +14667,9 @@ static op_t gen (c2m_ctx_t c2m_ctx, node_t r, int val_p) {
     /* Opt 17: record which ind_cache slot was hit for float field cache */
     if (c2m_options->opt_float_field_cache_p)
       gen_ctx->last_ind_cache_hit = cache_hit;
+    /* An array element decays to its address */
+    if (val_p && elem_type != type)
+      return (op_t){.decl = NULL, .kind = OPK_REG, .reg = addr_reg, .imm = 0, .base = 0};
     if (val_p) {
       if (is_float_type (type)) {
         int f32 = is_f32_type (type);
@@ -12790,6 +14691,11 @@ static op_t gen (c2m_ctx_t c2m_ctx, node_t r, int val_p) {
   case N_CALL: {
     node_t func_node = NL_HEAD (r->u.ops);
     node_t arg_list_node = NL_NEXT (func_node);
+    const struct atomic_builtin *ab;
+
+    if (e->builtin_call_p && func_node->code == N_ID
+        && (ab = find_atomic_builtin (func_node->u.s.s)) != NULL)
+      return gen_atomic_builtin (c2m_ctx, r, ab);
 
     /* Opt 13: try inline expansion for small functions */
     if (c2m_options->opt_inline_p && func_node->code == N_ID
@@ -12831,7 +14737,7 @@ static op_t gen (c2m_ctx_t c2m_ctx, node_t r, int val_p) {
 
     if (func_node->code == N_ID) {
       const char *name = func_node->u.s.s;
-      struct func_slot *slot = find_func_slot (c2m_ctx, name);
+      struct func_slot *slot = get_callee_slot (c2m_ctx, func_node);
       if (slot != NULL) {
         call_mode = 1;
         func_addr = (sljit_sw) &slot->code_addr; /* address of the slot */
@@ -12862,8 +14768,12 @@ static op_t gen (c2m_ctx_t c2m_ctx, node_t r, int val_p) {
       for (node_t a = NL_HEAD (arg_list_node->u.ops); a != NULL; a = NL_NEXT (a))
         if (expr_has_call (a)) { args_have_call = 1; break; }
     }
-    sljit_sw arg_base = args_have_call ? gen_ctx->call_temp_offset
-                                       : gen_ctx->call_save_offset;
+    /* Each call with calls in its arguments gets its own temp area, so the
+       arguments of a nested call do not overwrite those stored before it */
+    sljit_sw arg_base = gen_ctx->call_save_offset;
+    if (args_have_call)
+      arg_base = gen_ctx->call_temp_offset
+                 + gen_ctx->call_temp_level++ * gen_ctx->call_arg_slots * (sljit_sw) sizeof (sljit_sw);
     if (arg_list_node != NULL && arg_list_node->code == N_LIST) {
       for (node_t arg = NL_HEAD (arg_list_node->u.ops); arg != NULL && nargs < max_args;
            arg = NL_NEXT (arg)) {
@@ -12894,9 +14804,10 @@ static op_t gen (c2m_ctx_t c2m_ctx, node_t r, int val_p) {
       }
     }
     /* If args were stored in temp area, copy to call_save_offset for the actual call */
+    if (args_have_call) gen_ctx->call_temp_level--;
     if (args_have_call && nargs > 0) {
       for (int i = 0; i < nargs; i++) {
-        sljit_sw from = gen_ctx->call_temp_offset + i * (sljit_sw) sizeof (sljit_sw);
+        sljit_sw from = arg_base + i * (sljit_sw) sizeof (sljit_sw);
         sljit_sw to = gen_ctx->call_save_offset + i * (sljit_sw) sizeof (sljit_sw);
         sljit_emit_op1 (compiler, SLJIT_MOV, SLJIT_R0, 0, SLJIT_MEM1 (SLJIT_SP), from);
         sljit_emit_op1 (compiler, SLJIT_MOV, SLJIT_MEM1 (SLJIT_SP), to, SLJIT_R0, 0);
@@ -13028,8 +14939,18 @@ static op_t gen (c2m_ctx_t c2m_ctx, node_t r, int val_p) {
   /* ---- Statement expression (GCC extension) ---- */
   case N_STMTEXPR: {
     /* Execute the block and return last expression value */
-    gen_stmt (c2m_ctx, NL_HEAD (r->u.ops));
-    return void_op;
+    node_t block = NL_HEAD (r->u.ops), save_last = gen_ctx->stmt_expr.last;
+    op_t value, save_value = gen_ctx->stmt_expr.value;
+
+    gen_ctx->stmt_expr.last = NL_TAIL (NL_EL (block->u.ops, 1)->u.ops);
+    gen_ctx->stmt_expr.value = void_op;
+    gen_ctx->stmt_expr.depth++;
+    gen_stmt (c2m_ctx, block);
+    gen_ctx->stmt_expr.depth--;
+    value = gen_ctx->stmt_expr.value;
+    gen_ctx->stmt_expr.last = save_last;
+    gen_ctx->stmt_expr.value = save_value;
+    return val_p ? value : void_op;
   }
 
   default:
@@ -13060,7 +14981,7 @@ static op_t gen_right_operand (c2m_ctx_t c2m_ctx, node_t n) {
     /* For locals, return the operand directly when possible */
     struct expr *e = n->attr;
     decl_t decl = (e != NULL && e->u.lvalue_node != NULL) ? e->u.lvalue_node->attr : NULL;
-    if (decl != NULL) {
+    if (decl != NULL && !shared_atomic_lvalue_p (c2m_ctx, n)) {
       op_t v = var_op (c2m_ctx, decl);
       if (v.kind == OPK_REG) return v;  /* promoted: always usable directly */
       if (v.kind == OPK_MEM && v.base != 0 && e->type != NULL
@@ -13081,7 +15002,9 @@ static void gen_stmt (c2m_ctx_t c2m_ctx, node_t r) {
   if (r == NULL || r->code == N_IGNORE) return;
   /* Opt 13: stop generating code after inline return */
   if (gen_ctx->inline_ctx.active && gen_ctx->inline_ctx.returned) return;
-  gen_ctx->call_ret_slot = 0; /* reset call return save slots at statement boundary */
+  /* Reset call return save slots at statement boundary.  The slots of the
+     expression around a statement expression are still in use. */
+  if (gen_ctx->stmt_expr.depth == 0) gen_ctx->call_ret_slot = 0;
 
   /* Process labels (child 0 is N_LIST of labels for most statement nodes).
      Emit sljit labels for N_LABEL, N_CASE, N_DEFAULT so gotos/switch can target this statement. */
@@ -13092,7 +15015,7 @@ static void gen_stmt (c2m_ctx_t c2m_ctx, node_t r) {
         if (l->code == N_LABEL || l->code == N_CASE || l->code == N_DEFAULT) {
           invalidate_reg_cache (c2m_ctx);
           struct label_entry *le = get_or_add_label (c2m_ctx, r);
-          if (le != NULL && le->label == NULL) {
+          if (le->label == NULL) {
             le->label = sljit_emit_label (compiler);
             for (int i = 0; i < le->n_pending; i++)
               sljit_set_label (le->pending[i], le->label);
@@ -13109,7 +15032,10 @@ static void gen_stmt (c2m_ctx_t c2m_ctx, node_t r) {
     node_t expr = NL_EL (r->u.ops, 1);
     if (expr != NULL && expr->code != N_IGNORE) {
       reset_temp_regs (c2m_ctx);
-      gen (c2m_ctx, expr, FALSE);
+      if (r == gen_ctx->stmt_expr.last)
+        gen_ctx->stmt_expr.value = gen (c2m_ctx, expr, TRUE);
+      else
+        gen (c2m_ctx, expr, FALSE);
     }
     break;
   }
@@ -13528,7 +15454,6 @@ static void gen_stmt (c2m_ctx_t c2m_ctx, node_t r) {
     for (case_t c = DLIST_HEAD (case_t, sa->case_labels); c != NULL;
          c = DLIST_NEXT (case_t, c)) {
       struct label_entry *le = get_or_add_label (c2m_ctx, c->case_target_node);
-      if (le == NULL) continue;
       if (c->case_node->code == N_DEFAULT) {
         default_le = le;
         continue;
@@ -13539,22 +15464,12 @@ static void gen_stmt (c2m_ctx_t c2m_ctx, node_t r) {
       sljit_sw case_val = ce->c.i_val;
       struct sljit_jump *j = sljit_emit_cmp (compiler, SLJIT_EQUAL, sv.reg, 0,
                                               SLJIT_IMM, case_val);
-      if (le->label != NULL) {
-        sljit_set_label (j, le->label);
-      } else if (le->n_pending < 8) {
-        le->pending[le->n_pending++] = j;
-      }
+      jump_to_label (le, j);
     }
 
     /* Jump to default or break if no case matched */
     struct sljit_jump *no_match = sljit_emit_jump (compiler, SLJIT_JUMP);
-    if (default_le != NULL) {
-      if (default_le->label != NULL) {
-        sljit_set_label (no_match, default_le->label);
-      } else if (default_le->n_pending < 8) {
-        default_le->pending[default_le->n_pending++] = no_match;
-      }
-    }
+    if (default_le != NULL) jump_to_label (default_le, no_match);
 
     /* Generate body */
     gen_stmt (c2m_ctx, body);
@@ -13581,15 +15496,8 @@ static void gen_stmt (c2m_ctx_t c2m_ctx, node_t r) {
     invalidate_reg_cache (c2m_ctx);
     node_t target = (node_t) r->attr; /* target N_LABEL node */
     if (target != NULL) {
-      struct label_entry *le = get_or_add_label (c2m_ctx, target);
-      struct sljit_jump *j = sljit_emit_jump (compiler, SLJIT_JUMP);
-      if (le != NULL && le->label != NULL) {
-        /* Backward goto: label already emitted */
-        sljit_set_label (j, le->label);
-      } else if (le != NULL && le->n_pending < 8) {
-        /* Forward goto: save jump for patching when label is emitted */
-        le->pending[le->n_pending++] = j;
-      }
+      /* A forward goto is patched when the label is emitted */
+      jump_to_label (get_or_add_label (c2m_ctx, target), sljit_emit_jump (compiler, SLJIT_JUMP));
     }
     break;
   }
@@ -13683,7 +15591,7 @@ static void scan_calls (c2m_ctx_t c2m_ctx, node_t n, int *has_call, int *has_var
     struct type *ct = func_e != NULL ? func_e->type : NULL;
     if (ct != NULL && ct->mode == TM_PTR) ct = ct->u.ptr_type;
     if (ct != NULL && ct->mode == TM_FUNC && ct->u.func_type->dots_p) {
-      if (func_node->code != N_ID || find_func_slot (c2m_ctx, func_node->u.s.s) == NULL)
+      if (func_node->code != N_ID || get_callee_slot (c2m_ctx, func_node) == NULL)
         *has_variadic_extern = 1;
     }
     if (*has_variadic_extern) return;  /* already found worst case */
@@ -13863,7 +15771,8 @@ static op_t inline_call (c2m_ctx_t c2m_ctx, node_t call_node,
   decl_t func_decl = func_def->attr;
   struct func_type *ft = func_decl->decl_spec.type->u.func_type;
 
-  /* 1. Evaluate arguments and force to registers.
+  /* 1. Evaluate arguments into spill slots: a register would not survive
+     the evaluation of a later argument containing a call, nor the body.
      Do NOT reset temp regs — the caller may have live values in lower temp regs. */
   node_t func_node = NL_HEAD (call_node->u.ops);
   node_t arg_list = NL_NEXT (func_node);
@@ -13872,12 +15781,21 @@ static op_t inline_call (c2m_ctx_t c2m_ctx, node_t call_node,
   if (arg_list != NULL && arg_list->code == N_LIST) {
     for (node_t a = NL_HEAD (arg_list->u.ops); a != NULL && nargs < MAX_INLINE_PARAMS;
          a = NL_NEXT (a), nargs++) {
-      arg_vals[nargs] = gen (c2m_ctx, a, TRUE);
+      op_t v = gen (c2m_ctx, a, TRUE);
       struct expr *ae = a->attr;
-      if (ae != NULL && is_float_type (ae->type))
-        arg_vals[nargs] = force_freg (c2m_ctx, arg_vals[nargs], is_f32_type (ae->type));
-      else
-        arg_vals[nargs] = force_reg (c2m_ctx, arg_vals[nargs]);
+      sljit_sw slot = gen_ctx->spill_base_offset
+                      + gen_ctx->float_spill_depth++ * (sljit_sw) sizeof (sljit_sw);
+      if (ae != NULL && is_float_type (ae->type)) {
+        int f32 = is_f32_type (ae->type);
+        v = force_freg (c2m_ctx, v, f32);
+        sljit_emit_fop1 (compiler, f32 ? SLJIT_MOV_F32 : SLJIT_MOV_F64,
+                         SLJIT_MEM1 (SLJIT_SP), slot, v.reg, 0);
+      } else {
+        v = force_reg (c2m_ctx, v);
+        sljit_emit_op1 (compiler, SLJIT_MOV, SLJIT_MEM1 (SLJIT_SP), slot, v.reg, 0);
+      }
+      arg_vals[nargs]
+        = (op_t){.decl = NULL, .kind = OPK_MEM, .reg = 0, .imm = slot, .base = SLJIT_SP};
     }
   }
 
@@ -13906,88 +15824,3466 @@ static op_t inline_call (c2m_ctx_t c2m_ctx, node_t call_node,
   /* 4. Collect return value */
   op_t result = gen_ctx->inline_ctx.returned ? gen_ctx->inline_ctx.return_value : void_op;
   gen_ctx->inline_ctx.active = 0;
+  /* A result still read from an argument slot is loaded before the slot is released */
+  if (result.kind == OPK_MEM && nargs > 0)
+    result = is_float_type (ft->ret_type) ? force_freg (c2m_ctx, result, is_f32_type (ft->ret_type))
+                                          : force_reg (c2m_ctx, result);
+  gen_ctx->float_spill_depth -= nargs;
   return result;
 }
 
-/* ---- Function definition code generation ---- */
+/* ---- Opt 18: linear IR with global register allocation ---- */
 
-static void gen_func_def (c2m_ctx_t c2m_ctx, node_t func_def) {
-  gen_ctx_t gen_ctx = c2m_ctx->gen_ctx;
-  decl_t func_decl = func_def->attr;
-  struct type *func_type_node = func_decl->decl_spec.type;
-  assert (func_type_node->mode == TM_FUNC);
-  struct func_type *ft = func_type_node->u.func_type;
+/* With opt_lir_p a function body is not emitted straight from the AST.  It
+   is first lowered into a flat list of three-address instructions over an
+   unbounded set of virtual registers (vregs), split into basic blocks,
+   cleaned up by copy propagation and dead code elimination, and only then
+   mapped to machine registers by a linear-scan allocator working on live
+   intervals of the whole function.  A function using a construct the
+   lowering does not cover falls back to the AST generator (gen_func_def).
 
-  /* Extract function name from declarator: N_FUNC_DEF(decl_specs, declarator, decls, block) */
-  node_t declarator = NL_EL (func_def->u.ops, 1);
-  assert (declarator != NULL && declarator->code == N_DECL);
-  const char *func_name = NL_HEAD (declarator->u.ops)->u.s.s;
+   Value invariant: 8-byte values occupy the whole register, 4-byte values
+   only their low 32 bits, and 1/2-byte values are kept extended to at
+   least 32 bits according to their signedness.
 
-  /* Create sljit compiler for this function */
-  struct sljit_compiler *comp = sljit_create_compiler (NULL);
-  if (comp == NULL) {
-    fprintf (stderr, "c2sljit: failed to create sljit compiler for %s\n", func_name);
-    return;
-  }
-  compiler = comp;
+   Register conventions: R0..R2 and FR0..FR2 are emitter temporaries (spill
+   reloads, division, conversions); R0..R3 and FR0..FR3 also carry call
+   arguments.  Intervals live across a call are given saved registers. */
 
-  /* Enable SLJIT verbose output if requested */
-  if (c2m_options->verbose_p)
-    sljit_compiler_verbose (comp, c2m_options->message_file);
+typedef enum {
+  LIR_NOP,
+  LIR_MOV,    /* d = a */
+  LIR_EXT,    /* d = a extended by op (SLJIT_MOV_S8 .. SLJIT_MOV_U32) */
+  LIR_ADD,
+  LIR_SUB,
+  LIR_MUL,
+  LIR_AND,
+  LIR_OR,
+  LIR_XOR,
+  LIR_SHL,
+  LIR_LSHR,
+  LIR_ASHR,
+  LIR_DIV,
+  LIR_UDIV,
+  LIR_MOD,
+  LIR_UMOD,
+  LIR_MULHS,  /* d = high word of signed a * b */
+  LIR_MULHU,  /* d = high word of unsigned a * b */
+  LIR_SETCC,  /* d = (a op b), op is an integer sljit condition */
+  LIR_FMOV,
+  LIR_FCONST, /* d = fimm */
+  LIR_FADD,
+  LIR_FSUB,
+  LIR_FMUL,
+  LIR_FDIV,
+  LIR_FNEG,
+  LIR_FSETCC, /* d = (a op b), op is a float sljit condition */
+  LIR_CVT,    /* d = a converted by the sljit conversion op */
+  LIR_FCOPY,  /* d = raw bits of double a */
+  LIR_LOAD,   /* d = [a + disp] using mov op */
+  LIR_FLOAD,
+  LIR_STORE,  /* [a + disp] = b using mov op */
+  LIR_FSTORE,
+  LIR_LEA,    /* d = SP + disp */
+  LIR_LABEL,  /* disp is the label number */
+  LIR_JMP,
+  LIR_BCC,    /* if (a op b) goto disp */
+  LIR_FBCC,
+  LIR_CALL,   /* d = call, disp indexes lir->calls */
+  LIR_RET,    /* return a (none for void) */
+  LIR_FRET,
+} lir_code_t;
+
+typedef enum { LIR_OP_NONE, LIR_OP_VREG, LIR_OP_IMM, LIR_OP_SP } lir_opnd_mode_t;
 
-  /* Compute local frame size from the context checker's allocation.
-     N_FUNC_DEF children: decl_specs, declarator, decls, block (index 3). */
-  node_t block = NL_EL (func_def->u.ops, 3);
-  struct node_scope *ns = block != NULL ? block->attr : NULL;
-  sljit_sw local_size = ns != NULL ? (sljit_sw) ns->size : 256;
-  /* Round up to pointer alignment */
-  local_size = (local_size + sizeof (sljit_sw) - 1) & ~(sizeof (sljit_sw) - 1);
-  if (local_size < 64) local_size = 64;  /* minimum frame */
-  gen_ctx->call_save_offset = local_size;
-  int has_call = 0, has_variadic_extern = 0;
-  scan_calls (c2m_ctx, block, &has_call, &has_variadic_extern);
-  int call_arg_slots = has_variadic_extern ? 10 : has_call ? 4 : 0;
-  gen_ctx->call_arg_slots = call_arg_slots;
-  /* Stack layout for calls:
-     call_save_offset + 0..call_arg_slots:   arg slots (used at call time)
-     + func_save:                             saved func ptr for indirect calls (1 slot)
-     + call_temp_offset:                      temp arg eval area (call_arg_slots slots)
-     + spill_base_offset:                     binary_arith spill area (4 slots) */
-  local_size += (call_arg_slots + (has_call ? 1 : 0)) * (sljit_sw) sizeof (sljit_sw);
-  gen_ctx->call_temp_offset = local_size;
-  local_size += call_arg_slots * (sljit_sw) sizeof (sljit_sw);
-  gen_ctx->spill_base_offset = local_size;
-  local_size += 4 * (sljit_sw) sizeof (sljit_sw);  /* spill slots */
-  gen_ctx->call_ret_base = local_size;
-  local_size += 8 * (sljit_sw) sizeof (sljit_sw); /* return value saves for nested calls */
-  /* Opt 12: stack slots for array index address cache (2 entries) */
-  for (int ci = 0; ci < IND_CACHE_ENTRIES; ci++) {
-    gen_ctx->ind_cache_offsets[ci] = local_size;
-    local_size += (sljit_sw) sizeof (sljit_sw);
-    gen_ctx->ind_cache[ci].valid = 0;
-    gen_ctx->addr_cache[ci].reg = -1;
-  }
-  gen_ctx->ind_cache_next = 0;
-  gen_ctx->float_field_cache_count = 0;
-  gen_ctx->last_ind_cache_hit = -1;
-  gen_ctx->local_size = local_size;
+typedef struct {
+  lir_opnd_mode_t mode;
+  int vreg;
+  sljit_sw imm;
+} lir_opnd_t;
 
-  /* Count parameters and collect types */
-  int nargs = 0;
-  struct type *param_types[4] = {NULL, NULL, NULL, NULL};
-  if (ft->param_list != NULL) {
-    node_t first_param = NL_HEAD (ft->param_list->u.ops);
-    if (!void_param_p (first_param)) {
-      for (node_t param = first_param; param != NULL; param = NL_NEXT (param)) {
-        if (param->code == N_DOTS) break;
-        if (nargs < 4) {
-          decl_t pd = param->attr;
-          param_types[nargs] = pd != NULL ? pd->decl_spec.type : NULL;
-        }
-        nargs++;
-      }
-    }
-  }
+typedef struct {
+  lir_code_t code;
+  sljit_s32 op;       /* sljit mov/conversion op or condition */
+  sljit_s32 flags;    /* SLJIT_32 for 32-bit integer or f32 operations */
+  int d;              /* defined vreg, 0 if none */
+  lir_opnd_t a, b;
+  sljit_sw disp;      /* memory displacement, label number or call index */
+  double fimm;
+  int depth;          /* loop nesting depth, weights spill decisions */
+  int volatile_p;     /* memory access which must be kept */
+  decl_t obj;         /* variable accessed by LOAD/STORE, NULL if unknown */
+} lir_insn_t;
+
+typedef struct {
+  decl_t decl;        /* promoted variable, NULL for temporaries */
+  int float_p, f32_p, fixed_p, call_p; /* fixed_p: parameter precolored to reg */
+  sljit_s32 reg;      /* assigned register, 0 when spilled */
+  sljit_sw slot;      /* frame offset of the spill slot */
+  int start, end;     /* live interval in instruction positions */
+  int weight, hint;
+} lir_vreg_t;
+
+typedef struct {
+  lir_opnd_t val;
+  int float_p, f32_p;
+} lir_arg_t;
+
+typedef struct {
+  lir_opnd_t target;  /* VREG pointer or IMM function address */
+  int slot_p;         /* target.imm is the address of a func_slot code pointer */
+  int trampoline_p;   /* variadic call through c2sljit_call_variadic */
+  int n_fixed, first_arg, nargs;
+  sljit_s32 arg_types;
+} lir_call_t;
+
+typedef struct {
+  int first, last;    /* instruction range */
+  int succ[2], n_succ;
+} lir_bb_t;
+
+typedef struct {
+  void *key;          /* decl or labeled statement */
+  int val;
+} lir_map_t;
+
+typedef struct {
+  struct sljit_jump *jump;
+  int label;
+} lir_jump_t;
+
+/* Parameter passed in register REG but living in the frame at OFFSET. */
+typedef struct {
+  sljit_s32 reg;
+  int float_p, f32_p;
+  sljit_sw offset;
+} lir_param_store_t;
+
+typedef uint64_t lir_bits_t;
+
+DEF_VARR (lir_insn_t);
+DEF_VARR (lir_vreg_t);
+DEF_VARR (lir_arg_t);
+DEF_VARR (lir_call_t);
+DEF_VARR (lir_bb_t);
+DEF_VARR (lir_bits_t);
+DEF_VARR (lir_jump_t);
+DEF_VARR (int);
+DEF_HTAB (lir_map_t);
+
+struct lir_ctx {
+  VARR (lir_insn_t) * insns;
+  VARR (lir_vreg_t) * vregs;
+  VARR (lir_arg_t) * args;
+  VARR (lir_call_t) * calls;
+  VARR (lir_bb_t) * bbs;
+  VARR (int) * label_bbs;   /* label number -> basic block */
+  VARR (lir_bits_t) * live; /* use/def/in/out sets of all blocks */
+  VARR (int) * order;       /* vregs sorted by interval start */
+  VARR (void_ptr_t) * sljit_labels;
+  VARR (lir_jump_t) * jumps;
+  HTAB (lir_map_t) * var_tab;   /* promoted decl -> vreg */
+  HTAB (lir_map_t) * label_tab; /* labeled statement -> label number */
+  struct type int_type, long_type, ulong_type, float_type, double_type;
+  struct type *ret_type;
+  int n_labels, depth, unsupported_p;
+  int break_label, continue_label;
+  int has_call_p, has_icall_p, trampoline_p;
+  int tls_vreg, inst_vreg;  /* blocks of thread-local and instance globals, or 0 */
+  int n_words;              /* lir_bits_t words per vreg set */
+  int n_param_stores;
+  lir_param_store_t param_stores[4];
+  int n_int_params;
+  sljit_sw va_offset, call_slot_offset, spill_offset;
+};
+
+static htab_hash_t lir_map_hash (lir_map_t m, void *arg MIR_UNUSED) {
+  return (htab_hash_t) mir_hash64 ((uint64_t) (uintptr_t) m.key, 0x42);
+}
+
+static int lir_map_eq (lir_map_t m1, lir_map_t m2, void *arg MIR_UNUSED) {
+  return m1.key == m2.key;
+}
+
+static struct lir_ctx *lir_create (c2m_ctx_t c2m_ctx) {
+  MIR_alloc_t alloc = c2m_alloc (c2m_ctx);
+  struct lir_ctx *lir = c2sljit_calloc (c2m_ctx, sizeof (struct lir_ctx));
+
+  VARR_CREATE (lir_insn_t, lir->insns, alloc, 256);
+  VARR_CREATE (lir_vreg_t, lir->vregs, alloc, 64);
+  VARR_CREATE (lir_arg_t, lir->args, alloc, 16);
+  VARR_CREATE (lir_call_t, lir->calls, alloc, 16);
+  VARR_CREATE (lir_bb_t, lir->bbs, alloc, 32);
+  VARR_CREATE (int, lir->label_bbs, alloc, 32);
+  VARR_CREATE (lir_bits_t, lir->live, alloc, 256);
+  VARR_CREATE (int, lir->order, alloc, 64);
+  VARR_CREATE (void_ptr_t, lir->sljit_labels, alloc, 32);
+  VARR_CREATE (lir_jump_t, lir->jumps, alloc, 32);
+  HTAB_CREATE (lir_map_t, lir->var_tab, alloc, 64, lir_map_hash, lir_map_eq, NULL);
+  HTAB_CREATE (lir_map_t, lir->label_tab, alloc, 32, lir_map_hash, lir_map_eq, NULL);
+  init_type (&lir->int_type);
+  lir->int_type.mode = TM_BASIC;
+  lir->int_type.u.basic_type = TP_INT;
+  lir->long_type = lir->ulong_type = lir->float_type = lir->double_type = lir->int_type;
+  lir->long_type.u.basic_type = TP_LONG;
+  lir->ulong_type.u.basic_type = TP_ULONG;
+  lir->float_type.u.basic_type = TP_FLOAT;
+  lir->double_type.u.basic_type = TP_DOUBLE;
+  return lir;
+}
+
+static void lir_destroy (struct lir_ctx *lir) {
+  VARR_DESTROY (lir_insn_t, lir->insns);
+  VARR_DESTROY (lir_vreg_t, lir->vregs);
+  VARR_DESTROY (lir_arg_t, lir->args);
+  VARR_DESTROY (lir_call_t, lir->calls);
+  VARR_DESTROY (lir_bb_t, lir->bbs);
+  VARR_DESTROY (int, lir->label_bbs);
+  VARR_DESTROY (lir_bits_t, lir->live);
+  VARR_DESTROY (int, lir->order);
+  VARR_DESTROY (void_ptr_t, lir->sljit_labels);
+  VARR_DESTROY (lir_jump_t, lir->jumps);
+  HTAB_DESTROY (lir_map_t, lir->var_tab);
+  HTAB_DESTROY (lir_map_t, lir->label_tab);
+  free (lir);
+}
+
+static void lir_reset (struct lir_ctx *lir) {
+  lir_vreg_t v0;
+
+  VARR_TRUNC (lir_insn_t, lir->insns, 0);
+  VARR_TRUNC (lir_vreg_t, lir->vregs, 0);
+  VARR_TRUNC (lir_arg_t, lir->args, 0);
+  VARR_TRUNC (lir_call_t, lir->calls, 0);
+  VARR_TRUNC (lir_bb_t, lir->bbs, 0);
+  VARR_TRUNC (void_ptr_t, lir->sljit_labels, 0);
+  VARR_TRUNC (lir_jump_t, lir->jumps, 0);
+  HTAB_CLEAR (lir_map_t, lir->var_tab);
+  HTAB_CLEAR (lir_map_t, lir->label_tab);
+  memset (&v0, 0, sizeof (v0));
+  VARR_PUSH (lir_vreg_t, lir->vregs, v0); /* vreg 0 means "none" */
+  lir->n_labels = lir->depth = lir->unsupported_p = 0;
+  lir->break_label = lir->continue_label = -1;
+  lir->has_call_p = lir->has_icall_p = lir->trampoline_p = 0;
+  lir->tls_vreg = lir->inst_vreg = 0;
+  lir->n_param_stores = lir->n_int_params = 0;
+}
+
+/* ---- Opt 18: IR construction helpers ---- */
+
+static lir_opnd_t lir_none_op (void) {
+  return (lir_opnd_t){.mode = LIR_OP_NONE, .vreg = 0, .imm = 0};
+}
+
+static lir_opnd_t lir_vreg_op (int vreg) {
+  return (lir_opnd_t){.mode = LIR_OP_VREG, .vreg = vreg, .imm = 0};
+}
+
+static lir_opnd_t lir_imm_op (sljit_sw imm) {
+  return (lir_opnd_t){.mode = LIR_OP_IMM, .vreg = 0, .imm = imm};
+}
+
+static lir_opnd_t lir_sp_op (void) {
+  return (lir_opnd_t){.mode = LIR_OP_SP, .vreg = 0, .imm = 0};
+}
+
+static lir_vreg_t *lir_vreg (struct lir_ctx *lir, int vreg) {
+  return &VARR_ADDR (lir_vreg_t, lir->vregs)[vreg];
+}
+
+/* New vreg holding a value of TYPE, NULL for integer temporaries. */
+static int lir_new_vreg (c2m_ctx_t c2m_ctx, struct type *type) {
+  struct lir_ctx *lir = c2m_ctx->gen_ctx->lir;
+  lir_vreg_t v;
+
+  memset (&v, 0, sizeof (v));
+  v.float_p = is_float_type (type);
+  v.f32_p = is_f32_type (type);
+  VARR_PUSH (lir_vreg_t, lir->vregs, v);
+  return (int) VARR_LENGTH (lir_vreg_t, lir->vregs) - 1;
+}
+
+/* The returned pointer is valid only until the next lir_emit. */
+static lir_insn_t *lir_emit (c2m_ctx_t c2m_ctx, lir_code_t code, int d, lir_opnd_t a,
+                             lir_opnd_t b) {
+  struct lir_ctx *lir = c2m_ctx->gen_ctx->lir;
+  lir_insn_t insn;
+
+  memset (&insn, 0, sizeof (insn));
+  insn.code = code;
+  insn.d = d;
+  insn.a = a;
+  insn.b = b;
+  insn.depth = lir->depth;
+  VARR_PUSH (lir_insn_t, lir->insns, insn);
+  return &VARR_ADDR (lir_insn_t, lir->insns)[VARR_LENGTH (lir_insn_t, lir->insns) - 1];
+}
+
+static int lir_new_label (c2m_ctx_t c2m_ctx) { return c2m_ctx->gen_ctx->lir->n_labels++; }
+
+static void lir_emit_label (c2m_ctx_t c2m_ctx, int label) {
+  lir_emit (c2m_ctx, LIR_LABEL, 0, lir_none_op (), lir_none_op ())->disp = label;
+}
+
+static void lir_emit_jump (c2m_ctx_t c2m_ctx, int label) {
+  lir_emit (c2m_ctx, LIR_JMP, 0, lir_none_op (), lir_none_op ())->disp = label;
+}
+
+static void lir_unsupported (c2m_ctx_t c2m_ctx, const char *what) {
+  struct lir_ctx *lir = c2m_ctx->gen_ctx->lir;
+  if (lir->unsupported_p) return;
+  lir->unsupported_p = TRUE;
+  if (c2m_options->verbose_p && c2m_options->message_file != NULL)
+    fprintf (c2m_options->message_file, "  [lir] %s: falling back to AST code generator\n", what);
+}
+
+/* Label number of a labeled statement (goto, case and default target). */
+static int lir_stmt_label (c2m_ctx_t c2m_ctx, node_t stmt) {
+  struct lir_ctx *lir = c2m_ctx->gen_ctx->lir;
+  lir_map_t m, tab_m;
+
+  m.key = stmt;
+  if (HTAB_DO (lir_map_t, lir->label_tab, m, HTAB_FIND, tab_m)) return tab_m.val;
+  m.val = lir_new_label (c2m_ctx);
+  HTAB_DO (lir_map_t, lir->label_tab, m, HTAB_INSERT, tab_m);
+  return m.val;
+}
+
+/* ---- Opt 18: type helpers ---- */
+
+static int lir_type_size (struct type *type) {
+  switch (type->mode) {
+  case TM_BASIC: return type->u.basic_type == TP_VOID ? 0 : basic_type_size (type->u.basic_type);
+  case TM_ENUM: return basic_type_size (get_enum_basic_type (type));
+  case TM_PTR:
+  case TM_ARR:
+  case TM_FUNC: return sizeof (void *);
+  default: return type->raw_size == MIR_SIZE_MAX ? 0 : (int) type->raw_size;
+  }
+}
+
+static int lir_unsigned_p (struct type *type) { return !signed_integer_type_p (type); }
+
+static int lir_bool_p (struct type *type) {
+  return type->mode == TM_BASIC && type->u.basic_type == TP_BOOL;
+}
+
+static int lir_aggregate_p (struct type *type) {
+  return type->mode == TM_STRUCT || type->mode == TM_UNION;
+}
+
+/* Types whose values the IR can hold in a vreg. */
+static int lir_value_type_p (struct type *type) {
+  if (type->mode == TM_ARR || type->mode == TM_FUNC) return TRUE;
+  if (!scalar_type_p (type)) return FALSE;
+  return !floating_type_p (type) || type->u.basic_type != TP_LDOUBLE || sizeof (mir_ldouble) == 8;
+}
+
+static struct type *lir_pointee (struct type *type) {
+  if (type->mode == TM_PTR) return type->u.ptr_type;
+  if (type->mode == TM_ARR) return type->u.arr_type->el_type;
+  return NULL;
+}
+
+static sljit_sw lir_elem_size (c2m_ctx_t c2m_ctx, struct type *ptr_type) {
+  struct type *t = lir_pointee (ptr_type);
+  if (t == NULL || void_type_p (t) || t->mode == TM_FUNC) return 1;
+  return (sljit_sw) type_size (c2m_ctx, t);
+}
+
+static sljit_sw lir_trunc_imm (sljit_sw v, int size, int unsigned_p) {
+  switch (size) {
+  case 1: return unsigned_p ? (sljit_sw) (uint8_t) v : (sljit_sw) (int8_t) v;
+  case 2: return unsigned_p ? (sljit_sw) (uint16_t) v : (sljit_sw) (int16_t) v;
+  case 4: return unsigned_p ? (sljit_sw) (uint32_t) v : (sljit_sw) (int32_t) v;
+  default: return v;
+  }
+}
+
+static sljit_s32 lir_load_op (struct type *type) {
+  int size = lir_type_size (type), unsigned_p = lir_unsigned_p (type);
+  if (lir_bool_p (type)) return SLJIT_MOV_U8;
+  switch (size) {
+  case 1: return unsigned_p ? SLJIT_MOV_U8 : SLJIT_MOV_S8;
+  case 2: return unsigned_p ? SLJIT_MOV_U16 : SLJIT_MOV_S16;
+  case 4: return unsigned_p ? SLJIT_MOV_U32 : SLJIT_MOV_S32;
+  default: return SLJIT_MOV;
+  }
+}
+
+static sljit_s32 lir_store_op (struct type *type) {
+  switch (lir_type_size (type)) {
+  case 1: return SLJIT_MOV_U8;
+  case 2: return SLJIT_MOV_U16;
+  case 4: return SLJIT_MOV32;
+  default: return SLJIT_MOV;
+  }
+}
+
+static sljit_s32 lir_int_cond (node_code_t code, int unsigned_p) {
+  switch (code) {
+  case N_EQ: return SLJIT_EQUAL;
+  case N_NE: return SLJIT_NOT_EQUAL;
+  case N_LT: return unsigned_p ? SLJIT_LESS : SLJIT_SIG_LESS;
+  case N_LE: return unsigned_p ? SLJIT_LESS_EQUAL : SLJIT_SIG_LESS_EQUAL;
+  case N_GT: return unsigned_p ? SLJIT_GREATER : SLJIT_SIG_GREATER;
+  default: return unsigned_p ? SLJIT_GREATER_EQUAL : SLJIT_SIG_GREATER_EQUAL;
+  }
+}
+
+/* Condition for the same comparison with swapped operands. */
+static sljit_s32 lir_swap_cond (sljit_s32 cond) {
+  switch (cond) {
+  case SLJIT_LESS: return SLJIT_GREATER;
+  case SLJIT_GREATER: return SLJIT_LESS;
+  case SLJIT_LESS_EQUAL: return SLJIT_GREATER_EQUAL;
+  case SLJIT_GREATER_EQUAL: return SLJIT_LESS_EQUAL;
+  case SLJIT_SIG_LESS: return SLJIT_SIG_GREATER;
+  case SLJIT_SIG_GREATER: return SLJIT_SIG_LESS;
+  case SLJIT_SIG_LESS_EQUAL: return SLJIT_SIG_GREATER_EQUAL;
+  case SLJIT_SIG_GREATER_EQUAL: return SLJIT_SIG_LESS_EQUAL;
+  case SLJIT_F_LESS: return SLJIT_F_GREATER;
+  case SLJIT_F_GREATER: return SLJIT_F_LESS;
+  case SLJIT_F_LESS_EQUAL: return SLJIT_F_GREATER_EQUAL;
+  case SLJIT_F_GREATER_EQUAL: return SLJIT_F_LESS_EQUAL;
+  default: return cond;
+  }
+}
+
+/* Value of integer condition COND on constants A and B of SIZE bytes. */
+static int lir_cond_true_p (sljit_s32 cond, sljit_sw a, sljit_sw b, int size) {
+  int signed_p = cond >= SLJIT_SIG_LESS;
+  sljit_uw ua = (sljit_uw) lir_trunc_imm (a, size, TRUE), ub = (sljit_uw) lir_trunc_imm (b, size, TRUE);
+
+  a = lir_trunc_imm (a, size, !signed_p);
+  b = lir_trunc_imm (b, size, !signed_p);
+  switch (cond) {
+  case SLJIT_EQUAL: return ua == ub;
+  case SLJIT_NOT_EQUAL: return ua != ub;
+  case SLJIT_LESS: return ua < ub;
+  case SLJIT_GREATER_EQUAL: return ua >= ub;
+  case SLJIT_GREATER: return ua > ub;
+  case SLJIT_LESS_EQUAL: return ua <= ub;
+  case SLJIT_SIG_LESS: return a < b;
+  case SLJIT_SIG_GREATER_EQUAL: return a >= b;
+  case SLJIT_SIG_GREATER: return a > b;
+  default: return a <= b;
+  }
+}
+
+/* ---- Opt 18: value conversions ---- */
+
+static lir_opnd_t lir_fconst (c2m_ctx_t c2m_ctx, double val, int f32_p) {
+  struct lir_ctx *lir = c2m_ctx->gen_ctx->lir;
+  int d = lir_new_vreg (c2m_ctx, f32_p ? &lir->float_type : &lir->double_type);
+  lir_insn_t *insn = lir_emit (c2m_ctx, LIR_FCONST, d, lir_none_op (), lir_none_op ());
+  insn->fimm = val;
+  insn->flags = f32_p ? SLJIT_32 : 0;
+  return lir_vreg_op (d);
+}
+
+static lir_opnd_t lir_force_vreg (c2m_ctx_t c2m_ctx, lir_opnd_t v) {
+  if (v.mode == LIR_OP_VREG || v.mode == LIR_OP_NONE) return v;
+  int d = lir_new_vreg (c2m_ctx, NULL);
+  if (v.mode == LIR_OP_SP)
+    lir_emit (c2m_ctx, LIR_LEA, d, lir_none_op (), lir_none_op ())->disp = v.imm;
+  else
+    lir_emit (c2m_ctx, LIR_MOV, d, v, lir_none_op ());
+  return lir_vreg_op (d);
+}
+
+/* Integer to integer conversion between sizes FS and TS. */
+static lir_opnd_t lir_icvt (c2m_ctx_t c2m_ctx, lir_opnd_t v, int fs, int fu, int ts, int tu) {
+  sljit_s32 op;
+
+  if (v.mode == LIR_OP_IMM) return lir_imm_op (lir_trunc_imm (lir_trunc_imm (v.imm, fs, fu), ts, tu));
+  if (ts >= 8) {
+    if (fs >= 8) return v;
+    op = fu ? SLJIT_MOV_U32 : SLJIT_MOV_S32;
+  } else if (ts == 4) {
+    return v;
+  } else {
+    if (fs < ts && (fu || !tu)) return v;
+    if (ts == 1)
+      op = (tu ? SLJIT_MOV_U8 : SLJIT_MOV_S8) | SLJIT_32;
+    else
+      op = (tu ? SLJIT_MOV_U16 : SLJIT_MOV_S16) | SLJIT_32;
+  }
+  int d = lir_new_vreg (c2m_ctx, NULL);
+  lir_emit (c2m_ctx, LIR_EXT, d, v, lir_none_op ())->op = op;
+  return lir_vreg_op (d);
+}
+
+static lir_opnd_t lir_cvt (c2m_ctx_t c2m_ctx, lir_opnd_t v, struct type *from, struct type *to) {
+  int ff, tf, fs, ts, fu, tu, d;
+  sljit_s32 op;
+  lir_insn_t *insn;
+
+  if (void_type_p (to)) return lir_none_op ();
+  if (lir_aggregate_p (from) || lir_aggregate_p (to)) {
+    if (from->mode != to->mode) lir_unsupported (c2m_ctx, "aggregate conversion");
+    return v;
+  }
+  if (v.mode == LIR_OP_NONE) return v;
+  ff = is_float_type (from);
+  tf = is_float_type (to);
+  fs = lir_type_size (from);
+  ts = lir_type_size (to);
+  fu = lir_unsigned_p (from);
+  tu = lir_unsigned_p (to);
+  if (ff && tf) {
+    if (is_f32_type (from) == is_f32_type (to)) return v;
+    d = lir_new_vreg (c2m_ctx, to);
+    op = is_f32_type (to) ? SLJIT_CONV_F32_FROM_F64 : SLJIT_CONV_F64_FROM_F32;
+    lir_emit (c2m_ctx, LIR_CVT, d, v, lir_none_op ())->op = op;
+    return lir_vreg_op (d);
+  }
+  if (lir_bool_p (to)) {
+    if (lir_bool_p (from)) return v;
+    d = lir_new_vreg (c2m_ctx, NULL);
+    if (ff) {
+      lir_opnd_t zero = lir_fconst (c2m_ctx, 0.0, is_f32_type (from));
+      insn = lir_emit (c2m_ctx, LIR_FSETCC, d, v, zero);
+      insn->op = SLJIT_F_NOT_EQUAL;
+      insn->flags = is_f32_type (from) ? SLJIT_32 : 0;
+      return lir_vreg_op (d);
+    }
+    if (v.mode == LIR_OP_IMM) return lir_imm_op (lir_trunc_imm (v.imm, fs, fu) != 0);
+    insn = lir_emit (c2m_ctx, LIR_SETCC, d, v, lir_imm_op (0));
+    insn->op = SLJIT_NOT_EQUAL;
+    insn->flags = fs <= 4 ? SLJIT_32 : 0;
+    return lir_vreg_op (d);
+  }
+  if (tf) {
+    if (v.mode == LIR_OP_IMM) {
+      sljit_sw x = lir_trunc_imm (v.imm, fs, fu);
+      return lir_fconst (c2m_ctx, fu ? (double) (sljit_uw) x : (double) x, is_f32_type (to));
+    }
+    if (fs >= 8)
+      op = fu ? SLJIT_CONV_F64_FROM_UW : SLJIT_CONV_F64_FROM_SW;
+    else
+      op = fu && fs == 4 ? SLJIT_CONV_F64_FROM_U32 : SLJIT_CONV_F64_FROM_S32;
+    d = lir_new_vreg (c2m_ctx, to);
+    lir_emit (c2m_ctx, LIR_CVT, d, v, lir_none_op ())->op = op | (is_f32_type (to) ? SLJIT_32 : 0);
+    return lir_vreg_op (d);
+  }
+  if (ff) {
+    op = ts >= 8 || (tu && ts == 4) ? SLJIT_CONV_SW_FROM_F64 : SLJIT_CONV_S32_FROM_F64;
+    d = lir_new_vreg (c2m_ctx, NULL);
+    lir_emit (c2m_ctx, LIR_CVT, d, v, lir_none_op ())->op
+      = op | (is_f32_type (from) ? SLJIT_32 : 0);
+    if (op == SLJIT_CONV_SW_FROM_F64) return lir_vreg_op (d);
+    return lir_icvt (c2m_ctx, lir_vreg_op (d), 4, FALSE, ts, tu);
+  }
+  return lir_icvt (c2m_ctx, v, fs, fu, ts, tu);
+}
+
+/* Move V into vreg DST.  When V is a temporary just produced by the last
+   instruction, that instruction is retargeted to DST instead.  The bases of
+   the thread-local and instance blocks are used throughout the function and
+   are never retargeted. */
+static void lir_move (c2m_ctx_t c2m_ctx, int dst, lir_opnd_t v) {
+  struct lir_ctx *lir = c2m_ctx->gen_ctx->lir;
+  size_t n = VARR_LENGTH (lir_insn_t, lir->insns);
+
+  if (v.mode == LIR_OP_SP) {
+    lir_emit (c2m_ctx, LIR_LEA, dst, lir_none_op (), lir_none_op ())->disp = v.imm;
+    return;
+  }
+  if (v.mode == LIR_OP_VREG) {
+    if (v.vreg == dst) return;
+    lir_vreg_t *sv = lir_vreg (lir, v.vreg);
+    lir_insn_t *last = n == 0 ? NULL : &VARR_ADDR (lir_insn_t, lir->insns)[n - 1];
+    if (last != NULL && last->d == v.vreg && sv->decl == NULL && !sv->fixed_p
+        && v.vreg != lir->tls_vreg && v.vreg != lir->inst_vreg) {
+      last->d = dst;
+      return;
+    }
+  }
+  lir_emit (c2m_ctx, lir_vreg (lir, dst)->float_p ? LIR_FMOV : LIR_MOV, dst, v, lir_none_op ());
+}
+
+/* ---- Opt 18: lvalues ---- */
+
+typedef struct {
+  int vreg;          /* promoted variable, or 0 */
+  lir_opnd_t base;   /* otherwise the object is at base + disp */
+  sljit_sw disp;
+  struct type *type; /* type of the designated object */
+  int volatile_p;
+  decl_t obj;        /* variable containing the object, NULL if unknown */
+} lir_lval_t;
+
+static int lir_promotable_p (c2m_ctx_t c2m_ctx, decl_t decl) {
+  struct type *type = decl->decl_spec.type;
+  return (!decl->addr_p && !decl->asm_p && decl->scope != top_scope
+          && !decl->decl_spec.static_p && !decl->decl_spec.extern_p
+          && !decl->decl_spec.thread_local_p && !type->type_qual.volatile_p
+          && !type->type_qual.atomic_p && scalar_type_p (type) && lir_value_type_p (type));
+}
+
+static int lir_find_var (c2m_ctx_t c2m_ctx, decl_t decl) {
+  struct lir_ctx *lir = c2m_ctx->gen_ctx->lir;
+  lir_map_t m, tab_m;
+
+  m.key = decl;
+  return HTAB_DO (lir_map_t, lir->var_tab, m, HTAB_FIND, tab_m) ? tab_m.val : 0;
+}
+
+static int lir_var_vreg (c2m_ctx_t c2m_ctx, decl_t decl) {
+  struct lir_ctx *lir = c2m_ctx->gen_ctx->lir;
+  lir_map_t m, tab_m;
+  int v = lir_find_var (c2m_ctx, decl);
+
+  if (v != 0 || !lir_promotable_p (c2m_ctx, decl)) return v;
+  v = lir_new_vreg (c2m_ctx, decl->decl_spec.type);
+  lir_vreg (lir, v)->decl = decl;
+  m.key = decl;
+  m.val = v;
+  HTAB_DO (lir_map_t, lir->var_tab, m, HTAB_INSERT, tab_m);
+  return v;
+}
+
+static void lir_var_lval (c2m_ctx_t c2m_ctx, decl_t decl, const char *name, lir_lval_t *lv) {
+  gen_ctx_t gen_ctx = c2m_ctx->gen_ctx;
+  global_var_t gv;
+
+  lv->vreg = 0;
+  lv->base = lir_imm_op (0);
+  lv->disp = 0;
+  lv->type = decl->decl_spec.type;
+  lv->volatile_p = lv->type->type_qual.volatile_p;
+  lv->obj = decl;
+  if (lv->type->mode == TM_ARR && lv->type->raw_size == MIR_SIZE_MAX) {
+    lir_unsupported (c2m_ctx, "variable length array");
+    return;
+  }
+  if ((lv->vreg = lir_var_vreg (c2m_ctx, decl)) != 0) return;
+  if (find_global (c2m_ctx, decl, &gv)) {
+    int base = gv.image == &gen_ctx->tls ? gen_ctx->lir->tls_vreg : gen_ctx->lir->inst_vreg;
+    if (gv.image == NULL) {
+      lv->base = lir_imm_op ((sljit_sw) gv.addr);
+    } else if (base != 0) {
+      lv->base = lir_vreg_op (base);
+      lv->disp = gv.image_offset;
+    } else {
+      lir_unsupported (c2m_ctx, "global outside the function's data blocks");
+    }
+    return;
+  }
+  if (decl->scope == top_scope || decl->decl_spec.extern_p) {
+    void *addr = dlsym (RTLD_DEFAULT, name);
+    if (addr == NULL) lir_unsupported (c2m_ctx, "unresolved external variable");
+    lv->base = lir_imm_op ((sljit_sw) addr);
+    return;
+  }
+  if (decl->decl_spec.static_p || decl->decl_spec.thread_local_p) {
+    lir_unsupported (c2m_ctx, "static local variable");
+    return;
+  }
+  lv->base = lir_sp_op ();
+  lv->disp = (sljit_sw) decl->offset;
+}
+
+static lir_opnd_t lir_gen_expr (c2m_ctx_t c2m_ctx, node_t r);
+
+/* Turn pointer value P into a memory base operand. */
+static void lir_set_base (c2m_ctx_t c2m_ctx, lir_lval_t *lv, lir_opnd_t p) {
+  if (p.mode == LIR_OP_IMM) {
+    lv->base = lir_imm_op (0);
+    lv->disp += p.imm;
+  } else {
+    lv->base = lir_force_vreg (c2m_ctx, p);
+  }
+}
+
+static lir_opnd_t lir_scale (c2m_ctx_t c2m_ctx, lir_opnd_t idx, sljit_sw size);
+
+/* Return the variable containing array or aggregate lvalue R, NULL if R
+   is not known to designate a part of one variable. */
+static decl_t lir_object (node_t r) {
+  struct expr *e = r->attr;
+
+  switch (r->code) {
+  case N_ID: return e->u.lvalue_node == NULL ? NULL : e->u.lvalue_node->attr;
+  case N_FIELD: return lir_object (NL_HEAD (r->u.ops));
+  case N_IND: {
+    node_t a = NL_HEAD (r->u.ops);
+    if (((struct expr *) a->attr)->type->mode != TM_ARR) return NULL;
+    return lir_object (a);
+  }
+  default: return NULL;
+  }
+}
+
+static void lir_gen_lval (c2m_ctx_t c2m_ctx, node_t r, lir_lval_t *lv) {
+  gen_ctx_t gen_ctx = c2m_ctx->gen_ctx;
+  struct lir_ctx *lir = gen_ctx->lir;
+  struct expr *e = r->attr;
+
+  lv->vreg = 0;
+  lv->base = lir_imm_op (0);
+  lv->disp = 0;
+  lv->type = e->type;
+  lv->volatile_p = FALSE;
+  lv->obj = NULL;
+  if (e->type->type_qual.atomic_p) lir_unsupported (c2m_ctx, "atomic object");
+  switch (r->code) {
+  case N_ID:
+    if (e->u.lvalue_node == NULL) { /* function designator */
+      struct func_slot *slot = get_callee_slot (c2m_ctx, r);
+      lv->type = e->type->mode == TM_PTR ? e->type->u.ptr_type : e->type;
+      if (slot != NULL) {
+        int d = lir_new_vreg (c2m_ctx, NULL);
+        lir_emit (c2m_ctx, LIR_LOAD, d, lir_imm_op ((sljit_sw) &slot->code_addr), lir_none_op ())
+          ->op = SLJIT_MOV;
+        lv->base = lir_vreg_op (d);
+      } else {
+        void *addr = dlsym (RTLD_DEFAULT, r->u.s.s);
+        if (addr == NULL) lir_unsupported (c2m_ctx, "unresolved external function");
+        lv->base = lir_imm_op ((sljit_sw) addr);
+      }
+      return;
+    }
+    lir_var_lval (c2m_ctx, e->u.lvalue_node->attr, r->u.s.s, lv);
+    return;
+  case N_STR: {
+    lv->base = lir_imm_op ((sljit_sw) data_string (c2m_ctx, r->u.s.s, r->u.s.len));
+    if (e->type->mode == TM_PTR && e->type->arr_type != NULL) lv->type = e->type->arr_type;
+    return;
+  }
+  case N_DEREF: {
+    node_t op = NL_HEAD (r->u.ops);
+    struct type *pt = ((struct expr *) op->attr)->type;
+    lir_set_base (c2m_ctx, lv, lir_gen_expr (c2m_ctx, op));
+    lv->type = lir_pointee (pt) != NULL ? lir_pointee (pt) : e->type;
+    lv->volatile_p = lv->type->type_qual.volatile_p;
+    return;
+  }
+  case N_IND: {
+    node_t a = NL_HEAD (r->u.ops), i = NL_NEXT (a);
+    struct type *at = ((struct expr *) a->attr)->type, *it;
+    if (at->mode != TM_PTR && at->mode != TM_ARR) {
+      node_t t = a;
+      a = i;
+      i = t;
+      at = ((struct expr *) a->attr)->type;
+    }
+    it = ((struct expr *) i->attr)->type;
+    lir_opnd_t base = lir_gen_expr (c2m_ctx, a);
+    lir_opnd_t idx = lir_gen_expr (c2m_ctx, i);
+    sljit_sw size = lir_elem_size (c2m_ctx, at);
+    idx = lir_cvt (c2m_ctx, idx, it, lir_unsigned_p (it) ? &lir->ulong_type : &lir->long_type);
+    if (idx.mode == LIR_OP_IMM) {
+      lv->disp = idx.imm * size;
+      lir_set_base (c2m_ctx, lv, base);
+    } else {
+      idx = lir_scale (c2m_ctx, idx, size);
+      int d = lir_new_vreg (c2m_ctx, NULL);
+      lir_emit (c2m_ctx, LIR_ADD, d, base.mode == LIR_OP_IMM ? idx : lir_force_vreg (c2m_ctx, base),
+                base.mode == LIR_OP_IMM ? base : idx);
+      lv->base = lir_vreg_op (d);
+    }
+    lv->type = lir_pointee (at);
+    lv->volatile_p = lv->type->type_qual.volatile_p;
+    if (at->mode == TM_ARR) lv->obj = lir_object (a);
+    return;
+  }
+  case N_FIELD:
+  case N_DEREF_FIELD: {
+    node_t op = NL_HEAD (r->u.ops);
+    decl_t member = e->u.lvalue_node->attr;
+    if (member->bit_offset >= 0) {
+      lir_unsupported (c2m_ctx, "bit-field access");
+      return;
+    }
+    if (r->code == N_FIELD) {
+      lir_gen_lval (c2m_ctx, op, lv);
+      if (lv->vreg != 0) lir_unsupported (c2m_ctx, "field of register value");
+    } else {
+      lir_set_base (c2m_ctx, lv, lir_gen_expr (c2m_ctx, op));
+    }
+    lv->disp += (sljit_sw) member->offset;
+    lv->type = member->decl_spec.type;
+    lv->volatile_p |= lv->type->type_qual.volatile_p;
+    return;
+  }
+  default: lir_unsupported (c2m_ctx, "lvalue expression"); return;
+  }
+}
+
+static lir_opnd_t lir_lval_addr (c2m_ctx_t c2m_ctx, lir_lval_t *lv) {
+  int d;
+
+  if (lv->vreg != 0) {
+    lir_unsupported (c2m_ctx, "address of register variable");
+    return lir_imm_op (0);
+  }
+  switch (lv->base.mode) {
+  case LIR_OP_IMM: return lir_imm_op (lv->base.imm + lv->disp);
+  case LIR_OP_SP:
+    d = lir_new_vreg (c2m_ctx, NULL);
+    lir_emit (c2m_ctx, LIR_LEA, d, lir_none_op (), lir_none_op ())->disp = lv->disp;
+    return lir_vreg_op (d);
+  default:
+    if (lv->disp == 0) return lv->base;
+    d = lir_new_vreg (c2m_ctx, NULL);
+    lir_emit (c2m_ctx, LIR_ADD, d, lv->base, lir_imm_op (lv->disp));
+    return lir_vreg_op (d);
+  }
+}
+
+static lir_opnd_t lir_lval_value (c2m_ctx_t c2m_ctx, lir_lval_t *lv) {
+  struct type *type = lv->type;
+  lir_insn_t *insn;
+  int d;
+
+  /* Arrays, functions and aggregates are represented by their address */
+  if (type->mode == TM_ARR || type->mode == TM_FUNC || lir_aggregate_p (type))
+    return lir_lval_addr (c2m_ctx, lv);
+  if (lv->vreg != 0) return lir_vreg_op (lv->vreg);
+  if (!lir_value_type_p (type)) {
+    lir_unsupported (c2m_ctx, "aggregate value");
+    return lir_imm_op (0);
+  }
+  if (is_float_type (type)) {
+    d = lir_new_vreg (c2m_ctx, type);
+    insn = lir_emit (c2m_ctx, LIR_FLOAD, d, lv->base, lir_none_op ());
+    insn->op = is_f32_type (type) ? SLJIT_MOV_F32 : SLJIT_MOV_F64;
+  } else {
+    d = lir_new_vreg (c2m_ctx, NULL);
+    insn = lir_emit (c2m_ctx, LIR_LOAD, d, lv->base, lir_none_op ());
+    insn->op = lir_load_op (type);
+  }
+  insn->disp = lv->disp;
+  insn->volatile_p = lv->volatile_p;
+  insn->obj = lv->obj;
+  return lir_vreg_op (d);
+}
+
+/* Call libc FUNC (memset, memcpy or memmove) with three word arguments. */
+static void lir_gen_libc_call (c2m_ctx_t c2m_ctx, void *func, lir_opnd_t a1, lir_opnd_t a2,
+                               lir_opnd_t a3) {
+  struct lir_ctx *lir = c2m_ctx->gen_ctx->lir;
+  lir_arg_t arg;
+  lir_call_t call;
+
+  memset (&call, 0, sizeof (call));
+  memset (&arg, 0, sizeof (arg));
+  call.target = lir_imm_op ((sljit_sw) func);
+  call.n_fixed = call.nargs = 3;
+  call.first_arg = (int) VARR_LENGTH (lir_arg_t, lir->args);
+  call.arg_types = SLJIT_ARGS3 (W, W, W, W);
+  arg.val = a1;
+  VARR_PUSH (lir_arg_t, lir->args, arg);
+  arg.val = a2;
+  VARR_PUSH (lir_arg_t, lir->args, arg);
+  arg.val = a3;
+  VARR_PUSH (lir_arg_t, lir->args, arg);
+  VARR_PUSH (lir_call_t, lir->calls, call);
+  lir_emit (c2m_ctx, LIR_CALL, 0, lir_none_op (), lir_none_op ())->disp
+    = (sljit_sw) VARR_LENGTH (lir_call_t, lir->calls) - 1;
+  lir->has_call_p = TRUE;
+}
+
+/* Fetch the block of IMAGE on function entry, returning its vreg. */
+static int lir_gen_image_base (c2m_ctx_t c2m_ctx, struct data_image *image) {
+  gen_ctx_t gen_ctx = c2m_ctx->gen_ctx;
+  struct lir_ctx *lir = gen_ctx->lir;
+  lir_arg_t arg;
+  lir_call_t call;
+  int d;
+
+  memset (&call, 0, sizeof (call));
+  memset (&arg, 0, sizeof (arg));
+  call.target = lir_imm_op (image == &gen_ctx->tls ? (sljit_sw) tls_block : (sljit_sw) inst_block);
+  call.n_fixed = call.nargs = 1;
+  call.first_arg = (int) VARR_LENGTH (lir_arg_t, lir->args);
+  call.arg_types = SLJIT_ARGS1 (P, P);
+  arg.val = lir_imm_op ((sljit_sw) image);
+  VARR_PUSH (lir_arg_t, lir->args, arg);
+  VARR_PUSH (lir_call_t, lir->calls, call);
+  d = lir_new_vreg (c2m_ctx, NULL);
+  lir_emit (c2m_ctx, LIR_CALL, d, lir_none_op (), lir_none_op ())->disp
+    = (sljit_sw) VARR_LENGTH (lir_call_t, lir->calls) - 1;
+  lir->has_call_p = TRUE;
+  return d;
+}
+
+/* Copy aggregate LV's worth of bytes from address SRC into LV. */
+static void lir_copy_aggregate (c2m_ctx_t c2m_ctx, lir_lval_t *lv, lir_opnd_t src) {
+  sljit_sw size = (sljit_sw) type_size (c2m_ctx, lv->type), pos = 0;
+  lir_insn_t *insn;
+
+  if (size > 64) {
+    lir_gen_libc_call (c2m_ctx, (void *) memmove, lir_lval_addr (c2m_ctx, lv),
+                       lir_force_vreg (c2m_ctx, src), lir_imm_op (size));
+    return;
+  }
+  if (src.mode == LIR_OP_SP) src = lir_force_vreg (c2m_ctx, src);
+  for (int chunk = 8; chunk >= 1; chunk /= 2)
+    for (; size - pos >= chunk; pos += chunk) {
+      sljit_s32 op = chunk == 8   ? SLJIT_MOV
+                     : chunk == 4 ? SLJIT_MOV32
+                     : chunk == 2 ? SLJIT_MOV_U16
+                                  : SLJIT_MOV_U8;
+      int d = lir_new_vreg (c2m_ctx, NULL);
+      insn = lir_emit (c2m_ctx, LIR_LOAD, d, src, lir_none_op ());
+      insn->op = op;
+      insn->disp = pos;
+      insn->volatile_p = lv->volatile_p;
+      insn = lir_emit (c2m_ctx, LIR_STORE, 0, lv->base, lir_vreg_op (d));
+      insn->op = op;
+      insn->disp = lv->disp + pos;
+      insn->volatile_p = lv->volatile_p;
+      insn->obj = lv->obj;
+    }
+}
+
+/* Store V (already converted to the object type) into LV, return the stored value. */
+static lir_opnd_t lir_assign (c2m_ctx_t c2m_ctx, lir_lval_t *lv, lir_opnd_t v) {
+  struct type *type = lv->type;
+  lir_insn_t *insn;
+
+  if (lv->vreg != 0) {
+    lir_move (c2m_ctx, lv->vreg, v);
+    return lir_vreg_op (lv->vreg);
+  }
+  if (lir_aggregate_p (type)) {
+    lir_copy_aggregate (c2m_ctx, lv, v);
+    return lir_lval_addr (c2m_ctx, lv);
+  }
+  if (!lir_value_type_p (type) || type->mode == TM_ARR || type->mode == TM_FUNC) {
+    lir_unsupported (c2m_ctx, "aggregate assignment");
+    return v;
+  }
+  if (is_float_type (type)) {
+    insn = lir_emit (c2m_ctx, LIR_FSTORE, 0, lv->base, v);
+    insn->op = is_f32_type (type) ? SLJIT_MOV_F32 : SLJIT_MOV_F64;
+  } else {
+    insn = lir_emit (c2m_ctx, LIR_STORE, 0, lv->base, v);
+    insn->op = lir_store_op (type);
+  }
+  insn->disp = lv->disp;
+  insn->volatile_p = lv->volatile_p;
+  insn->obj = lv->obj;
+  return v;
+}
+
+/* ---- Opt 18: arithmetic lowering ---- */
+
+static lir_opnd_t lir_scale (c2m_ctx_t c2m_ctx, lir_opnd_t idx, sljit_sw size) {
+  int d, log2;
+
+  if (size == 1) return idx;
+  if (idx.mode == LIR_OP_IMM) return lir_imm_op (idx.imm * size);
+  d = lir_new_vreg (c2m_ctx, NULL);
+  if ((log2 = is_power_of_2 (size)) >= 0)
+    lir_emit (c2m_ctx, LIR_SHL, d, idx, lir_imm_op (log2));
+  else
+    lir_emit (c2m_ctx, LIR_MUL, d, idx, lir_imm_op (size));
+  return lir_vreg_op (d);
+}
+
+static int lir_commutative_p (lir_code_t code) {
+  return code == LIR_ADD || code == LIR_MUL || code == LIR_AND || code == LIR_OR
+         || code == LIR_XOR;
+}
+
+/* Fold integer operation on constants A and B of SIZE bytes.  Return FALSE
+   when the result is undefined (division by zero or overflow). */
+static int lir_fold (lir_code_t code, sljit_sw a, sljit_sw b, int size, int unsigned_p,
+                     sljit_sw *res) {
+  sljit_uw ua = (sljit_uw) a, ub = (sljit_uw) b;
+  int bits = size * 8;
+
+  switch (code) {
+  case LIR_ADD: *res = (sljit_sw) (ua + ub); break;
+  case LIR_SUB: *res = (sljit_sw) (ua - ub); break;
+  case LIR_MUL: *res = (sljit_sw) (ua * ub); break;
+  case LIR_AND: *res = a & b; break;
+  case LIR_OR: *res = a | b; break;
+  case LIR_XOR: *res = a ^ b; break;
+  case LIR_SHL: *res = (sljit_sw) (ua << (ub & (bits - 1))); break;
+  case LIR_LSHR: *res = (sljit_sw) ((sljit_uw) lir_trunc_imm (a, size, TRUE) >> (ub & (bits - 1))); break;
+  case LIR_ASHR: *res = lir_trunc_imm (a, size, FALSE) >> (ub & (bits - 1)); break;
+  case LIR_DIV:
+  case LIR_MOD:
+    a = lir_trunc_imm (a, size, FALSE);
+    b = lir_trunc_imm (b, size, FALSE);
+    if (b == 0 || (b == -1 && a == (size == 4 ? (sljit_sw) INT32_MIN : (sljit_sw) ((sljit_uw) 1 << (bits - 1)))))
+      return FALSE;
+    *res = code == LIR_DIV ? a / b : a % b;
+    break;
+  case LIR_UDIV:
+  case LIR_UMOD:
+    ua = (sljit_uw) lir_trunc_imm (a, size, TRUE);
+    ub = (sljit_uw) lir_trunc_imm (b, size, TRUE);
+    if (ub == 0) return FALSE;
+    *res = (sljit_sw) (code == LIR_UDIV ? ua / ub : ua % ub);
+    break;
+  default: return FALSE;
+  }
+  *res = lir_trunc_imm (*res, size, unsigned_p);
+  return TRUE;
+}
+
+static lir_opnd_t lir_op2 (c2m_ctx_t c2m_ctx, lir_code_t code, int size, lir_opnd_t a,
+                           lir_opnd_t b) {
+  int d = lir_new_vreg (c2m_ctx, NULL);
+  lir_emit (c2m_ctx, code, d, a, b)->flags = size == 4 ? SLJIT_32 : 0;
+  return lir_vreg_op (d);
+}
+
+/* Quotient of A by constant C > 1 through multiplication by a magic number
+   (see compute_signed_magic32 and friends), or a none operand when the
+   divisor is not handled.  Signed 32-bit division uses a plain 64-bit
+   multiplication, the other cases the high word of a widening one. */
+static lir_opnd_t lir_magic_div (c2m_ctx_t c2m_ctx, lir_opnd_t a, sljit_sw c, int size,
+                                 int unsigned_p) {
+  int x;
+  lir_opnd_t q, t;
+
+  if (sizeof (sljit_sw) < 8) return lir_none_op (); /* as in emit_signed_div_magic */
+  if (size == 4 && !unsigned_p) {
+    struct magic_signed ms = compute_signed_magic32 ((int32_t) c);
+    x = lir_new_vreg (c2m_ctx, NULL);
+    lir_emit (c2m_ctx, LIR_EXT, x, a, lir_none_op ())->op = SLJIT_MOV_S32;
+    q = lir_op2 (c2m_ctx, LIR_MUL, 8, lir_vreg_op (x), lir_imm_op ((sljit_sw) ms.magic));
+    q = lir_op2 (c2m_ctx, LIR_ASHR, 8, q, lir_imm_op (32 + ms.shift));
+    t = lir_op2 (c2m_ctx, LIR_LSHR, 8, lir_vreg_op (x), lir_imm_op (63));
+    return lir_op2 (c2m_ctx, LIR_ADD, 4, q, t);
+  }
+  if (size == 4) {
+    /* x < 2^32, so the high word of x * ceil (2^64 / c) is exact */
+    x = lir_new_vreg (c2m_ctx, NULL);
+    lir_emit (c2m_ctx, LIR_EXT, x, a, lir_none_op ())->op = SLJIT_MOV_U32;
+    return lir_op2 (c2m_ctx, LIR_MULHU, 8, lir_vreg_op (x),
+                    lir_imm_op ((sljit_sw) (UINT64_MAX / (uint64_t) c + 1)));
+  }
+  a = lir_force_vreg (c2m_ctx, a);
+  if (!unsigned_p) {
+    struct magic_signed ms = compute_signed_magic64 ((int64_t) c);
+    q = lir_op2 (c2m_ctx, LIR_MULHS, 8, a, lir_imm_op ((sljit_sw) ms.magic));
+    if (ms.magic < 0) q = lir_op2 (c2m_ctx, LIR_ADD, 8, q, a);
+    if (ms.shift > 0) q = lir_op2 (c2m_ctx, LIR_ASHR, 8, q, lir_imm_op (ms.shift));
+    t = lir_op2 (c2m_ctx, LIR_LSHR, 8, q, lir_imm_op (63));
+    return lir_op2 (c2m_ctx, LIR_ADD, 8, q, t);
+  }
+  if ((uint64_t) c >> 63 != 0) { /* the quotient is 0 or 1 */
+    x = lir_new_vreg (c2m_ctx, NULL);
+    lir_insn_t *insn = lir_emit (c2m_ctx, LIR_SETCC, x, a, lir_imm_op (c));
+    insn->op = SLJIT_GREATER_EQUAL;
+    return lir_vreg_op (x);
+  }
+  struct magic_unsigned mu = compute_unsigned_magic64 ((uint64_t) c);
+  t = lir_op2 (c2m_ctx, LIR_MULHU, 8, a, lir_imm_op ((sljit_sw) mu.magic));
+  q = lir_op2 (c2m_ctx, LIR_SUB, 8, a, t);
+  q = lir_op2 (c2m_ctx, LIR_LSHR, 8, q, lir_imm_op (1));
+  q = lir_op2 (c2m_ctx, LIR_ADD, 8, q, t);
+  return mu.shift > 0 ? lir_op2 (c2m_ctx, LIR_LSHR, 8, q, lir_imm_op (mu.shift)) : q;
+}
+
+/* Integer operation CODE in TYPE (already promoted) with constant folding and,
+   under the Opt 6 flags, strength reduction of constant right operands. */
+static lir_opnd_t lir_arith (c2m_ctx_t c2m_ctx, lir_code_t code, struct type *type,
+                             lir_opnd_t a, lir_opnd_t b) {
+  int size = lir_type_size (type) < 8 ? 4 : 8, unsigned_p = lir_unsigned_p (type);
+  int bits = size * 8, log2;
+  sljit_sw c, res;
+
+  if (a.mode == LIR_OP_IMM && b.mode == LIR_OP_IMM
+      && lir_fold (code, a.imm, b.imm, size, unsigned_p, &res))
+    return lir_imm_op (res);
+  if (a.mode == LIR_OP_IMM && b.mode != LIR_OP_IMM && lir_commutative_p (code)) {
+    lir_opnd_t t = a;
+    a = b;
+    b = t;
+  }
+  if (b.mode != LIR_OP_IMM || a.mode == LIR_OP_IMM) return lir_op2 (c2m_ctx, code, size, a, b);
+  c = lir_trunc_imm (b.imm, size, unsigned_p);
+  switch (code) {
+  case LIR_ADD:
+  case LIR_SUB:
+  case LIR_OR:
+  case LIR_XOR:
+  case LIR_SHL:
+  case LIR_LSHR:
+  case LIR_ASHR:
+    if (c == 0) return a;
+    break;
+  case LIR_AND:
+    if (c == 0) return lir_imm_op (0);
+    if (lir_trunc_imm (c, size, FALSE) == -1) return a;
+    break;
+  case LIR_MUL:
+    if (c == 0) return lir_imm_op (0);
+    if (c == 1) return a;
+    if (c2m_options->opt_strength_reduce_p && (log2 = is_power_of_2 (c)) > 0)
+      return lir_op2 (c2m_ctx, LIR_SHL, size, a, lir_imm_op (log2));
+    break;
+  case LIR_UDIV:
+  case LIR_UMOD:
+    if (c == 1) return code == LIR_UDIV ? a : lir_imm_op (0);
+    if (c2m_options->opt_strength_reduce_p && (log2 = is_power_of_2 (c)) > 0)
+      return code == LIR_UDIV ? lir_op2 (c2m_ctx, LIR_LSHR, size, a, lir_imm_op (log2))
+                              : lir_op2 (c2m_ctx, LIR_AND, size, a, lir_imm_op (c - 1));
+    if (c2m_options->opt_magic_div_p && c != 0) {
+      /* The remainder reuses the quotient sequence, so x / c and x % c
+         share it under value numbering. */
+      lir_opnd_t q = lir_magic_div (c2m_ctx, a, c, size, TRUE);
+      if (q.mode == LIR_OP_NONE) break;
+      if (code == LIR_UDIV) return q;
+      q = lir_op2 (c2m_ctx, LIR_MUL, size, q, lir_imm_op (c));
+      return lir_op2 (c2m_ctx, LIR_SUB, size, a, q);
+    }
+    break;
+  case LIR_DIV:
+  case LIR_MOD:
+    if (c == 1) return code == LIR_DIV ? a : lir_imm_op (0);
+    if (c2m_options->opt_strength_reduce_p && (log2 = is_power_of_2 (c)) > 0) {
+      /* Round toward zero: add c - 1 to negative dividends. */
+      lir_opnd_t t = lir_op2 (c2m_ctx, LIR_ASHR, size, a, lir_imm_op (bits - 1));
+      t = lir_op2 (c2m_ctx, LIR_LSHR, size, t, lir_imm_op (bits - log2));
+      t = lir_op2 (c2m_ctx, LIR_ADD, size, a, t);
+      if (code == LIR_DIV) return lir_op2 (c2m_ctx, LIR_ASHR, size, t, lir_imm_op (log2));
+      t = lir_op2 (c2m_ctx, LIR_AND, size, t, lir_imm_op (-c));
+      return lir_op2 (c2m_ctx, LIR_SUB, size, a, t);
+    }
+    if (c2m_options->opt_magic_div_p && c > 1) {
+      lir_opnd_t q = lir_magic_div (c2m_ctx, a, c, size, FALSE);
+      if (q.mode == LIR_OP_NONE) break;
+      if (code == LIR_DIV) return q;
+      q = lir_op2 (c2m_ctx, LIR_MUL, size, q, lir_imm_op (c));
+      return lir_op2 (c2m_ctx, LIR_SUB, size, a, q);
+    }
+    break;
+  default: break;
+  }
+  return lir_op2 (c2m_ctx, code, size, a, b);
+}
+
+/* Binary operation of node CODE on A and B already converted to TYPE. */
+static lir_opnd_t lir_binop (c2m_ctx_t c2m_ctx, node_code_t code, struct type *type,
+                             lir_opnd_t a, lir_opnd_t b) {
+  int unsigned_p = lir_unsigned_p (type);
+  lir_code_t lc;
+
+  if (is_float_type (type)) {
+    switch (code) {
+    case N_ADD: lc = LIR_FADD; break;
+    case N_SUB: lc = LIR_FSUB; break;
+    case N_MUL: lc = LIR_FMUL; break;
+    case N_DIV: lc = LIR_FDIV; break;
+    default: lir_unsupported (c2m_ctx, "float operation"); return a;
+    }
+    int d = lir_new_vreg (c2m_ctx, type);
+    lir_emit (c2m_ctx, lc, d, a, b)->flags = is_f32_type (type) ? SLJIT_32 : 0;
+    return lir_vreg_op (d);
+  }
+  switch (code) {
+  case N_ADD: lc = LIR_ADD; break;
+  case N_SUB: lc = LIR_SUB; break;
+  case N_MUL: lc = LIR_MUL; break;
+  case N_DIV: lc = unsigned_p ? LIR_UDIV : LIR_DIV; break;
+  case N_MOD: lc = unsigned_p ? LIR_UMOD : LIR_MOD; break;
+  case N_AND: lc = LIR_AND; break;
+  case N_OR: lc = LIR_OR; break;
+  case N_XOR: lc = LIR_XOR; break;
+  case N_LSH: lc = LIR_SHL; break;
+  default: lc = unsigned_p ? LIR_LSHR : LIR_ASHR; break;
+  }
+  return lir_arith (c2m_ctx, lc, type, a, b);
+}
+
+static node_code_t lir_assign_base_code (node_code_t code) {
+  switch (code) {
+  case N_AND_ASSIGN: return N_AND;
+  case N_OR_ASSIGN: return N_OR;
+  case N_XOR_ASSIGN: return N_XOR;
+  case N_LSH_ASSIGN: return N_LSH;
+  case N_RSH_ASSIGN: return N_RSH;
+  case N_ADD_ASSIGN: return N_ADD;
+  case N_SUB_ASSIGN: return N_SUB;
+  case N_MUL_ASSIGN: return N_MUL;
+  case N_DIV_ASSIGN: return N_DIV;
+  default: return N_MOD;
+  }
+}
+
+static int lir_ptr_type_p (struct type *type) {
+  return type->mode == TM_PTR || type->mode == TM_ARR || type->mode == TM_FUNC;
+}
+
+/* Pointer P plus or minus (CODE) integer I of type IT scaled by the size of
+   PTR_TYPE elements. */
+static lir_opnd_t lir_ptr_arith (c2m_ctx_t c2m_ctx, lir_code_t code, struct type *ptr_type,
+                                 lir_opnd_t p, lir_opnd_t i, struct type *it) {
+  struct lir_ctx *lir = c2m_ctx->gen_ctx->lir;
+
+  i = lir_cvt (c2m_ctx, i, it, lir_unsigned_p (it) ? &lir->ulong_type : &lir->long_type);
+  i = lir_scale (c2m_ctx, i, lir_elem_size (c2m_ctx, ptr_type));
+  return lir_arith (c2m_ctx, code, &lir->long_type, p, i);
+}
+
+/* ---- Opt 18: comparisons and conditional branches ---- */
+
+static lir_opnd_t lir_const (c2m_ctx_t c2m_ctx, struct expr *e) {
+  struct type *type = e->type;
+
+  if (floating_type_p (type)) return lir_fconst (c2m_ctx, (double) e->c.d_val, is_f32_type (type));
+  if (lir_bool_p (type)) return lir_imm_op (e->c.u_val != 0);
+  return lir_imm_op (lir_trunc_imm (signed_integer_type_p (type) ? (sljit_sw) e->c.i_val
+                                                                 : (sljit_sw) e->c.u_val,
+                                    lir_type_size (type), lir_unsigned_p (type)));
+}
+
+static int lir_const_true_p (struct expr *e) {
+  if (floating_type_p (e->type)) return e->c.d_val != 0;
+  return e->c.u_val != 0;
+}
+
+typedef struct {
+  int float_p;
+  sljit_s32 cond, flags;
+  lir_opnd_t a, b;
+} lir_cmp_t;
+
+/* Evaluate operands of comparison node R.  Integer operands are arranged so
+   that an immediate can only be the second one. */
+static void lir_gen_cmp (c2m_ctx_t c2m_ctx, node_t r, lir_cmp_t *cmp) {
+  struct lir_ctx *lir = c2m_ctx->gen_ctx->lir;
+  node_t l = NL_HEAD (r->u.ops), rn = NL_NEXT (l);
+  struct type *lt = ((struct expr *) l->attr)->type, *rt = ((struct expr *) rn->attr)->type;
+  struct type t;
+
+  if (lir_ptr_type_p (lt) || lir_ptr_type_p (rt))
+    t = lir->ulong_type;
+  else
+    t = arithmetic_conversion (lt, rt);
+  cmp->a = lir_cvt (c2m_ctx, lir_gen_expr (c2m_ctx, l), lt, &t);
+  cmp->b = lir_cvt (c2m_ctx, lir_gen_expr (c2m_ctx, rn), rt, &t);
+  cmp->float_p = is_float_type (&t);
+  if (cmp->float_p) {
+    cmp->cond = float_comparison_cond (r->code);
+    cmp->flags = is_f32_type (&t) ? SLJIT_32 : 0;
+    return;
+  }
+  cmp->cond = lir_int_cond (r->code, lir_unsigned_p (&t));
+  cmp->flags = lir_type_size (&t) <= 4 ? SLJIT_32 : 0;
+  if (cmp->a.mode == LIR_OP_IMM && cmp->b.mode != LIR_OP_IMM) {
+    lir_opnd_t tmp = cmp->a;
+    cmp->a = cmp->b;
+    cmp->b = tmp;
+    cmp->cond = lir_swap_cond (cmp->cond);
+  }
+}
+
+static int lir_cmp_node_p (node_code_t code) {
+  return code == N_EQ || code == N_NE || code == N_LT || code == N_LE || code == N_GT
+         || code == N_GE;
+}
+
+/* Jump to LABEL when the value of R is TRUE_P. */
+static void lir_gen_cond (c2m_ctx_t c2m_ctx, node_t r, int true_p, int label) {
+  struct expr *e = r->attr;
+  lir_insn_t *insn;
+  lir_cmp_t cmp;
+  lir_opnd_t v;
+  int skip;
+
+  if (e->const_p) {
+    if (lir_const_true_p (e) == true_p) lir_emit_jump (c2m_ctx, label);
+    return;
+  }
+  switch (r->code) {
+  case N_NOT: lir_gen_cond (c2m_ctx, NL_HEAD (r->u.ops), !true_p, label); return;
+  case N_COMMA:
+    lir_gen_expr (c2m_ctx, NL_HEAD (r->u.ops));
+    lir_gen_cond (c2m_ctx, NL_EL (r->u.ops, 1), true_p, label);
+    return;
+  case N_ANDAND:
+  case N_OROR:
+    if ((r->code == N_ANDAND) == true_p) {
+      skip = lir_new_label (c2m_ctx);
+      lir_gen_cond (c2m_ctx, NL_HEAD (r->u.ops), !true_p, skip);
+      lir_gen_cond (c2m_ctx, NL_EL (r->u.ops, 1), true_p, label);
+      lir_emit_label (c2m_ctx, skip);
+    } else {
+      lir_gen_cond (c2m_ctx, NL_HEAD (r->u.ops), true_p, label);
+      lir_gen_cond (c2m_ctx, NL_EL (r->u.ops, 1), true_p, label);
+    }
+    return;
+  default: break;
+  }
+  if (lir_cmp_node_p (r->code)) {
+    lir_gen_cmp (c2m_ctx, r, &cmp);
+  } else {
+    v = lir_gen_expr (c2m_ctx, r);
+    cmp.float_p = is_float_type (e->type);
+    if (cmp.float_p) {
+      cmp.a = v;
+      cmp.b = lir_fconst (c2m_ctx, 0.0, is_f32_type (e->type));
+      cmp.cond = SLJIT_F_NOT_EQUAL;
+      cmp.flags = is_f32_type (e->type) ? SLJIT_32 : 0;
+    } else {
+      cmp.a = v;
+      cmp.b = lir_imm_op (0);
+      cmp.cond = SLJIT_NOT_EQUAL;
+      cmp.flags = lir_type_size (e->type) <= 4 ? SLJIT_32 : 0;
+    }
+  }
+  if (cmp.float_p) {
+    insn = lir_emit (c2m_ctx, LIR_FBCC, 0, cmp.a, cmp.b);
+    insn->op = true_p ? cmp.cond : invert_float_cond (cmp.cond);
+  } else {
+    if (cmp.a.mode == LIR_OP_IMM) {
+      if (lir_cond_true_p (cmp.cond, cmp.a.imm, cmp.b.imm, cmp.flags ? 4 : 8) == true_p)
+        lir_emit_jump (c2m_ctx, label);
+      return;
+    }
+    insn = lir_emit (c2m_ctx, LIR_BCC, 0, cmp.a, cmp.b);
+    insn->op = true_p ? cmp.cond : invert_sljit_cond (cmp.cond);
+  }
+  insn->flags = cmp.flags;
+  insn->disp = label;
+}
+
+/* ---- Opt 18: expressions ---- */
+
+static lir_opnd_t lir_setcc (c2m_ctx_t c2m_ctx, lir_cmp_t *cmp) {
+  lir_insn_t *insn;
+  int d;
+
+  if (!cmp->float_p && cmp->a.mode == LIR_OP_IMM)
+    return lir_imm_op (lir_cond_true_p (cmp->cond, cmp->a.imm, cmp->b.imm, cmp->flags ? 4 : 8));
+  d = lir_new_vreg (c2m_ctx, NULL);
+  insn = lir_emit (c2m_ctx, cmp->float_p ? LIR_FSETCC : LIR_SETCC, d, cmp->a, cmp->b);
+  insn->op = cmp->cond;
+  insn->flags = cmp->flags;
+  return lir_vreg_op (d);
+}
+
+/* Value of a logical expression through conditional branches. */
+static lir_opnd_t lir_gen_bool (c2m_ctx_t c2m_ctx, node_t r) {
+  int d = lir_new_vreg (c2m_ctx, NULL);
+  int false_label = lir_new_label (c2m_ctx), end_label = lir_new_label (c2m_ctx);
+
+  lir_gen_cond (c2m_ctx, r, FALSE, false_label);
+  lir_emit (c2m_ctx, LIR_MOV, d, lir_imm_op (1), lir_none_op ());
+  lir_emit_jump (c2m_ctx, end_label);
+  lir_emit_label (c2m_ctx, false_label);
+  lir_emit (c2m_ctx, LIR_MOV, d, lir_imm_op (0), lir_none_op ());
+  lir_emit_label (c2m_ctx, end_label);
+  return lir_vreg_op (d);
+}
+
+static lir_opnd_t lir_gen_call (c2m_ctx_t c2m_ctx, node_t r);
+
+/* Pre/post increment and decrement. */
+static lir_opnd_t lir_gen_incdec (c2m_ctx_t c2m_ctx, node_t r) {
+  struct lir_ctx *lir = c2m_ctx->gen_ctx->lir;
+  struct expr *e = r->attr;
+  struct type *t2 = e->type2 != NULL ? e->type2 : e->type;
+  int post_p = r->code == N_POST_INC || r->code == N_POST_DEC;
+  int inc_p = r->code == N_INC || r->code == N_POST_INC;
+  lir_opnd_t old, res;
+  lir_lval_t lv;
+
+  lir_gen_lval (c2m_ctx, NL_HEAD (r->u.ops), &lv);
+  old = lir_lval_value (c2m_ctx, &lv);
+  if (post_p && lv.vreg != 0) { /* the variable itself is about to change */
+    int copy = lir_new_vreg (c2m_ctx, lv.type);
+    lir_move (c2m_ctx, copy, old);
+    old = lir_vreg_op (copy);
+  }
+  if (lir_ptr_type_p (t2)) {
+    res = lir_ptr_arith (c2m_ctx, inc_p ? LIR_ADD : LIR_SUB, t2, old, lir_imm_op (1),
+                         &lir->long_type);
+  } else if (is_float_type (t2)) {
+    res = lir_binop (c2m_ctx, inc_p ? N_ADD : N_SUB, t2, lir_cvt (c2m_ctx, old, lv.type, t2),
+                     lir_fconst (c2m_ctx, 1.0, is_f32_type (t2)));
+  } else {
+    res = lir_arith (c2m_ctx, inc_p ? LIR_ADD : LIR_SUB, t2, lir_cvt (c2m_ctx, old, lv.type, t2),
+                     lir_imm_op (1));
+  }
+  res = lir_assign (c2m_ctx, &lv, lir_cvt (c2m_ctx, res, t2, lv.type));
+  return post_p ? old : res;
+}
+
+static lir_opnd_t lir_gen_expr (c2m_ctx_t c2m_ctx, node_t r) {
+  struct lir_ctx *lir = c2m_ctx->gen_ctx->lir;
+  struct expr *e = r->attr;
+  node_t op1, op2;
+  struct type *t1, *t2;
+  lir_opnd_t a, b;
+  lir_lval_t lv;
+  lir_cmp_t cmp;
+  int d;
+
+  if (lir->unsupported_p) return lir_imm_op (0);
+  if (e == NULL || e->type == NULL) {
+    lir_unsupported (c2m_ctx, "expression without type");
+    return lir_imm_op (0);
+  }
+  if (!void_type_p (e->type) && !lir_value_type_p (e->type) && !lir_aggregate_p (e->type)) {
+    lir_unsupported (c2m_ctx, "long double value");
+    return lir_imm_op (0);
+  }
+  if (e->const_p && !void_type_p (e->type) && scalar_type_p (e->type)) return lir_const (c2m_ctx, e);
+  switch (r->code) {
+  case N_STR:
+    lir_gen_lval (c2m_ctx, r, &lv);
+    return lir_lval_addr (c2m_ctx, &lv);
+  case N_ID:
+  case N_IND:
+  case N_DEREF:
+  case N_FIELD:
+  case N_DEREF_FIELD:
+    lir_gen_lval (c2m_ctx, r, &lv);
+    return lir_lval_value (c2m_ctx, &lv);
+  case N_ADDR:
+    lir_gen_lval (c2m_ctx, NL_HEAD (r->u.ops), &lv);
+    return lir_lval_addr (c2m_ctx, &lv);
+  case N_COMMA:
+    lir_gen_expr (c2m_ctx, NL_HEAD (r->u.ops));
+    return lir_gen_expr (c2m_ctx, NL_EL (r->u.ops, 1));
+  case N_CAST:
+    op1 = NL_EL (r->u.ops, 1);
+    return lir_cvt (c2m_ctx, lir_gen_expr (c2m_ctx, op1), ((struct expr *) op1->attr)->type,
+                    e->type);
+  case N_CALL: return lir_gen_call (c2m_ctx, r);
+  case N_NOT:
+  case N_ANDAND:
+  case N_OROR: return lir_gen_bool (c2m_ctx, r);
+  case N_EQ:
+  case N_NE:
+  case N_LT:
+  case N_LE:
+  case N_GT:
+  case N_GE: lir_gen_cmp (c2m_ctx, r, &cmp); return lir_setcc (c2m_ctx, &cmp);
+  case N_BITWISE_NOT:
+    op1 = NL_HEAD (r->u.ops);
+    a = lir_cvt (c2m_ctx, lir_gen_expr (c2m_ctx, op1), ((struct expr *) op1->attr)->type, e->type);
+    return lir_arith (c2m_ctx, LIR_XOR, e->type, a, lir_imm_op (-1));
+  case N_COND: {
+    node_t cond = NL_HEAD (r->u.ops), e1 = NL_NEXT (cond), e2 = NL_NEXT (e1);
+    int else_label = lir_new_label (c2m_ctx), end_label = lir_new_label (c2m_ctx);
+    int void_p = void_type_p (e->type);
+    if (lir_aggregate_p (e->type)) {
+      lir_unsupported (c2m_ctx, "aggregate conditional expression");
+      return lir_imm_op (0);
+    }
+    d = void_p ? 0 : lir_new_vreg (c2m_ctx, e->type);
+    lir_gen_cond (c2m_ctx, cond, FALSE, else_label);
+    a = lir_cvt (c2m_ctx, lir_gen_expr (c2m_ctx, e1), ((struct expr *) e1->attr)->type, e->type);
+    if (!void_p) lir_move (c2m_ctx, d, a);
+    lir_emit_jump (c2m_ctx, end_label);
+    lir_emit_label (c2m_ctx, else_label);
+    b = lir_cvt (c2m_ctx, lir_gen_expr (c2m_ctx, e2), ((struct expr *) e2->attr)->type, e->type);
+    if (!void_p) lir_move (c2m_ctx, d, b);
+    lir_emit_label (c2m_ctx, end_label);
+    return void_p ? lir_none_op () : lir_vreg_op (d);
+  }
+  case N_ASSIGN:
+    op1 = NL_HEAD (r->u.ops);
+    op2 = NL_NEXT (op1);
+    lir_gen_lval (c2m_ctx, op1, &lv);
+    a = lir_gen_expr (c2m_ctx, op2);
+    return lir_assign (c2m_ctx, &lv, lir_cvt (c2m_ctx, a, ((struct expr *) op2->attr)->type, lv.type));
+  case N_AND_ASSIGN:
+  case N_OR_ASSIGN:
+  case N_XOR_ASSIGN:
+  case N_LSH_ASSIGN:
+  case N_RSH_ASSIGN:
+  case N_ADD_ASSIGN:
+  case N_SUB_ASSIGN:
+  case N_MUL_ASSIGN:
+  case N_DIV_ASSIGN:
+  case N_MOD_ASSIGN: {
+    node_code_t code = lir_assign_base_code (r->code);
+    op1 = NL_HEAD (r->u.ops);
+    op2 = NL_NEXT (op1);
+    t2 = ((struct expr *) op2->attr)->type;
+    lir_gen_lval (c2m_ctx, op1, &lv);
+    a = lir_lval_value (c2m_ctx, &lv);
+    b = lir_gen_expr (c2m_ctx, op2);
+    if (lir_ptr_type_p (e->type2)) {
+      a = lir_ptr_arith (c2m_ctx, code == N_ADD ? LIR_ADD : LIR_SUB, e->type2, a, b, t2);
+    } else {
+      a = lir_cvt (c2m_ctx, a, lv.type, e->type2);
+      b = lir_cvt (c2m_ctx, b, t2, e->type2);
+      a = lir_binop (c2m_ctx, code, e->type2, a, b);
+    }
+    return lir_assign (c2m_ctx, &lv, lir_cvt (c2m_ctx, a, e->type2, lv.type));
+  }
+  case N_INC:
+  case N_DEC:
+  case N_POST_INC:
+  case N_POST_DEC: return lir_gen_incdec (c2m_ctx, r);
+  case N_ADD:
+  case N_SUB:
+    op1 = NL_HEAD (r->u.ops);
+    op2 = NL_NEXT (op1);
+    t1 = ((struct expr *) op1->attr)->type;
+    if (op2 == NULL) {
+      a = lir_cvt (c2m_ctx, lir_gen_expr (c2m_ctx, op1), t1, e->type);
+      if (r->code == N_ADD) return a;
+      if (is_float_type (e->type)) {
+        d = lir_new_vreg (c2m_ctx, e->type);
+        lir_emit (c2m_ctx, LIR_FNEG, d, a, lir_none_op ())->flags
+          = is_f32_type (e->type) ? SLJIT_32 : 0;
+        return lir_vreg_op (d);
+      }
+      return lir_arith (c2m_ctx, LIR_SUB, e->type, lir_imm_op (0), a);
+    }
+    t2 = ((struct expr *) op2->attr)->type;
+    if (lir_ptr_type_p (t1) && lir_ptr_type_p (t2)) { /* pointer difference */
+      sljit_sw size = lir_elem_size (c2m_ctx, t1);
+      a = lir_gen_expr (c2m_ctx, op1);
+      b = lir_gen_expr (c2m_ctx, op2);
+      a = lir_arith (c2m_ctx, LIR_SUB, &lir->long_type, a, b);
+      return lir_arith (c2m_ctx, LIR_DIV, &lir->long_type, a, lir_imm_op (size));
+    }
+    if (lir_ptr_type_p (t1) || lir_ptr_type_p (t2)) {
+      a = lir_gen_expr (c2m_ctx, op1);
+      b = lir_gen_expr (c2m_ctx, op2);
+      if (lir_ptr_type_p (t1))
+        return lir_ptr_arith (c2m_ctx, r->code == N_ADD ? LIR_ADD : LIR_SUB, t1, a, b, t2);
+      return lir_ptr_arith (c2m_ctx, LIR_ADD, t2, b, a, t1);
+    }
+    /* falls through */
+  case N_MUL:
+  case N_DIV:
+  case N_MOD:
+  case N_AND:
+  case N_OR:
+  case N_XOR:
+  case N_LSH:
+  case N_RSH:
+    op1 = NL_HEAD (r->u.ops);
+    op2 = NL_NEXT (op1);
+    a = lir_cvt (c2m_ctx, lir_gen_expr (c2m_ctx, op1), ((struct expr *) op1->attr)->type, e->type);
+    b = lir_cvt (c2m_ctx, lir_gen_expr (c2m_ctx, op2), ((struct expr *) op2->attr)->type, e->type);
+    return lir_binop (c2m_ctx, r->code, e->type, a, b);
+  default: lir_unsupported (c2m_ctx, "expression"); return lir_imm_op (0);
+  }
+}
+
+/* ---- Opt 18: calls ---- */
+
+#define LIR_MAX_CALL_ARGS 10
+
+static lir_opnd_t lir_gen_call (c2m_ctx_t c2m_ctx, node_t r) {
+  struct lir_ctx *lir = c2m_ctx->gen_ctx->lir;
+  struct expr *e = r->attr;
+  node_t func = NL_HEAD (r->u.ops), args = NL_NEXT (func), param = NULL;
+  struct type *ftype, *ret_type = e->type;
+  lir_arg_t call_args[LIR_MAX_CALL_ARGS];
+  int n_int = 0, n_float = 0, d = 0;
+  lir_call_t call;
+
+  if (e->builtin_call_p) {
+    lir_unsupported (c2m_ctx, "builtin call");
+    return lir_imm_op (0);
+  }
+  ftype = ((struct expr *) func->attr)->type;
+  if (ftype->mode == TM_PTR) ftype = ftype->u.ptr_type;
+  if (ftype->mode != TM_FUNC || lir_aggregate_p (ret_type)) {
+    lir_unsupported (c2m_ctx, "call returning an aggregate");
+    return lir_imm_op (0);
+  }
+  memset (&call, 0, sizeof (call));
+  if (ftype->u.func_type->param_list != NULL) {
+    param = NL_HEAD (ftype->u.func_type->param_list->u.ops);
+    if (param != NULL && void_param_p (param)) param = NULL;
+    for (node_t p = param; p != NULL && p->code != N_DOTS; p = NL_NEXT (p)) call.n_fixed++;
+  }
+  if (func->code == N_ID && ((struct expr *) func->attr)->u.lvalue_node == NULL) {
+    struct func_slot *slot = get_callee_slot (c2m_ctx, func);
+    if (slot != NULL) {
+      call.target = lir_imm_op ((sljit_sw) &slot->code_addr);
+      call.slot_p = TRUE;
+    } else {
+      void *addr = dlsym (RTLD_DEFAULT, func->u.s.s);
+      if (addr == NULL) lir_unsupported (c2m_ctx, "unresolved external function");
+      call.target = lir_imm_op ((sljit_sw) addr);
+    }
+  } else {
+    call.target = lir_force_vreg (c2m_ctx, lir_gen_expr (c2m_ctx, func));
+    lir->has_icall_p = TRUE;
+  }
+  if (ftype->u.func_type->dots_p) {
+    if (call.slot_p) {
+      lir_unsupported (c2m_ctx, "call of variadic function defined in the module");
+      return lir_imm_op (0);
+    }
+    call.trampoline_p = TRUE;
+  }
+  /* Arguments are collected locally first: nested calls in them push their
+     own arguments. */
+  for (node_t arg = args == NULL ? NULL : NL_HEAD (args->u.ops); arg != NULL;
+       arg = NL_NEXT (arg), call.nargs++) {
+    struct type *at = ((struct expr *) arg->attr)->type, *pt;
+    struct type promoted;
+    lir_opnd_t v;
+    int fixed_p = param != NULL && param->code != N_DOTS;
+
+    if (call.nargs >= LIR_MAX_CALL_ARGS || lir_aggregate_p (at)) {
+      lir_unsupported (c2m_ctx, "call argument");
+      return lir_imm_op (0);
+    }
+    v = lir_gen_expr (c2m_ctx, arg);
+    if (fixed_p) {
+      pt = get_param_decl_spec (param)->type;
+      param = NL_NEXT (param);
+    } else if (is_f32_type (at)) {
+      pt = &lir->double_type;
+    } else if (integer_type_p (at)) {
+      promoted = integer_promotion (at);
+      pt = &promoted;
+    } else {
+      pt = at;
+    }
+    v = lir_cvt (c2m_ctx, v, at, pt);
+    call_args[call.nargs].float_p = is_float_type (pt);
+    call_args[call.nargs].f32_p = is_f32_type (pt);
+    if (call_args[call.nargs].float_p && call.trampoline_p) {
+      /* The trampoline receives every argument as a word. */
+      if (fixed_p) {
+        lir_unsupported (c2m_ctx, "float fixed argument of variadic call");
+        return lir_imm_op (0);
+      }
+      d = lir_new_vreg (c2m_ctx, NULL);
+      lir_emit (c2m_ctx, LIR_FCOPY, d, v, lir_none_op ());
+      v = lir_vreg_op (d);
+      call_args[call.nargs].float_p = call_args[call.nargs].f32_p = FALSE;
+    }
+    if (call_args[call.nargs].float_p)
+      n_float++;
+    else
+      n_int++;
+    call_args[call.nargs].val = v;
+  }
+  if (call.trampoline_p) {
+    if (call.n_fixed < 1 || call.n_fixed > 3 || is_float_type (ret_type)) {
+      lir_unsupported (c2m_ctx, "variadic call");
+      return lir_imm_op (0);
+    }
+    call.arg_types = SLJIT_ARGS4 (W, W, W, W, W);
+    lir->trampoline_p = TRUE;
+  } else {
+    if (call.nargs > 4) {
+      lir_unsupported (c2m_ctx, "call with more than 4 arguments");
+      return lir_imm_op (0);
+    }
+    call.arg_types = void_type_p (ret_type) ? SLJIT_ARG_TYPE_RET_VOID : sljit_arg_type_for (ret_type);
+    for (int i = 0; i < call.nargs; i++)
+      call.arg_types
+        |= (call_args[i].float_p ? (call_args[i].f32_p ? SLJIT_ARG_TYPE_F32 : SLJIT_ARG_TYPE_F64)
+                                 : SLJIT_ARG_TYPE_W)
+           << (SLJIT_ARG_SHIFT * (i + 1));
+  }
+  call.first_arg = (int) VARR_LENGTH (lir_arg_t, lir->args);
+  for (int i = 0; i < call.nargs; i++) VARR_PUSH (lir_arg_t, lir->args, call_args[i]);
+  VARR_PUSH (lir_call_t, lir->calls, call);
+  d = void_type_p (ret_type) ? 0 : lir_new_vreg (c2m_ctx, ret_type);
+  lir_emit (c2m_ctx, LIR_CALL, d, lir_none_op (), lir_none_op ())->disp
+    = (sljit_sw) VARR_LENGTH (lir_call_t, lir->calls) - 1;
+  lir->has_call_p = TRUE;
+  if (d == 0) return lir_none_op ();
+  if (!is_float_type (ret_type) && lir_type_size (ret_type) < 4) {
+    /* The callee may leave the upper bits of a narrow result undefined. */
+    int ext = lir_new_vreg (c2m_ctx, NULL);
+    lir_emit (c2m_ctx, LIR_EXT, ext, lir_vreg_op (d), lir_none_op ())->op
+      = lir_load_op (ret_type) | SLJIT_32;
+    d = ext;
+  }
+  return lir_vreg_op (d);
+}
+
+/* ---- Opt 18: statements ---- */
+
+static void lir_gen_stmt (c2m_ctx_t c2m_ctx, node_t r);
+
+static void lir_store_imm (c2m_ctx_t c2m_ctx, sljit_sw offset, sljit_sw val, int size) {
+  lir_insn_t *insn = lir_emit (c2m_ctx, LIR_STORE, 0, lir_sp_op (), lir_imm_op (val));
+  insn->op = size == 8 ? SLJIT_MOV : size == 4 ? SLJIT_MOV32 : size == 2 ? SLJIT_MOV_U16 : SLJIT_MOV_U8;
+  insn->disp = offset;
+}
+
+/* Store SIZE bytes of DATA (zeros when NULL) to the frame at OFFSET. */
+static void lir_store_bytes (c2m_ctx_t c2m_ctx, sljit_sw offset, const char *data, sljit_sw size) {
+  sljit_sw pos = 0;
+
+  if (size > 128) {
+    int d = lir_new_vreg (c2m_ctx, NULL);
+    lir_emit (c2m_ctx, LIR_LEA, d, lir_none_op (), lir_none_op ())->disp = offset;
+    if (data == NULL) {
+      lir_gen_libc_call (c2m_ctx, (void *) memset, lir_vreg_op (d), lir_imm_op (0), lir_imm_op (size));
+    } else {
+      const char *copy = data_string (c2m_ctx, data, (size_t) size);
+      lir_gen_libc_call (c2m_ctx, (void *) memcpy, lir_vreg_op (d), lir_imm_op ((sljit_sw) copy),
+                         lir_imm_op (size));
+    }
+    return;
+  }
+  for (int chunk = 8; chunk >= 1; chunk /= 2)
+    for (; size - pos >= chunk; pos += chunk) {
+      sljit_sw val = 0;
+      if (data != NULL) {
+        int64_t v64 = 0;
+        int32_t v32 = 0;
+        int16_t v16 = 0;
+        switch (chunk) {
+        case 8: memcpy (&v64, data + pos, 8); val = (sljit_sw) v64; break;
+        case 4: memcpy (&v32, data + pos, 4); val = v32; break;
+        case 2: memcpy (&v16, data + pos, 2); val = v16; break;
+        default: val = data[pos]; break;
+        }
+      }
+      lir_store_imm (c2m_ctx, offset + pos, val, chunk);
+    }
+}
+
+/* Initialize local aggregate DECL from a brace list without designators or
+   nested braces.  Members not mentioned are zeroed first. */
+static void lir_gen_aggregate_init (c2m_ctx_t c2m_ctx, decl_t decl, node_t init) {
+  struct type *type = decl->decl_spec.type, *el_type;
+  sljit_sw size = (sljit_sw) type_size (c2m_ctx, type), offset = (sljit_sw) decl->offset;
+  node_t member = NULL, val;
+  lir_lval_t lv;
+  int idx = 0;
+
+  if (init->code == N_STR || (init->code == N_LIST && NL_HEAD (init->u.ops) != NULL
+                              && NL_HEAD (init->u.ops)->code == N_INIT
+                              && NL_EL (NL_HEAD (init->u.ops)->u.ops, 1)->code == N_STR
+                              && type->mode == TM_ARR
+                              && lir_type_size (type->u.arr_type->el_type) == 1)) {
+    node_t str = init->code == N_STR ? init : NL_EL (NL_HEAD (init->u.ops)->u.ops, 1);
+    if (type->mode != TM_ARR || (sljit_sw) str->u.s.len > size) {
+      lir_unsupported (c2m_ctx, "string initializer");
+      return;
+    }
+    lir_store_bytes (c2m_ctx, offset, str->u.s.s, (sljit_sw) str->u.s.len);
+    if ((sljit_sw) str->u.s.len < size)
+      lir_store_bytes (c2m_ctx, offset + (sljit_sw) str->u.s.len, NULL,
+                       size - (sljit_sw) str->u.s.len);
+    return;
+  }
+  if (init->code != N_LIST) {
+    if (!lir_aggregate_p (type)) {
+      lir_unsupported (c2m_ctx, "aggregate initializer");
+      return;
+    }
+    lir_var_lval (c2m_ctx, decl, NULL, &lv);
+    lir_assign (c2m_ctx, &lv, lir_gen_expr (c2m_ctx, init));
+    return;
+  }
+  if (type->mode == TM_STRUCT || type->mode == TM_UNION) {
+    node_t decl_list = NL_EL (type->u.tag_type->u.ops, 1);
+    member = decl_list == NULL ? NULL : NL_HEAD (decl_list->u.ops);
+  }
+  lir_store_bytes (c2m_ctx, offset, NULL, size);
+  for (node_t n = NL_HEAD (init->u.ops); n != NULL; n = NL_NEXT (n)) {
+    if (n->code != N_INIT || NL_HEAD (NL_HEAD (n->u.ops)->u.ops) != NULL) {
+      lir_unsupported (c2m_ctx, "designated initializer");
+      return;
+    }
+    val = NL_EL (n->u.ops, 1);
+    lv.vreg = 0;
+    lv.base = lir_sp_op ();
+    lv.volatile_p = FALSE;
+    lv.obj = decl;
+    if (type->mode == TM_ARR) {
+      el_type = type->u.arr_type->el_type;
+      lv.disp = offset + idx++ * (sljit_sw) type_size (c2m_ctx, el_type);
+    } else {
+      while (member != NULL && member->code != N_MEMBER) member = NL_NEXT (member);
+      if (member == NULL) {
+        lir_unsupported (c2m_ctx, "aggregate initializer");
+        return;
+      }
+      decl_t md = member->attr;
+      if (md->bit_offset >= 0) {
+        lir_unsupported (c2m_ctx, "bit-field initializer");
+        return;
+      }
+      el_type = md->decl_spec.type;
+      lv.disp = offset + (sljit_sw) md->offset;
+      member = type->mode == TM_UNION ? NULL : NL_NEXT (member);
+    }
+    if (val->code == N_LIST || !scalar_type_p (el_type)) {
+      lir_unsupported (c2m_ctx, "nested initializer");
+      return;
+    }
+    lv.type = el_type;
+    lir_assign (c2m_ctx, &lv,
+                lir_cvt (c2m_ctx, lir_gen_expr (c2m_ctx, val), ((struct expr *) val->attr)->type,
+                         el_type));
+  }
+}
+
+static void lir_gen_decl (c2m_ctx_t c2m_ctx, node_t r) {
+  node_t init = NL_EL (r->u.ops, 4);
+  decl_t decl = r->attr;
+  struct decl_spec *ds;
+  lir_lval_t lv;
+
+  if (decl == NULL) return;
+  ds = &decl->decl_spec;
+  if (ds->typedef_p || ds->extern_p || ds->type->mode == TM_FUNC) return;
+  if (ds->static_p || ds->thread_local_p) {
+    lir_unsupported (c2m_ctx, "static local variable");
+    return;
+  }
+  if (ds->type->mode == TM_ARR && ds->type->raw_size == MIR_SIZE_MAX) {
+    lir_unsupported (c2m_ctx, "variable length array");
+    return;
+  }
+  if (init == NULL || init->code == N_IGNORE) return;
+  if (!scalar_type_p (ds->type)) {
+    lir_gen_aggregate_init (c2m_ctx, decl, init);
+    return;
+  }
+  if (init->code == N_LIST) {
+    node_t first = NL_HEAD (init->u.ops);
+    if (first == NULL || NL_NEXT (first) != NULL || first->code != N_INIT) {
+      lir_unsupported (c2m_ctx, "scalar initializer");
+      return;
+    }
+    init = first;
+  }
+  if (init->code == N_INIT) init = NL_EL (init->u.ops, 1);
+  lir_var_lval (c2m_ctx, decl, NULL, &lv);
+  lir_assign (c2m_ctx, &lv,
+              lir_cvt (c2m_ctx, lir_gen_expr (c2m_ctx, init), ((struct expr *) init->attr)->type,
+                       ds->type));
+}
+
+/* Emit labels of statement R (labels, case and default are keyed by R). */
+static void lir_gen_stmt_labels (c2m_ctx_t c2m_ctx, node_t r) {
+  node_t labels = NL_HEAD (r->u.ops);
+
+  if (labels == NULL || labels->code != N_LIST) return;
+  for (node_t l = NL_HEAD (labels->u.ops); l != NULL; l = NL_NEXT (l))
+    if (l->code == N_LABEL || l->code == N_CASE || l->code == N_DEFAULT) {
+      lir_emit_label (c2m_ctx, lir_stmt_label (c2m_ctx, r));
+      return;
+    }
+}
+
+static void lir_gen_loop (c2m_ctx_t c2m_ctx, node_t cond, node_t body, node_t iter, int guard_p) {
+  struct lir_ctx *lir = c2m_ctx->gen_ctx->lir;
+  int saved_break = lir->break_label, saved_continue = lir->continue_label;
+  int top = lir_new_label (c2m_ctx), end = lir_new_label (c2m_ctx);
+  int has_cond_p = cond != NULL && cond->code != N_IGNORE;
+
+  lir->break_label = end;
+  lir->continue_label = lir_new_label (c2m_ctx);
+  if (guard_p && has_cond_p) lir_gen_cond (c2m_ctx, cond, FALSE, end);
+  lir->depth++;
+  lir_emit_label (c2m_ctx, top);
+  lir_gen_stmt (c2m_ctx, body);
+  lir_emit_label (c2m_ctx, lir->continue_label);
+  if (iter != NULL && iter->code != N_IGNORE) lir_gen_expr (c2m_ctx, iter);
+  if (has_cond_p)
+    lir_gen_cond (c2m_ctx, cond, TRUE, top);
+  else
+    lir_emit_jump (c2m_ctx, top);
+  lir->depth--;
+  lir_emit_label (c2m_ctx, end);
+  lir->break_label = saved_break;
+  lir->continue_label = saved_continue;
+}
+
+/* ---- Opt 20: loop unrolling ---- */
+
+#define LIR_UNROLL_MAX_NODES 48
+#define LIR_FULL_UNROLL_NODES 64
+
+static int lir_int_const_p (node_t r, int64_t *val) {
+  struct expr *e = r->attr;
+
+  if (e == NULL || !e->const_p || !integer_type_p (e->type)) return FALSE;
+  *val = signed_integer_type_p (e->type) ? e->c.i_val : (int64_t) e->c.u_val;
+  return TRUE;
+}
+
+static decl_t lir_id_decl (node_t r) {
+  struct expr *e = r->attr;
+  if (r->code != N_ID || e == NULL || e->u.lvalue_node == NULL) return NULL;
+  return e->u.lvalue_node->attr;
+}
+
+/* Return TRUE if statement R can be emitted several times and does not
+   change variables IVAR and BOUND.  Labels would be duplicated and inner
+   loops are left to their own unrolling. */
+static int lir_unrollable_p (node_t r, decl_t ivar, decl_t bound) {
+  if (r == NULL) return TRUE;
+  switch (r->code) {
+  case N_LABEL:
+  case N_CASE:
+  case N_DEFAULT:
+  case N_GOTO:
+  case N_INDIRECT_GOTO:
+  case N_LABEL_ADDR:
+  case N_SWITCH:
+  case N_FOR:
+  case N_WHILE:
+  case N_DO:
+  case N_STMTEXPR: return FALSE;
+  case N_ASSIGN:
+  case N_AND_ASSIGN:
+  case N_OR_ASSIGN:
+  case N_XOR_ASSIGN:
+  case N_LSH_ASSIGN:
+  case N_RSH_ASSIGN:
+  case N_ADD_ASSIGN:
+  case N_SUB_ASSIGN:
+  case N_MUL_ASSIGN:
+  case N_DIV_ASSIGN:
+  case N_MOD_ASSIGN:
+  case N_INC:
+  case N_DEC:
+  case N_POST_INC:
+  case N_POST_DEC: {
+    decl_t d = lir_id_decl (NL_HEAD (r->u.ops));
+    if (d != NULL && (d == ivar || d == bound)) return FALSE;
+    break;
+  }
+  default: break;
+  }
+  if (!node_has_ops (r->code)) return TRUE;
+  for (node_t c = NL_HEAD (r->u.ops); c != NULL; c = NL_NEXT (c))
+    if (!lir_unrollable_p (c, ivar, bound)) return FALSE;
+  return TRUE;
+}
+
+/* Emit N copies of BODY each followed by ITER. */
+static void lir_gen_body_copies (c2m_ctx_t c2m_ctx, node_t body, node_t iter, int64_t n) {
+  struct lir_ctx *lir = c2m_ctx->gen_ctx->lir;
+
+  for (int64_t k = 0; k < n; k++) {
+    lir->continue_label = lir_new_label (c2m_ctx);
+    lir_gen_stmt (c2m_ctx, body);
+    lir_emit_label (c2m_ctx, lir->continue_label);
+    lir_gen_expr (c2m_ctx, iter);
+  }
+}
+
+/* Try to emit a counted for-loop unrolled: completely for a small
+   constant trip count, otherwise by 2, 4 or 8 followed by a remainder
+   loop.  The loop must have the form for (i = init; i CMP bound; i += step)
+   with a constant step, a constant or unmodified register bound, and a
+   body which does not change I.  INIT has already been emitted.  Return
+   FALSE if the loop does not qualify. */
+static int lir_gen_unrolled_loop (c2m_ctx_t c2m_ctx, node_t init, node_t cond, node_t iter,
+                                  node_t body) {
+  struct lir_ctx *lir = c2m_ctx->gen_ctx->lir;
+  int saved_break = lir->break_label, saved_continue = lir->continue_label;
+  node_t op1, op2, bound_node, init_val = NULL;
+  decl_t ivar, bound = NULL;
+  struct type *itype, ctype;
+  int64_t step, bval, ival, trips, limit;
+  int size, unsigned_p, up_p, strict_p, nodes, factor, top, rem_top, end;
+  node_code_t code;
+  lir_opnd_t iv, bv, rem;
+  lir_insn_t *insn;
+
+  if (cond == NULL || cond->code == N_IGNORE || iter == NULL || iter->code == N_IGNORE)
+    return FALSE;
+  code = cond->code;
+  if (code != N_LT && code != N_LE && code != N_GT && code != N_GE) return FALSE;
+  op1 = NL_HEAD (cond->u.ops);
+  op2 = NL_NEXT (op1);
+  if (iter->code != N_INC && iter->code != N_POST_INC && iter->code != N_DEC
+      && iter->code != N_POST_DEC && iter->code != N_ADD_ASSIGN && iter->code != N_SUB_ASSIGN)
+    return FALSE;
+  if ((ivar = lir_id_decl (NL_HEAD (iter->u.ops))) == NULL || lir_find_var (c2m_ctx, ivar) == 0)
+    return FALSE;
+  if (lir_id_decl (op1) == ivar) {
+    bound_node = op2;
+  } else if (lir_id_decl (op2) == ivar) {
+    bound_node = op1;
+    code = code == N_LT ? N_GT : code == N_LE ? N_GE : code == N_GT ? N_LT : N_LE;
+  } else {
+    return FALSE;
+  }
+  itype = ivar->decl_spec.type;
+  if (!integer_type_p (itype) || lir_bool_p (itype)) return FALSE;
+  size = lir_type_size (itype);
+  unsigned_p = lir_unsigned_p (itype);
+  ctype = arithmetic_conversion (((struct expr *) op1->attr)->type,
+                                 ((struct expr *) op2->attr)->type);
+  if (size < 4 || lir_type_size (&ctype) != size || lir_unsigned_p (&ctype) != unsigned_p)
+    return FALSE;
+  if (!lir_int_const_p (bound_node, &bval)) {
+    if ((bound = lir_id_decl (bound_node)) == NULL || bound == ivar
+        || lir_var_vreg (c2m_ctx, bound) == 0 || !integer_type_p (bound->decl_spec.type))
+      return FALSE;
+  }
+  /* The step */
+  if (iter->code == N_INC || iter->code == N_POST_INC) {
+    step = 1;
+  } else if (iter->code == N_DEC || iter->code == N_POST_DEC) {
+    step = -1;
+  } else if ((iter->code == N_ADD_ASSIGN || iter->code == N_SUB_ASSIGN)
+             && lir_int_const_p (NL_EL (iter->u.ops, 1), &step) && step > 0 && step < 1024) {
+    if (iter->code == N_SUB_ASSIGN) step = -step;
+  } else {
+    return FALSE;
+  }
+  up_p = code == N_LT || code == N_LE;
+  strict_p = code == N_LT || code == N_GT;
+  if ((step > 0) != up_p || !lir_unrollable_p (body, ivar, bound)) return FALSE;
+  nodes = count_ast_nodes (body) + 1;
+
+  /* Complete unrolling of a constant trip count */
+  if (init != NULL && init->code == N_LIST && NL_HEAD (init->u.ops) != NULL
+      && NL_NEXT (NL_HEAD (init->u.ops)) == NULL && NL_HEAD (init->u.ops)->code == N_SPEC_DECL
+      && NL_HEAD (init->u.ops)->attr == ivar) {
+    init_val = NL_EL (NL_HEAD (init->u.ops)->u.ops, 4);
+    if (init_val != NULL && init_val->code == N_INIT) init_val = NL_EL (init_val->u.ops, 1);
+  } else if (init != NULL && init->code == N_ASSIGN && lir_id_decl (NL_HEAD (init->u.ops)) == ivar) {
+    init_val = NL_EL (init->u.ops, 1);
+  }
+  if (bound == NULL && init_val != NULL && init_val->code != N_IGNORE
+      && lir_int_const_p (init_val, &ival)) {
+    ival = lir_trunc_imm (ival, size, unsigned_p);
+    bval = lir_trunc_imm (bval, size, unsigned_p);
+    if (ival >= INT32_MIN && ival <= INT32_MAX && bval >= INT32_MIN && bval <= INT32_MAX
+        && (!unsigned_p || (ival >= 0 && bval >= 0))) {
+      int64_t dist = up_p ? bval - ival : ival - bval, astep = step < 0 ? -step : step;
+      if (dist < 0 || (dist == 0 && strict_p))
+        trips = 0;
+      else
+        trips = strict_p ? (dist + astep - 1) / astep : dist / astep + 1;
+      if (trips * nodes <= LIR_FULL_UNROLL_NODES) {
+        lir->break_label = end = lir_new_label (c2m_ctx);
+        lir_gen_body_copies (c2m_ctx, body, iter, trips);
+        lir_emit_label (c2m_ctx, end);
+        lir->break_label = saved_break;
+        lir->continue_label = saved_continue;
+        return TRUE;
+      }
+    }
+  }
+
+  if (nodes > LIR_UNROLL_MAX_NODES) return FALSE;
+  factor = nodes <= LIR_UNROLL_MAX_NODES / 4 ? 8 : nodes <= LIR_UNROLL_MAX_NODES / 2 ? 4 : 2;
+  top = lir_new_label (c2m_ctx);
+  rem_top = lir_new_label (c2m_ctx);
+  lir->break_label = end = lir_new_label (c2m_ctx);
+  lir_gen_cond (c2m_ctx, cond, FALSE, end);
+  lir->depth++;
+  lir_emit_label (c2m_ctx, top);
+  /* Run FACTOR iterations at once while the distance to the bound, exact
+     as an unsigned word once i CMP bound holds, leaves room for them. */
+  iv = lir_icvt (c2m_ctx, lir_vreg_op (lir_find_var (c2m_ctx, ivar)), size, unsigned_p, 8, unsigned_p);
+  if (bound == NULL)
+    bv = lir_imm_op (lir_trunc_imm (bval, size, unsigned_p));
+  else
+    bv = lir_icvt (c2m_ctx,
+                   lir_cvt (c2m_ctx, lir_vreg_op (lir_find_var (c2m_ctx, bound)),
+                            bound->decl_spec.type, itype),
+                   size, unsigned_p, 8, unsigned_p);
+  rem = lir_vreg_op (lir_new_vreg (c2m_ctx, NULL));
+  lir_emit (c2m_ctx, LIR_SUB, rem.vreg, up_p ? lir_force_vreg (c2m_ctx, bv) : iv, up_p ? iv : bv);
+  limit = (int64_t) (factor - 1) * (step < 0 ? -step : step);
+  insn = lir_emit (c2m_ctx, LIR_BCC, 0, rem, lir_imm_op (limit));
+  insn->op = strict_p ? SLJIT_LESS_EQUAL : SLJIT_LESS;
+  insn->disp = rem_top;
+  lir_gen_body_copies (c2m_ctx, body, iter, factor);
+  lir_gen_cond (c2m_ctx, cond, TRUE, top);
+  lir_emit_jump (c2m_ctx, end);
+  lir->depth--;
+  /* The remainder loop is entered with the condition known to hold. */
+  lir_emit_label (c2m_ctx, rem_top);
+  lir_gen_loop (c2m_ctx, cond, body, iter, FALSE);
+  lir_emit_label (c2m_ctx, end);
+  lir->break_label = saved_break;
+  lir->continue_label = saved_continue;
+  return TRUE;
+}
+
+static void lir_gen_switch (c2m_ctx_t c2m_ctx, node_t r) {
+  struct lir_ctx *lir = c2m_ctx->gen_ctx->lir;
+  node_t expr = NL_EL (r->u.ops, 1), body = NL_NEXT (expr);
+  struct switch_attr *sa = r->attr;
+  int saved_break = lir->break_label, end = lir_new_label (c2m_ctx), default_label = end;
+  int size = lir_type_size (&sa->type), unsigned_p = lir_unsigned_p (&sa->type);
+  lir_opnd_t v;
+
+  if (sa->ranges_p) {
+    lir_unsupported (c2m_ctx, "case range");
+    return;
+  }
+  v = lir_cvt (c2m_ctx, lir_gen_expr (c2m_ctx, expr), ((struct expr *) expr->attr)->type, &sa->type);
+  v = lir_force_vreg (c2m_ctx, v);
+  for (case_t c = DLIST_HEAD (case_t, sa->case_labels); c != NULL; c = DLIST_NEXT (case_t, c)) {
+    int label = lir_stmt_label (c2m_ctx, c->case_target_node);
+    if (c->case_node->code == N_DEFAULT) {
+      default_label = label;
+      continue;
+    }
+    struct expr *ce = NL_HEAD (c->case_node->u.ops)->attr;
+    lir_insn_t *insn = lir_emit (c2m_ctx, LIR_BCC, 0, v,
+                                 lir_imm_op (lir_trunc_imm ((sljit_sw) ce->c.i_val, size, unsigned_p)));
+    insn->op = SLJIT_EQUAL;
+    insn->flags = size <= 4 ? SLJIT_32 : 0;
+    insn->disp = label;
+  }
+  lir_emit_jump (c2m_ctx, default_label);
+  lir->break_label = end;
+  lir_gen_stmt (c2m_ctx, body);
+  lir_emit_label (c2m_ctx, end);
+  lir->break_label = saved_break;
+}
+
+static void lir_gen_return (c2m_ctx_t c2m_ctx, node_t expr) {
+  struct lir_ctx *lir = c2m_ctx->gen_ctx->lir;
+  lir_opnd_t v = lir_none_op ();
+
+  if (expr != NULL && expr->code != N_IGNORE) {
+    v = lir_cvt (c2m_ctx, lir_gen_expr (c2m_ctx, expr), ((struct expr *) expr->attr)->type,
+                 lir->ret_type);
+    if (void_type_p (lir->ret_type)) v = lir_none_op ();
+  }
+  if (is_float_type (lir->ret_type)) {
+    if (v.mode == LIR_OP_NONE) v = lir_fconst (c2m_ctx, 0.0, is_f32_type (lir->ret_type));
+    lir_emit (c2m_ctx, LIR_FRET, 0, v, lir_none_op ())->flags
+      = is_f32_type (lir->ret_type) ? SLJIT_32 : 0;
+  } else {
+    if (v.mode == LIR_OP_NONE && !void_type_p (lir->ret_type)) v = lir_imm_op (0);
+    lir_emit (c2m_ctx, LIR_RET, 0, v, lir_none_op ());
+  }
+}
+
+static void lir_gen_stmt (c2m_ctx_t c2m_ctx, node_t r) {
+  struct lir_ctx *lir = c2m_ctx->gen_ctx->lir;
+  node_t n;
+
+  if (r == NULL || r->code == N_IGNORE || lir->unsupported_p) return;
+  if (node_has_ops (r->code) && r->code != N_LIST && r->code != N_BLOCK)
+    lir_gen_stmt_labels (c2m_ctx, r);
+  switch (r->code) {
+  case N_EXPR:
+    n = NL_EL (r->u.ops, 1);
+    if (n != NULL && n->code != N_IGNORE) lir_gen_expr (c2m_ctx, n);
+    break;
+  case N_BLOCK:
+    n = NL_EL (r->u.ops, 1);
+    if (n != NULL) lir_gen_stmt (c2m_ctx, n);
+    break;
+  case N_LIST:
+    for (n = NL_HEAD (r->u.ops); n != NULL; n = NL_NEXT (n)) lir_gen_stmt (c2m_ctx, n);
+    break;
+  case N_IF: {
+    node_t cond = NL_EL (r->u.ops, 1), then_stmt = NL_NEXT (cond), else_stmt = NL_NEXT (then_stmt);
+    int else_label = lir_new_label (c2m_ctx);
+    lir_gen_cond (c2m_ctx, cond, FALSE, else_label);
+    lir_gen_stmt (c2m_ctx, then_stmt);
+    if (else_stmt != NULL && else_stmt->code != N_IGNORE) {
+      int end_label = lir_new_label (c2m_ctx);
+      lir_emit_jump (c2m_ctx, end_label);
+      lir_emit_label (c2m_ctx, else_label);
+      lir_gen_stmt (c2m_ctx, else_stmt);
+      lir_emit_label (c2m_ctx, end_label);
+    } else {
+      lir_emit_label (c2m_ctx, else_label);
+    }
+    break;
+  }
+  case N_WHILE:
+    n = NL_EL (r->u.ops, 1);
+    lir_gen_loop (c2m_ctx, n, NL_NEXT (n), NULL, TRUE);
+    break;
+  case N_DO:
+    n = NL_EL (r->u.ops, 1);
+    lir_gen_loop (c2m_ctx, n, NL_NEXT (n), NULL, FALSE);
+    break;
+  case N_FOR: {
+    node_t init = NL_EL (r->u.ops, 1), cond = NL_NEXT (init), iter = NL_NEXT (cond);
+    if (init != NULL && init->code != N_IGNORE) {
+      if (init->code == N_LIST)
+        lir_gen_stmt (c2m_ctx, init);
+      else
+        lir_gen_expr (c2m_ctx, init);
+    }
+    if (!c2m_options->opt_unroll_p || !lir_gen_unrolled_loop (c2m_ctx, init, cond, iter, NL_NEXT (iter)))
+      lir_gen_loop (c2m_ctx, cond, NL_NEXT (iter), iter, TRUE);
+    break;
+  }
+  case N_SWITCH: lir_gen_switch (c2m_ctx, r); break;
+  case N_RETURN: lir_gen_return (c2m_ctx, NL_EL (r->u.ops, 1)); break;
+  case N_BREAK:
+    if (lir->break_label < 0) lir_unsupported (c2m_ctx, "break outside loop");
+    lir_emit_jump (c2m_ctx, lir->break_label);
+    break;
+  case N_CONTINUE:
+    if (lir->continue_label < 0) lir_unsupported (c2m_ctx, "continue outside loop");
+    lir_emit_jump (c2m_ctx, lir->continue_label);
+    break;
+  case N_GOTO: lir_emit_jump (c2m_ctx, lir_stmt_label (c2m_ctx, (node_t) r->attr)); break;
+  case N_SPEC_DECL: lir_gen_decl (c2m_ctx, r); break;
+  case N_LABEL:
+  case N_CASE:
+  case N_DEFAULT: break;
+  case N_INDIRECT_GOTO: lir_unsupported (c2m_ctx, "computed goto"); break;
+  default:
+    if (r->attr != NULL)
+      lir_gen_expr (c2m_ctx, r);
+    else
+      lir_unsupported (c2m_ctx, "statement");
+    break;
+  }
+}
+
+/* ---- Opt 18: basic blocks and liveness ---- */
+
+enum { LIR_USE, LIR_DEF, LIR_IN, LIR_OUT };
+
+static lir_bits_t *lir_set (struct lir_ctx *lir, int bb, int kind) {
+  return &VARR_ADDR (lir_bits_t, lir->live)[((size_t) bb * 4 + kind) * lir->n_words];
+}
+
+static int lir_bit_p (lir_bits_t *set, int v) { return (set[v / 64] >> (v % 64)) & 1; }
+static void lir_bit_set (lir_bits_t *set, int v) { set[v / 64] |= (lir_bits_t) 1 << (v % 64); }
+static void lir_bit_clear (lir_bits_t *set, int v) { set[v / 64] &= ~((lir_bits_t) 1 << (v % 64)); }
+
+/* Collect pointers to the operands read by INSN, return their number. */
+static int lir_insn_opnds (struct lir_ctx *lir, lir_insn_t *insn, lir_opnd_t **opnds) {
+  int n = 0;
+
+  if (insn->code == LIR_CALL) {
+    lir_call_t *call = &VARR_ADDR (lir_call_t, lir->calls)[insn->disp];
+    lir_arg_t *args = &VARR_ADDR (lir_arg_t, lir->args)[call->first_arg];
+    opnds[n++] = &call->target;
+    for (int i = 0; i < call->nargs; i++) opnds[n++] = &args[i].val;
+    return n;
+  }
+  opnds[n++] = &insn->a;
+  opnds[n++] = &insn->b;
+  return n;
+}
+
+static int lir_branch_p (lir_code_t code) {
+  return code == LIR_JMP || code == LIR_BCC || code == LIR_FBCC;
+}
+
+static int lir_bb_end_p (lir_code_t code) {
+  return lir_branch_p (code) || code == LIR_RET || code == LIR_FRET;
+}
+
+/* Split instructions into basic blocks.  Return FALSE if a jump targets a
+   label which was never emitted. */
+static int lir_build_bbs (struct lir_ctx *lir) {
+  lir_insn_t *insns = VARR_ADDR (lir_insn_t, lir->insns);
+  int n = (int) VARR_LENGTH (lir_insn_t, lir->insns), start = 0;
+  lir_bb_t bb = {0, 0, {-1, -1}, 0};
+
+  VARR_TRUNC (lir_bb_t, lir->bbs, 0);
+  VARR_TRUNC (int, lir->label_bbs, 0);
+  for (int i = 0; i < lir->n_labels; i++) VARR_PUSH (int, lir->label_bbs, -1);
+  for (int i = 0; i < n; i++) {
+    if (insns[i].code == LIR_LABEL && i != start) {
+      bb.first = start;
+      bb.last = i - 1;
+      VARR_PUSH (lir_bb_t, lir->bbs, bb);
+      start = i;
+    }
+    if (insns[i].code == LIR_LABEL)
+      VARR_ADDR (int, lir->label_bbs)[insns[i].disp] = (int) VARR_LENGTH (lir_bb_t, lir->bbs);
+    if (lir_bb_end_p (insns[i].code)) {
+      bb.first = start;
+      bb.last = i;
+      VARR_PUSH (lir_bb_t, lir->bbs, bb);
+      start = i + 1;
+    }
+  }
+  if (start < n) {
+    bb.first = start;
+    bb.last = n - 1;
+    VARR_PUSH (lir_bb_t, lir->bbs, bb);
+  }
+  int n_bbs = (int) VARR_LENGTH (lir_bb_t, lir->bbs);
+  for (int i = 0; i < n_bbs; i++) {
+    lir_bb_t *b = &VARR_ADDR (lir_bb_t, lir->bbs)[i];
+    lir_insn_t *last = &insns[b->last];
+    b->n_succ = 0;
+    if (lir_branch_p (last->code)) {
+      int target = VARR_GET (int, lir->label_bbs, last->disp);
+      if (target < 0) return FALSE;
+      b->succ[b->n_succ++] = target;
+    }
+    if (last->code != LIR_JMP && last->code != LIR_RET && last->code != LIR_FRET && i + 1 < n_bbs)
+      b->succ[b->n_succ++] = i + 1;
+  }
+  return TRUE;
+}
+
+static void lir_liveness (struct lir_ctx *lir) {
+  lir_insn_t *insns = VARR_ADDR (lir_insn_t, lir->insns);
+  int n_bbs = (int) VARR_LENGTH (lir_bb_t, lir->bbs), changed_p, n_opnds;
+  lir_opnd_t *opnds[LIR_MAX_CALL_ARGS + 1];
+
+  lir->n_words = ((int) VARR_LENGTH (lir_vreg_t, lir->vregs) + 63) / 64;
+  VARR_TRUNC (lir_bits_t, lir->live, 0);
+  for (size_t i = 0; i < (size_t) n_bbs * 4 * lir->n_words; i++)
+    VARR_PUSH (lir_bits_t, lir->live, 0);
+  for (int b = 0; b < n_bbs; b++) {
+    lir_bb_t *bb = &VARR_ADDR (lir_bb_t, lir->bbs)[b];
+    lir_bits_t *use = lir_set (lir, b, LIR_USE), *def = lir_set (lir, b, LIR_DEF);
+    for (int i = bb->first; i <= bb->last; i++) {
+      n_opnds = lir_insn_opnds (lir, &insns[i], opnds);
+      for (int k = 0; k < n_opnds; k++)
+        if (opnds[k]->mode == LIR_OP_VREG && !lir_bit_p (def, opnds[k]->vreg))
+          lir_bit_set (use, opnds[k]->vreg);
+      if (insns[i].d != 0) lir_bit_set (def, insns[i].d);
+    }
+  }
+  do {
+    changed_p = FALSE;
+    for (int b = n_bbs - 1; b >= 0; b--) {
+      lir_bb_t *bb = &VARR_ADDR (lir_bb_t, lir->bbs)[b];
+      lir_bits_t *use = lir_set (lir, b, LIR_USE), *def = lir_set (lir, b, LIR_DEF);
+      lir_bits_t *in = lir_set (lir, b, LIR_IN), *out = lir_set (lir, b, LIR_OUT);
+      for (int w = 0; w < lir->n_words; w++) {
+        lir_bits_t o = 0, nin;
+        for (int s = 0; s < bb->n_succ; s++) o |= lir_set (lir, bb->succ[s], LIR_IN)[w];
+        nin = use[w] | (o & ~def[w]);
+        if (o != out[w] || nin != in[w]) changed_p = TRUE;
+        out[w] = o;
+        in[w] = nin;
+      }
+    }
+  } while (changed_p);
+}
+
+/* ---- Opt 18: copy propagation and dead code elimination ---- */
+
+/* Can an immediate replace operand K of INSN? */
+static int lir_imm_ok_p (lir_insn_t *insn, int k) {
+  if (insn->code == LIR_CALL) return k != 0;
+  if (k != 0) return TRUE;
+  return insn->code != LIR_SETCC && insn->code != LIR_BCC && insn->code != LIR_CVT
+         && insn->code != LIR_FCOPY;
+}
+
+static int lir_pure_p (lir_insn_t *insn) {
+  switch (insn->code) {
+  case LIR_LOAD:
+  case LIR_FLOAD: return !insn->volatile_p;
+  case LIR_STORE:
+  case LIR_FSTORE:
+  case LIR_LABEL:
+  case LIR_JMP:
+  case LIR_BCC:
+  case LIR_FBCC:
+  case LIR_CALL:
+  case LIR_RET:
+  case LIR_FRET: return FALSE;
+  default: return insn->d != 0;
+  }
+}
+
+/* ---- Opt 21: local value numbering ---- */
+
+/* Within a basic block an instruction recomputing a value which is still
+   available in a vreg becomes a copy of that vreg.  Available values are
+   kept as the instructions which computed them; they die when their result
+   or an operand is redefined, loads also when a store may alias them or a
+   call happens. */
+
+#define LIR_LVN_MAX 64
+
+static int lir_access_size (lir_insn_t *insn) {
+  switch (insn->op & ~SLJIT_32) {
+  case SLJIT_MOV_U8:
+  case SLJIT_MOV_S8: return 1;
+  case SLJIT_MOV_U16:
+  case SLJIT_MOV_S16: return 2;
+  case SLJIT_MOV_U32:
+  case SLJIT_MOV_S32:
+  case SLJIT_MOV32: return 4;
+  case SLJIT_MOV_F64: return insn->op & SLJIT_32 ? 4 : 8;
+  default: return 8;
+  }
+}
+
+/* Return TRUE if load LD and store ST can touch the same bytes.  LOOP_DEFS,
+   when not NULL, tells which base vregs change between the two accesses. */
+static int lir_may_alias (lir_insn_t *ld, lir_insn_t *st, int *loop_defs) {
+  int ld_size = lir_access_size (ld), st_size = lir_access_size (st);
+  sljit_sw ld_start = ld->disp, st_start = st->disp;
+
+  if (ld->volatile_p || st->volatile_p) return TRUE;
+  if (ld->obj != NULL && st->obj != NULL && ld->obj != st->obj) return FALSE;
+  if (ld->a.mode != st->a.mode) return ld->a.mode == LIR_OP_VREG || st->a.mode == LIR_OP_VREG;
+  if (ld->a.mode == LIR_OP_VREG
+      && (ld->a.vreg != st->a.vreg || (loop_defs != NULL && loop_defs[ld->a.vreg] != 0)))
+    return TRUE;
+  if (ld->a.mode == LIR_OP_IMM) {
+    ld_start += ld->a.imm;
+    st_start += st->a.imm;
+  }
+  return ld_start < st_start + st_size && st_start < ld_start + ld_size;
+}
+
+static int lir_lvn_p (lir_insn_t *insn) {
+  if (insn->d == 0 || !lir_pure_p (insn)) return FALSE;
+  return insn->code != LIR_MOV && insn->code != LIR_FMOV && insn->code != LIR_NOP;
+}
+
+static int lir_same_opnd_p (lir_opnd_t *a, lir_opnd_t *b) {
+  if (a->mode != b->mode) return FALSE;
+  if (a->mode == LIR_OP_VREG) return a->vreg == b->vreg;
+  return a->mode != LIR_OP_IMM || a->imm == b->imm;
+}
+
+static int lir_same_value_p (lir_insn_t *e, lir_insn_t *insn) {
+  if (e->code != insn->code || e->op != insn->op || e->flags != insn->flags) return FALSE;
+  switch (insn->code) {
+  case LIR_FCONST: return memcmp (&e->fimm, &insn->fimm, sizeof (double)) == 0;
+  case LIR_LEA: return e->disp == insn->disp;
+  case LIR_LOAD:
+  case LIR_FLOAD:
+    if (e->disp != insn->disp) return FALSE;
+    break;
+  default: break;
+  }
+  if (lir_same_opnd_p (&e->a, &insn->a) && lir_same_opnd_p (&e->b, &insn->b)) return TRUE;
+  return (lir_commutative_p (insn->code) && lir_same_opnd_p (&e->a, &insn->b)
+          && lir_same_opnd_p (&e->b, &insn->a));
+}
+
+static int lir_uses_vreg_p (lir_insn_t *insn, int v) {
+  return ((insn->a.mode == LIR_OP_VREG && insn->a.vreg == v)
+          || (insn->b.mode == LIR_OP_VREG && insn->b.vreg == v));
+}
+
+/* Replace uses of copies by their sources inside each basic block.  With
+   LVN_P, also turn recomputations of available values into copies. */
+static void lir_copy_prop (struct lir_ctx *lir, int lvn_p) {
+  lir_insn_t *insns = VARR_ADDR (lir_insn_t, lir->insns), avail[LIR_LVN_MAX];
+  int n_vregs = (int) VARR_LENGTH (lir_vreg_t, lir->vregs), n_opnds, n_avail = 0;
+  lir_opnd_t *repl = calloc (n_vregs, sizeof (lir_opnd_t)), *opnds[LIR_MAX_CALL_ARGS + 1];
+  VARR (int) *active = lir->order; /* vregs with a valid replacement */
+
+  VARR_TRUNC (int, active, 0);
+  for (size_t b = 0; b < VARR_LENGTH (lir_bb_t, lir->bbs); b++) {
+    lir_bb_t *bb = &VARR_ADDR (lir_bb_t, lir->bbs)[b];
+    for (size_t j = 0; j < VARR_LENGTH (int, active); j++)
+      repl[VARR_GET (int, active, j)].mode = LIR_OP_NONE;
+    VARR_TRUNC (int, active, 0);
+    n_avail = 0;
+    for (int i = bb->first; i <= bb->last; i++) {
+      lir_insn_t *insn = &insns[i];
+      int d = insn->d, found = 0;
+      n_opnds = lir_insn_opnds (lir, insn, opnds);
+      for (int k = 0; k < n_opnds; k++) {
+        lir_opnd_t *op = opnds[k];
+        if (op->mode != LIR_OP_VREG || repl[op->vreg].mode == LIR_OP_NONE) continue;
+        if (repl[op->vreg].mode == LIR_OP_IMM && !lir_imm_ok_p (insn, k)) continue;
+        *op = repl[op->vreg];
+      }
+      if (lvn_p) {
+        int m = 0;
+        for (int j = 0; j < n_avail; j++) {
+          lir_insn_t *e = &avail[j];
+          int dead_p = FALSE;
+          if (insn->code == LIR_CALL)
+            dead_p = e->code == LIR_LOAD || e->code == LIR_FLOAD;
+          else if (insn->code == LIR_STORE || insn->code == LIR_FSTORE)
+            dead_p = (e->code == LIR_LOAD || e->code == LIR_FLOAD) && lir_may_alias (e, insn, NULL);
+          else if (found == 0 && lir_lvn_p (insn) && lir_same_value_p (e, insn))
+            found = e->d;
+          if (!dead_p) avail[m++] = *e;
+        }
+        n_avail = m;
+        if (found != 0 && found != d) {
+          insn->code = lir_vreg (lir, d)->float_p ? LIR_FMOV : LIR_MOV;
+          insn->op = insn->flags = 0;
+          insn->a = lir_vreg_op (found);
+          insn->b = lir_none_op ();
+        }
+      }
+      if (d == 0) continue;
+      for (size_t j = 0; j < VARR_LENGTH (int, active); j++) {
+        int v = VARR_GET (int, active, j);
+        if (v == d || (repl[v].mode == LIR_OP_VREG && repl[v].vreg == d))
+          repl[v].mode = LIR_OP_NONE;
+      }
+      if (lvn_p) {
+        int m = 0;
+        for (int j = 0; j < n_avail; j++)
+          if (avail[j].d != d && !lir_uses_vreg_p (&avail[j], d)) avail[m++] = avail[j];
+        n_avail = m;
+        if (found == 0 && lir_lvn_p (insn) && !lir_uses_vreg_p (insn, d) && n_avail < LIR_LVN_MAX)
+          avail[n_avail++] = *insn;
+      }
+      if ((insn->code == LIR_MOV || insn->code == LIR_FMOV)
+          && (insn->a.mode == LIR_OP_IMM || (insn->a.mode == LIR_OP_VREG && insn->a.vreg != d))) {
+        repl[d] = insn->a;
+        VARR_PUSH (int, active, d);
+      }
+    }
+  }
+  free (repl);
+}
+
+/* Remove instructions whose results are dead.  Return TRUE if any was removed. */
+static int lir_dce (struct lir_ctx *lir) {
+  lir_insn_t *insns = VARR_ADDR (lir_insn_t, lir->insns);
+  lir_bits_t *live = calloc (lir->n_words, sizeof (lir_bits_t));
+  lir_opnd_t *opnds[LIR_MAX_CALL_ARGS + 1];
+  int changed_p = FALSE, n_opnds;
+
+  for (size_t b = 0; b < VARR_LENGTH (lir_bb_t, lir->bbs); b++) {
+    lir_bb_t *bb = &VARR_ADDR (lir_bb_t, lir->bbs)[b];
+    memcpy (live, lir_set (lir, (int) b, LIR_OUT), lir->n_words * sizeof (lir_bits_t));
+    for (int i = bb->last; i >= bb->first; i--) {
+      lir_insn_t *insn = &insns[i];
+      if (insn->d != 0 && !lir_bit_p (live, insn->d)) {
+        if (lir_pure_p (insn)) {
+          insn->code = LIR_NOP;
+          insn->d = 0;
+          insn->a = insn->b = lir_none_op ();
+          changed_p = TRUE;
+          continue;
+        }
+        if (insn->code == LIR_CALL) insn->d = 0;
+      }
+      if (insn->d != 0) lir_bit_clear (live, insn->d);
+      n_opnds = lir_insn_opnds (lir, insn, opnds);
+      for (int k = 0; k < n_opnds; k++)
+        if (opnds[k]->mode == LIR_OP_VREG) lir_bit_set (live, opnds[k]->vreg);
+    }
+  }
+  free (live);
+  return changed_p;
+}
+
+static void lir_compact (struct lir_ctx *lir) {
+  lir_insn_t *insns = VARR_ADDR (lir_insn_t, lir->insns);
+  size_t n = 0;
+
+  for (size_t i = 0; i < VARR_LENGTH (lir_insn_t, lir->insns); i++)
+    if (insns[i].code != LIR_NOP) insns[n++] = insns[i];
+  VARR_TRUNC (lir_insn_t, lir->insns, n);
+}
+
+/* ---- Opt 19: loop-invariant code motion ---- */
+
+/* A loop is a label L and the furthest branch back to it.  Generated code
+   keeps loop bodies contiguous, so the loop is the instruction range between
+   the two.  Invariant instructions are moved in front of L (the preheader),
+   which is only valid if L is entered from outside solely by falling
+   through. */
+
+static int lir_invariant_opnd_p (lir_opnd_t *op, int *loop_defs) {
+  return op->mode != LIR_OP_VREG || loop_defs[op->vreg] == 0;
+}
+
+/* Hoist invariant instructions of the loop headed by label HEAD.  Return
+   FALSE if the loop has no usable preheader. */
+static int lir_licm_loop (struct lir_ctx *lir, int head, int *label_pos, int *n_defs,
+                          int *loop_defs) {
+  lir_insn_t *insns = VARR_ADDR (lir_insn_t, lir->insns), hoisted;
+  int n = (int) VARR_LENGTH (lir_insn_t, lir->insns), h = label_pos[head], t = -1;
+  int n_vregs = (int) VARR_LENGTH (lir_vreg_t, lir->vregs), call_p = FALSE, exit_p = FALSE;
+  int fwd = h, n_hoisted = 0, changed_p, pos, target;
+  char *safe_p;
+
+  for (int i = h + 1; i < n; i++)
+    if (lir_branch_p (insns[i].code) && insns[i].disp == head) t = i;
+  if (t < 0 || h == 0 || insns[h - 1].code == LIR_JMP || insns[h - 1].code == LIR_RET
+      || insns[h - 1].code == LIR_FRET)
+    return FALSE;
+  for (int i = 0; i < n; i++) {
+    if (i >= h && i <= t) continue;
+    if (!lir_branch_p (insns[i].code)) continue;
+    target = label_pos[insns[i].disp];
+    if (target >= h && target <= t) return FALSE;
+  }
+  memset (loop_defs, 0, n_vregs * sizeof (int));
+  safe_p = malloc (t - h + 1);
+  /* An instruction is always executed in an iteration if no earlier branch
+     can skip it or leave the loop. */
+  for (int i = h; i <= t; i++) {
+    lir_insn_t *insn = &insns[i];
+    safe_p[i - h] = !exit_p && fwd <= i;
+    if (insn->d != 0) loop_defs[insn->d]++;
+    if (insn->code == LIR_CALL) call_p = TRUE;
+    if (insn->code == LIR_RET || insn->code == LIR_FRET) exit_p = TRUE;
+    if (lir_branch_p (insn->code) && i != t) {
+      target = label_pos[insn->disp];
+      if (target < h || target > t)
+        exit_p = TRUE;
+      else if (target > fwd)
+        fwd = target;
+    }
+  }
+  do {
+    changed_p = FALSE;
+    for (int i = h + 1; i < t; i++) {
+      lir_insn_t *insn = &insns[i];
+      if (insn->d == 0 || !lir_pure_p (insn) || n_defs[insn->d] != 1
+          || lir_vreg (lir, insn->d)->fixed_p || loop_defs[insn->d] == 0)
+        continue;
+      switch (insn->code) {
+      case LIR_DIV:
+      case LIR_UDIV:
+      case LIR_MOD:
+      case LIR_UMOD: continue; /* may trap when the loop does not run */
+      case LIR_MOV:
+      case LIR_FMOV:
+        if (insn->a.mode != LIR_OP_VREG) continue; /* an immediate is free */
+        break;
+      default: break;
+      }
+      if (!lir_invariant_opnd_p (&insn->a, loop_defs) || !lir_invariant_opnd_p (&insn->b, loop_defs))
+        continue;
+      if (insn->code == LIR_LOAD || insn->code == LIR_FLOAD) {
+        if (call_p || !safe_p[i - h]) continue;
+        for (pos = h; pos <= t; pos++)
+          if ((insns[pos].code == LIR_STORE || insns[pos].code == LIR_FSTORE)
+              && lir_may_alias (insn, &insns[pos], loop_defs))
+            break;
+        if (pos <= t) continue;
+      }
+      hoisted = *insn;
+      hoisted.depth = insns[h - 1].depth;
+      insn->code = LIR_NOP;
+      insn->d = 0;
+      loop_defs[hoisted.d] = 0;
+      /* Keep hoisted instructions in discovery order right before HEAD. */
+      VARR_PUSH (lir_insn_t, lir->insns, hoisted);
+      insns = VARR_ADDR (lir_insn_t, lir->insns);
+      n_hoisted++;
+      changed_p = TRUE;
+    }
+  } while (changed_p);
+  free (safe_p);
+  if (n_hoisted != 0) {
+    lir_insn_t *copy = malloc (n_hoisted * sizeof (lir_insn_t));
+    memcpy (copy, &insns[n], n_hoisted * sizeof (lir_insn_t));
+    memmove (&insns[h + n_hoisted], &insns[h], (n - h) * sizeof (lir_insn_t));
+    memcpy (&insns[h], copy, n_hoisted * sizeof (lir_insn_t));
+    free (copy);
+  }
+  return TRUE;
+}
+
+static void lir_licm (struct lir_ctx *lir) {
+  int n_vregs = (int) VARR_LENGTH (lir_vreg_t, lir->vregs), n, n_loops = 0;
+  int *label_pos = malloc ((lir->n_labels + 1) * sizeof (int));
+  int *n_defs = calloc (n_vregs, sizeof (int)), *loop_defs = calloc (n_vregs, sizeof (int));
+  int *heads = malloc ((lir->n_labels + 1) * sizeof (int));
+  lir_insn_t *insns;
+
+  /* Loops are processed in the order of their back branches: inner ones
+     first, so their hoisted code can move out of enclosing loops later. */
+  insns = VARR_ADDR (lir_insn_t, lir->insns);
+  n = (int) VARR_LENGTH (lir_insn_t, lir->insns);
+  for (int i = 0; i < lir->n_labels; i++) label_pos[i] = -1;
+  for (int i = 0; i < n; i++) {
+    if (insns[i].code == LIR_LABEL) label_pos[insns[i].disp] = i;
+    if (insns[i].d != 0) n_defs[insns[i].d]++;
+  }
+  for (int i = 0; i < n; i++) {
+    int head = (int) insns[i].disp;
+    if (!lir_branch_p (insns[i].code) || label_pos[head] < 0 || label_pos[head] > i) continue;
+    for (int k = 0; k < n_loops; k++)
+      if (heads[k] == head) {
+        memmove (&heads[k], &heads[k + 1], (n_loops - k - 1) * sizeof (int));
+        n_loops--;
+        break;
+      }
+    heads[n_loops++] = head;
+  }
+  for (int k = 0; k < n_loops; k++) {
+    insns = VARR_ADDR (lir_insn_t, lir->insns);
+    n = (int) VARR_LENGTH (lir_insn_t, lir->insns);
+    for (int i = 0; i < n; i++)
+      if (insns[i].code == LIR_LABEL) label_pos[insns[i].disp] = i;
+    lir_licm_loop (lir, heads[k], label_pos, n_defs, loop_defs);
+  }
+  free (heads);
+  free (loop_defs);
+  free (n_defs);
+  free (label_pos);
+}
+
+/* ---- Opt 18: live intervals and linear-scan register allocation ---- */
+
+static void lir_extend (lir_vreg_t *v, int pos) {
+  if (v->start > pos) v->start = pos;
+  if (v->end < pos) v->end = pos;
+}
+
+/* Instruction K uses its operands at position 2K and defines its result
+   at 2K + 1. */
+static void lir_build_intervals (struct lir_ctx *lir) {
+  lir_insn_t *insns = VARR_ADDR (lir_insn_t, lir->insns);
+  lir_vreg_t *vregs = VARR_ADDR (lir_vreg_t, lir->vregs);
+  int n_vregs = (int) VARR_LENGTH (lir_vreg_t, lir->vregs), n_opnds;
+  int n_insns = (int) VARR_LENGTH (lir_insn_t, lir->insns);
+  lir_opnd_t *opnds[LIR_MAX_CALL_ARGS + 1];
+  int *calls_before = malloc ((n_insns + 1) * sizeof (int));
+
+  for (int v = 1; v < n_vregs; v++) {
+    vregs[v].start = INT_MAX;
+    vregs[v].end = -1;
+    vregs[v].weight = vregs[v].hint = 0;
+    vregs[v].call_p = FALSE;
+  }
+  for (size_t b = 0; b < VARR_LENGTH (lir_bb_t, lir->bbs); b++) {
+    lir_bb_t *bb = &VARR_ADDR (lir_bb_t, lir->bbs)[b];
+    lir_bits_t *in = lir_set (lir, (int) b, LIR_IN), *out = lir_set (lir, (int) b, LIR_OUT);
+    for (int v = 1; v < n_vregs; v++) {
+      if (lir_bit_p (in, v)) lir_extend (&vregs[v], 2 * bb->first);
+      if (lir_bit_p (out, v)) lir_extend (&vregs[v], 2 * bb->last + 1);
+    }
+  }
+  calls_before[0] = 0;
+  for (int i = 0; i < n_insns; i++) {
+    lir_insn_t *insn = &insns[i];
+    int w = depth_weight (insn->depth);
+    calls_before[i + 1] = calls_before[i] + (insn->code == LIR_CALL);
+    n_opnds = lir_insn_opnds (lir, insn, opnds);
+    for (int k = 0; k < n_opnds; k++)
+      if (opnds[k]->mode == LIR_OP_VREG) {
+        lir_extend (&vregs[opnds[k]->vreg], 2 * i);
+        vregs[opnds[k]->vreg].weight += w;
+      }
+    if (insn->d != 0) {
+      lir_extend (&vregs[insn->d], 2 * i + 1);
+      vregs[insn->d].weight += w;
+      if ((insn->code == LIR_MOV || insn->code == LIR_FMOV) && insn->a.mode == LIR_OP_VREG)
+        vregs[insn->d].hint = insn->a.vreg;
+    }
+  }
+  for (int v = 1; v < n_vregs; v++) {
+    int lo = (vregs[v].start + 1) / 2, hi = (vregs[v].end - 1) / 2;
+    if (vregs[v].end >= 0 && lo <= hi && hi < n_insns)
+      vregs[v].call_p = calls_before[hi + 1] - calls_before[lo] > 0;
+  }
+  free (calls_before);
+}
+
+typedef struct {
+  int n, first_reg, step; /* registers first_reg + i * step */
+} lir_pool_t;
+
+static sljit_s32 lir_pool_reg (lir_pool_t *pool, int i) { return pool->first_reg + i * pool->step; }
+
+/* Linear scan over intervals sorted by start.  Integer and float vregs use
+   separate pools; intervals crossing calls get only saved registers, the
+   others prefer scratch ones.  On pressure the lowest weight interval is
+   spilled to its own frame slot. */
+static void lir_alloc_regs (struct lir_ctx *lir, int *max_regs) {
+  lir_vreg_t *vregs = VARR_ADDR (lir_vreg_t, lir->vregs);
+  int n_vregs = (int) VARR_LENGTH (lir_vreg_t, lir->vregs);
+  lir_pool_t pools[2][2]; /* [float_p][saved_p] */
+  int owner[2][2][SLJIT_NUMBER_OF_REGISTERS + SLJIT_NUMBER_OF_FLOAT_REGISTERS + 1];
+  int n_order;
+
+  pools[0][0] = (lir_pool_t){SLJIT_NUMBER_OF_SCRATCH_REGISTERS - 3, SLJIT_R3, 1};
+  pools[0][1] = (lir_pool_t){SLJIT_NUMBER_OF_SAVED_REGISTERS - lir->n_int_params,
+                             SLJIT_S0 - lir->n_int_params, -1};
+  pools[1][0] = (lir_pool_t){SLJIT_NUMBER_OF_SCRATCH_FLOAT_REGISTERS - 3, SLJIT_FR3, 1};
+  pools[1][1] = (lir_pool_t){SLJIT_NUMBER_OF_SAVED_FLOAT_REGISTERS, SLJIT_FS0, -1};
+  for (int f = 0; f < 2; f++)
+    for (int s = 0; s < 2; s++) {
+      if (pools[f][s].n < 0) pools[f][s].n = 0;
+      for (int i = 0; i < pools[f][s].n; i++) owner[f][s][i] = 0;
+    }
+  VARR_TRUNC (int, lir->order, 0);
+  for (int v = 1; v < n_vregs; v++) {
+    vregs[v].slot = 0;
+    if (!vregs[v].fixed_p) vregs[v].reg = 0;
+    if (!vregs[v].fixed_p && vregs[v].end >= 0) VARR_PUSH (int, lir->order, v);
+  }
+  n_order = (int) VARR_LENGTH (int, lir->order);
+  int *order = VARR_ADDR (int, lir->order);
+  for (int i = 1; i < n_order; i++) { /* insertion sort: vregs are mostly in order */
+    int v = order[i], j = i - 1;
+    for (; j >= 0 && vregs[order[j]].start > vregs[v].start; j--) order[j + 1] = order[j];
+    order[j + 1] = v;
+  }
+  for (int i = 0; i < n_order; i++) {
+    int v = order[i], f = vregs[v].float_p, best_s = -1, best_i = -1, victim = 0;
+    lir_vreg_t *cur = &vregs[v];
+    /* Expire intervals which ended before this one starts. */
+    for (int s = 0; s < 2; s++)
+      for (int k = 0; k < pools[f][s].n; k++)
+        if (owner[f][s][k] != 0 && vregs[owner[f][s][k]].end < cur->start) owner[f][s][k] = 0;
+    for (int s = cur->call_p ? 1 : 0; s < 2 && best_s < 0; s++)
+      for (int k = 0; k < pools[f][s].n; k++)
+        if (owner[f][s][k] == 0) {
+          if (best_s < 0) best_s = s, best_i = k;
+          if (cur->hint != 0 && vregs[cur->hint].reg == lir_pool_reg (&pools[f][s], k)) {
+            best_s = s, best_i = k;
+            break;
+          }
+        }
+    if (best_s < 0) {
+      /* Spill the cheapest of this interval and the ones holding usable registers. */
+      for (int s = cur->call_p ? 1 : 0; s < 2; s++)
+        for (int k = 0; k < pools[f][s].n; k++) {
+          int o = owner[f][s][k];
+          if (o != 0 && (!vregs[o].call_p || s == 1)
+              && vregs[o].weight < (victim == 0 ? cur->weight : vregs[victim].weight))
+            victim = o, best_s = s, best_i = k;
+        }
+      if (victim == 0) {
+        cur->reg = 0;
+        continue;
+      }
+      vregs[victim].reg = 0;
+    }
+    owner[f][best_s][best_i] = v;
+    cur->reg = lir_pool_reg (&pools[f][best_s], best_i);
+    if (best_s == 0 && max_regs[f * 2] < best_i + 4) max_regs[f * 2] = best_i + 4;
+    if (best_s == 1 && max_regs[f * 2 + 1] < best_i + 1) max_regs[f * 2 + 1] = best_i + 1;
+  }
+  for (int v = 1; v < n_vregs; v++)
+    if (vregs[v].end >= 0 && vregs[v].reg == 0) {
+      vregs[v].slot = lir->spill_offset;
+      lir->spill_offset += (sljit_sw) sizeof (sljit_sw);
+    }
+}
+
+/* ---- Opt 18: machine code emission ---- */
+
+/* Integer operand: register, immediate, or spilled value loaded into TEMP. */
+static void lir_int_src (c2m_ctx_t c2m_ctx, lir_opnd_t op, sljit_s32 temp, sljit_s32 *reg,
+                         sljit_sw *regw) {
+  gen_ctx_t gen_ctx = c2m_ctx->gen_ctx;
+  lir_vreg_t *v;
+
+  *regw = 0;
+  if (op.mode == LIR_OP_IMM) {
+    *reg = SLJIT_IMM;
+    *regw = op.imm;
+    return;
+  }
+  v = lir_vreg (gen_ctx->lir, op.vreg);
+  if (v->reg != 0) {
+    *reg = v->reg;
+    return;
+  }
+  sljit_emit_op1 (compiler, SLJIT_MOV, temp, 0, SLJIT_MEM1 (SLJIT_SP), v->slot);
+  *reg = temp;
+}
+
+/* Register receiving the integer result of vreg D: its own or TEMP. */
+static sljit_s32 lir_int_dst (c2m_ctx_t c2m_ctx, int d, sljit_s32 temp) {
+  lir_vreg_t *v = lir_vreg (c2m_ctx->gen_ctx->lir, d);
+  return v->reg != 0 ? v->reg : temp;
+}
+
+/* Store TEMP back to the spill slot of D when D is not in a register. */
+static void lir_int_writeback (c2m_ctx_t c2m_ctx, int d, sljit_s32 temp) {
+  gen_ctx_t gen_ctx = c2m_ctx->gen_ctx;
+  lir_vreg_t *v = lir_vreg (gen_ctx->lir, d);
+  if (v->reg == 0) sljit_emit_op1 (compiler, SLJIT_MOV, SLJIT_MEM1 (SLJIT_SP), v->slot, temp, 0);
+}
+
+/* Float operand: register or spill slot. */
+static void lir_float_opnd (c2m_ctx_t c2m_ctx, int vreg, sljit_s32 *reg, sljit_sw *regw) {
+  lir_vreg_t *v = lir_vreg (c2m_ctx->gen_ctx->lir, vreg);
+  if (v->reg != 0) {
+    *reg = v->reg;
+    *regw = 0;
+  } else {
+    *reg = SLJIT_MEM1 (SLJIT_SP);
+    *regw = v->slot;
+  }
+}
+
+static sljit_s32 lir_fmov_op (c2m_ctx_t c2m_ctx, int vreg) {
+  return lir_vreg (c2m_ctx->gen_ctx->lir, vreg)->f32_p ? SLJIT_MOV_F32 : SLJIT_MOV_F64;
+}
+
+/* Float register holding vreg V, loading a spilled value into TEMP. */
+static sljit_s32 lir_float_src_reg (c2m_ctx_t c2m_ctx, int vreg, sljit_s32 temp) {
+  gen_ctx_t gen_ctx = c2m_ctx->gen_ctx;
+  sljit_s32 reg;
+  sljit_sw regw;
+
+  lir_float_opnd (c2m_ctx, vreg, &reg, &regw);
+  if (reg != SLJIT_MEM1 (SLJIT_SP)) return reg;
+  sljit_emit_fop1 (compiler, lir_fmov_op (c2m_ctx, vreg), temp, 0, reg, regw);
+  return temp;
+}
+
+static sljit_s32 lir_float_dst (c2m_ctx_t c2m_ctx, int d) {
+  lir_vreg_t *v = lir_vreg (c2m_ctx->gen_ctx->lir, d);
+  return v->reg != 0 ? v->reg : SLJIT_FR0;
+}
+
+static void lir_float_writeback (c2m_ctx_t c2m_ctx, int d) {
+  gen_ctx_t gen_ctx = c2m_ctx->gen_ctx;
+  lir_vreg_t *v = lir_vreg (gen_ctx->lir, d);
+  if (v->reg == 0)
+    sljit_emit_fop1 (compiler, lir_fmov_op (c2m_ctx, d), SLJIT_MEM1 (SLJIT_SP), v->slot,
+                     SLJIT_FR0, 0);
+}
+
+/* Memory operand [base + disp] of a load or store, using R1 for a spilled base. */
+static void lir_mem (c2m_ctx_t c2m_ctx, lir_insn_t *insn, sljit_s32 *mem, sljit_sw *memw) {
+  gen_ctx_t gen_ctx = c2m_ctx->gen_ctx;
+  lir_vreg_t *v;
+
+  switch (insn->a.mode) {
+  case LIR_OP_IMM:
+    *mem = SLJIT_MEM0 ();
+    *memw = insn->a.imm + insn->disp;
+    return;
+  case LIR_OP_SP:
+    *mem = SLJIT_MEM1 (SLJIT_SP);
+    *memw = insn->disp;
+    return;
+  default:
+    v = lir_vreg (gen_ctx->lir, insn->a.vreg);
+    if (v->reg == 0) {
+      sljit_emit_op1 (compiler, SLJIT_MOV, SLJIT_R1, 0, SLJIT_MEM1 (SLJIT_SP), v->slot);
+      *mem = SLJIT_MEM1 (SLJIT_R1);
+    } else {
+      *mem = SLJIT_MEM1 (v->reg);
+    }
+    *memw = insn->disp;
+  }
+}
+
+static sljit_s32 lir_sljit_op2 (lir_code_t code) {
+  switch (code) {
+  case LIR_ADD: return SLJIT_ADD;
+  case LIR_SUB: return SLJIT_SUB;
+  case LIR_MUL: return SLJIT_MUL;
+  case LIR_AND: return SLJIT_AND;
+  case LIR_OR: return SLJIT_OR;
+  case LIR_XOR: return SLJIT_XOR;
+  case LIR_SHL: return SLJIT_SHL;
+  case LIR_LSHR: return SLJIT_LSHR;
+  case LIR_ASHR: return SLJIT_ASHR;
+  case LIR_FADD: return SLJIT_ADD_F64;
+  case LIR_FSUB: return SLJIT_SUB_F64;
+  case LIR_FMUL: return SLJIT_MUL_F64;
+  default: return SLJIT_DIV_F64;
+  }
+}
+
+static sljit_s32 lir_set_flag (sljit_s32 cond) {
+  return cond <= SLJIT_NOT_EQUAL ? SLJIT_SET_Z : SLJIT_SET (cond & ~1);
+}
+
+static void lir_emit_call (c2m_ctx_t c2m_ctx, lir_insn_t *insn) {
+  gen_ctx_t gen_ctx = c2m_ctx->gen_ctx;
+  struct lir_ctx *lir = gen_ctx->lir;
+  lir_call_t *call = &VARR_ADDR (lir_call_t, lir->calls)[insn->disp];
+  lir_arg_t *args = &VARR_ADDR (lir_arg_t, lir->args)[call->first_arg];
+  sljit_s32 reg, src = SLJIT_IMM;
+  sljit_sw regw, srcw = call->target.imm;
+  int n_int = 0, n_float = 0;
+
+  if (call->target.mode == LIR_OP_VREG) {
+    /* Argument registers may hold the target: keep it in the frame. */
+    lir_int_src (c2m_ctx, call->target, SLJIT_R0, &reg, &regw);
+    sljit_emit_op1 (compiler, SLJIT_MOV, SLJIT_MEM1 (SLJIT_SP), lir->call_slot_offset, reg, regw);
+    src = SLJIT_MEM1 (SLJIT_SP);
+    srcw = lir->call_slot_offset;
+  } else if (call->slot_p) {
+    src = SLJIT_MEM0 ();
+  }
+  if (call->trampoline_p) {
+    for (int i = 0; i < call->nargs; i++) {
+      lir_int_src (c2m_ctx, args[i].val, SLJIT_R0, &reg, &regw);
+      sljit_emit_op1 (compiler, SLJIT_MOV, SLJIT_MEM1 (SLJIT_SP),
+                      lir->va_offset + i * (sljit_sw) sizeof (sljit_sw), reg, regw);
+    }
+    sljit_emit_op1 (compiler, SLJIT_MOV, SLJIT_R0, 0, src, srcw);
+    sljit_emit_op1 (compiler, SLJIT_MOV, SLJIT_R1, 0, SLJIT_IMM, call->n_fixed);
+    sljit_emit_op1 (compiler, SLJIT_MOV, SLJIT_R2, 0, SLJIT_IMM, call->nargs);
+    sljit_get_local_base (compiler, SLJIT_R3, 0, lir->va_offset);
+    sljit_emit_icall (compiler, SLJIT_CALL, call->arg_types, SLJIT_IMM,
+                      (sljit_sw) c2sljit_call_variadic);
+  } else {
+    /* Allocated registers start at R3/FR3, so filling R0..R3 and FR0..FR3
+       in order never clobbers a pending argument. */
+    for (int i = 0; i < call->nargs; i++) {
+      if (args[i].float_p) {
+        lir_float_opnd (c2m_ctx, args[i].val.vreg, &reg, &regw);
+        if (reg != SLJIT_FR0 + n_float)
+          sljit_emit_fop1 (compiler, args[i].f32_p ? SLJIT_MOV_F32 : SLJIT_MOV_F64,
+                           SLJIT_FR0 + n_float, 0, reg, regw);
+        n_float++;
+      } else {
+        lir_int_src (c2m_ctx, args[i].val, SLJIT_R0 + n_int, &reg, &regw);
+        if (reg != SLJIT_R0 + n_int)
+          sljit_emit_op1 (compiler, SLJIT_MOV, SLJIT_R0 + n_int, 0, reg, regw);
+        n_int++;
+      }
+    }
+    sljit_emit_icall (compiler, SLJIT_CALL, call->arg_types, src, srcw);
+  }
+  if (insn->d == 0) return;
+  if (lir_vreg (lir, insn->d)->float_p) {
+    lir_float_opnd (c2m_ctx, insn->d, &reg, &regw);
+    sljit_emit_fop1 (compiler, lir_fmov_op (c2m_ctx, insn->d), reg, regw, SLJIT_FR0, 0);
+  } else {
+    reg = lir_int_dst (c2m_ctx, insn->d, SLJIT_R0);
+    if (reg != SLJIT_R0) sljit_emit_op1 (compiler, SLJIT_MOV, reg, 0, SLJIT_R0, 0);
+    lir_int_writeback (c2m_ctx, insn->d, SLJIT_R0);
+  }
+}
+
+static void lir_emit_insn (c2m_ctx_t c2m_ctx, int i) {
+  gen_ctx_t gen_ctx = c2m_ctx->gen_ctx;
+  struct lir_ctx *lir = gen_ctx->lir;
+  lir_insn_t *insns = VARR_ADDR (lir_insn_t, lir->insns), *insn = &insns[i];
+  int n_insns = (int) VARR_LENGTH (lir_insn_t, lir->insns);
+  sljit_s32 a, b, d, fa, fb;
+  sljit_sw aw, bw, fdw;
+  lir_jump_t jump;
+
+  switch (insn->code) {
+  case LIR_NOP: break;
+  case LIR_MOV:
+  case LIR_EXT:
+    lir_int_src (c2m_ctx, insn->a, SLJIT_R0, &a, &aw);
+    d = lir_int_dst (c2m_ctx, insn->d, SLJIT_R0);
+    if (insn->code == LIR_EXT || a != d)
+      sljit_emit_op1 (compiler, insn->code == LIR_MOV ? SLJIT_MOV : insn->op, d, 0, a, aw);
+    lir_int_writeback (c2m_ctx, insn->d, d);
+    break;
+  case LIR_ADD:
+  case LIR_SUB:
+  case LIR_MUL:
+  case LIR_AND:
+  case LIR_OR:
+  case LIR_XOR:
+  case LIR_SHL:
+  case LIR_LSHR:
+  case LIR_ASHR:
+    lir_int_src (c2m_ctx, insn->a, SLJIT_R1, &a, &aw);
+    if (a == SLJIT_IMM && insn->b.mode == LIR_OP_IMM) {
+      sljit_emit_op1 (compiler, SLJIT_MOV, SLJIT_R1, 0, SLJIT_IMM, aw);
+      a = SLJIT_R1;
+      aw = 0;
+    }
+    lir_int_src (c2m_ctx, insn->b, SLJIT_R2, &b, &bw);
+    d = lir_int_dst (c2m_ctx, insn->d, SLJIT_R0);
+    sljit_emit_op2 (compiler, lir_sljit_op2 (insn->code) | insn->flags, d, 0, a, aw, b, bw);
+    lir_int_writeback (c2m_ctx, insn->d, d);
+    break;
+  case LIR_DIV:
+  case LIR_UDIV:
+  case LIR_MOD:
+  case LIR_UMOD: {
+    sljit_s32 op = insn->code == LIR_DIV    ? SLJIT_DIV_SW
+                   : insn->code == LIR_UDIV ? SLJIT_DIV_UW
+                   : insn->code == LIR_MOD  ? SLJIT_DIVMOD_SW
+                                            : SLJIT_DIVMOD_UW;
+    lir_int_src (c2m_ctx, insn->a, SLJIT_R0, &a, &aw);
+    if (a != SLJIT_R0) sljit_emit_op1 (compiler, SLJIT_MOV, SLJIT_R0, 0, a, aw);
+    lir_int_src (c2m_ctx, insn->b, SLJIT_R1, &b, &bw);
+    if (b != SLJIT_R1) sljit_emit_op1 (compiler, SLJIT_MOV, SLJIT_R1, 0, b, bw);
+    sljit_emit_op0 (compiler, op | insn->flags);
+    a = insn->code == LIR_DIV || insn->code == LIR_UDIV ? SLJIT_R0 : SLJIT_R1;
+    d = lir_int_dst (c2m_ctx, insn->d, a);
+    if (d != a) sljit_emit_op1 (compiler, SLJIT_MOV, d, 0, a, 0);
+    lir_int_writeback (c2m_ctx, insn->d, d);
+    break;
+  }
+  case LIR_MULHS:
+  case LIR_MULHU:
+    lir_int_src (c2m_ctx, insn->a, SLJIT_R0, &a, &aw);
+    if (a != SLJIT_R0) sljit_emit_op1 (compiler, SLJIT_MOV, SLJIT_R0, 0, a, aw);
+    lir_int_src (c2m_ctx, insn->b, SLJIT_R1, &b, &bw);
+    if (b != SLJIT_R1) sljit_emit_op1 (compiler, SLJIT_MOV, SLJIT_R1, 0, b, bw);
+    sljit_emit_op0 (compiler, insn->code == LIR_MULHS ? SLJIT_LMUL_SW : SLJIT_LMUL_UW);
+    d = lir_int_dst (c2m_ctx, insn->d, SLJIT_R1);
+    if (d != SLJIT_R1) sljit_emit_op1 (compiler, SLJIT_MOV, d, 0, SLJIT_R1, 0);
+    lir_int_writeback (c2m_ctx, insn->d, d);
+    break;
+  case LIR_SETCC:
+    lir_int_src (c2m_ctx, insn->a, SLJIT_R1, &a, &aw);
+    if (a == SLJIT_IMM) {
+      sljit_emit_op1 (compiler, SLJIT_MOV, SLJIT_R1, 0, SLJIT_IMM, aw);
+      a = SLJIT_R1;
+      aw = 0;
+    }
+    lir_int_src (c2m_ctx, insn->b, SLJIT_R2, &b, &bw);
+    sljit_emit_op2u (compiler, SLJIT_SUB | insn->flags | lir_set_flag (insn->op), a, aw, b, bw);
+    d = lir_int_dst (c2m_ctx, insn->d, SLJIT_R0);
+    sljit_emit_op_flags (compiler, SLJIT_MOV, d, 0, insn->op);
+    lir_int_writeback (c2m_ctx, insn->d, d);
+    break;
+  case LIR_FSETCC:
+    lir_float_opnd (c2m_ctx, insn->a.vreg, &fa, &aw);
+    lir_float_opnd (c2m_ctx, insn->b.vreg, &fb, &bw);
+    sljit_emit_fop1 (compiler, SLJIT_CMP_F64 | insn->flags | SLJIT_SET (insn->op & ~1), fa, aw,
+                     fb, bw);
+    d = lir_int_dst (c2m_ctx, insn->d, SLJIT_R0);
+    sljit_emit_op_flags (compiler, SLJIT_MOV, d, 0, insn->op);
+    lir_int_writeback (c2m_ctx, insn->d, d);
+    break;
+  case LIR_FMOV:
+    fa = lir_float_src_reg (c2m_ctx, insn->a.vreg, SLJIT_FR0);
+    lir_float_opnd (c2m_ctx, insn->d, &d, &fdw);
+    if (fa != d) sljit_emit_fop1 (compiler, lir_fmov_op (c2m_ctx, insn->d), d, fdw, fa, 0);
+    break;
+  case LIR_FCONST:
+    d = lir_float_dst (c2m_ctx, insn->d);
+    if (lir_vreg (lir, insn->d)->f32_p)
+      sljit_emit_fset32 (compiler, d, (sljit_f32) insn->fimm);
+    else
+      sljit_emit_fset64 (compiler, d, insn->fimm);
+    lir_float_writeback (c2m_ctx, insn->d);
+    break;
+  case LIR_FADD:
+  case LIR_FSUB:
+  case LIR_FMUL:
+  case LIR_FDIV:
+    lir_float_opnd (c2m_ctx, insn->a.vreg, &fa, &aw);
+    lir_float_opnd (c2m_ctx, insn->b.vreg, &fb, &bw);
+    d = lir_float_dst (c2m_ctx, insn->d);
+    sljit_emit_fop2 (compiler, lir_sljit_op2 (insn->code) | insn->flags, d, 0, fa, aw, fb, bw);
+    lir_float_writeback (c2m_ctx, insn->d);
+    break;
+  case LIR_FNEG:
+    lir_float_opnd (c2m_ctx, insn->a.vreg, &fa, &aw);
+    d = lir_float_dst (c2m_ctx, insn->d);
+    sljit_emit_fop1 (compiler, SLJIT_NEG_F64 | insn->flags, d, 0, fa, aw);
+    lir_float_writeback (c2m_ctx, insn->d);
+    break;
+  case LIR_CVT:
+    if (lir_vreg (lir, insn->a.vreg)->float_p)
+      lir_float_opnd (c2m_ctx, insn->a.vreg, &a, &aw);
+    else
+      lir_int_src (c2m_ctx, insn->a, SLJIT_R1, &a, &aw);
+    if (lir_vreg (lir, insn->d)->float_p) {
+      d = lir_float_dst (c2m_ctx, insn->d);
+      sljit_emit_fop1 (compiler, insn->op, d, 0, a, aw);
+      lir_float_writeback (c2m_ctx, insn->d);
+    } else {
+      d = lir_int_dst (c2m_ctx, insn->d, SLJIT_R0);
+      sljit_emit_fop1 (compiler, insn->op, d, 0, a, aw);
+      lir_int_writeback (c2m_ctx, insn->d, d);
+    }
+    break;
+  case LIR_FCOPY:
+    fa = lir_float_src_reg (c2m_ctx, insn->a.vreg, SLJIT_FR0);
+    d = lir_int_dst (c2m_ctx, insn->d, SLJIT_R0);
+    sljit_emit_fcopy (compiler, SLJIT_COPY_FROM_F64, fa, d);
+    lir_int_writeback (c2m_ctx, insn->d, d);
+    break;
+  case LIR_LOAD:
+    lir_mem (c2m_ctx, insn, &a, &aw);
+    d = lir_int_dst (c2m_ctx, insn->d, SLJIT_R0);
+    sljit_emit_op1 (compiler, insn->op, d, 0, a, aw);
+    lir_int_writeback (c2m_ctx, insn->d, d);
+    break;
+  case LIR_FLOAD:
+    lir_mem (c2m_ctx, insn, &a, &aw);
+    d = lir_float_dst (c2m_ctx, insn->d);
+    sljit_emit_fop1 (compiler, insn->op, d, 0, a, aw);
+    lir_float_writeback (c2m_ctx, insn->d);
+    break;
+  case LIR_STORE:
+    lir_int_src (c2m_ctx, insn->b, SLJIT_R2, &b, &bw);
+    lir_mem (c2m_ctx, insn, &a, &aw);
+    sljit_emit_op1 (compiler, insn->op, a, aw, b, bw);
+    break;
+  case LIR_FSTORE:
+    fb = lir_float_src_reg (c2m_ctx, insn->b.vreg, SLJIT_FR0);
+    lir_mem (c2m_ctx, insn, &a, &aw);
+    sljit_emit_fop1 (compiler, insn->op, a, aw, fb, 0);
+    break;
+  case LIR_LEA:
+    d = lir_int_dst (c2m_ctx, insn->d, SLJIT_R0);
+    sljit_get_local_base (compiler, d, 0, insn->disp);
+    lir_int_writeback (c2m_ctx, insn->d, d);
+    break;
+  case LIR_LABEL:
+    VARR_SET (void_ptr_t, lir->sljit_labels, insn->disp, sljit_emit_label (compiler));
+    break;
+  case LIR_JMP:
+    /* A jump to one of the immediately following labels is a fall through. */
+    for (int k = i + 1; k < n_insns && insns[k].code == LIR_LABEL; k++)
+      if (insns[k].disp == insn->disp) return;
+    jump.jump = sljit_emit_jump (compiler, SLJIT_JUMP);
+    jump.label = (int) insn->disp;
+    VARR_PUSH (lir_jump_t, lir->jumps, jump);
+    break;
+  case LIR_BCC:
+    lir_int_src (c2m_ctx, insn->a, SLJIT_R1, &a, &aw);
+    lir_int_src (c2m_ctx, insn->b, SLJIT_R2, &b, &bw);
+    jump.jump = sljit_emit_cmp (compiler, insn->op | insn->flags, a, aw, b, bw);
+    jump.label = (int) insn->disp;
+    VARR_PUSH (lir_jump_t, lir->jumps, jump);
+    break;
+  case LIR_FBCC:
+    lir_float_opnd (c2m_ctx, insn->a.vreg, &fa, &aw);
+    lir_float_opnd (c2m_ctx, insn->b.vreg, &fb, &bw);
+    jump.jump = sljit_emit_fcmp (compiler, insn->op | insn->flags, fa, aw, fb, bw);
+    jump.label = (int) insn->disp;
+    VARR_PUSH (lir_jump_t, lir->jumps, jump);
+    break;
+  case LIR_CALL: lir_emit_call (c2m_ctx, insn); break;
+  case LIR_RET:
+    if (insn->a.mode == LIR_OP_NONE) {
+      sljit_emit_return_void (compiler);
+    } else {
+      lir_int_src (c2m_ctx, insn->a, SLJIT_R0, &a, &aw);
+      sljit_emit_return (compiler, SLJIT_MOV, a, aw);
+    }
+    break;
+  case LIR_FRET:
+    lir_float_opnd (c2m_ctx, insn->a.vreg, &fa, &aw);
+    sljit_emit_return (compiler, insn->flags ? SLJIT_MOV_F32 : SLJIT_MOV_F64, fa, aw);
+    break;
+  }
+}
+
+/* ---- Opt 18: function driver ---- */
+
+static void lir_dump (c2m_ctx_t c2m_ctx, const char *name) {
+  struct lir_ctx *lir = c2m_ctx->gen_ctx->lir;
+  int n_vregs = 0, n_spilled = 0;
+
+  for (size_t v = 1; v < VARR_LENGTH (lir_vreg_t, lir->vregs); v++) {
+    lir_vreg_t *vr = lir_vreg (lir, (int) v);
+    if (vr->end < 0) continue;
+    n_vregs++;
+    if (vr->reg == 0) n_spilled++;
+  }
+  fprintf (c2m_options->message_file, "  [lir] %s: %d insns, %d vregs, %d spilled\n", name,
+           (int) VARR_LENGTH (lir_insn_t, lir->insns), n_vregs, n_spilled);
+}
+
+/* Lower function definition FUNC_DEF into the IR and generate its code.
+   Return FALSE, without emitting anything, when the function should go
+   through gen_func_def instead. */
+static int lir_gen_func (c2m_ctx_t c2m_ctx, node_t func_def) {
+  gen_ctx_t gen_ctx = c2m_ctx->gen_ctx;
+  struct lir_ctx *lir = gen_ctx->lir;
+  decl_t func_decl = func_def->attr;
+  struct func_type *ft = func_decl->decl_spec.type->u.func_type;
+  node_t declarator = NL_EL (func_def->u.ops, 1), block = NL_EL (func_def->u.ops, 3);
+  const char *func_name = NL_HEAD (declarator->u.ops)->u.s.s;
+  struct node_scope *ns = block->attr;
+  struct type *param_types[4] = {NULL, NULL, NULL, NULL};
+  int nargs = 0, n_float_params = 0, max_regs[4] = {4, 0, 4, 0};
+  struct sljit_compiler *comp;
+  sljit_sw local_size;
+
+  if (SLJIT_NUMBER_OF_SCRATCH_REGISTERS < 4 || SLJIT_NUMBER_OF_SCRATCH_FLOAT_REGISTERS < 4)
+    return FALSE;
+  lir_reset (lir);
+  lir->ret_type = ft->ret_type;
+  if (!void_type_p (ft->ret_type) && !lir_value_type_p (ft->ret_type)) return FALSE;
+  if (ft->param_list != NULL) {
+    node_t first = NL_HEAD (ft->param_list->u.ops);
+    if (first != NULL && void_param_p (first)) first = NULL;
+    for (node_t p = first; p != NULL; p = NL_NEXT (p)) {
+      decl_t pd;
+      struct type *t;
+      if (p->code != N_SPEC_DECL || nargs >= 4) return FALSE;
+      pd = p->attr;
+      t = pd->decl_spec.type;
+      if (!lir_value_type_p (t) || t->mode == TM_ARR || t->mode == TM_FUNC) return FALSE;
+      param_types[nargs++] = t;
+      if (is_float_type (t)) {
+        int f32_p = is_f32_type (t);
+        lir->param_stores[lir->n_param_stores++]
+          = (lir_param_store_t){SLJIT_FR0 + n_float_params++, TRUE, f32_p, (sljit_sw) pd->offset};
+        int v = lir_var_vreg (c2m_ctx, pd);
+        if (v != 0) {
+          lir_insn_t *insn = lir_emit (c2m_ctx, LIR_FLOAD, v, lir_sp_op (), lir_none_op ());
+          insn->op = f32_p ? SLJIT_MOV_F32 : SLJIT_MOV_F64;
+          insn->disp = (sljit_sw) pd->offset;
+        }
+      } else {
+        sljit_s32 reg = SLJIT_S0 - lir->n_int_params++;
+        int v = lir_var_vreg (c2m_ctx, pd);
+        if (v == 0) {
+          lir->param_stores[lir->n_param_stores++]
+            = (lir_param_store_t){reg, FALSE, FALSE, (sljit_sw) pd->offset};
+        } else {
+          lir_vreg (lir, v)->fixed_p = TRUE;
+          lir_vreg (lir, v)->reg = reg;
+          if (lir_type_size (t) < 4) /* narrow arguments may come unextended */
+            lir_emit (c2m_ctx, LIR_EXT, v, lir_vreg_op (v), lir_none_op ())->op
+              = lir_load_op (t) | SLJIT_32;
+        }
+      }
+    }
+  }
+  if (gen_ctx->tls.key_p && image_ref_p (c2m_ctx, block, &gen_ctx->tls))
+    lir->tls_vreg = lir_gen_image_base (c2m_ctx, &gen_ctx->tls);
+  if (gen_ctx->inst.key_p && image_ref_p (c2m_ctx, block, &gen_ctx->inst))
+    lir->inst_vreg = lir_gen_image_base (c2m_ctx, &gen_ctx->inst);
+  lir_gen_stmt (c2m_ctx, block);
+  lir_gen_return (c2m_ctx, NULL);
+  if (lir->unsupported_p || !lir_build_bbs (lir)) return FALSE;
+
+  /* Optimize, then allocate registers. */
+  lir_copy_prop (lir, c2m_options->opt_lvn_p);
+  do {
+    lir_liveness (lir);
+  } while (lir_dce (lir));
+  lir_compact (lir);
+  if (c2m_options->opt_licm_p) {
+    lir_licm (lir);
+    lir_compact (lir);
+  }
+  lir_build_bbs (lir);
+  lir_liveness (lir);
+  lir_build_intervals (lir);
+  local_size = ns != NULL ? ((sljit_sw) ns->size + 7) & ~(sljit_sw) 7 : 0;
+  lir->va_offset = local_size;
+  if (lir->trampoline_p) local_size += 10 * (sljit_sw) sizeof (sljit_sw);
+  lir->call_slot_offset = local_size;
+  if (lir->has_icall_p) local_size += (sljit_sw) sizeof (sljit_sw);
+  lir->spill_offset = local_size;
+  lir_alloc_regs (lir, max_regs);
+  local_size = lir->spill_offset;
+
+  comp = sljit_create_compiler (NULL);
+  if (comp == NULL) return FALSE;
+  compiler = comp;
+  if (c2m_options->verbose_p) {
+    sljit_compiler_verbose (comp, c2m_options->message_file);
+    lir_dump (c2m_ctx, func_name);
+  }
+  sljit_emit_enter (compiler, 0, build_arg_types (ft->ret_type, param_types, nargs),
+                    max_regs[0] | SLJIT_ENTER_FLOAT (max_regs[2]),
+                    (lir->n_int_params + max_regs[1]) | SLJIT_ENTER_FLOAT (max_regs[3]),
+                    local_size);
+  for (int i = 0; i < lir->n_param_stores; i++) {
+    if (lir->param_stores[i].float_p)
+      sljit_emit_fop1 (compiler, lir->param_stores[i].f32_p ? SLJIT_MOV_F32 : SLJIT_MOV_F64,
+                       SLJIT_MEM1 (SLJIT_SP), lir->param_stores[i].offset,
+                       lir->param_stores[i].reg, 0);
+    else
+      sljit_emit_op1 (compiler, SLJIT_MOV, SLJIT_MEM1 (SLJIT_SP), lir->param_stores[i].offset,
+                      lir->param_stores[i].reg, 0);
+  }
+  VARR_TRUNC (void_ptr_t, lir->sljit_labels, 0);
+  for (int i = 0; i < lir->n_labels; i++) VARR_PUSH (void_ptr_t, lir->sljit_labels, NULL);
+  VARR_TRUNC (lir_jump_t, lir->jumps, 0);
+  for (int i = 0; i < (int) VARR_LENGTH (lir_insn_t, lir->insns); i++) lir_emit_insn (c2m_ctx, i);
+  for (size_t i = 0; i < VARR_LENGTH (lir_jump_t, lir->jumps); i++) {
+    lir_jump_t *j = &VARR_ADDR (lir_jump_t, lir->jumps)[i];
+    sljit_set_label (j->jump, VARR_GET (void_ptr_t, lir->sljit_labels, j->label));
+  }
+
+  void *code = sljit_generate_code (comp, 0, NULL);
+  if (code != NULL) {
+    compiled_func_t cf;
+    cf.name = func_name;
+    cf.code = code;
+    VARR_PUSH (compiled_func_t, compiled_funcs, cf);
+    struct func_slot *slot = find_func_slot (c2m_ctx, func_name);
+    if (slot != NULL) slot->code_addr = code;
+  } else {
+    fprintf (stderr, "c2sljit: code generation failed for %s\n", func_name);
+  }
+  sljit_free_compiler (comp); /* the code does not need it */
+  compiler = NULL;
+  return TRUE;
+}
+
+/* ---- Function definition code generation ---- */
+
+static void gen_func_def (c2m_ctx_t c2m_ctx, node_t func_def) {
+  gen_ctx_t gen_ctx = c2m_ctx->gen_ctx;
+  decl_t func_decl = func_def->attr;
+  struct type *func_type_node = func_decl->decl_spec.type;
+  assert (func_type_node->mode == TM_FUNC);
+  struct func_type *ft = func_type_node->u.func_type;
+
+  /* Extract function name from declarator: N_FUNC_DEF(decl_specs, declarator, decls, block) */
+  node_t declarator = NL_EL (func_def->u.ops, 1);
+  assert (declarator != NULL && declarator->code == N_DECL);
+  const char *func_name = NL_HEAD (declarator->u.ops)->u.s.s;
+
+  /* Opt 18: functions the IR covers are compiled through it */
+  if (gen_ctx->lir != NULL && lir_gen_func (c2m_ctx, func_def)) return;
+
+  /* Create sljit compiler for this function */
+  struct sljit_compiler *comp = sljit_create_compiler (NULL);
+  if (comp == NULL) {
+    fprintf (stderr, "c2sljit: failed to create sljit compiler for %s\n", func_name);
+    return;
+  }
+  compiler = comp;
+
+  /* Enable SLJIT verbose output if requested */
+  if (c2m_options->verbose_p)
+    sljit_compiler_verbose (comp, c2m_options->message_file);
+
+  /* Compute local frame size from the context checker's allocation.
+     N_FUNC_DEF children: decl_specs, declarator, decls, block (index 3). */
+  node_t block = NL_EL (func_def->u.ops, 3);
+  struct node_scope *ns = block != NULL ? block->attr : NULL;
+  sljit_sw local_size = ns != NULL ? (sljit_sw) ns->size : 256;
+  /* Round up to pointer alignment */
+  local_size = (local_size + sizeof (sljit_sw) - 1) & ~(sizeof (sljit_sw) - 1);
+  if (local_size < 64) local_size = 64;  /* minimum frame */
+  gen_ctx->call_save_offset = local_size;
+  int has_call = 0, has_variadic_extern = 0;
+  scan_calls (c2m_ctx, block, &has_call, &has_variadic_extern);
+  int call_arg_slots = has_variadic_extern ? 10 : has_call ? 4 : 0;
+  gen_ctx->call_arg_slots = call_arg_slots;
+  /* Stack layout for calls:
+     call_save_offset + 0..call_arg_slots:   arg slots (used at call time)
+     + func_save:                             saved func ptr for indirect calls (1 slot)
+     + call_temp_offset:                      temp arg eval areas (call_arg_slots slots
+                                              per level of call nesting in arguments)
+     + spill_base_offset:                     binary_arith spill area (16 slots) */
+  int call_temp_levels = has_call ? call_nesting (block) - 1 : 0;
+  local_size += (call_arg_slots + (has_call ? 1 : 0)) * (sljit_sw) sizeof (sljit_sw);
+  gen_ctx->call_temp_offset = local_size;
+  gen_ctx->call_temp_level = 0;
+  local_size += call_arg_slots * call_temp_levels * (sljit_sw) sizeof (sljit_sw);
+  gen_ctx->spill_base_offset = local_size;
+  local_size += 16 * (sljit_sw) sizeof (sljit_sw);  /* spill slots */
+  gen_ctx->call_ret_base = local_size;
+  local_size += 8 * (sljit_sw) sizeof (sljit_sw); /* return value saves for nested calls */
+  /* Opt 12: stack slots for array index address cache (2 entries) */
+  for (int ci = 0; ci < IND_CACHE_ENTRIES; ci++) {
+    gen_ctx->ind_cache_offsets[ci] = local_size;
+    local_size += (sljit_sw) sizeof (sljit_sw);
+    gen_ctx->ind_cache[ci].valid = 0;
+    gen_ctx->addr_cache[ci].reg = -1;
+  }
+  gen_ctx->ind_cache_next = 0;
+  gen_ctx->float_field_cache_count = 0;
+  gen_ctx->last_ind_cache_hit = -1;
+  gen_ctx->local_size = local_size;
+
+  /* Count parameters and collect types */
+  int nargs = 0;
+  struct type *param_types[4] = {NULL, NULL, NULL, NULL};
+  if (ft->param_list != NULL) {
+    node_t first_param = NL_HEAD (ft->param_list->u.ops);
+    if (!void_param_p (first_param)) {
+      for (node_t param = first_param; param != NULL; param = NL_NEXT (param)) {
+        if (param->code == N_DOTS) break;
+        if (nargs < 4) {
+          decl_t pd = param->attr;
+          param_types[nargs] = pd != NULL ? pd->decl_spec.type : NULL;
+        }
+        nargs++;
+      }
+    }
+  }
   if (nargs > 4) nargs = 4;  /* sljit supports up to ~4 word args directly */
 
   /* Build arg_types for sljit with proper float/int type info */
@@ -13999,7 +19295,7 @@ static void gen_func_def (c2m_ctx_t c2m_ctx, node_t func_def) {
   gen_ctx->n_float_saved_regs = 0;
   gen_ctx->assign_dest = 0;
   gen_ctx->float_assign_dest = 0;
-  gen_ctx->n_labels = 0;
+  HTAB_CLEAR (label_entry_t, gen_ctx->labels);
   gen_ctx->func_returns_float = is_float_type (ft->ret_type);
   gen_ctx->func_returns_f32 = is_f32_type (ft->ret_type);
 
@@ -14053,6 +19349,10 @@ static void gen_func_def (c2m_ctx_t c2m_ctx, node_t func_def) {
   int max_saved = SLJIT_NUMBER_OF_SAVED_REGISTERS;
   if (max_saved > MAX_REG_VARS) max_saved = MAX_REG_VARS;
   int avail_regs = max_saved - n_int_params;
+  /* Blocks of globals are kept in pinned saved registers */
+  int tls_p = gen_ctx->tls.key_p && image_ref_p (c2m_ctx, block, &gen_ctx->tls);
+  int inst_p = gen_ctx->inst.key_p && image_ref_p (c2m_ctx, block, &gen_ctx->inst);
+  avail_regs -= tls_p + inst_p;
   if (avail_regs > 0 && block != NULL) {
     struct reg_var candidates[MAX_REG_VARS];
     node_t scan_nodes[1] = {block};
@@ -14084,6 +19384,8 @@ static void gen_func_def (c2m_ctx_t c2m_ctx, node_t func_def) {
   /* Step 3: Compute register budget */
   int n_saved = n_int_params;
   if (gen_ctx->n_reg_vars > n_saved) n_saved = gen_ctx->n_reg_vars;
+  gen_ctx->tls_reg = tls_p ? SLJIT_S0 - n_saved++ : 0;
+  gen_ctx->inst_reg = inst_p ? SLJIT_S0 - n_saved++ : 0;
   int max_scratch = SLJIT_NUMBER_OF_SCRATCH_REGISTERS;
   if (max_scratch > 10) max_scratch = 10;
   gen_ctx->n_scratch_regs = max_scratch;
@@ -14123,6 +19425,21 @@ static void gen_func_def (c2m_ctx_t c2m_ctx, node_t func_def) {
     }
   }
 
+  /* Step 6: Fetch the blocks of thread-local and instance globals, once
+     per invocation */
+  if (tls_p) {
+    sljit_emit_op1 (compiler, SLJIT_MOV, SLJIT_R0, 0, SLJIT_IMM, (sljit_sw) &gen_ctx->tls);
+    sljit_emit_icall (compiler, SLJIT_CALL, SLJIT_ARGS1 (P, P), SLJIT_IMM,
+                      SLJIT_FUNC_ADDR (tls_block));
+    sljit_emit_op1 (compiler, SLJIT_MOV, gen_ctx->tls_reg, 0, SLJIT_RETURN_REG, 0);
+  }
+  if (inst_p) {
+    sljit_emit_op1 (compiler, SLJIT_MOV, SLJIT_R0, 0, SLJIT_IMM, (sljit_sw) &gen_ctx->inst);
+    sljit_emit_icall (compiler, SLJIT_CALL, SLJIT_ARGS1 (P, P), SLJIT_IMM,
+                      SLJIT_FUNC_ADDR (inst_block));
+    sljit_emit_op1 (compiler, SLJIT_MOV, gen_ctx->inst_reg, 0, SLJIT_RETURN_REG, 0);
+  }
+
   /* Promoted locals: no load needed — C doesn't require zero-init for locals.
      The N_SPEC_DECL initializer will write the correct value via store_to_mem(OPK_REG). */
 
@@ -14164,15 +19481,14 @@ static void gen_func_def (c2m_ctx_t c2m_ctx, node_t func_def) {
     compiled_func_t cf;
     cf.name = func_name;
     cf.code = code;
-    cf.comp = comp;
     VARR_PUSH (compiled_func_t, compiled_funcs, cf);
     /* Fill in function slot for indirect calls */
     struct func_slot *slot = find_func_slot (c2m_ctx, func_name);
     if (slot != NULL) slot->code_addr = code;
   } else {
     fprintf (stderr, "c2sljit: code generation failed for %s\n", func_name);
-    sljit_free_compiler (comp);
   }
+  sljit_free_compiler (comp); /* the code does not need it */
 
   gen_ctx->in_function = FALSE;
   compiler = NULL;
@@ -14232,6 +19548,10 @@ static void gen_prescan (c2m_ctx_t c2m_ctx, node_t r) {
           int has_call = 0, has_loop = 0, has_goto = 0, has_local = 0;
           scan_inline_body (block, &has_call, &has_loop, &has_goto, &has_local);
           if (has_call || has_loop || has_goto || has_local) eligible = 0;
+          /* The caller may not have the thread's block at hand */
+          if (image_ref_p (c2m_ctx, block, &c2m_ctx->gen_ctx->tls)
+              || image_ref_p (c2m_ctx, block, &c2m_ctx->gen_ctx->inst))
+            eligible = 0;
           if (eligible) {
             int node_count = count_ast_nodes (block);
             if (node_count > 30) eligible = 0;
@@ -14246,10 +19566,339 @@ static void gen_prescan (c2m_ctx_t c2m_ctx, node_t r) {
         }
       }
     }
-    break;
+    break;
+  }
+  default: break;
+  }
+}
+
+/* Return TRUE if all bytes of an object of TYPE are const, so it can live
+   in read-only data. */
+static int const_object_p (struct type *type) {
+  while (type->mode == TM_ARR) type = type->u.arr_type->el_type;
+  return type->type_qual.const_p && !type->type_qual.volatile_p;
+}
+
+/* ---- Static initializers of globals ---- */
+
+/* Offset of the object designated by init_object_path in the initialized
+   object. */
+static mir_size_t get_object_path_offset (c2m_ctx_t c2m_ctx) {
+  init_object_t init_object;
+  mir_size_t offset = 0;
+
+  for (size_t i = 0; i < VARR_LENGTH (init_object_t, init_object_path); i++) {
+    init_object = VARR_GET (init_object_t, init_object_path, i);
+    if (init_object.container_type->mode == TM_ARR) {
+      offset += (init_object.u.curr_index
+                 * type_size (c2m_ctx, init_object.container_type->u.arr_type->el_type));
+    } else if (!anon_struct_union_type_member_p (init_object.u.curr_member)) {
+      /* Members of anonymous structs/unions already have adjusted offsets */
+      offset += ((decl_t) init_object.u.curr_member->attr)->offset;
+    }
+  }
+  return offset;
+}
+
+/* Push the elements of an already checked INITIALIZER of an object of
+   *TYPE_PTR to init_els.  It walks the initializer the same way as
+   check_initializer does. */
+static void collect_init_els (c2m_ctx_t c2m_ctx, decl_t member_decl, struct type **type_ptr,
+                              node_t initializer, int const_only_p, int top_p MIR_UNUSED) {
+  gen_ctx_t gen_ctx = c2m_ctx->gen_ctx;
+  struct type *type = *type_ptr;
+  node_t literal, des_list, curr_des, init, str, value;
+  size_t mark;
+  symbol_t sym;
+  init_object_t init_object;
+  init_el_t init_el;
+  int addr_p = FALSE;
+
+  literal = get_compound_literal (initializer, &addr_p);
+  if (literal != NULL && !addr_p && initializer->code != N_STR && initializer->code != N_STR16
+      && initializer->code != N_STR32)
+    initializer = NL_EL (literal->u.ops, 1);
+collect_one_value:
+  init_el.offset = get_object_path_offset (c2m_ctx);
+  init_el.member_decl = member_decl;
+  init_el.el_type = type;
+  if (initializer->code != N_LIST
+      && !(type->mode == TM_ARR
+           && init_compatible_string_p (initializer, type->u.arr_type->el_type))) {
+    init_el.init = initializer;
+    VARR_PUSH (init_el_t, gen_ctx->init_els, init_el);
+    return;
+  }
+  init = NL_HEAD (initializer->u.ops);
+  if (((str = initializer)->code == N_STR || str->code == N_STR16
+       || str->code == N_STR32 /* string or string in parentheses */
+       || (init != NULL && init->code == N_INIT && NL_EL (initializer->u.ops, 1) == NULL
+           && (des_list = NL_HEAD (init->u.ops))->code == N_LIST
+           && NL_HEAD (des_list->u.ops) == NULL && NL_EL (init->u.ops, 1) != NULL
+           && ((str = NL_EL (init->u.ops, 1))->code == N_STR || str->code == N_STR16
+               || str->code == N_STR32)))
+      && type->mode == TM_ARR && init_compatible_string_p (str, type->u.arr_type->el_type)) {
+    init_el.init = str;
+    VARR_PUSH (init_el_t, gen_ctx->init_els, init_el);
+    return;
+  }
+  if (init == NULL) return;
+  des_list = NL_HEAD (init->u.ops);
+  if (type->mode != TM_ARR && type->mode != TM_STRUCT && type->mode != TM_UNION) {
+    initializer = NL_NEXT (des_list); /* scalar in braces */
+    goto collect_one_value;
+  }
+  mark = VARR_LENGTH (init_object_t, init_object_path);
+  init_object.container_type = type;
+  init_object.field_designator_p = FALSE;
+  if (type->mode == TM_ARR)
+    init_object.u.curr_index = -1;
+  else
+    init_object.u.curr_member = NULL;
+  VARR_PUSH (init_object_t, init_object_path, init_object);
+  for (; init != NULL; init = NL_NEXT (init)) {
+    des_list = NL_HEAD (init->u.ops);
+    value = NL_NEXT (des_list);
+    if ((curr_des = NL_HEAD (des_list->u.ops)) == NULL) {
+      if (!update_path_and_do (c2m_ctx, TRUE, collect_init_els, mark, value, const_only_p, NULL,
+                               POS (init), "array/struct/union"))
+        break;
+      continue;
+    }
+    struct type *curr_type = type;
+    int first_p = TRUE;
+
+    VARR_TRUNC (init_object_t, init_object_path, mark + 1);
+    for (; curr_des != NULL; curr_des = NL_NEXT (curr_des), first_p = FALSE) {
+      init_object = VARR_LAST (init_object_t, init_object_path);
+      if (first_p)
+        VARR_POP (init_object_t, init_object_path);
+      else if (init_object.container_type->mode == TM_ARR)
+        curr_type = init_object.container_type->u.arr_type->el_type;
+      else
+        curr_type = ((decl_t) init_object.u.curr_member->attr)->decl_spec.type;
+      if (curr_des->code == N_FIELD_ID) {
+        if (!symbol_find (c2m_ctx, S_REGULAR, NL_HEAD (curr_des->u.ops), curr_type->u.tag_type,
+                          &sym))
+          break;
+        process_init_field_designator (c2m_ctx, sym.def_node, curr_type);
+        if (!update_path_and_do (c2m_ctx, NL_NEXT (curr_des) == NULL, collect_init_els, mark,
+                                 value, const_only_p, NULL, POS (init), "struct/union"))
+          break;
+      } else {
+        init_object.u.curr_index = ((struct expr *) curr_des->attr)->c.i_val - 1; /* previous el */
+        init_object.field_designator_p = FALSE;
+        init_object.container_type = curr_type;
+        VARR_PUSH (init_object_t, init_object_path, init_object);
+        if (!update_path_and_do (c2m_ctx, NL_NEXT (curr_des) == NULL, collect_init_els, mark,
+                                 value, const_only_p, NULL, POS (init), "array"))
+          break;
+      }
+    }
   }
-  default: break;
+  VARR_TRUNC (init_object_t, init_object_path, mark);
+}
+
+/* Bytes of string literal STR including the terminator. */
+static size_t str_node_size (node_t str) {
+  return str->u.s.len * (str->code == N_STR ? 1 : str->code == N_STR16 ? 2 : 4);
+}
+
+/* Address of OFFSET in IMAGE's initial block, or OFFSET itself if IMAGE
+   is NULL. */
+static char *static_init_loc (struct data_image *image, sljit_sw offset) {
+  return image == NULL ? (char *) offset : image->init + offset;
+}
+
+/* Store constant E converted to scalar TYPE at P, or into bit-field
+   MEMBER_DECL of the unit at P. */
+static void store_init_scalar (c2m_ctx_t c2m_ctx, char *p, struct type *type,
+                               decl_t member_decl, struct expr *e) {
+  size_t size = type_size (c2m_ctx, type);
+  struct expr v;
+
+  v.const_p = TRUE;
+  v.type = type;
+  cast_value (&v, e, type);
+  if (floating_type_p (type)) {
+    float f = (float) v.c.d_val;
+    double d = (double) v.c.d_val;
+
+    memcpy (p,
+            size == sizeof (float)    ? (void *) &f
+            : size == sizeof (double) ? (void *) &d
+                                      : (void *) &v.c.d_val,
+            size);
+  } else if (member_decl != NULL && member_decl->bit_offset >= 0) {
+    int width = member_decl->width;
+    mir_ullong unit = 0, mask = width >= 64 ? ~(mir_ullong) 0 : ((mir_ullong) 1 << width) - 1;
+
+    memcpy (&unit, p, size);
+    unit &= ~(mask << member_decl->bit_offset);
+    unit |= (v.c.u_val & mask) << member_decl->bit_offset;
+    memcpy (p, &unit, size);
+  } else {
+    memcpy (p, &v.c.u_val, size); /* little endian */
+  }
+}
+
+/* Store pointer TARGET at OFFSET of IMAGE (see static_init_loc).  TARGET
+   is an offset in TARGET_IMAGE's blocks if that is not NULL. */
+static void store_init_addr (c2m_ctx_t c2m_ctx, struct data_image *image, sljit_sw offset,
+                             struct data_image *target_image, sljit_sw target, pos_t pos) {
+  if (target_image != NULL && target_image != image) {
+    error (c2m_ctx, pos,
+           target_image == &c2m_ctx->gen_ctx->tls
+             ? "address of a thread local variable in initializer of another object"
+             : "address of an instance global in initializer of a shared object");
+    return;
+  }
+  memcpy (static_init_loc (image, offset), &target, sizeof (target));
+  if (target_image != NULL) VARR_PUSH (sljit_sw, image->relocs, offset);
+}
+
+/* Return TRUE if init_els from MARK refer to addresses of variables. */
+static int init_els_var_addr_p (c2m_ctx_t c2m_ctx, size_t mark) {
+  gen_ctx_t gen_ctx = c2m_ctx->gen_ctx;
+
+  for (size_t i = mark; i < VARR_LENGTH (init_el_t, gen_ctx->init_els); i++) {
+    struct expr *e = VARR_GET (init_el_t, gen_ctx->init_els, i).init->attr;
+
+    if (!e->const_p && e->const_addr_p && e->def_node != NULL && e->def_node->code == N_SPEC_DECL
+        && ((decl_t) e->def_node->attr)->decl_spec.type->mode != TM_FUNC)
+      return TRUE;
+  }
+  return FALSE;
+}
+
+/* Reserve a static object of TYPE in *IMAGE_PTR and return its offset
+   there.  If *IMAGE_PTR is NULL or has no room, the object goes to a data
+   segment, *IMAGE_PTR becomes NULL and the result is its address. */
+static sljit_sw static_object_alloc (c2m_ctx_t c2m_ctx, struct data_image **image_ptr,
+                                     struct type *type, int init_p) {
+  gen_ctx_t gen_ctx = c2m_ctx->gen_ctx;
+  int size = sljit_type_size (type);
+  int align = type->align > 0 ? type->align : size;
+  sljit_sw offset;
+
+  if (align > 16) align = 16;
+  if (*image_ptr != NULL && image_alloc (c2m_ctx, *image_ptr, size, align, init_p, &offset))
+    return offset;
+  *image_ptr = NULL;
+  return (sljit_sw) data_alloc (c2m_ctx,
+                                const_object_p (type) ? &gen_ctx->rodata
+                                : init_p              ? &gen_ctx->data
+                                                      : &gen_ctx->bss,
+                                size, align);
+}
+
+static void fill_static_object (c2m_ctx_t c2m_ctx, size_t mark, struct data_image *image,
+                                sljit_sw offset);
+
+/* Allocate and fill the object of a compound literal whose address is
+   taken by an initializer of an object in IMAGE.  Return the address as
+   for static_object_alloc. */
+static sljit_sw gen_static_compound_literal (c2m_ctx_t c2m_ctx, node_t literal,
+                                             struct data_image **image_ptr) {
+  gen_ctx_t gen_ctx = c2m_ctx->gen_ctx;
+  struct type *type = ((decl_t) NL_HEAD (literal->u.ops)->attr)->decl_spec.type;
+  size_t mark = VARR_LENGTH (init_el_t, gen_ctx->init_els);
+  sljit_sw offset;
+
+  collect_init_els (c2m_ctx, NULL, &type, NL_EL (literal->u.ops, 1), TRUE, TRUE);
+  offset = static_object_alloc (c2m_ctx, image_ptr, type, TRUE);
+  fill_static_object (c2m_ctx, mark, *image_ptr, offset);
+  return offset;
+}
+
+/* Write init_els from MARK into the object at OFFSET of IMAGE (see
+   static_init_loc) and pop them.  Pointers to globals and functions are
+   recorded in data_relocs. */
+static void fill_static_object (c2m_ctx_t c2m_ctx, size_t mark, struct data_image *image,
+                                sljit_sw offset) {
+  gen_ctx_t gen_ctx = c2m_ctx->gen_ctx;
+  size_t len = VARR_LENGTH (init_el_t, gen_ctx->init_els);
+
+  for (size_t i = mark; i < len; i++) {
+    init_el_t el = VARR_GET (init_el_t, gen_ctx->init_els, i);
+    sljit_sw el_offset = offset + (sljit_sw) el.offset;
+    struct expr *e = el.init->attr;
+    struct data_image *target_image = image;
+    node_t literal;
+    data_reloc_t reloc;
+    int addr_p;
+
+    if (el.el_type->mode == TM_ARR) { /* string in array */
+      size_t size = type_size (c2m_ctx, el.el_type), str_size = str_node_size (el.init);
+
+      memcpy (static_init_loc (image, el_offset), el.init->u.s.s,
+              str_size < size ? str_size : size);
+    } else if (e->const_p) {
+      store_init_scalar (c2m_ctx, static_init_loc (image, el_offset), el.el_type, el.member_decl,
+                         e);
+    } else if ((literal = get_compound_literal (el.init, &addr_p)) != NULL
+               && (addr_p || literal->code != N_COMPOUND_LITERAL)) {
+      sljit_sw addr
+        = (literal->code != N_COMPOUND_LITERAL
+             ? (sljit_sw) data_string (c2m_ctx, literal->u.s.s, str_node_size (literal))
+             : gen_static_compound_literal (c2m_ctx, literal, &target_image));
+
+      if (literal->code != N_COMPOUND_LITERAL) target_image = NULL;
+      store_init_addr (c2m_ctx, image, el_offset, target_image, addr, POS (el.init));
+    } else if (e->const_addr_p && e->def_node != NULL) {
+      if (e->def_node->code == N_STR || e->def_node->code == N_STR16
+          || e->def_node->code == N_STR32) {
+        store_init_addr (c2m_ctx, image, el_offset, NULL,
+                         (sljit_sw) data_string (c2m_ctx, e->def_node->u.s.s,
+                                                 str_node_size (e->def_node))
+                           + (sljit_sw) e->c.i_val,
+                         POS (el.init));
+      } else if (e->def_node->code == N_LABEL_ADDR) {
+        error (c2m_ctx, POS (el.init), "label address in static initializer is not supported");
+      } else {
+        reloc.image = image;
+        reloc.offset = el_offset;
+        reloc.target = e->def_node;
+        reloc.addend = (sljit_sw) e->c.i_val;
+        reloc.pos = POS (el.init);
+        VARR_PUSH (data_reloc_t, gen_ctx->data_relocs, reloc);
+      }
+    } else {
+      error (c2m_ctx, POS (el.init), "initializer element is not a constant");
+    }
+  }
+  VARR_TRUNC (init_el_t, gen_ctx->init_els, mark);
+}
+
+/* Write the pointers recorded in data_relocs now that every global and
+   function has an address. */
+static void resolve_data_relocs (c2m_ctx_t c2m_ctx) {
+  gen_ctx_t gen_ctx = c2m_ctx->gen_ctx;
+
+  for (size_t i = 0; i < VARR_LENGTH (data_reloc_t, gen_ctx->data_relocs); i++) {
+    data_reloc_t reloc = VARR_GET (data_reloc_t, gen_ctx->data_relocs, i);
+    decl_t decl = reloc.target->attr;
+    const char *name = NL_HEAD (NL_EL (reloc.target->u.ops, 1)->u.ops)->u.s.s;
+    struct data_image *image = NULL;
+    struct func_slot *slot;
+    sljit_sw addr = 0;
+
+    if (decl->decl_spec.type->mode == TM_FUNC) {
+      if ((slot = find_func_slot (c2m_ctx, name)) != NULL) addr = (sljit_sw) slot->code_addr;
+    } else {
+      global_var_t gv;
+      if (find_global (c2m_ctx, decl, &gv)) {
+        image = gv.image;
+        addr = image != NULL ? gv.image_offset : (sljit_sw) gv.addr;
+      }
+    }
+    if (addr == 0 && image == NULL && (addr = (sljit_sw) dlsym (RTLD_DEFAULT, name)) == 0) {
+      error (c2m_ctx, reloc.pos, "unresolved %s in initializer", name);
+      continue;
+    }
+    store_init_addr (c2m_ctx, reloc.image, reloc.offset, image, addr + reloc.addend, reloc.pos);
   }
+  VARR_TRUNC (data_reloc_t, gen_ctx->data_relocs, 0);
 }
 
 static void gen_top (c2m_ctx_t c2m_ctx, node_t r) {
@@ -14272,56 +19921,28 @@ static void gen_top (c2m_ctx_t c2m_ctx, node_t r) {
     if (decl->decl_spec.typedef_p || decl->decl_spec.extern_p) break;
     struct type *type = decl->decl_spec.type;
     if (type == NULL || type->mode == TM_FUNC) break;
-    int size = sljit_type_size (type);
-    if (size <= 0) break;
-    int align = type->align > 0 ? type->align : size;
-    if (align > 16) align = 16;
-    void *addr = data_alloc (c2m_ctx, size, align);
-    memset (addr, 0, size); /* zero-initialize */
-    /* Register in global variable table */
+    if (sljit_type_size (type) <= 0) break;
     gen_ctx_t gen_ctx = c2m_ctx->gen_ctx;
-    if (gen_ctx->n_globals < MAX_GLOBALS) {
-      gen_ctx->globals[gen_ctx->n_globals].decl = decl;
-      gen_ctx->globals[gen_ctx->n_globals].addr = addr;
-      gen_ctx->n_globals++;
-    }
-    /* Process initializer if present */
     node_t initializer = NL_EL (r->u.ops, 4);
-    if (initializer != NULL && initializer->code != N_IGNORE) {
-      node_t init_expr = initializer;
-      if (initializer->code == N_INIT) init_expr = NL_EL (initializer->u.ops, 1);
-      if (init_expr != NULL && init_expr->code != N_IGNORE) {
-        if (init_expr->code == N_STR) {
-          /* String literal initializer */
-          size_t slen = init_expr->u.s.len;
-          if (type->mode == TM_PTR) {
-            /* char *p = "hello" — allocate string, store address */
-            char *str_dst = data_alloc (c2m_ctx, slen, 1);
-            memcpy (str_dst, init_expr->u.s.s, slen);
-            sljit_sw str_addr = (sljit_sw) str_dst;
-            memcpy (addr, &str_addr, sizeof (sljit_sw));
-          } else {
-            /* char msg[] = "hello" — copy string directly into array */
-            size_t copy_len = slen < (size_t) size ? slen : (size_t) size;
-            memcpy (addr, init_expr->u.s.s, copy_len);
-          }
-        } else {
-          struct expr *e = init_expr->attr;
-          if (e != NULL && e->const_p) {
-            /* Constant initializer: store directly */
-            if (size <= (int) sizeof (sljit_sw)) {
-              if (signed_integer_type_p (type)) {
-                sljit_sw val = e->c.i_val;
-                memcpy (addr, &val, size);
-              } else {
-                sljit_uw val = e->c.u_val;
-                memcpy (addr, &val, size);
-              }
-            }
-          }
-        }
-      }
-    }
+    int init_p = initializer != NULL && initializer->code != N_IGNORE;
+    size_t mark = VARR_LENGTH (init_el_t, gen_ctx->init_els);
+    if (init_p) collect_init_els (c2m_ctx, NULL, &type, initializer, TRUE, TRUE);
+    /* Constant pointers to instance globals differ between instances */
+    struct data_image *image
+      = decl->decl_spec.thread_local_p ? &gen_ctx->tls
+        : c2m_options->instances_p
+            && (!const_object_p (type) || init_els_var_addr_p (c2m_ctx, mark))
+          ? &gen_ctx->inst
+          : NULL;
+    sljit_sw offset = static_object_alloc (c2m_ctx, &image, type, init_p);
+    /* Register in global variable table */
+    global_var_t gv;
+    gv.decl = decl;
+    gv.addr = image != NULL ? NULL : (void *) offset;
+    gv.image = image;
+    gv.image_offset = image != NULL ? offset : -1;
+    HTAB_DO (global_var_t, gen_ctx->globals, gv, HTAB_REPLACE, gv);
+    fill_static_object (c2m_ctx, mark, image, offset);
     break;
   }
   default: break;
@@ -14330,36 +19951,175 @@ static void gen_top (c2m_ctx_t c2m_ctx, node_t r) {
 
 /* ---- gen_init / gen_finish / gen_mir (sljit version) ---- */
 
-static void gen_finish (c2m_ctx_t c2m_ctx) {
+/* Free the state only generation needs, keeping what the code of the
+   module uses at run time. */
+static void gen_release_scratch (gen_ctx_t gen_ctx) {
+  if (gen_ctx->lir != NULL) lir_destroy (gen_ctx->lir);
+  gen_ctx->lir = NULL;
+  if (gen_ctx->str_pool == NULL) return;
+  HTAB_DESTROY (pool_str_t, gen_ctx->str_pool);
+  VARR_DESTROY (init_el_t, gen_ctx->init_els);
+  HTAB_DESTROY (global_var_t, gen_ctx->globals);
+  HTAB_DESTROY (label_entry_t, gen_ctx->labels);
+  VARR_DESTROY (data_reloc_t, gen_ctx->data_relocs);
+}
+
+/* Low-memory mode: keep only a compact map of the module functions which
+   does not refer to the frontend strings. */
+static void gen_compact_symbols (c2m_ctx_t c2m_ctx) {
   gen_ctx_t gen_ctx = c2m_ctx->gen_ctx;
-  if (gen_ctx == NULL) return;
-  /* Free compiled functions' sljit compilers */
-  for (size_t i = 0; i < VARR_LENGTH (compiled_func_t, compiled_funcs); i++) {
-    compiled_func_t *cf = &VARR_ADDR (compiled_func_t, compiled_funcs)[i];
-    if (cf->code != NULL) sljit_free_code (cf->code, NULL);
-    if (cf->comp != NULL) sljit_free_compiler (cf->comp);
-  }
+  size_t i, len = 0, n = VARR_LENGTH (compiled_func_t, compiled_funcs);
+  compiled_func_t *cfs = VARR_ADDR (compiled_func_t, compiled_funcs);
+  char *p;
+
+  for (i = 0; i < n; i++)
+    if (cfs[i].name != NULL) len += strlen (cfs[i].name) + 1;
+  gen_ctx->names = p = c2sljit_calloc (c2m_ctx, len + 1);
+  for (i = 0; i < n; i++)
+    if (cfs[i].name != NULL) {
+      len = strlen (cfs[i].name) + 1;
+      cfs[i].name = memcpy (p, cfs[i].name, len);
+      p += len;
+    }
+  if (n != 0) VARR_TAILOR (compiled_func_t, compiled_funcs, n);
+  /* The slots are only kept alive for the code referring to them */
+  HTAB_FOREACH_ELEM (func_slot_t, gen_ctx->func_slots, func_slot_forget, NULL);
+}
+
+/* Free module GEN_CTX: its code, data and metadata. */
+static void gen_finish (c2m_ctx_t c2m_ctx, gen_ctx_t gen_ctx) {
+  gen_ctx_t *ptr;
+
+  for (ptr = &c2m_ctx->modules; *ptr != gen_ctx; ptr = &(*ptr)->next_module) assert (*ptr != NULL);
+  *ptr = gen_ctx->next_module;
+  if (c2m_ctx->gen_ctx == gen_ctx) c2m_ctx->gen_ctx = NULL;
+  for (size_t i = 0; i < VARR_LENGTH (compiled_func_t, compiled_funcs); i++)
+    sljit_free_code (VARR_GET (compiled_func_t, compiled_funcs, i).code, NULL);
   VARR_DESTROY (compiled_func_t, compiled_funcs);
-  free (gen_ctx->data_buf);
-  free (gen_ctx);
-  c2m_ctx->gen_ctx = NULL;
-}
-
-static void gen_mir (c2m_ctx_t c2m_ctx, node_t r) {
+  gen_release_scratch (gen_ctx);
+  data_free (&gen_ctx->rodata);
+  data_free (&gen_ctx->data);
+  data_free (&gen_ctx->bss);
+  HTAB_DESTROY (func_slot_t, gen_ctx->func_slots);
+  VARR_DESTROY (sljit_sw, gen_ctx->tls.relocs);
+  VARR_DESTROY (sljit_sw, gen_ctx->inst.relocs);
+  if (gen_ctx->tls.key_p) {
+    /* Blocks of threads still running are not reachable from here */
+    free (pthread_getspecific (gen_ctx->tls.key));
+    pthread_key_delete (gen_ctx->tls.key);
+  }
+  free (gen_ctx->tls.init);
+  if (gen_ctx->inst.key_p) pthread_key_delete (gen_ctx->inst.key);
+  free (gen_ctx->inst.default_block);
+  free (gen_ctx->inst.init);
+  if (gen_ctx->names != NULL) MIR_free (c2m_alloc (c2m_ctx), gen_ctx->names);
+  MIR_free (c2m_alloc (c2m_ctx), gen_ctx);
+}
+
+static void gen_start (c2m_ctx_t c2m_ctx) {
   MIR_alloc_t alloc = c2m_alloc (c2m_ctx);
   gen_ctx_t gen_ctx;
 
   c2m_ctx->gen_ctx = gen_ctx = c2sljit_calloc (c2m_ctx, sizeof (struct gen_ctx));
+  gen_ctx->next_module = c2m_ctx->modules;
+  c2m_ctx->modules = gen_ctx;
   VARR_CREATE (compiled_func_t, compiled_funcs, alloc, 16);
+  HTAB_CREATE (pool_str_t, gen_ctx->str_pool, alloc, 64, pool_str_hash, pool_str_eq, NULL);
+  VARR_CREATE (init_el_t, gen_ctx->init_els, alloc, 64);
+  HTAB_CREATE (global_var_t, gen_ctx->globals, alloc, 256, global_var_hash, global_var_eq, NULL);
+  HTAB_CREATE_WITH_FREE_FUNC (func_slot_t, gen_ctx->func_slots, alloc, 256, func_slot_hash,
+                              func_slot_eq, func_slot_free, alloc);
+  HTAB_CREATE_WITH_FREE_FUNC (label_entry_t, gen_ctx->labels, alloc, 64, label_entry_hash,
+                              label_entry_eq, label_entry_free, alloc);
+  VARR_CREATE (data_reloc_t, gen_ctx->data_relocs, alloc, 16);
+  VARR_CREATE (sljit_sw, gen_ctx->tls.relocs, alloc, 0);
+  VARR_CREATE (sljit_sw, gen_ctx->inst.relocs, alloc, 0);
+  gen_ctx->instances_p = c2m_options->instances_p;
+  if (c2m_options->opt_lir_p) gen_ctx->lir = lir_create (c2m_ctx);
+}
+
+static void gen_end (c2m_ctx_t c2m_ctx) {
+  gen_ctx_t gen_ctx = c2m_ctx->gen_ctx;
+
+  resolve_data_relocs (c2m_ctx);
+  if (gen_ctx->inst.key_p) gen_ctx->inst.default_block = image_new_block (&gen_ctx->inst);
+  data_seal (&gen_ctx->rodata);
+  gen_release_scratch (gen_ctx);
+  if (c2m_options->low_memory_p) gen_compact_symbols (c2m_ctx);
+}
 
+static void gen_mir (c2m_ctx_t c2m_ctx, node_t r) {
+  gen_start (c2m_ctx);
   gen_prescan (c2m_ctx, r);
   gen_top (c2m_ctx, r);
+  gen_end (c2m_ctx);
 }
 
-/* ---- Retrieve compiled main function ---- */
+/* ---- Streaming compilation ---- */
 
-static void *find_compiled_func (c2m_ctx_t c2m_ctx, const char *name) {
-  gen_ctx_t gen_ctx = c2m_ctx->gen_ctx;
+/* With stream_p, each external declaration is checked and generated as
+   soon as it is parsed.  The body of a function definition lives in the
+   body arena and is released after its code generation, so the AST
+   memory is bounded by the largest function.  The body is kept when
+   something outside it refers to it: an inlinable function, an
+   implicit or block scope extern declaration, a static initializer
+   resolved at the module end or a possibly incomplete declaration.
+   Calls of functions defined later go through their slots.  Code
+   generated after an error is unloaded at the end. */
+static void stream_start (c2m_ctx_t c2m_ctx, node_t module) {
+  context_start (c2m_ctx, module);
+  if (!c2m_options->syntax_only_p) gen_start (c2m_ctx);
+}
+
+static void stream_ext_decl (c2m_ctx_t c2m_ctx, node_t r) {
+  check_ctx_t check_ctx = c2m_ctx->check_ctx;
+  size_t incomplete_decls_num = VARR_LENGTH (node_t, possible_incomplete_decls);
+  size_t call_nodes_num = VARR_LENGTH (node_t, call_nodes), relocs_num = 0;
+  struct func_slot *slot = NULL;
+  int gen_p = FALSE, keep_p;
+  node_t block;
+
+  if (!c2m_options->syntax_only_p) {
+    body_record_p = r->code == N_FUNC_DEF;
+    context_ext_decl (c2m_ctx, r);
+    body_record_p = FALSE;
+    if (n_errors == 0) {
+      gen_p = TRUE;
+      relocs_num = VARR_LENGTH (data_reloc_t, c2m_ctx->gen_ctx->data_relocs);
+      gen_prescan (c2m_ctx, r);
+      gen_top (c2m_ctx, r);
+    }
+  }
+  if (r->code != N_FUNC_DEF) return;
+  block = NL_EL (r->u.ops, 3);
+  if (gen_p) slot = find_func_slot (c2m_ctx, NL_HEAD (NL_EL (r->u.ops, 1)->u.ops)->u.s.s);
+  keep_p = (n_errors != 0 || c2m_options->debug_p || body_ref_p
+            || VARR_LENGTH (node_t, possible_incomplete_decls) != incomplete_decls_num
+            || (slot != NULL && slot->inlinable)
+            || (gen_p && VARR_LENGTH (data_reloc_t, c2m_ctx->gen_ctx->data_relocs) != relocs_num));
+  tpname_release_body (c2m_ctx, keep_p);
+  symbol_release_body (c2m_ctx, keep_p);
+  if (keep_p) {
+    reg_body_keep (c2m_ctx);
+    return;
+  }
+  VARR_TRUNC (node_t, call_nodes, call_nodes_num);
+  NL_REMOVE (r->u.ops, block);
+  reg_body_release (c2m_ctx);
+}
+
+static void stream_finish (c2m_ctx_t c2m_ctx) {
+  context_end (c2m_ctx);
+  if (c2m_ctx->gen_ctx == NULL) return;
+  if (n_errors == 0)
+    gen_end (c2m_ctx);
+  else
+    gen_finish (c2m_ctx, c2m_ctx->gen_ctx);
+}
+
+/* ---- Retrieve compiled functions ---- */
+
+static void *find_compiled_func (gen_ctx_t gen_ctx, const char *name) {
   if (gen_ctx == NULL) return NULL;
   for (size_t i = 0; i < VARR_LENGTH (compiled_func_t, compiled_funcs); i++) {
     compiled_func_t *cf = &VARR_ADDR (compiled_func_t, compiled_funcs)[i];
@@ -14468,7 +20228,7 @@ static void print_type (c2m_ctx_t c2m_ctx, FILE *f, struct type *type) {
   switch (type->mode) {
   case TM_UNDEF: fprintf (f, "undef type mode"); break;
   case TM_BASIC: print_basic_type (f, type->u.basic_type); break;
-  case TM_ENUM: fprintf (f, "enum node %u", type->u.tag_type->uid); break;
+  case TM_ENUM: fprintf (f, "enum node %p", (void *) type->u.tag_type); break;
   case TM_PTR:
     fprintf (f, "ptr (");
     print_type (c2m_ctx, f, type->u.ptr_type);
@@ -14479,19 +20239,19 @@ static void print_type (c2m_ctx_t c2m_ctx, FILE *f, struct type *type) {
     }
     if (type->func_type_before_adjustment_p) fprintf (f, ", former func");
     break;
-  case TM_STRUCT: fprintf (f, "struct node %u", type->u.tag_type->uid); break;
-  case TM_UNION: fprintf (f, "union node %u", type->u.tag_type->uid); break;
+  case TM_STRUCT: fprintf (f, "struct node %p", (void *) type->u.tag_type); break;
+  case TM_UNION: fprintf (f, "union node %p", (void *) type->u.tag_type); break;
   case TM_ARR:
     fprintf (f, "array [%s", type->u.arr_type->static_p ? "static " : "");
     print_qual (f, type->u.arr_type->ind_type_qual);
-    fprintf (f, "size node %u] (", type->u.arr_type->size->uid);
+    fprintf (f, "size node %p] (", (void *) type->u.arr_type->size);
     print_type (c2m_ctx, f, type->u.arr_type->el_type);
     fprintf (f, ")");
     break;
   case TM_FUNC:
     fprintf (f, "func ");
     print_type (c2m_ctx, f, type->u.func_type->ret_type);
-    fprintf (f, "(params node %u", type->u.func_type->param_list->uid);
+    fprintf (f, "(params node %p", (void *) type->u.func_type->param_list);
     fprintf (f, type->u.func_type->dots_p ? ", ...)" : ")");
     break;
   default: assert (FALSE);
@@ -14515,7 +20275,7 @@ static void print_decl_spec (c2m_ctx_t c2m_ctx, FILE *f, struct decl_spec *decl_
   if (decl_spec->no_return_p) fprintf (f, " no return, ");
   if (decl_spec->align >= 0) fprintf (f, " align = %d, ", decl_spec->align);
   if (decl_spec->align_node != NULL)
-    fprintf (f, " strictest align node %u, ", decl_spec->align_node->uid);
+    fprintf (f, " strictest align node %p, ", (void *) decl_spec->align_node);
   if (decl_spec->linkage != N_IGNORE)
     fprintf (f, " %s linkage, ", decl_spec->linkage == N_STATIC ? "static" : "extern");
   print_type (c2m_ctx, f, decl_spec->type);
@@ -14524,7 +20284,7 @@ static void print_decl_spec (c2m_ctx_t c2m_ctx, FILE *f, struct decl_spec *decl_
 static void print_decl (c2m_ctx_t c2m_ctx, FILE *f, decl_t decl) {
   if (decl == NULL) return;
   fprintf (f, ": ");
-  if (decl->scope != NULL) fprintf (f, "scope node = %u, ", decl->scope->uid);
+  if (decl->scope != NULL) fprintf (f, "scope node = %p, ", (void *) decl->scope);
   print_decl_spec (c2m_ctx, f, &decl->decl_spec);
   if (decl->addr_p) fprintf (f, ", addressable");
   if (decl->used_p) fprintf (f, ", used");
@@ -14557,7 +20317,7 @@ static void print_expr (c2m_ctx_t c2m_ctx, FILE *f, struct expr *e) {
 static void print_node (c2m_ctx_t c2m_ctx, FILE *f, node_t n, int indent, int attr_p) {
   int i;
 
-  fprintf (f, "%6u: ", n->uid);
+  fprintf (f, "%p: ", (void *) n);
   for (i = 0; i < indent; i++) fprintf (f, " ");
   if (n == err_node) {
     fprintf (f, "<error>\n");
@@ -14740,7 +20500,7 @@ static void print_node (c2m_ctx_t c2m_ctx, FILE *f, node_t n, int indent, int at
     else if (n->code == N_MODULE)
       fprintf (f, ": the top scope");
     else if (n->attr != NULL)
-      fprintf (f, ": higher scope node %u", ((struct node_scope *) n->attr)->scope->uid);
+      fprintf (f, ": higher scope node %p", (void *) ((struct node_scope *) n->attr)->scope);
     if (n->code == N_STRUCT || n->code == N_UNION)
       fprintf (f, "\n");
     else if (attr_p && n->attr != NULL)
@@ -14758,7 +20518,7 @@ static void print_node (c2m_ctx_t c2m_ctx, FILE *f, node_t n, int indent, int at
     print_ops (c2m_ctx, f, n, indent, attr_p);
     break;
   case N_GOTO:
-    if (attr_p && n->attr != NULL) fprintf (f, ": target node %u\n", ((node_t) n->attr)->uid);
+    if (attr_p && n->attr != NULL) fprintf (f, ": target node %p\n", n->attr);
     print_ops (c2m_ctx, f, n, indent, attr_p);
     break;
   case N_INDIRECT_GOTO: print_ops (c2m_ctx, f, n, indent, attr_p); break;
@@ -14783,8 +20543,10 @@ static void init_include_dirs (c2m_ctx_t c2m_ctx) {
   MIR_alloc_t alloc = c2m_alloc (c2m_ctx);
   int MIR_UNUSED added_p = FALSE;
 
-  VARR_CREATE (char_ptr_t, headers, alloc, 0);
-  VARR_CREATE (char_ptr_t, system_headers, alloc, 0);
+  if (headers == NULL) {
+    VARR_CREATE (char_ptr_t, headers, alloc, 0);
+    VARR_CREATE (char_ptr_t, system_headers, alloc, 0);
+  }
   for (size_t i = 0; i < c2m_options->include_dirs_num; i++) {
     VARR_PUSH (char_ptr_t, headers, c2m_options->include_dirs[i]);
     VARR_PUSH (char_ptr_t, system_headers, c2m_options->include_dirs[i]);
@@ -14859,7 +20621,6 @@ static void define_cmd_macro (c2m_ctx_t c2m_ctx, const char *name, const char *d
   VARR_TRUNC (char, temp_string, 0);
   for (; *def != '\0'; def++) VARR_PUSH (char, temp_string, *def);
   VARR_PUSH (char, temp_string, '\0');
-  reverse (temp_string);
   set_string_stream (c2m_ctx, VARR_ADDR (char, temp_string), pos, NULL);
   while ((t = get_next_pptoken (c2m_ctx))->code != T_EOFILE && t->code != T_EOU)
     VARR_PUSH (token_t, repl, t);
@@ -14901,6 +20662,390 @@ static void process_macro_commands (c2m_ctx_t c2m_ctx) {
       undefine_cmd_macro (c2m_ctx, c2m_options->macro_commands[i].name);
 }
 
+/* ---- Environment snapshots ---- */
+
+/* A snapshot keeps the preprocessor state reached after the standard
+   definitions and a prefix text: the parse tokens produced so far, the
+   macro table and the once-included and guarded files.  Restoring it replaces the
+   lexing and preprocessing of the prefix with copying the tokens.  Token
+   strings are interned, so str_tab is kept while snapshots exist. */
+#define SNAPSHOT_SOURCE_NAME "<snapshot>"
+
+/* Snapshot files start with a header: the magic, the format version and
+   the id of the build which wrote them.  The data refers to token and
+   node codes and contains node values as they are in memory, so the
+   build id holds the build time, the byte order and the sizes and code
+   counts the data depends on.  Loading rejects a file with any other
+   header. */
+#define SNAPSHOT_MAGIC "c2sljit snapshot"
+#define SNAPSHOT_VERSION 1
+#define SNAPSHOT_BUILD_TIME __DATE__ " " __TIME__
+
+typedef struct snap_token {
+  int code, processed_p, node_p;
+  pos_t pos, node_pos;
+  node_code_t node_code;
+  const char *repr;
+  struct node node; /* code and value of the token node if node_p */
+} snap_token_t;
+
+typedef struct snap_macro {
+  size_t id, params_start, repl_start, repl_num; /* indexes of the snapshot tokens */
+  long long params_num;                           /* -1 if the macro has no params */
+} snap_macro_t;
+
+typedef struct snap_file {
+  const char *name;
+  long long size, mtime; /* -1 if the file can not be stat'ed */
+} snap_file_t;
+
+DEF_VARR (snap_token_t);
+DEF_VARR (snap_macro_t);
+DEF_VARR (snap_file_t);
+
+struct c2sljit_snapshot {
+  char *prefix;
+  size_t out_num;               /* the first tokens are the parse tokens */
+  VARR (snap_token_t) * tokens; /* then the tokens of the macros */
+  VARR (snap_macro_t) * macro_defs;
+  VARR (char_ptr_t) * once_files;
+  VARR (include_guard_t) * guards;
+  VARR (snap_file_t) * files; /* the files read, to detect their changes */
+  int commands_p;             /* it has the macro commands of the compile, see env_snapshot */
+};
+
+static c2sljit_snapshot_t snapshot_new (c2m_ctx_t c2m_ctx, const char *prefix) {
+  MIR_alloc_t alloc = c2m_alloc (c2m_ctx);
+  c2sljit_snapshot_t snap = c2sljit_calloc (c2m_ctx, sizeof (struct c2sljit_snapshot));
+
+  snap->prefix = c2sljit_calloc (c2m_ctx, strlen (prefix) + 1);
+  strcpy (snap->prefix, prefix);
+  VARR_CREATE (snap_token_t, snap->tokens, alloc, 1024);
+  VARR_CREATE (snap_macro_t, snap->macro_defs, alloc, 256);
+  VARR_CREATE (char_ptr_t, snap->once_files, alloc, 16);
+  VARR_CREATE (include_guard_t, snap->guards, alloc, 16);
+  VARR_CREATE (snap_file_t, snap->files, alloc, 16);
+  c2m_ctx->snapshots_num++;
+  return snap;
+}
+
+static void snapshot_free (c2m_ctx_t c2m_ctx, c2sljit_snapshot_t snap) {
+  MIR_alloc_t alloc = c2m_alloc (c2m_ctx);
+
+  VARR_DESTROY (snap_token_t, snap->tokens);
+  VARR_DESTROY (snap_macro_t, snap->macro_defs);
+  VARR_DESTROY (char_ptr_t, snap->once_files);
+  VARR_DESTROY (include_guard_t, snap->guards);
+  VARR_DESTROY (snap_file_t, snap->files);
+  MIR_free (alloc, snap->prefix);
+  MIR_free (alloc, snap);
+  c2m_ctx->snapshots_num--;
+}
+
+static size_t snapshot_add_token (c2m_ctx_t c2m_ctx, c2sljit_snapshot_t snap, token_t t) {
+  snap_token_t st;
+
+  memset (&st, 0, sizeof (st));
+  st.code = t->code;
+  st.processed_p = t->processed_p;
+  st.pos = t->pos;
+  st.node_code = t->node_code;
+  st.repr = t->repr;
+  if ((st.node_p = t->node != NULL)) {
+    st.node = *t->node;
+    st.node_pos = POS (t->node);
+  }
+  VARR_PUSH (snap_token_t, snap->tokens, st);
+  return VARR_LENGTH (snap_token_t, snap->tokens) - 1;
+}
+
+static token_t snapshot_token (c2m_ctx_t c2m_ctx, const snap_token_t *st) {
+  token_t t = new_token (c2m_ctx, st->pos, st->repr, st->code, st->node_code);
+
+  t->processed_p = st->processed_p;
+  if (st->node_p) {
+    t->node = new_node (c2m_ctx, st->node.code);
+    t->node->u = st->node.u;
+    set_node_pos (c2m_ctx, t->node, st->node_pos);
+  }
+  return t;
+}
+
+static void snapshot_add_file (c2sljit_snapshot_t snap, const char *name) {
+  struct stat st;
+  snap_file_t file;
+
+  file.name = name;
+  file.size = file.mtime = -1;
+  if (stat (name, &st) == 0) {
+    file.size = (long long) st.st_size;
+    file.mtime = (long long) st.st_mtime;
+  }
+  VARR_PUSH (snap_file_t, snap->files, file);
+}
+
+static void snapshot_add_guard (include_guard_t guard, void *arg) {
+  c2sljit_snapshot_t snap = arg;
+
+  VARR_PUSH (include_guard_t, snap->guards, guard);
+}
+
+/* Make a snapshot of the state after preprocessing PREFIX */
+static c2sljit_snapshot_t snapshot_capture (c2m_ctx_t c2m_ctx, const char *prefix) {
+  pre_ctx_t pre_ctx = c2m_ctx->pre_ctx;
+  c2sljit_snapshot_t snap = snapshot_new (c2m_ctx, prefix);
+  size_t i, j, n = VARR_LENGTH (token_t, recorded_tokens);
+  snap_macro_t sm;
+  macro_t m, tab_m;
+
+  assert (n != 0 && VARR_LAST (token_t, recorded_tokens)->code == T_EOFILE);
+  for (i = 0; i + 1 < n; i++)
+    snapshot_add_token (c2m_ctx, snap, VARR_GET (token_t, recorded_tokens, i));
+  snap->out_num = n - 1;
+  for (i = 0; i < VARR_LENGTH (macro_t, macros); i++) {
+    m = VARR_GET (macro_t, macros, i);
+    /* Standard macros are created anew, undefined ones are not in the table */
+    if (m->replacement == NULL || !HTAB_DO (macro_t, macro_tab, m, HTAB_FIND, tab_m)
+        || tab_m != m)
+      continue;
+    sm.id = snapshot_add_token (c2m_ctx, snap, m->id);
+    sm.params_num = m->params == NULL ? -1 : (long long) VARR_LENGTH (token_t, m->params);
+    sm.params_start = VARR_LENGTH (snap_token_t, snap->tokens);
+    for (j = 0; m->params != NULL && j < VARR_LENGTH (token_t, m->params); j++)
+      snapshot_add_token (c2m_ctx, snap, VARR_GET (token_t, m->params, j));
+    sm.repl_start = VARR_LENGTH (snap_token_t, snap->tokens);
+    sm.repl_num = VARR_LENGTH (token_t, m->replacement);
+    for (j = 0; j < sm.repl_num; j++)
+      snapshot_add_token (c2m_ctx, snap, VARR_GET (token_t, m->replacement, j));
+    VARR_PUSH (snap_macro_t, snap->macro_defs, sm);
+  }
+  for (i = 0; i < VARR_LENGTH (char_ptr_t, once_include_files); i++)
+    VARR_PUSH (char_ptr_t, snap->once_files, VARR_GET (char_ptr_t, once_include_files, i));
+  HTAB_FOREACH_ELEM (include_guard_t, include_guard_tab, snapshot_add_guard, snap);
+  for (i = 0; i < VARR_LENGTH (char_ptr_t, include_files); i++)
+    snapshot_add_file (snap, VARR_GET (char_ptr_t, include_files, i));
+  return snap;
+}
+
+/* Return TRUE if the snapshot of the options can be restored: the files
+   read for it have not changed since. */
+static int snapshot_usable_p (c2m_ctx_t c2m_ctx) {
+  c2sljit_snapshot_t snap = c2m_options->snapshot;
+  struct stat st;
+
+  if (snap == NULL || c2m_options->no_prepro_p || c2m_options->prepro_only_p) return FALSE;
+  for (size_t i = 0; i < VARR_LENGTH (snap_file_t, snap->files); i++) {
+    snap_file_t *file = &VARR_ADDR (snap_file_t, snap->files)[i];
+
+    if (stat (file->name, &st) != 0 || file->size != (long long) st.st_size
+        || file->mtime != (long long) st.st_mtime)
+      return FALSE;
+  }
+  return TRUE;
+}
+
+static void snapshot_restore (c2m_ctx_t c2m_ctx, c2sljit_snapshot_t snap) {
+  MIR_alloc_t alloc = c2m_alloc (c2m_ctx);
+  pre_ctx_t pre_ctx = c2m_ctx->pre_ctx;
+  const snap_token_t *sts = VARR_ADDR (snap_token_t, snap->tokens);
+  VARR (token_t) * params, *repl;
+  struct macro macro;
+  macro_t tab_m;
+  include_guard_t guard;
+  size_t i, j;
+
+  for (i = 0; i < snap->out_num; i++)
+    VARR_PUSH (token_t, recorded_tokens, snapshot_token (c2m_ctx, &sts[i]));
+  for (i = 0; i < VARR_LENGTH (snap_macro_t, snap->macro_defs); i++) {
+    const snap_macro_t *sm = &VARR_ADDR (snap_macro_t, snap->macro_defs)[i];
+
+    macro.id = snapshot_token (c2m_ctx, &sts[sm->id]);
+    if (HTAB_DO (macro_t, macro_tab, &macro, HTAB_FIND, tab_m))
+      HTAB_DO (macro_t, macro_tab, &macro, HTAB_DELETE, tab_m);
+    params = NULL;
+    if (sm->params_num >= 0) {
+      VARR_CREATE (token_t, params, alloc, sm->params_num + 1);
+      for (j = 0; j < (size_t) sm->params_num; j++)
+        VARR_PUSH (token_t, params, snapshot_token (c2m_ctx, &sts[sm->params_start + j]));
+    }
+    VARR_CREATE (token_t, repl, alloc, sm->repl_num + 1);
+    for (j = 0; j < sm->repl_num; j++)
+      VARR_PUSH (token_t, repl, snapshot_token (c2m_ctx, &sts[sm->repl_start + j]));
+    new_macro (c2m_ctx, macro.id, params, repl);
+  }
+  for (i = 0; i < VARR_LENGTH (char_ptr_t, snap->once_files); i++)
+    VARR_PUSH (char_ptr_t, once_include_files, VARR_GET (char_ptr_t, snap->once_files, i));
+  for (i = 0; i < VARR_LENGTH (include_guard_t, snap->guards); i++)
+    HTAB_DO (include_guard_t, include_guard_tab, VARR_GET (include_guard_t, snap->guards, i),
+             HTAB_REPLACE, guard);
+}
+
+/* Snapshot files: the header, then the snapshot data.  Strings are
+   written once, at their first use, and referred to by index later. */
+typedef struct snap_str {
+  const char *s;
+  size_t ix;
+} snap_str_t;
+
+DEF_HTAB (snap_str_t);
+DEF_VARR (str_t);
+
+struct snap_io {
+  c2m_ctx_t c2m_ctx;
+  FILE *f;
+  int ok_p;
+  HTAB (snap_str_t) * written_strs; /* strings written so far */
+  VARR (str_t) * strs;               /* strings read so far */
+};
+
+static htab_hash_t snap_str_hash (snap_str_t str, void *arg MIR_UNUSED) {
+  return (htab_hash_t) mir_hash (&str.s, sizeof (str.s), 0x73);
+}
+
+static int snap_str_eq (snap_str_t str1, snap_str_t str2, void *arg MIR_UNUSED) {
+  return str1.s == str2.s;
+}
+
+static int snap_str_node_p (node_code_t code) {
+  return code == N_ID || code == N_STR || code == N_STR16 || code == N_STR32;
+}
+
+static void snap_put (struct snap_io *io, const void *p, size_t size) {
+  if (io->ok_p && fwrite (p, size, 1, io->f) != 1) io->ok_p = FALSE;
+}
+
+static void snap_put_num (struct snap_io *io, long long v) { snap_put (io, &v, sizeof (v)); }
+
+static void snap_put_str (struct snap_io *io, const char *s, size_t len) {
+  snap_str_t el, tab_el;
+
+  if (s == NULL) {
+    snap_put_num (io, -1);
+    return;
+  }
+  el.s = s;
+  if (HTAB_DO (snap_str_t, io->written_strs, el, HTAB_FIND, tab_el)) {
+    snap_put_num (io, (long long) tab_el.ix);
+    return;
+  }
+  el.ix = HTAB_ELS_NUM (snap_str_t, io->written_strs);
+  HTAB_DO (snap_str_t, io->written_strs, el, HTAB_INSERT, tab_el);
+  snap_put_num (io, (long long) el.ix);
+  snap_put_num (io, (long long) len);
+  snap_put (io, s, len);
+}
+
+static void snap_put_cstr (struct snap_io *io, const char *s) {
+  snap_put_str (io, s, s == NULL ? 0 : strlen (s) + 1);
+}
+
+static void snap_put_header (struct snap_io *io) {
+  snap_put (io, SNAPSHOT_MAGIC, sizeof (SNAPSHOT_MAGIC));
+  snap_put_num (io, SNAPSHOT_VERSION);
+  snap_put (io, SNAPSHOT_BUILD_TIME, sizeof (SNAPSHOT_BUILD_TIME));
+  snap_put_num (io, 0x0102030405060708LL);
+  snap_put_num (io, (long long) sizeof (struct node));
+  snap_put_num (io, T_EOU);
+  snap_put_num (io, N_ATTR);
+}
+
+static void snap_put_pos (struct snap_io *io, pos_t pos) {
+  snap_put_cstr (io, pos.fname);
+  snap_put_num (io, pos.lno);
+  snap_put_num (io, pos.ln_pos);
+}
+
+static void snap_put_token (struct snap_io *io, const snap_token_t *st) {
+  snap_put_num (io, st->code);
+  snap_put_num (io, st->processed_p);
+  snap_put_pos (io, st->pos);
+  snap_put_num (io, st->node_code);
+  snap_put_cstr (io, st->repr);
+  snap_put_num (io, st->node_p);
+  if (!st->node_p) return;
+  snap_put_num (io, st->node.code);
+  snap_put_pos (io, st->node_pos);
+  if (snap_str_node_p (st->node.code))
+    snap_put_str (io, st->node.u.s.s, st->node.u.s.len);
+  else
+    snap_put (io, &st->node.u, sizeof (st->node.u));
+}
+
+static void snap_get (struct snap_io *io, void *p, size_t size) {
+  if (io->ok_p && fread (p, size, 1, io->f) != 1) io->ok_p = FALSE;
+}
+
+static long long snap_get_num (struct snap_io *io) {
+  long long v = 0;
+
+  snap_get (io, &v, sizeof (v));
+  return v;
+}
+
+/* Read the header and clear IO->ok_p if it was not written by this build */
+static void snap_check_header (struct snap_io *io) {
+  char magic[sizeof (SNAPSHOT_MAGIC)], build_time[sizeof (SNAPSHOT_BUILD_TIME)];
+
+  snap_get (io, magic, sizeof (magic));
+  if (io->ok_p && memcmp (magic, SNAPSHOT_MAGIC, sizeof (magic)) != 0) io->ok_p = FALSE;
+  if (snap_get_num (io) != SNAPSHOT_VERSION) io->ok_p = FALSE;
+  snap_get (io, build_time, sizeof (build_time));
+  if (io->ok_p && memcmp (build_time, SNAPSHOT_BUILD_TIME, sizeof (build_time)) != 0)
+    io->ok_p = FALSE;
+  if (snap_get_num (io) != 0x0102030405060708LL
+      || snap_get_num (io) != (long long) sizeof (struct node) || snap_get_num (io) != T_EOU
+      || snap_get_num (io) != N_ATTR)
+    io->ok_p = FALSE;
+}
+
+/* Return the interned string of the next reference */
+static str_t snap_get_str (struct snap_io *io) {
+  long long ix = snap_get_num (io), len;
+  str_t str = {NULL, 0};
+  char *mem;
+
+  if (!io->ok_p || ix < 0) return str;
+  if ((size_t) ix < VARR_LENGTH (str_t, io->strs)) return VARR_GET (str_t, io->strs, ix);
+  if ((size_t) ix != VARR_LENGTH (str_t, io->strs) || (len = snap_get_num (io)) <= 0
+      || (mem = MIR_malloc (c2m_alloc (io->c2m_ctx), (size_t) len)) == NULL) {
+    io->ok_p = FALSE;
+    return str;
+  }
+  snap_get (io, mem, (size_t) len);
+  if (io->ok_p) {
+    str = uniq_str (io->c2m_ctx, mem, (size_t) len);
+    VARR_PUSH (str_t, io->strs, str);
+  }
+  MIR_free (c2m_alloc (io->c2m_ctx), mem);
+  return str;
+}
+
+static pos_t snap_get_pos (struct snap_io *io) {
+  pos_t pos;
+
+  pos.fname = snap_get_str (io).s;
+  pos.lno = (int) snap_get_num (io);
+  pos.ln_pos = (int) snap_get_num (io);
+  return pos;
+}
+
+static void snap_get_token (struct snap_io *io, snap_token_t *st) {
+  memset (st, 0, sizeof (snap_token_t));
+  st->code = (int) snap_get_num (io);
+  st->processed_p = (int) snap_get_num (io);
+  st->pos = snap_get_pos (io);
+  st->node_code = (node_code_t) snap_get_num (io);
+  st->repr = snap_get_str (io).s;
+  if (st->repr == NULL) io->ok_p = FALSE;
+  if (!(st->node_p = (int) snap_get_num (io))) return;
+  st->node.code = (node_code_t) snap_get_num (io);
+  st->node_pos = snap_get_pos (io);
+  if (snap_str_node_p (st->node.code))
+    st->node.u.s = snap_get_str (io);
+  else
+    snap_get (io, &st->node.u, sizeof (st->node.u));
+}
+
 static void compile_init (c2m_ctx_t c2m_ctx, struct c2sljit_options *ops, int (*getc_func) (void *),
                           void *getc_data) {
   MIR_alloc_t alloc = c2m_alloc (c2m_ctx);
@@ -14908,29 +21053,59 @@ static void compile_init (c2m_ctx_t c2m_ctx, struct c2sljit_options *ops, int (*
   n_errors = n_warnings = 0;
   c_getc = getc_func;
   c_getc_data = getc_data;
-  VARR_CREATE (char, symbol_text, alloc, 128);
-  VARR_CREATE (char, temp_string, alloc, 128);
-  VARR_CREATE (pos_t, node_positions, alloc, 128);
+  if (symbol_text == NULL) { /* otherwise kept from the previous compile */
+    VARR_CREATE (char, symbol_text, alloc, 128);
+    VARR_CREATE (char, temp_string, alloc, 128);
+    VARR_CREATE (node_t, call_nodes, alloc, 128); /* used in context and gen */
+    VARR_CREATE (node_t, containing_anon_members, alloc, 8);
+    VARR_CREATE (init_object_t, init_object_path, alloc, 8);
+    VARR_CREATE (char_ptr_t, node_fnames, alloc, 16);
+  }
   parse_init (c2m_ctx);
   context_init (c2m_ctx);
   init_include_dirs (c2m_ctx);
-  process_macro_commands (c2m_ctx);
-  VARR_CREATE (node_t, call_nodes, alloc, 128); /* used in context and gen */
-  VARR_CREATE (node_t, containing_anon_members, alloc, 8);
-  VARR_CREATE (init_object_t, init_object_path, alloc, 8);
 }
 
-static void compile_finish (c2m_ctx_t c2m_ctx) {
+/* Free the compile state.  If KEEP_P, only clear it so that the next
+   compile reuses the allocated containers. */
+static void compile_finish (c2m_ctx_t c2m_ctx, int keep_p) {
+  parse_finish (c2m_ctx, keep_p);
+  context_finish (c2m_ctx, keep_p);
+  if (keep_p) {
+    VARR_TRUNC (char, symbol_text, 0);
+    VARR_TRUNC (char, temp_string, 0);
+    VARR_TRUNC (char_ptr_t, headers, 0);
+    VARR_TRUNC (char_ptr_t, system_headers, 0);
+    VARR_TRUNC (node_t, call_nodes, 0);
+    VARR_TRUNC (node_t, containing_anon_members, 0);
+    VARR_TRUNC (init_object_t, init_object_path, 0);
+    return;
+  }
   if (symbol_text != NULL) VARR_DESTROY (char, symbol_text);
   if (temp_string != NULL) VARR_DESTROY (char, temp_string);
-  if (node_positions != NULL) VARR_DESTROY (pos_t, node_positions);
-  parse_finish (c2m_ctx);
-  context_finish (c2m_ctx);
   if (headers != NULL) VARR_DESTROY (char_ptr_t, headers);
   if (system_headers != NULL) VARR_DESTROY (char_ptr_t, system_headers);
   if (call_nodes != NULL) VARR_DESTROY (node_t, call_nodes);
   if (containing_anon_members != NULL) VARR_DESTROY (node_t, containing_anon_members);
   if (init_object_path != NULL) VARR_DESTROY (init_object_t, init_object_path);
+  if (node_fnames != NULL) VARR_DESTROY (char_ptr_t, node_fnames);
+}
+
+/* Low-memory mode: give back what the last compile grew.  The interned
+   strings can go too when no loaded module or snapshot refers to them. */
+static void release_compile_memory (c2m_ctx_t c2m_ctx) {
+  gen_ctx_t gen_ctx;
+
+  reg_memory_trim (c2m_ctx);
+  for (gen_ctx = c2m_ctx->modules; gen_ctx != NULL; gen_ctx = gen_ctx->next_module)
+    if (gen_ctx->names == NULL && VARR_LENGTH (compiled_func_t, compiled_funcs) != 0) break;
+  if (gen_ctx == NULL && c2m_ctx->snapshots_num == 0) {
+    str_finish (c2m_ctx);
+    str_init (c2m_ctx);
+  }
+#ifdef __GLIBC__
+  malloc_trim (0); /* the freed frontend memory is mostly below live blocks */
+#endif
 }
 
 #include "real-time.h"
@@ -14942,38 +21117,130 @@ static const char *get_module_name (c2m_ctx_t c2m_ctx) {
 
 static int top_level_getc (c2m_ctx_t c2m_ctx) { return c_getc (c_getc_data); }
 
-int c2sljit_compile (MIR_context_t ctx, struct c2sljit_options *ops, int (*getc_func) (void *),
-                     void *getc_data, const char *source_name, FILE *output_file) {
-  struct c2m_ctx *c2m_ctx = *c2m_ctx_loc (ctx);
+static c2sljit_snapshot_t snapshot_create (c2m_ctx_t c2m_ctx, struct c2sljit_options *ops,
+                                           const char *prefix) {
+  struct c2sljit_options options;
+  c2sljit_snapshot_t snap;
+  size_t mark;
+
+  options = *ops;
+  options.prepro_only_p = options.no_prepro_p = FALSE;
+  options.snapshot = NULL;
+  mark = reg_memory_mark (c2m_ctx);
+  if (setjmp (c2m_ctx->env)) {
+    compile_finish (c2m_ctx, !options.low_memory_p);
+    reg_memory_pop (c2m_ctx, mark);
+    return NULL;
+  }
+  compile_init (c2m_ctx, &options, NULL, NULL);
+  process_macro_commands (c2m_ctx);
+  add_stream (c2m_ctx, SNAPSHOT_SOURCE_NAME, prefix, strlen (prefix), NULL);
+  add_standard_includes (c2m_ctx);
+  pre (c2m_ctx);
+  snap = n_errors == 0 ? snapshot_capture (c2m_ctx, prefix) : NULL;
+  compile_finish (c2m_ctx, !options.low_memory_p);
+  reg_memory_pop (c2m_ctx, mark);
+  return snap;
+}
+
+/* Put the options OPS which change the state reached after the standard
+   macros into KEY: pedantic_p and the macro commands, which are
+   processed before the standard macros. */
+static void env_key (struct c2sljit_options *ops, VARR (char) * key) {
+  VARR_TRUNC (char, key, 0);
+  VARR_PUSH (char, key, ops->pedantic_p ? 'p' : '-');
+  for (size_t i = 0; i < ops->macro_commands_num; i++) {
+    struct c2sljit_macro_command *cmd = &ops->macro_commands[i];
+
+    VARR_PUSH (char, key, cmd->def_p ? 'D' : 'U');
+    VARR_PUSH_ARR (char, key, cmd->name, strlen (cmd->name) + 1);
+    if (cmd->def_p) VARR_PUSH_ARR (char, key, cmd->def, strlen (cmd->def) + 1);
+  }
+}
+
+/* Return the snapshot of the standard macros and the macro commands for
+   a compile with OPS, or NULL if the compile should process them itself.
+   The first compile in the context processes them; later compiles with
+   the same pedantic_p and macro commands restore a snapshot made once,
+   which is much cheaper than processing the definitions and dominates
+   compiles of small sources.  The snapshot is made again when these
+   options change. */
+static c2sljit_snapshot_t env_snapshot (c2m_ctx_t c2m_ctx, struct c2sljit_options *ops) {
+  VARR (char) * key;
+  int first_p = !c2m_ctx->compiled_p;
+
+  c2m_ctx->compiled_p = TRUE;
+  if (first_p || ops->snapshot != NULL || ops->no_prepro_p || ops->prepro_only_p
+      || ops->low_memory_p)
+    return NULL;
+  if (c2m_ctx->env_key == NULL) VARR_CREATE (char, c2m_ctx->env_key, c2m_alloc (c2m_ctx), 64);
+  VARR_CREATE (char, key, c2m_alloc (c2m_ctx), 64);
+  env_key (ops, key);
+  if (c2m_ctx->env_snapshot != NULL
+      && (VARR_LENGTH (char, key) != VARR_LENGTH (char, c2m_ctx->env_key)
+          || memcmp (VARR_ADDR (char, key), VARR_ADDR (char, c2m_ctx->env_key),
+                     VARR_LENGTH (char, key))
+               != 0)) {
+    snapshot_free (c2m_ctx, c2m_ctx->env_snapshot);
+    c2m_ctx->env_snapshot = NULL;
+  }
+  if (c2m_ctx->env_snapshot == NULL) {
+    if ((c2m_ctx->env_snapshot = snapshot_create (c2m_ctx, ops, "")) != NULL) {
+      c2m_ctx->env_snapshot->commands_p = TRUE;
+      VARR_TRUNC (char, c2m_ctx->env_key, 0);
+      VARR_PUSH_ARR (char, c2m_ctx->env_key, VARR_ADDR (char, key), VARR_LENGTH (char, key));
+    }
+  }
+  VARR_DESTROY (char, key);
+  return c2m_ctx->env_snapshot;
+}
+
+static int compile_source (c2m_ctx_t c2m_ctx, struct c2sljit_options *ops,
+                           int (*getc_func) (void *), void *getc_data, const char *buf,
+                           size_t len, const char *source_name) {
   double start_time = real_usec_time ();
   node_t r;
   unsigned n_error_before;
+  size_t mark;
+  int restored_p;
 
-  (void) output_file;  /* not used in sljit mode */
-
-  if (c2m_ctx == NULL) return 0;
+  mark = reg_memory_mark (c2m_ctx);
   if (setjmp (c2m_ctx->env)) {
-    compile_finish (c2m_ctx);
+    if (reg_body_p) reg_body_switch (c2m_ctx, FALSE);
+    reg_body_release (c2m_ctx);
+    if (c2m_ctx->gen_ctx != NULL) gen_finish (c2m_ctx, c2m_ctx->gen_ctx); /* partial module */
+    compile_finish (c2m_ctx, !c2m_options->low_memory_p);
+    reg_memory_pop (c2m_ctx, mark);
+    if (c2m_options->low_memory_p) release_compile_memory (c2m_ctx);
     return 0;
   }
+  c2m_ctx->gen_ctx = NULL; /* previous modules stay loaded */
   compile_init (c2m_ctx, ops, getc_func, getc_data);
+  if ((restored_p = snapshot_usable_p (c2m_ctx))) snapshot_restore (c2m_ctx, ops->snapshot);
+  if (!restored_p || !ops->snapshot->commands_p) process_macro_commands (c2m_ctx);
   if (c2m_options->verbose_p && c2m_options->message_file != NULL)
     fprintf (c2m_options->message_file, "c2sljit init end           -- %.0f usec\n",
              real_usec_time () - start_time);
-  add_stream (c2m_ctx, NULL, source_name, top_level_getc);
-  if (!c2m_options->no_prepro_p) add_standard_includes (c2m_ctx);
-  pre (c2m_ctx);
-  if (c2m_options->verbose_p && c2m_options->message_file != NULL)
-    fprintf (c2m_options->message_file, "  c2sljit preprocessor end    -- %.0f usec\n",
-             real_usec_time () - start_time);
-  if (!c2m_options->prepro_only_p) {
+  add_stream (c2m_ctx, source_name, buf, len, top_level_getc);
+  if (!restored_p && ops->snapshot != NULL) /* stale snapshot: process its prefix again */
+    add_string_stream (c2m_ctx, SNAPSHOT_SOURCE_NAME, ops->snapshot->prefix);
+  if (!c2m_options->no_prepro_p && !restored_p) add_standard_includes (c2m_ctx);
+  if (c2m_options->prepro_only_p) {
+    pre (c2m_ctx);
+    if (c2m_options->verbose_p && c2m_options->message_file != NULL)
+      fprintf (c2m_options->message_file, "  c2sljit preprocessor end    -- %.0f usec\n",
+               real_usec_time () - start_time);
+  } else {
+    pre_start (c2m_ctx, TRUE); /* the parser pulls the tokens */
     r = parse (c2m_ctx);
+    if (c2m_options->low_memory_p) /* only the AST is used further */
+      parse_finish (c2m_ctx, FALSE);
     if (c2m_options->verbose_p && c2m_options->message_file != NULL)
       fprintf (c2m_options->message_file, "  c2sljit parser end          -- %.0f usec\n",
                real_usec_time () - start_time);
     if (c2m_options->verbose_p && c2m_options->message_file != NULL && n_errors)
       fprintf (c2m_options->message_file, "parser - FAIL\n");
-    if (!c2m_options->syntax_only_p) {
+    if (!c2m_options->syntax_only_p && !c2m_options->stream_p) {
       n_error_before = n_errors;
       do_context (c2m_ctx, r);
       if (n_errors > n_error_before) {
@@ -14992,18 +21259,238 @@ int c2sljit_compile (MIR_context_t ctx, struct c2sljit_options *ops, int (*getc_
       }
     }
   }
-  compile_finish (c2m_ctx);
+  compile_finish (c2m_ctx, !c2m_options->low_memory_p);
+  reg_memory_pop (c2m_ctx, mark); /* the modules do not refer to the AST */
+  if (c2m_options->low_memory_p) release_compile_memory (c2m_ctx);
   if (c2m_options->verbose_p && c2m_options->message_file != NULL)
     fprintf (c2m_options->message_file, "c2sljit compiler end                -- %.0f usec\n",
              real_usec_time () - start_time);
   return n_errors == 0;
 }
 
+/* Compile the source given by GETC_FUNC or by LEN bytes at BUF if it is not NULL */
+static int compile (c2m_ctx_t c2m_ctx, struct c2sljit_options *ops, int (*getc_func) (void *),
+                    void *getc_data, const char *buf, size_t len, const char *source_name) {
+  struct c2sljit_options env_ops;
+  c2sljit_snapshot_t snap;
+
+  if (c2m_ctx == NULL) return 0;
+  if ((snap = env_snapshot (c2m_ctx, ops)) != NULL) {
+    env_ops = *ops;
+    env_ops.snapshot = snap;
+    ops = &env_ops;
+  }
+  return compile_source (c2m_ctx, ops, getc_func, getc_data, buf, len, source_name);
+}
+
+int c2sljit_compile (MIR_context_t ctx, struct c2sljit_options *ops, int (*getc_func) (void *),
+                     void *getc_data, const char *source_name, FILE *output_file) {
+  (void) output_file; /* not used in sljit mode */
+  return compile (*c2m_ctx_loc (ctx), ops, getc_func, getc_data, NULL, 0, source_name);
+}
+
+int c2sljit_compile_buffer (MIR_context_t ctx, struct c2sljit_options *ops, const char *buf,
+                            size_t len, const char *source_name) {
+  return compile (*c2m_ctx_loc (ctx), ops, NULL, NULL, buf, len, source_name);
+}
+
+c2sljit_snapshot_t c2sljit_snapshot_create (MIR_context_t ctx, struct c2sljit_options *ops,
+                                            const char *prefix) {
+  c2m_ctx_t c2m_ctx = *c2m_ctx_loc (ctx);
+
+  if (c2m_ctx == NULL || prefix == NULL) return NULL;
+  return snapshot_create (c2m_ctx, ops, prefix);
+}
+
+int c2sljit_snapshot_save (MIR_context_t ctx, c2sljit_snapshot_t snap, FILE *f) {
+  c2m_ctx_t c2m_ctx = *c2m_ctx_loc (ctx);
+  struct snap_io io;
+  size_t i;
+
+  if (c2m_ctx == NULL || snap == NULL) return FALSE;
+  io.c2m_ctx = c2m_ctx;
+  io.f = f;
+  io.ok_p = TRUE;
+  HTAB_CREATE (snap_str_t, io.written_strs, c2m_alloc (c2m_ctx), 1024, snap_str_hash, snap_str_eq,
+               NULL);
+  snap_put_header (&io);
+  snap_put_str (&io, snap->prefix, strlen (snap->prefix) + 1);
+  snap_put_num (&io, (long long) snap->out_num);
+  snap_put_num (&io, (long long) VARR_LENGTH (snap_token_t, snap->tokens));
+  for (i = 0; i < VARR_LENGTH (snap_token_t, snap->tokens); i++)
+    snap_put_token (&io, &VARR_ADDR (snap_token_t, snap->tokens)[i]);
+  snap_put_num (&io, (long long) VARR_LENGTH (snap_macro_t, snap->macro_defs));
+  for (i = 0; i < VARR_LENGTH (snap_macro_t, snap->macro_defs); i++) {
+    snap_macro_t *sm = &VARR_ADDR (snap_macro_t, snap->macro_defs)[i];
+
+    snap_put_num (&io, (long long) sm->id);
+    snap_put_num (&io, sm->params_num);
+    snap_put_num (&io, (long long) sm->params_start);
+    snap_put_num (&io, (long long) sm->repl_start);
+    snap_put_num (&io, (long long) sm->repl_num);
+  }
+  snap_put_num (&io, (long long) VARR_LENGTH (char_ptr_t, snap->once_files));
+  for (i = 0; i < VARR_LENGTH (char_ptr_t, snap->once_files); i++)
+    snap_put_cstr (&io, VARR_GET (char_ptr_t, snap->once_files, i));
+  snap_put_num (&io, (long long) VARR_LENGTH (include_guard_t, snap->guards));
+  for (i = 0; i < VARR_LENGTH (include_guard_t, snap->guards); i++) {
+    snap_put_cstr (&io, VARR_GET (include_guard_t, snap->guards, i).fname);
+    snap_put_cstr (&io, VARR_GET (include_guard_t, snap->guards, i).id);
+  }
+  snap_put_num (&io, (long long) VARR_LENGTH (snap_file_t, snap->files));
+  for (i = 0; i < VARR_LENGTH (snap_file_t, snap->files); i++) {
+    snap_file_t *file = &VARR_ADDR (snap_file_t, snap->files)[i];
+
+    snap_put_cstr (&io, file->name);
+    snap_put_num (&io, file->size);
+    snap_put_num (&io, file->mtime);
+  }
+  HTAB_DESTROY (snap_str_t, io.written_strs);
+  return io.ok_p;
+}
+
+c2sljit_snapshot_t c2sljit_snapshot_load (MIR_context_t ctx, FILE *f) {
+  c2m_ctx_t c2m_ctx = *c2m_ctx_loc (ctx);
+  struct snap_io io;
+  c2sljit_snapshot_t snap;
+  snap_token_t st;
+  snap_macro_t sm;
+  include_guard_t guard;
+  snap_file_t file;
+  const char *prefix;
+  long long i, n, tokens_num;
+
+  if (c2m_ctx == NULL) return NULL;
+  io.c2m_ctx = c2m_ctx;
+  io.f = f;
+  io.ok_p = TRUE;
+  snap_check_header (&io);
+  if (!io.ok_p) return NULL;
+  VARR_CREATE (str_t, io.strs, c2m_alloc (c2m_ctx), 1024);
+  prefix = snap_get_str (&io).s;
+  snap = snapshot_new (c2m_ctx, prefix == NULL ? "" : prefix);
+  if (prefix == NULL) io.ok_p = FALSE;
+  snap->out_num = (size_t) snap_get_num (&io);
+  tokens_num = snap_get_num (&io);
+  if (tokens_num < 0 || (long long) snap->out_num > tokens_num) io.ok_p = FALSE;
+  for (i = 0; io.ok_p && i < tokens_num; i++) {
+    snap_get_token (&io, &st);
+    VARR_PUSH (snap_token_t, snap->tokens, st);
+  }
+  n = snap_get_num (&io);
+  for (i = 0; io.ok_p && i < n; i++) {
+    sm.id = (size_t) snap_get_num (&io);
+    sm.params_num = snap_get_num (&io);
+    sm.params_start = (size_t) snap_get_num (&io);
+    sm.repl_start = (size_t) snap_get_num (&io);
+    sm.repl_num = (size_t) snap_get_num (&io);
+    if (sm.id >= (size_t) tokens_num || sm.params_num < -1
+        || sm.params_start + (sm.params_num < 0 ? 0 : sm.params_num) > (size_t) tokens_num
+        || sm.repl_start + sm.repl_num > (size_t) tokens_num)
+      io.ok_p = FALSE;
+    VARR_PUSH (snap_macro_t, snap->macro_defs, sm);
+  }
+  n = snap_get_num (&io);
+  for (i = 0; io.ok_p && i < n; i++)
+    VARR_PUSH (char_ptr_t, snap->once_files, snap_get_str (&io).s);
+  n = snap_get_num (&io);
+  for (i = 0; io.ok_p && i < n; i++) {
+    guard.fname = snap_get_str (&io).s;
+    guard.id = snap_get_str (&io).s;
+    if (guard.fname == NULL || guard.id == NULL) io.ok_p = FALSE;
+    VARR_PUSH (include_guard_t, snap->guards, guard);
+  }
+  n = snap_get_num (&io);
+  for (i = 0; io.ok_p && i < n; i++) {
+    file.name = snap_get_str (&io).s;
+    file.size = snap_get_num (&io);
+    file.mtime = snap_get_num (&io);
+    if (file.name == NULL) io.ok_p = FALSE;
+    VARR_PUSH (snap_file_t, snap->files, file);
+  }
+  VARR_DESTROY (str_t, io.strs);
+  if (io.ok_p) return snap;
+  snapshot_free (c2m_ctx, snap);
+  return NULL;
+}
+
+void c2sljit_snapshot_free (MIR_context_t ctx, c2sljit_snapshot_t snap) {
+  c2m_ctx_t c2m_ctx = *c2m_ctx_loc (ctx);
+
+  if (c2m_ctx != NULL && snap != NULL) snapshot_free (c2m_ctx, snap);
+}
+
 /* Retrieve the compiled 'main' function */
 c2sljit_main_func_t c2sljit_get_main (MIR_context_t ctx) {
   struct c2m_ctx *c2m_ctx = *c2m_ctx_loc (ctx);
   if (c2m_ctx == NULL) return NULL;
-  return (c2sljit_main_func_t) find_compiled_func (c2m_ctx, "main");
+  return (c2sljit_main_func_t) find_compiled_func (c2m_ctx->gen_ctx, "main");
+}
+
+/* Modules are identified by their generator contexts */
+c2sljit_module_t c2sljit_get_module (MIR_context_t ctx) {
+  struct c2m_ctx *c2m_ctx = *c2m_ctx_loc (ctx);
+  if (c2m_ctx == NULL) return NULL;
+  return (c2sljit_module_t) c2m_ctx->gen_ctx;
+}
+
+void c2sljit_unload (MIR_context_t ctx, c2sljit_module_t module) {
+  struct c2m_ctx *c2m_ctx = *c2m_ctx_loc (ctx);
+  if (c2m_ctx == NULL || module == NULL) return;
+  gen_finish (c2m_ctx, (gen_ctx_t) module);
+}
+
+/* Return the generator context of MODULE if it is loaded in CTX, NULL
+   otherwise. */
+static gen_ctx_t loaded_module (MIR_context_t ctx, c2sljit_module_t module) {
+  struct c2m_ctx *c2m_ctx = *c2m_ctx_loc (ctx);
+  gen_ctx_t gen_ctx;
+
+  if (c2m_ctx == NULL) return NULL;
+  for (gen_ctx = c2m_ctx->modules; gen_ctx != NULL; gen_ctx = gen_ctx->next_module)
+    if (gen_ctx == (gen_ctx_t) module) break;
+  return gen_ctx;
+}
+
+void *c2sljit_module_get_func (MIR_context_t ctx, c2sljit_module_t module, const char *name) {
+  return find_compiled_func (loaded_module (ctx, module), name);
+}
+
+c2sljit_main_func_t c2sljit_module_get_main (MIR_context_t ctx, c2sljit_module_t module) {
+  return (c2sljit_main_func_t) c2sljit_module_get_func (ctx, module, "main");
+}
+
+/* The instance functions have no way to report a wrong module but to
+   stop: the code of any other module would use the instance as if it
+   held its own globals. */
+static gen_ctx_t instance_module (MIR_context_t ctx, c2sljit_module_t module,
+                                  const char *func_name) {
+  gen_ctx_t gen_ctx = loaded_module (ctx, module);
+
+  if (gen_ctx == NULL || !gen_ctx->instances_p) {
+    fprintf (stderr, "%s: %s\n", func_name,
+             gen_ctx == NULL ? "the module is not loaded" : "the module is not in instance mode");
+    abort ();
+  }
+  return gen_ctx;
+}
+
+/* Instance mode: a block with the initial values of the module globals */
+c2sljit_instance_t c2sljit_instantiate (MIR_context_t ctx, c2sljit_module_t module) {
+  gen_ctx_t gen_ctx = instance_module (ctx, module, "c2sljit_instantiate");
+  return image_new_block (&gen_ctx->inst);
+}
+
+void c2sljit_set_instance (MIR_context_t ctx, c2sljit_module_t module, c2sljit_instance_t inst) {
+  gen_ctx_t gen_ctx = instance_module (ctx, module, "c2sljit_set_instance");
+  if (gen_ctx->inst.key_p) pthread_setspecific (gen_ctx->inst.key, inst);
+}
+
+void c2sljit_free_instance (MIR_context_t ctx, c2sljit_module_t module, c2sljit_instance_t inst) {
+  gen_ctx_t gen_ctx = instance_module (ctx, module, "c2sljit_free_instance");
+  if (gen_ctx->inst.key_p && pthread_getspecific (gen_ctx->inst.key) == inst)
+    pthread_setspecific (gen_ctx->inst.key, NULL);
+  free (inst);
 }
 
 /* Local Variables:                */
@@ -16,6 +16,8 @@ struct c2sljit_macro_command {
   const char *name, *def; /* def is used only when def_p is true */
 };
 
+typedef struct c2sljit_snapshot *c2sljit_snapshot_t;
+
 struct c2sljit_options {
   FILE *message_file;
   int debug_p, verbose_p, ignore_warnings_p, no_prepro_p, prepro_only_p;
@@ -24,7 +26,7 @@ struct c2sljit_options {
   int opt_reg_cache_p;       /* Opt 4: register caching within basic blocks */
   int opt_cmp_branch_p;      /* Opt 5: comparison-branch fusion */
   int opt_strength_reduce_p; /* Opt 6: strength reduction for constant mul/div/mod */
-  int opt_magic_div_p;       /* Opt 6b: magic number division (x86-64 only) */
+  int opt_magic_div_p;       /* Opt 6b: magic number division (64-bit targets) */
   int opt_commute_p;         /* Opt 7: commutative operand swap */
   int opt_smart_regs_p;      /* Opt 8: cache-aware temp reg allocation */
   int opt_defer_store_p;     /* Opt 9: deferred write-back for cached vars */
@@ -36,6 +38,14 @@ struct c2sljit_options {
   int opt_addr_cache_p;      /* Opt 15: address register caching */
   int opt_fmadd_p;           /* Opt 16: fused multiply-add (ARM64) */
   int opt_float_field_cache_p; /* Opt 17: float field load CSE */
+  int opt_lir_p;             /* Opt 18: linear IR with global register allocation */
+  int opt_licm_p;            /* Opt 19: loop-invariant code motion (linear IR) */
+  int opt_unroll_p;          /* Opt 20: counted loop unrolling (linear IR) */
+  int opt_lvn_p;             /* Opt 21: local value numbering (linear IR) */
+  int instances_p;           /* globals live in per-instance data blocks */
+  int low_memory_p;          /* release compile-time memory as early as possible */
+  int stream_p;              /* generate each function once it is parsed, then free its AST */
+  c2sljit_snapshot_t snapshot; /* start from this environment snapshot */
   size_t module_num;
   FILE *prepro_output_file; /* non-null for prepro_only_p */
   const char *output_file_name;
@@ -47,14 +57,77 @@ struct c2sljit_options {
 void c2sljit_init (MIR_context_t ctx);
 void c2sljit_finish (MIR_context_t ctx);
 
-/* Compile one C source.  Returns 0 on success.
+/* Prepare the context for the next compile as c2sljit_finish and
+   c2sljit_init would do: all modules are unloaded.  The containers of the
+   compile state and the interned strings are kept, so a sequence of small
+   compiles does not pay for setting them up again.
+
+   Whether the context was reset or not, each compile after the first one
+   in the context takes the standard macros and the macro commands from
+   a snapshot, made once for each pedantic_p and list of macro commands,
+   with the same result as processing them.  Only the compile which makes
+   the snapshot reports problems in them, such as a command redefining a
+   standard macro.  Compiles with low_memory_p, a snapshot, no_prepro_p or
+   prepro_only_p process them themselves.  */
+void c2sljit_reset (MIR_context_t ctx);
+
+/* Compile one C source.  Returns nonzero on success, 0 on errors.
    The compiled code can be retrieved and executed via the context.  */
 int c2sljit_compile (MIR_context_t ctx, struct c2sljit_options *ops, int (*getc_func) (void *),
                      void *getc_data, const char *source_name, FILE *output_file);
 
-/* After compilation, retrieve the JIT-compiled function pointer for "main".
-   Returns NULL if main was not found.  */
+/* The same for the source of LEN bytes at BUF (e.g. a mapped file).  The
+   buffer is read in place and must not change during the compile.  */
+int c2sljit_compile_buffer (MIR_context_t ctx, struct c2sljit_options *ops, const char *buf,
+                            size_t len, const char *source_name);
+
+/* After compilation, retrieve the JIT-compiled function pointer for "main"
+   of the last compile.  Returns NULL if main was not found.  */
 typedef int (*c2sljit_main_func_t) (int argc, char **argv);
 c2sljit_main_func_t c2sljit_get_main (MIR_context_t ctx);
 
+/* The code and data of each compile form a module which stays loaded,
+   also across later compiles, until it is unloaded or the context is
+   finished.  c2sljit_get_module returns the module of the last compile
+   (NULL if it failed before code generation); the compile functions keep
+   returning a success flag, as before modules existed, so the handle is
+   taken from the context right after the compile, like the main
+   function.  Unloading frees the module's code and globals; none of its
+   functions may run at that time.  */
+typedef struct c2sljit_module *c2sljit_module_t;
+c2sljit_module_t c2sljit_get_module (MIR_context_t ctx);
+void c2sljit_unload (MIR_context_t ctx, c2sljit_module_t module);
+
+/* The code of the function NAME (or "main") defined in a loaded MODULE,
+   at any time after its compile.  Return NULL if MODULE has no such
+   function or is not loaded.  */
+void *c2sljit_module_get_func (MIR_context_t ctx, c2sljit_module_t module, const char *name);
+c2sljit_main_func_t c2sljit_module_get_main (MIR_context_t ctx, c2sljit_module_t module);
+
+/* Instance mode (instances_p): the code compiled once can run for several
+   sessions, each with its own copy of the module globals.  An instance
+   starts with the initial values of the globals; compiled code running in
+   a thread uses the instance set for the thread, or a default one (as do
+   threads started by the compiled code itself).  An instance belongs to
+   the module it was made for.  These functions abort with a message when
+   MODULE is not loaded or was not compiled in instance mode.  */
+typedef void *c2sljit_instance_t;
+c2sljit_instance_t c2sljit_instantiate (MIR_context_t ctx, c2sljit_module_t module);
+void c2sljit_set_instance (MIR_context_t ctx, c2sljit_module_t module, c2sljit_instance_t inst);
+void c2sljit_free_instance (MIR_context_t ctx, c2sljit_module_t module, c2sljit_instance_t inst);
+
+/* Environment snapshots: the preprocessor state (macros and tokens)
+   after the standard definitions and PREFIX, usually the common #include
+   lines, so that compiles with the snapshot option set start from it
+   instead of processing PREFIX again.  The source then should not repeat
+   PREFIX.  A snapshot whose headers changed since is not used: PREFIX is
+   processed instead.  Saved snapshots start with a header naming the
+   c2sljit build which wrote them; loading returns NULL for a file of
+   another build or one which is not a snapshot.  Snapshots should be freed before c2sljit_finish.  */
+c2sljit_snapshot_t c2sljit_snapshot_create (MIR_context_t ctx, struct c2sljit_options *ops,
+                                            const char *prefix);
+int c2sljit_snapshot_save (MIR_context_t ctx, c2sljit_snapshot_t snap, FILE *f);
+c2sljit_snapshot_t c2sljit_snapshot_load (MIR_context_t ctx, FILE *f);
+void c2sljit_snapshot_free (MIR_context_t ctx, c2sljit_snapshot_t snap);
+
 #endif
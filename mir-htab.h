@@ -157,11 +157,11 @@ DEF_VARR (htab_ind_t)
     arg = htab->arg;                                                                             \
     HTAB_ASSERT (els_size * 2 == size, "do size", T);                                            \
     if ((action == HTAB_INSERT || action == HTAB_REPLACE) && htab->els_bound == els_size) {      \
-      size *= 2;                                                                                 \
+      if (htab->els_num * 2 > els_size) size *= 2; /* otherwise reuse the deleted els */         \
       VARR_TAILOR (htab_ind_t, htab->entries, size);                                             \
       addr = VARR_ADDR (htab_ind_t, htab->entries);                                              \
       for (i = 0; i < size; i++) addr[i] = HTAB_EMPTY_IND;                                       \
-      VARR_TAILOR (HTAB_EL (T), htab->els, els_size * 2);                                        \
+      VARR_TAILOR (HTAB_EL (T), htab->els, size / 2);                                            \
       els_addr = VARR_ADDR (HTAB_EL (T), htab->els);                                             \
       start = htab->els_start;                                                                   \
       bound = htab->els_bound;                                                                   \
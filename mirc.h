@@ -7,7 +7,6 @@ static const char mirc[]
     "#define __MIRC__ 1\n"
     "#define __STDC_HOSTED__ 1\n"
     "//#define __STDC_ISO_10646__ 201103L\n"
-    "#define __STDC_NO_ATOMICS__ 1\n"
     "#define __STDC_NO_COMPLEX__ 1\n"
     "#define __STDC_NO_THREADS__ 1\n"
     "#define __STDC_NO_VLA__ 1\n"
@@ -16,6 +15,13 @@ static const char mirc[]
     "#define __STDC_VERSION__ 201112L\n"
     "#define __STDC__ 1\n"
     "\n"
+    "#define __ATOMIC_RELAXED 0\n"
+    "#define __ATOMIC_CONSUME 1\n"
+    "#define __ATOMIC_ACQUIRE 2\n"
+    "#define __ATOMIC_RELEASE 3\n"
+    "#define __ATOMIC_ACQ_REL 4\n"
+    "#define __ATOMIC_SEQ_CST 5\n"
+    "\n"
     "/* Some GCC alternative keywords used but not defined in standard headers:  */\n"
     "#define __const const\n"
     "#define __const__ const\n"
@@ -30,10 +36,12 @@ static const char mirc[]
 #include "mirc_stdalign.h"
 #include "mirc_stdbool.h"
 #include "mirc_stdnoreturn.h"
+#include "mirc_stdatomic.h"
 
 #define TARGET_STD_INCLUDES                                                               \
   {"iso646.h", iso646_str}, {"stdalign.h", stdalign_str}, {"stdbool.h", stdbool_str},     \
-    {"stdnoreturn.h", stdnoreturn_str}, {"float.h", float_str}, {"limits.h", limits_str}, \
+    {"stdnoreturn.h", stdnoreturn_str}, {"stdatomic.h", stdatomic_str},                   \
+    {"float.h", float_str}, {"limits.h", limits_str},                                     \
     {"stdarg.h", stdarg_str}, {"stdint.h", stdint_str}, {                                 \
     "stddef.h", stddef_str                                                                \
   }
@@ -0,0 +1,92 @@
+/* This file is a part of MIR project.
+   Copyright (C) 2020-2024 Vladimir Makarov <vmakarov.gcc@gmail.com>.
+*/
+
+/* See C11 7.17 */
+static char stdatomic_str[]
+  = "#ifndef __STDATOMIC_H\n"
+    "#define __STDATOMIC_H\n"
+    "\n"
+    "typedef enum memory_order {\n"
+    "  memory_order_relaxed = __ATOMIC_RELAXED,\n"
+    "  memory_order_consume = __ATOMIC_CONSUME,\n"
+    "  memory_order_acquire = __ATOMIC_ACQUIRE,\n"
+    "  memory_order_release = __ATOMIC_RELEASE,\n"
+    "  memory_order_acq_rel = __ATOMIC_ACQ_REL,\n"
+    "  memory_order_seq_cst = __ATOMIC_SEQ_CST\n"
+    "} memory_order;\n"
+    "\n"
+    "typedef _Atomic _Bool atomic_bool;\n"
+    "typedef _Atomic char atomic_char;\n"
+    "typedef _Atomic signed char atomic_schar;\n"
+    "typedef _Atomic unsigned char atomic_uchar;\n"
+    "typedef _Atomic short atomic_short;\n"
+    "typedef _Atomic unsigned short atomic_ushort;\n"
+    "typedef _Atomic int atomic_int;\n"
+    "typedef _Atomic unsigned int atomic_uint;\n"
+    "typedef _Atomic long atomic_long;\n"
+    "typedef _Atomic unsigned long atomic_ulong;\n"
+    "typedef _Atomic long long atomic_llong;\n"
+    "typedef _Atomic unsigned long long atomic_ullong;\n"
+    "typedef _Atomic __UINT16_TYPE__ atomic_char16_t;\n"
+    "typedef _Atomic __UINT32_TYPE__ atomic_char32_t;\n"
+    "typedef _Atomic __INTPTR_TYPE__ atomic_intptr_t;\n"
+    "typedef _Atomic __UINTPTR_TYPE__ atomic_uintptr_t;\n"
+    "typedef _Atomic __SIZE_TYPE__ atomic_size_t;\n"
+    "typedef _Atomic __PTRDIFF_TYPE__ atomic_ptrdiff_t;\n"
+    "typedef _Atomic __INTMAX_TYPE__ atomic_intmax_t;\n"
+    "typedef _Atomic __UINTMAX_TYPE__ atomic_uintmax_t;\n"
+    "\n"
+    "#define ATOMIC_BOOL_LOCK_FREE 2\n"
+    "#define ATOMIC_CHAR_LOCK_FREE 2\n"
+    "#define ATOMIC_CHAR16_T_LOCK_FREE 2\n"
+    "#define ATOMIC_CHAR32_T_LOCK_FREE 2\n"
+    "#define ATOMIC_SHORT_LOCK_FREE 2\n"
+    "#define ATOMIC_INT_LOCK_FREE 2\n"
+    "#define ATOMIC_LONG_LOCK_FREE 2\n"
+    "#define ATOMIC_LLONG_LOCK_FREE 2\n"
+    "#define ATOMIC_POINTER_LOCK_FREE 2\n"
+    "\n"
+    "#define ATOMIC_VAR_INIT(value) (value)\n"
+    "#define atomic_init(obj, value) __atomic_store_n (obj, value, __ATOMIC_RELAXED)\n"
+    "#define kill_dependency(y) (y)\n"
+    "#define atomic_thread_fence(order) __atomic_thread_fence (order)\n"
+    "#define atomic_signal_fence(order) __atomic_signal_fence (order)\n"
+    "#define atomic_is_lock_free(obj) (sizeof (*(obj)) <= sizeof (void *))\n"
+    "\n"
+    "#define atomic_store_explicit(obj, v, order) __atomic_store_n (obj, v, order)\n"
+    "#define atomic_store(obj, v) __atomic_store_n (obj, v, __ATOMIC_SEQ_CST)\n"
+    "#define atomic_load_explicit(obj, order) __atomic_load_n (obj, order)\n"
+    "#define atomic_load(obj) __atomic_load_n (obj, __ATOMIC_SEQ_CST)\n"
+    "#define atomic_exchange_explicit(obj, v, order) __atomic_exchange_n (obj, v, order)\n"
+    "#define atomic_exchange(obj, v) __atomic_exchange_n (obj, v, __ATOMIC_SEQ_CST)\n"
+    "#define atomic_compare_exchange_strong_explicit(obj, expected, desired, succ, fail) \\\n"
+    "  __atomic_compare_exchange_n (obj, expected, desired, 0, succ, fail)\n"
+    "#define atomic_compare_exchange_strong(obj, expected, desired) \\\n"
+    "  __atomic_compare_exchange_n (obj, expected, desired, 0, __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST)\n"
+    "#define atomic_compare_exchange_weak_explicit(obj, expected, desired, succ, fail) \\\n"
+    "  __atomic_compare_exchange_n (obj, expected, desired, 1, succ, fail)\n"
+    "#define atomic_compare_exchange_weak(obj, expected, desired) \\\n"
+    "  __atomic_compare_exchange_n (obj, expected, desired, 1, __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST)\n"
+    "#define atomic_fetch_add_explicit(obj, v, order) __atomic_fetch_add (obj, v, order)\n"
+    "#define atomic_fetch_add(obj, v) __atomic_fetch_add (obj, v, __ATOMIC_SEQ_CST)\n"
+    "#define atomic_fetch_sub_explicit(obj, v, order) __atomic_fetch_sub (obj, v, order)\n"
+    "#define atomic_fetch_sub(obj, v) __atomic_fetch_sub (obj, v, __ATOMIC_SEQ_CST)\n"
+    "#define atomic_fetch_or_explicit(obj, v, order) __atomic_fetch_or (obj, v, order)\n"
+    "#define atomic_fetch_or(obj, v) __atomic_fetch_or (obj, v, __ATOMIC_SEQ_CST)\n"
+    "#define atomic_fetch_xor_explicit(obj, v, order) __atomic_fetch_xor (obj, v, order)\n"
+    "#define atomic_fetch_xor(obj, v) __atomic_fetch_xor (obj, v, __ATOMIC_SEQ_CST)\n"
+    "#define atomic_fetch_and_explicit(obj, v, order) __atomic_fetch_and (obj, v, order)\n"
+    "#define atomic_fetch_and(obj, v) __atomic_fetch_and (obj, v, __ATOMIC_SEQ_CST)\n"
+    "\n"
+    "typedef struct atomic_flag {\n"
+    "  _Atomic unsigned char __val;\n"
+    "} atomic_flag;\n"
+    "\n"
+    "#define ATOMIC_FLAG_INIT {0}\n"
+    "#define atomic_flag_test_and_set_explicit(obj, order) \\\n"
+    "  ((_Bool) __atomic_exchange_n (&(obj)->__val, 1, order))\n"
+    "#define atomic_flag_test_and_set(obj) atomic_flag_test_and_set_explicit (obj, __ATOMIC_SEQ_CST)\n"
+    "#define atomic_flag_clear_explicit(obj, order) __atomic_store_n (&(obj)->__val, 0, order)\n"
+    "#define atomic_flag_clear(obj) atomic_flag_clear_explicit (obj, __ATOMIC_SEQ_CST)\n"
+    "#endif /* #ifndef __STDATOMIC_H */\n";
@@ -0,0 +1,87 @@
+/* c2sljit_compile_buffer reads the source in place: the buffer is not
+   NUL-terminated, mixes LF and CRLF lines, continues lines with
+   backslashes and does not end with a newline.  Splices, also written
+   as ??/ trigraphs, can split a punctuator, so that characters read
+   past the splice are put back across it.  The same sources compiled
+   through a getc callback give the same results. */
+#include <stdio.h>
+#include <string.h>
+
+#include "mir-alloc.h"
+#include "mir-alloc-default.c"
+#include "c2sljit.h"
+
+static const char source[]
+  = "#include <stdio.h>\r\n"
+    "#define SUM(a, b) \\\n"
+    "  ((a) + (b))\r\n"
+    "static const char *s = \"crlf\\\r\n"
+    "-joined\";\n"
+    "int main (void) {\r\n"
+    "  printf (\"%s %d\\n\", s, SUM (40, 2));\n"
+    "  return SUM (1, 2); }"
+    "int trailing_garbage_outside_the_buffer";
+
+static const char splices[]
+  = "#include <stdio.h>\n"
+    "#define S(x) #x\n"
+    "#define CAT(a, b) a %:%\\\n"
+    ": b\n"
+    "#define CAT2(a, b) a %:%?\?/\n"
+    ": b\n"
+    "int main (void) {\n"
+    "  int a = 1, b = 40, ab = 2, c;\n"
+    "  a +\\\n"
+    "= 4;\n"
+    "  a +?\?/\n"
+    "= 1;\n"
+    "  b >\\\n"
+    ">\\\n"
+    "= 1;\n"
+    "  c = b <\\\n"
+    " 1;\n"
+    "  printf (\"%d %d %d %d %d\\n\", a, b, c, CAT (a, b), CAT2 (a, b));\n"
+    "  printf (\"%s|%s\\n\", S (1 %:%\\\n"
+    "b ..\\\n"
+    "x), S (a ?\?/\n"
+    "= 2 %:%?\?/\n"
+    "%:));\n"
+    "  return a; }";
+
+struct string_getc_data {
+  const char *str;
+  size_t pos, len;
+};
+
+static int string_getc (void *data) {
+  struct string_getc_data *d = data;
+  return d->pos < d->len ? (unsigned char) d->str[d->pos++] : EOF;
+}
+
+int main (void) {
+  struct MIR_context st;
+  struct c2sljit_options ops;
+  MIR_context_t ctx = &st;
+  size_t len = strstr (source, "int trailing") - source;
+  struct string_getc_data data = {source, 0, len};
+
+  memset (&st, 0, sizeof (st));
+  st.alloc = &default_alloc;
+  memset (&ops, 0, sizeof (ops));
+  ops.message_file = stdout;
+  c2sljit_init (ctx);
+  if (c2sljit_compile_buffer (ctx, &ops, source, len, "<buffer>"))
+    printf ("buffer returned %d\n", c2sljit_get_main (ctx) (0, NULL));
+  if (c2sljit_compile (ctx, &ops, string_getc, &data, "<getc>", NULL))
+    printf ("getc returned %d\n", c2sljit_get_main (ctx) (0, NULL));
+  if (c2sljit_compile_buffer (ctx, &ops, splices, sizeof (splices) - 1, "<splices>"))
+    printf ("splices buffer returned %d\n", c2sljit_get_main (ctx) (0, NULL));
+  data = (struct string_getc_data) {splices, 0, sizeof (splices) - 1};
+  if (c2sljit_compile (ctx, &ops, string_getc, &data, "<splices getc>", NULL))
+    printf ("splices getc returned %d\n", c2sljit_get_main (ctx) (0, NULL));
+  /* An empty buffer is an empty translation unit */
+  if (c2sljit_compile_buffer (ctx, &ops, source, 0, "<empty>"))
+    printf ("empty has main %d\n", c2sljit_get_main (ctx) != NULL);
+  c2sljit_finish (ctx);
+  return 0;
+}
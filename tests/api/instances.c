@@ -0,0 +1,50 @@
+/* Instances belong to a module: after a later compile, instances of the
+   earlier module still hold that module's globals, and each instance of
+   a module starts from its initial values. */
+#include <stdio.h>
+#include <string.h>
+
+#include "mir-alloc.h"
+#include "mir-alloc-default.c"
+#include "c2sljit.h"
+
+static const char *sources[] = {
+  "static int calls = 100;\nint main (void) { return ++calls; }\n",
+  "int data[3] = {1, 2, 3};\n"
+  "int main (void) { return data[0] += data[1] + data[2]; }\n",
+};
+
+int main (void) {
+  struct MIR_context st;
+  struct c2sljit_options ops;
+  MIR_context_t ctx = &st;
+  c2sljit_main_func_t mains[2];
+  c2sljit_module_t modules[2];
+  c2sljit_instance_t insts[2][2];
+
+  memset (&st, 0, sizeof (st));
+  st.alloc = &default_alloc;
+  memset (&ops, 0, sizeof (ops));
+  ops.message_file = stdout;
+  ops.instances_p = 1;
+  c2sljit_init (ctx);
+  for (int i = 0; i < 2; i++) {
+    c2sljit_compile_buffer (ctx, &ops, sources[i], strlen (sources[i]), "<string>");
+    mains[i] = c2sljit_get_main (ctx);
+    modules[i] = c2sljit_get_module (ctx);
+  }
+  for (int i = 0; i < 2; i++)
+    for (int j = 0; j < 2; j++) insts[i][j] = c2sljit_instantiate (ctx, modules[i]);
+  for (int run = 0; run < 2; run++)
+    for (int i = 0; i < 2; i++)
+      for (int j = 0; j < 2; j++) {
+        c2sljit_set_instance (ctx, modules[i], insts[i][j]);
+        printf ("module %d instance %d: %d\n", i, j, mains[i] (0, NULL));
+      }
+  for (int i = 0; i < 2; i++)
+    for (int j = 0; j < 2; j++) c2sljit_free_instance (ctx, modules[i], insts[i][j]);
+  c2sljit_unload (ctx, modules[0]);
+  c2sljit_unload (ctx, modules[1]);
+  c2sljit_finish (ctx);
+  return 0;
+}
@@ -0,0 +1,60 @@
+/* c2sljit_reset between compiles: each compile starts from a clean
+   context, also after a failed one, and the standard macros and includes
+   still work.  Macro commands are processed before the standard macros,
+   whether a compile processes them or restores them, with or without a
+   reset before it. */
+#include <stdio.h>
+#include <string.h>
+
+#include "mir-alloc.h"
+#include "mir-alloc-default.c"
+#include "c2sljit.h"
+
+static const char *sources[] = {
+  "#include <stdio.h>\nint g = 5;\nint main (void) { printf (\"first %d\\n\", g); return g; }\n",
+  "#include <stdio.h>\n#define TWICE(x) ((x) * 2)\nint g;\n"
+  "int main (void) { printf (\"second %d\\n\", TWICE (g + 3)); return 0; }\n",
+  "int main (void) { return undeclared; }\n",
+  "#include <limits.h>\nint g = 7;\nint main (void) { return g + (INT_MAX > 0); }\n",
+};
+
+static const char commands_source[]
+  = "#ifdef __STDC_VERSION__\n#define V 1\n#else\n#define V 0\n#endif\n"
+    "#ifndef SCALE\n#define SCALE 1\n#endif\n"
+    "int main (void) { return SCALE * 10 + V; }\n";
+
+static int compile_string (MIR_context_t ctx, struct c2sljit_options *ops, const char *src) {
+  return c2sljit_compile_buffer (ctx, ops, src, strlen (src), "<string>");
+}
+
+int main (void) {
+  struct MIR_context st;
+  struct c2sljit_options ops;
+  MIR_context_t ctx = &st;
+  struct c2sljit_macro_command cmds[] = {{0, "__STDC_VERSION__", NULL}, {1, "SCALE", "3"}};
+
+  memset (&st, 0, sizeof (st));
+  st.alloc = &default_alloc;
+  memset (&ops, 0, sizeof (ops));
+  ops.message_file = stdout;
+  c2sljit_init (ctx);
+  for (int round = 0; round < 2; round++)
+    for (int i = 0; i < 4; i++) {
+      if (compile_string (ctx, &ops, sources[i]))
+        printf ("source %d returned %d\n", i, c2sljit_get_main (ctx) (0, NULL));
+      else
+        printf ("source %d failed\n", i);
+      c2sljit_reset (ctx);
+    }
+  ops.macro_commands = cmds;
+  for (int n = 0; n <= 2; n++)
+    for (int reset_p = 0; reset_p < 2; reset_p++) {
+      ops.macro_commands_num = n;
+      if (compile_string (ctx, &ops, commands_source))
+        printf ("%d commands, reset %d: returned %d\n", n, reset_p,
+                c2sljit_get_main (ctx) (0, NULL));
+      if (reset_p) c2sljit_reset (ctx);
+    }
+  c2sljit_finish (ctx);
+  return 0;
+}
@@ -0,0 +1,103 @@
+/* Environment snapshots: compiles start from the saved preprocessor
+   state, also after a save and load round trip and with -D commands on
+   top of it, and a snapshot whose header changed is not used.  Files
+   with a wrong snapshot header are not loaded. */
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "mir-alloc.h"
+#include "mir-alloc-default.c"
+#include "c2sljit.h"
+
+static const char prefix[]
+  = "#include <stdio.h>\n#include <string.h>\n#define SCALE 3\n"
+    "typedef struct { int a, b; } pair;\n";
+
+static const char source[]
+  = "int main (void) {\n"
+    "  pair p = {SCALE, (int) strlen (\"four\")};\n"
+    "  printf (\"%d %d %d\\n\", p.a, p.b, EXTRA);\n"
+    "  return p.a * p.b;\n"
+    "}\n";
+
+static char header_name[64];
+
+static void write_header (int value) {
+  FILE *f = fopen (header_name, "w");
+  fprintf (f, "#define HEADER_VALUE %d\n", value);
+  fclose (f);
+}
+
+static void run (MIR_context_t ctx, struct c2sljit_options *ops, const char *name,
+                 const char *src) {
+  if (c2sljit_compile_buffer (ctx, ops, src, strlen (src), name))
+    printf ("%s returned %d\n", name, c2sljit_get_main (ctx) (0, NULL));
+  else
+    printf ("%s failed\n", name);
+  fflush (stdout);
+}
+
+int main (void) {
+  struct MIR_context st;
+  struct c2sljit_options ops;
+  struct c2sljit_macro_command extra = {1, "EXTRA", "7"};
+  MIR_context_t ctx = &st;
+  c2sljit_snapshot_t snap;
+  char header_prefix[128], bytes[64];
+  FILE *f;
+
+  memset (&st, 0, sizeof (st));
+  st.alloc = &default_alloc;
+  memset (&ops, 0, sizeof (ops));
+  ops.message_file = stdout;
+  ops.macro_commands = &extra;
+  c2sljit_init (ctx);
+  snap = c2sljit_snapshot_create (ctx, &ops, prefix);
+  ops.snapshot = snap;
+  ops.macro_commands_num = 1;
+  run (ctx, &ops, "created", source);
+  extra.def = "8";
+  run (ctx, &ops, "redefined", source);
+
+  f = tmpfile ();
+  printf ("saved %d\n", c2sljit_snapshot_save (ctx, snap, f) != 0);
+  c2sljit_snapshot_free (ctx, snap);
+  rewind (f);
+  ops.snapshot = snap = c2sljit_snapshot_load (ctx, f);
+  fclose (f);
+  printf ("loaded %d\n", snap != NULL);
+  run (ctx, &ops, "loaded", source);
+
+  /* The same file from another format version, and a file which is not a
+     snapshot */
+  f = tmpfile ();
+  c2sljit_snapshot_save (ctx, snap, f);
+  rewind (f);
+  fread (bytes, sizeof (bytes), 1, f);
+  bytes[sizeof ("c2sljit snapshot")]++;
+  rewind (f);
+  fwrite (bytes, sizeof (bytes), 1, f);
+  rewind (f);
+  printf ("other version loaded %d\n", c2sljit_snapshot_load (ctx, f) != NULL);
+  fclose (f);
+  f = tmpfile ();
+  fputs ("#include <stdio.h>\n", f);
+  rewind (f);
+  printf ("source loaded %d\n", c2sljit_snapshot_load (ctx, f) != NULL);
+  fclose (f);
+  c2sljit_snapshot_free (ctx, snap);
+
+  /* A changed header makes the compile process the prefix again */
+  snprintf (header_name, sizeof (header_name), "/tmp/c2sljit-snapshot-%d.h", (int) getpid ());
+  snprintf (header_prefix, sizeof (header_prefix), "#include \"%s\"\n", header_name);
+  write_header (1);
+  ops.snapshot = snap = c2sljit_snapshot_create (ctx, &ops, header_prefix);
+  run (ctx, &ops, "header", "int main (void) { return HEADER_VALUE; }\n");
+  write_header (1000);
+  run (ctx, &ops, "changed header", "int main (void) { return HEADER_VALUE; }\n");
+  c2sljit_snapshot_free (ctx, snap);
+  remove (header_name);
+  c2sljit_finish (ctx);
+  return 0;
+}
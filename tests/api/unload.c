@@ -0,0 +1,57 @@
+/* Modules stay loaded across compiles until c2sljit_unload: the code of
+   an earlier module still runs after later compiles and after unloading
+   other modules, its functions can still be looked up, and a failed
+   compile has no module. */
+#include <stdio.h>
+#include <string.h>
+
+#include "mir-alloc.h"
+#include "mir-alloc-default.c"
+#include "c2sljit.h"
+
+static const char *sources[] = {
+  "static int calls;\nint main (void) { return ++calls * 10; }\n",
+  "int data[4] = {1, 2, 3, 4};\n"
+  "int scale (int x) { return x * data[3]; }\n"
+  "int main (void) { int s = 0; for (int i = 0; i < 4; i++) s += data[i]; return s; }\n",
+  "int main (void) { return missing_function_body; }\n",
+};
+
+int main (void) {
+  struct MIR_context st;
+  struct c2sljit_options ops;
+  MIR_context_t ctx = &st;
+  c2sljit_main_func_t mains[3];
+  c2sljit_module_t modules[3];
+
+  memset (&st, 0, sizeof (st));
+  st.alloc = &default_alloc;
+  memset (&ops, 0, sizeof (ops));
+  ops.message_file = stdout;
+  c2sljit_init (ctx);
+  for (int i = 0; i < 3; i++) {
+    int ok = c2sljit_compile_buffer (ctx, &ops, sources[i], strlen (sources[i]), "<string>");
+    mains[i] = ok ? c2sljit_get_main (ctx) : NULL;
+    modules[i] = c2sljit_get_module (ctx);
+    printf ("module %d: compiled %d, handle %d\n", i, ok != 0, modules[i] != NULL);
+  }
+  printf ("first %d\n", mains[0] (0, NULL));
+  printf ("second %d\n", mains[1] (0, NULL));
+  printf ("first %d\n", mains[0] (0, NULL));
+  printf ("lookup first %d\n", c2sljit_module_get_main (ctx, modules[0]) == mains[0]);
+  int (*scale) (int) = (int (*) (int)) c2sljit_module_get_func (ctx, modules[1], "scale");
+  printf ("lookup scale %d, in first %d\n", scale (5),
+          c2sljit_module_get_func (ctx, modules[0], "scale") != NULL);
+  c2sljit_unload (ctx, modules[0]);
+  printf ("lookup unloaded %d\n", c2sljit_module_get_main (ctx, modules[0]) != NULL);
+  printf ("second after unload %d\n", mains[1] (0, NULL));
+  /* A module compiled after an unload gets fresh globals */
+  c2sljit_compile_buffer (ctx, &ops, sources[0], strlen (sources[0]), "<string>");
+  mains[0] = c2sljit_get_main (ctx);
+  modules[0] = c2sljit_get_module (ctx);
+  printf ("first again %d\n", mains[0] (0, NULL));
+  c2sljit_unload (ctx, modules[1]);
+  c2sljit_unload (ctx, modules[0]);
+  c2sljit_finish (ctx);
+  return 0;
+}
@@ -0,0 +1,86 @@
+/* GCC __atomic/__sync builtins, C11 _Atomic objects of every size declared
+   with the qualifier and with the _Atomic (type-name) specifier, and
+   read-modify-write operations inside a loop. */
+#include <stdio.h>
+#include <stdatomic.h>
+
+char c8;
+short s16;
+int i32;
+long i64;
+atomic_int ai;
+atomic_uchar auc = 250;
+_Atomic long al;
+atomic_long counter;
+_Atomic(short) as16 = 7;
+_Atomic(int *) aptr;
+long sync_counter;
+
+static long worker (long arg) {
+  for (int i = 0; i < 10000; i++) {
+    atomic_fetch_add (&counter, 1);
+    __sync_fetch_and_add (&sync_counter, 2);
+  }
+  return arg;
+}
+
+int main (void) {
+  long r, e64 = 0;
+  int e32 = 7;
+
+  r = __atomic_fetch_add (&c8, 5, __ATOMIC_RELAXED);
+  printf ("fetch_add %ld %d\n", r, c8);
+  r = __atomic_fetch_sub (&s16, 3, __ATOMIC_ACQUIRE);
+  printf ("fetch_sub %ld %d\n", r, s16);
+  r = __atomic_fetch_or (&i32, 12, __ATOMIC_RELEASE);
+  printf ("fetch_or %ld %d\n", r, i32);
+  r = __atomic_fetch_xor (&i64, 255, __ATOMIC_SEQ_CST);
+  printf ("fetch_xor %ld %ld\n", r, i64);
+  r = __atomic_add_fetch (&c8, 1, __ATOMIC_SEQ_CST);
+  printf ("add_fetch %ld\n", r);
+  r = __atomic_and_fetch (&i32, 6, __ATOMIC_SEQ_CST);
+  printf ("and_fetch %ld\n", r);
+  r = __atomic_sub_fetch (&i64, 55, __ATOMIC_SEQ_CST);
+  printf ("sub_fetch %ld\n", r);
+  __atomic_store_n (&i32, 7, __ATOMIC_RELEASE);
+  r = __atomic_load_n (&i32, __ATOMIC_ACQUIRE);
+  printf ("load %ld\n", r);
+  r = __atomic_exchange_n (&i32, 9, __ATOMIC_ACQ_REL);
+  printf ("exchange %ld %d\n", r, i32);
+  r = __atomic_compare_exchange_n (&i32, &e32, 1, 0, __ATOMIC_SEQ_CST, __ATOMIC_RELAXED);
+  printf ("cas fail %ld %d\n", r, e32);
+  r = __atomic_compare_exchange_n (&i32, &e32, 1, 1, __ATOMIC_SEQ_CST, __ATOMIC_RELAXED);
+  printf ("cas ok %ld %d\n", r, i32);
+  r = __sync_val_compare_and_swap (&i64, 200, 300);
+  printf ("sync val cas %ld %ld\n", r, i64);
+  r = __sync_bool_compare_and_swap (&i64, 1, 2);
+  printf ("sync bool cas %ld %ld\n", r, i64);
+  r = __sync_lock_test_and_set (&i32, 4);
+  printf ("test_and_set %ld %d\n", r, i32);
+  __sync_lock_release (&i32);
+  __sync_synchronize ();
+  __atomic_thread_fence (__ATOMIC_SEQ_CST);
+  printf ("released %d\n", i32);
+  ai = 10;
+  ai++;
+  ++ai;
+  ai *= 3;
+  ai >>= 1;
+  r = atomic_load (&ai);
+  printf ("c11 int %ld\n", r);
+  r = atomic_fetch_sub_explicit (&ai, 8, memory_order_relaxed);
+  printf ("c11 fetch_sub %ld %d\n", r, (int) ai);
+  auc += 10; /* wraps in 8 bits */
+  printf ("c11 uchar %d\n", (int) auc);
+  al = -5;
+  r = al--;
+  printf ("c11 long %ld %ld\n", r, (long) al);
+  r = atomic_compare_exchange_strong (&al, &e64, 1);
+  printf ("c11 cas %ld %ld\n", r, e64);
+  as16 *= 3;
+  aptr = &e32;
+  printf ("c11 specifier %d %d %d\n", (int) as16, *aptr, (int) sizeof (_Atomic(char)));
+  for (int i = 0; i < 4; i++) worker (i);
+  printf ("loops %ld %ld\n", (long) counter, sync_counter);
+  return 0;
+}
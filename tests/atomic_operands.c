@@ -0,0 +1,32 @@
+/* Atomic operations whose value operand needs scratch registers of its own
+   must not lose the address computed before it.  */
+#include <stdio.h>
+#include <stdatomic.h>
+
+long tc = 5;
+int arr[3] = {1, 2, 3};
+long plain;
+atomic_long total;
+int flag;
+
+static int three (void) { return 3; }
+
+int main (void) {
+  long old, expected = 6;
+
+  old = __atomic_fetch_add (&plain, tc + arr[0], __ATOMIC_SEQ_CST);
+  printf ("fetch_add: %ld %ld\n", old, plain);
+  old = __atomic_exchange_n (&plain, tc * arr[2] + arr[1], __ATOMIC_SEQ_CST);
+  printf ("exchange: %ld %ld\n", old, plain);
+  plain = 6;
+  flag = __atomic_compare_exchange_n (&plain, &expected, tc + arr[1] + three (), 0,
+                                      __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST);
+  printf ("cas: %d %ld\n", flag, plain);
+  total = tc + arr[0];
+  printf ("assign: %ld\n", (long) total);
+  total += tc + arr[1];
+  printf ("add_assign: %ld\n", (long) total);
+  total -= arr[1] * three ();
+  printf ("sub_assign: %ld\n", (long) total);
+  return 0;
+}
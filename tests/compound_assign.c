@@ -0,0 +1,22 @@
+/* Compound assignments whose right operand contains a call or needs many
+   temps: the lvalue address and its current value must survive it, also
+   when the operation is a division using R0 and R1.  */
+#include <stdio.h>
+struct s { int x; long y; } st = {7, 9}, *sp = &st;
+int a[5] = {10, 20, 30, 40, 50};
+unsigned u = 4000000000u;
+int g;
+static int f (int k) { g += k; return k + 1; }
+int main (void) {
+  int i = 2, x = 100;
+  a[i] += f (3);
+  a[a[0] / 10] -= f (1) * 2;
+  sp->x *= f (2);
+  sp->y /= f (1);
+  x %= f (5);
+  u >>= f (0);
+  a[4] += a[a[1] / 10 + 1] + a[a[2] / 10 - 2];
+  printf ("%d %d %d %d %d %d\n", a[0], a[1], a[2], a[3], a[4], g);
+  printf ("%d %ld %d %u\n", st.x, st.y, x, u);
+  return 0;
+}
@@ -0,0 +1,19 @@
+/* Values read through pointers have the width and signedness of the
+   pointee, and a pointer to an array dereferences to the array, which
+   decays to its address. */
+#include <stdio.h>
+
+int main (void) {
+  long words[2] = {-1, 0x123456789L};
+  signed char *cp = (signed char *) &words[0];
+  unsigned char *ucp = (unsigned char *) &words[0];
+  short *sp = (short *) &words[0];
+  unsigned *up = (unsigned *) &words[1];
+  int arr[3] = {4, 5, 6};
+  int (*ap)[3] = &arr;
+  int *first = *ap;
+
+  printf ("%d %d %d %u\n", *cp, *ucp, *sp, *up);
+  printf ("%d %d %d\n", *first, (*ap)[2], **ap + *(*ap + 1));
+  return 0;
+}
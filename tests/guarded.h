@@ -0,0 +1,13 @@
+/* Included several times by tests/preprocessor.c: the guard must keep the
+   definitions from being repeated. */
+#ifndef GUARDED_H
+#define GUARDED_H
+
+#define GUARD_VALUE 17
+typedef struct {
+  int a, b;
+} guarded_pair;
+
+static int guarded_sum (guarded_pair *p) { return p->a + p->b; }
+
+#endif /* GUARDED_H */
@@ -0,0 +1,26 @@
+/* Small functions inlined at -O1 and above: statements of the inlined body
+   must not recycle the registers holding the arguments or the caller's
+   partially evaluated expression, and operands of the body read the
+   parameters from the argument slots.  Without inlining, calls nested two deep
+   in arguments must not overwrite the arguments saved by the outer call.  */
+#include <stdio.h>
+
+static void set (long *p) { *p = 77; }
+static int add3 (int a, int b, int c) { return a + b * c; }
+static int twice (int x) { return x + x; }
+static long mix (long a, long b, long c, long d) { return a * 3 - b + c * d; }
+
+int main (void) {
+  long a[2];
+  int k = 4;
+  long w = k - 3, x = k - 2, y = k - 1, z = k;
+
+  set (a);
+  set (&a[1]);
+  printf ("set %ld %ld\n", a[0], a[1]);
+  printf ("add3 %d\n", add3 (k, k + 1, k * 2));
+  printf ("nested %d\n", k * 3 + twice (k + 2));
+  printf ("chain %d\n", add3 (twice (k), twice (1), add3 (1, 2, 3)));
+  printf ("mix %ld\n", mix (w, x, y, z));
+  return 0;
+}
@@ -0,0 +1,28 @@
+/* Instance mode (run with -finstances=3): each run of main starts from the
+   initial values of the globals in a fresh instance, so every run prints
+   the same lines. */
+#include <stdio.h>
+
+int runs = 0;
+long total = 100;
+int hist[4] = {1, 2, 3, 4};
+static int calls;
+const char *msg = "instance";
+int *hp = &hist[2];
+
+static int step (int k) {
+  calls++;
+  hist[k & 3] += k;
+  return hist[k & 3];
+}
+
+int main (void) {
+  int *p = &runs;
+
+  *p += 1;
+  for (int k = 0; k < 6; k++) total += step (k);
+  *hp *= 10;
+  printf ("%s runs %d calls %d total %ld\n", msg, runs, calls, total);
+  printf ("hist %d %d %d %d\n", hist[0], hist[1], hist[2], hist[3]);
+  return 0;
+}
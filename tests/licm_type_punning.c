@@ -0,0 +1,37 @@
+/* Loads must not be hoisted out of loops past stores of another type to
+   the same bytes: struct copies move double fields as integers and unions
+   may be read through another member.  */
+#include <stdio.h>
+
+struct S {
+  double d;
+  long k;
+} a[4], cur;
+
+union U {
+  double d;
+  unsigned long l;
+} u;
+
+int n = 4; /* not a constant, so the loops are not unrolled */
+
+int main (void) {
+  double sum = 0;
+  unsigned long acc = 0;
+
+  for (int i = 0; i < 4; i++) {
+    a[i].d = 10.0 * (i + 1) + 5;
+    a[i].k = i;
+  }
+  for (int i = 0; i < n; i++) {
+    cur = a[i];
+    sum += cur.d;
+  }
+  printf ("struct copy: %ld\n", (long) sum);
+  for (int i = 0; i < n; i++) {
+    u.d = i + 1.0;
+    acc += u.l >> 52;
+  }
+  printf ("union: %lu\n", acc);
+  return 0;
+}
@@ -0,0 +1,61 @@
+/* Functions the linear IR (-O2) translates and allocates registers for:
+   more live values than registers, values live across calls and loops,
+   mixed integer and floating point, short-circuit conditions and
+   switches.  The same results are expected at every level. */
+#include <stdio.h>
+
+struct acc {
+  long sum;
+  double avg;
+  int n;
+};
+
+static long mix (long a, long b, long c, long d) { return a * 3 - b + c * d; }
+
+static long pressure (long x) {
+  long a = x + 1, b = x + 2, c = x + 3, d = x + 4, e = x + 5, f = x + 6, g = x + 7, h = x + 8;
+  long i = a * b, j = c * d, k = e * f, l = g * h;
+  long m = mix (a, b, c, d);
+  return a + b + c + d + e + f + g + h + i + j + k + l + m;
+}
+
+static void add (struct acc *acc, int v) {
+  acc->sum = acc->sum + v;
+  acc->n++;
+  acc->avg = (double) acc->sum / acc->n;
+}
+
+static int classify (int v) {
+  switch (v % 5) {
+  case 0: return 10;
+  case 1:
+  case 2: return 20;
+  case 3: break;
+  default: return -1;
+  }
+  return v > 10 && v < 20 ? 30 : 40;
+}
+
+static double poly (double x) {
+  double r = 0.0;
+  for (int i = 0; i < 4; i++) r = r * x + (i + 1);
+  return r;
+}
+
+int main (void) {
+  struct acc acc = {0, 0.0, 0};
+  int cls = 0;
+  long total = 0;
+
+  for (int v = 1; v <= 24; v++) {
+    if (v % 3 == 0 || v == 7) continue;
+    add (&acc, v);
+    cls = cls * 7 % 1000 + classify (v);
+  }
+  for (long x = 0; x < 5; x++) total = total + pressure (x);
+  printf ("acc %ld %d %d\n", acc.sum, acc.n, (int) (acc.avg * 100));
+  printf ("classify %d\n", cls);
+  printf ("pressure %ld\n", total);
+  printf ("poly %d\n", (int) poly (1.5));
+  return 0;
+}
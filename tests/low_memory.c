@@ -0,0 +1,30 @@
+/* Compiled with -flow-memory: the parser state is freed before code
+   generation and the function names and slots are compacted after it,
+   while calls, strings and globals of the module still work. */
+#include <stdio.h>
+#include <string.h>
+
+static const char *names[] = {"alpha", "beta", "gamma"};
+char buf[32];
+int calls;
+
+static int is_even (int n);
+static int is_odd (int n) { calls++; return n == 0 ? 0 : is_even (n - 1); }
+static int is_even (int n) { calls++; return n == 0 ? 1 : is_odd (n - 1); }
+
+int total_len (void) {
+  int s = 0;
+  for (int i = 0; i < 3; i++) s += strlen (names[i]);
+  return s;
+}
+
+int main (void) {
+  strcpy (buf, names[1]);
+  strcat (buf, "-");
+  strcat (buf, names[2]);
+  printf ("buf %s\n", buf);
+  printf ("len %d\n", total_len ());
+  printf ("even %d odd %d\n", is_even (10), is_odd (7));
+  printf ("calls %d\n", calls);
+  return 0;
+}
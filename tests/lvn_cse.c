@@ -0,0 +1,43 @@
+/* Common subexpressions the local value numbering reuses, and values it
+   must recompute after stores and calls. */
+#include <stdio.h>
+
+int g[8];
+int *p;
+
+static void bump (void) { g[2] += 10; }
+
+static int f (int x, int y) {
+  int a = x * y + 3, b = x * y + 3; /* same value */
+  int c = (x + y) * (x + y);
+  return a + b + c;
+}
+
+static int reload_after_store (int i) {
+  int s = g[i] + g[i + 1];
+
+  g[i] = 100;
+  s += g[i] + g[i + 1]; /* g[i] changed */
+  p[i + 1] = 50;
+  s += g[i + 1]; /* changed through a pointer */
+  return s;
+}
+
+static int reload_after_call (void) {
+  int s = g[2];
+
+  bump ();
+  return s + g[2];
+}
+
+int main (void) {
+  int init[8] = {3, 1, 4, 1, 5, 9, 2, 6};
+
+  for (int i = 0; i < 8; i++) g[i] = init[i];
+  p = g;
+  printf ("f %d\n", f (4, 5));
+  printf ("store %d\n", reload_after_store (1));
+  printf ("call %d\n", reload_after_call ());
+  printf ("g %d %d %d %d\n", g[0], g[1], g[2], g[3]);
+  return 0;
+}
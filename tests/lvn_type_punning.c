@@ -0,0 +1,33 @@
+/* A load must not be reused after a store of another type to the same
+   bytes, as done by struct copies and union punning.  */
+#include <stdio.h>
+
+struct S {
+  double d;
+  long k;
+} a[4], cur;
+
+union U {
+  double d;
+  unsigned long l;
+} u;
+
+int main (void) {
+  double x, y, f, g;
+
+  for (int i = 0; i < 4; i++) {
+    a[i].d = 10.0 * i + 5;
+    a[i].k = i;
+  }
+  cur = a[1];
+  x = cur.d;
+  cur = a[3];
+  y = cur.d;
+  printf ("struct copy: %ld %ld\n", (long) x, (long) y);
+  u.l = 0x3ff0000000000000UL;
+  f = u.d;
+  u.l = 0x4000000000000000UL;
+  g = u.d;
+  printf ("union: %ld %ld\n", (long) f, (long) g);
+  return 0;
+}
@@ -0,0 +1,55 @@
+/* Division and remainder by constants, which are strength reduced into
+   multiplications by magic numbers, for all signednesses and sizes. */
+#include <stdio.h>
+
+int si[] = {0, 1, -1, 7, -7, 100, -100, 2147483647, -2147483647 - 1, 123456789, -98765};
+unsigned ui[] = {0, 1, 6, 7, 100, 4294967295u, 2147483648u, 3000000000u, 12345};
+long sl[] = {0, 1, -1, 1000000007L, -1000000007L, 9223372036854775807L,
+             -9223372036854775807L - 1, 123456789012345L, -55555555555L};
+unsigned long ul[] = {0, 1, 7, 18446744073709551615ul, 9223372036854775808ul,
+                      12345678901234567ul, 1000000};
+
+int main (void) {
+  unsigned long h = 0;
+
+  for (int i = 0; i < (int) (sizeof (si) / sizeof (si[0])); i++) {
+    int x = si[i];
+    h = h * 31 + (unsigned) (x / 3) + (unsigned) (x % 3);
+    h = h * 31 + (unsigned) (x / 7) + (unsigned) (x % 7);
+    h = h * 31 + (unsigned) (x / 10) + (unsigned) (x % 10);
+    h = h * 31 + (unsigned) (x / -5) + (unsigned) (x % -5);
+    h = h * 31 + (unsigned) (x / 641) + (unsigned) (x % 641);
+  }
+  printf ("int %lu\n", h);
+  h = 0;
+  for (int i = 0; i < (int) (sizeof (ui) / sizeof (ui[0])); i++) {
+    unsigned x = ui[i];
+    h = h * 31 + x / 3 + x % 3;
+    h = h * 31 + x / 7 + x % 7;
+    h = h * 31 + x / 10 + x % 10;
+    h = h * 31 + x / 641 + x % 641;
+    h = h * 31 + x / 2147483649u + x % 2147483649u;
+  }
+  printf ("unsigned %lu\n", h);
+  h = 0;
+  for (int i = 0; i < (int) (sizeof (sl) / sizeof (sl[0])); i++) {
+    long x = sl[i];
+    h = h * 31 + (unsigned long) (x / 3) + (unsigned long) (x % 3);
+    h = h * 31 + (unsigned long) (x / 7) + (unsigned long) (x % 7);
+    h = h * 31 + (unsigned long) (x / 1000) + (unsigned long) (x % 1000);
+    h = h * 31 + (unsigned long) (x / -9L) + (unsigned long) (x % -9L);
+    h = h * 31 + (unsigned long) (x / 10000000019L) + (unsigned long) (x % 10000000019L);
+  }
+  printf ("long %lu\n", h);
+  h = 0;
+  for (int i = 0; i < (int) (sizeof (ul) / sizeof (ul[0])); i++) {
+    unsigned long x = ul[i];
+    h = h * 31 + x / 3 + x % 3;
+    h = h * 31 + x / 7 + x % 7;
+    h = h * 31 + x / 1000 + x % 1000;
+    h = h * 31 + x / 10000000019ul + x % 10000000019ul;
+    h = h * 31 + x / 9223372036854775809ul + x % 9223372036854775809ul;
+  }
+  printf ("unsigned long %lu\n", h);
+  return 0;
+}
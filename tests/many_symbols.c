@@ -0,0 +1,40 @@
+/* Hundreds of globals, functions and labels, far more than the old fixed
+   tables held, generated by nested macro expansion.  Each global must have
+   its own storage and each function its own code.  */
+#include <stdio.h>
+
+#define X10(M, p) M (p##0) M (p##1) M (p##2) M (p##3) M (p##4) \
+  M (p##5) M (p##6) M (p##7) M (p##8) M (p##9)
+#define X100(M, p) X10 (M, p##0) X10 (M, p##1) X10 (M, p##2) X10 (M, p##3) \
+  X10 (M, p##4) X10 (M, p##5) X10 (M, p##6) X10 (M, p##7) X10 (M, p##8) X10 (M, p##9)
+#define X300(M) X100 (M, a) X100 (M, b) X100 (M, c)
+
+#define GLOBAL(n) int n;
+#define FUNC(n) static int n##_f (int v) { n = v; return v + 1; }
+#define ADDR(n) &n,
+#define LABEL(n) n##_l : count++; if (count % 7 == 0) goto done;
+
+X300 (GLOBAL)
+X300 (FUNC)
+int *addrs[] = {X300 (ADDR) 0};
+
+static int labels (int start) {
+  int count = start;
+
+  X100 (LABEL, l)
+done:
+  return count;
+}
+
+int main (void) {
+  long sum = 0;
+  int n = 0, ret = 0;
+
+  for (n = 0; addrs[n] != 0; n++) *addrs[n] = n;
+  for (int i = 0; i < n; i++) sum += *addrs[i];
+  printf ("globals %d sum %ld a00 %d b17 %d c99 %d\n", n, sum, a00, b17, c99);
+  ret += a00_f (5) + a23_f (7) + b50_f (11) + c09_f (13) + c99_f (17);
+  printf ("funcs %d %d %d %d %d %d\n", ret, a00, a23, b50, c09, c99);
+  printf ("labels %d %d %d\n", labels (0), labels (3), labels (6));
+  return 0;
+}
@@ -0,0 +1,32 @@
+/* Constructs the parser has to try more than one way: casts and
+   parenthesized expressions, typedef names used as types and as
+   expressions, sizeof of types and of expressions, pointers to arrays,
+   declarations and expression statements starting alike. */
+#include <stdio.h>
+
+typedef int num;
+typedef struct pt {
+  int x, y;
+} pt;
+typedef num (*binop) (num, num);
+
+static num add (num a, num b) { return a + b; }
+
+int main (void) {
+  num a = 5, b = (num) 2.75, c = (a) - 1;
+  long sz = sizeof (num) + sizeof a + sizeof (pt) + sizeof (a + 1L) + sizeof (num *);
+  pt p = {1, 2};
+  pt *pp = &p;
+  int arr[4] = {9, 8, 7, 6};
+  int (*ap)[4] = &arr;
+  num *np = (num *) &arr[1];
+  int d = (int) (char) 300 + (a) * (b);
+
+  (a) = (a) + 1;
+  pp->y *= (num) (a + b);
+  c = ((pt *) pp)->y + (*ap)[2] + *np;
+  printf ("%d %d %d %d %ld\n", a, b, c, d, sz);
+  printf ("%d %d %d\n", pp->x, p.y, add ((num) 1, (num) (a)));
+  printf ("%d\n", (int) sizeof (int[3]) + (int) sizeof (struct pt *));
+  return 0;
+}
@@ -0,0 +1,85 @@
+/* Typedef names the parser has classified and memoized for a scope: the
+   answer changes when an inner scope redeclares the name as an object, and
+   comes back after the scope ends.  Deeply nested statement expressions,
+   parenthesized expressions and casts have to be told apart at every
+   level.  Compiled with -fstream, which releases each function body after
+   its code generation. */
+#include <stdio.h>
+
+typedef int T;
+typedef long U;
+
+static int shadow (void) {
+  T a = 3, b = 0;
+  {
+    T c = (T) 4;       /* T is memoized as a typedef for this block */
+    int T = 5;         /* ... and is an object from here on */
+    b = (T) + c;       /* parenthesized object, not a cast */
+    b = b * (T);
+    {
+      b += T * a;      /* a product, not a declaration of a pointer */
+      {
+        typedef char T; /* a typedef again in the innermost block */
+        T z = (T) 300;
+        b += z + (int) sizeof (T);
+      }
+      b += T;
+    }
+  }
+  T d = (T) 2;         /* the outer typedef is visible again */
+  return b * 10 + d + (int) sizeof (T);
+}
+
+/* With -fstream, the scopes of a released body are allocated again for
+   the next one: what was memoized for them must not outlive the body.  T
+   is an object in the innermost block of the first function and a type in
+   that of the second. */
+static int object_body (void) {
+  int r = 0;
+  {
+    int T = 2;
+    {
+      T *= 3;
+      r = T;
+    }
+  }
+  return r;
+}
+
+static int type_body (void) {
+  int r = 0;
+  {
+    int x = 2;
+    {
+      T y = 3;
+      r = x * y;
+    }
+  }
+  return r;
+}
+
+static long nest (long v) {
+  return ({
+    U x = v;
+    ({
+      U y = (U) ((x)) + 1;
+      ({
+        int U = 3;
+        ({
+          long w = ((y) * (U));
+          w + ({ U; });
+        });
+      });
+    });
+  });
+}
+
+int main (void) {
+  U u = (U) (T) 7;
+  T t = ((T) (((u)))) * (T) 2;
+
+  printf ("%d %d %d\n", shadow (), object_body (), type_body ());
+  printf ("%ld %d\n", nest (4), t);
+  printf ("%ld\n", (long) ({ U n = 0; for (T i = 0; i < 5; i++) n += ({ T k = i * i; k; }); n; }));
+  return 0;
+}
@@ -0,0 +1,44 @@
+/* Include guards, function-like and variadic macros, stringizing, token
+   pasting, nested and self-referential expansions, and keywords and
+   punctuators next to identifiers that look like them. */
+#include <stdio.h>
+#include "guarded.h"
+#include "guarded.h"
+#include "./guarded.h"
+
+#define SQ(x) ((x) * (x))
+#define ADD(a, b) ((a) + (b))
+#define TWICE(f, x) f (f (x))
+#define STR(x) #x
+#define XSTR(x) STR (x)
+#define CAT(a, b) a##b
+#define VAR(n) CAT (var_, n)
+#define LOG(fmt, ...) printf ("log: " fmt "\n", __VA_ARGS__)
+#define FIRST(a, ...) a
+#define EMPTY()
+#define APPLY(m, args) m args
+#if defined(SQ) && !defined(NOT_DEFINED) && GUARD_VALUE > 10
+#define CHECK 1
+#else
+#define CHECK 0
+#endif
+
+int var_1 = 5, var_2 = 6;
+int foo = 1;
+#define foo foo + 1
+int ifx = 3, returned = 4, int_ = 5, whiles = 6;
+
+int main (void) {
+  guarded_pair p = {3, 4};
+  int r = ADD (SQ (3), SQ (ADD (1, 1)));
+
+  printf ("%d %d %d\n", guarded_sum (&p), GUARD_VALUE, r);
+  printf ("%d %d\n", TWICE (SQ, 2), APPLY (ADD, (VAR (1), VAR (2))));
+  printf ("%s %s %s\n", STR (a + b), XSTR (GUARD_VALUE), STR ("q\n"));
+  LOG ("%d %d", FIRST (7, 8, 9), CHECK);
+  printf ("%d %d\n", foo, SQ (EMPTY () 5));
+  printf ("%d\n", ifx + returned * int_ - whiles);
+  printf ("%d %d %d\n", 7 >> 1 <= 3 ? 0 : 1, 1 && !0 || 0, (5 & 3) | (8 ^ 2) + (~0 == -1));
+  printf ("%d %s\n", __LINE__, __FILE__);
+  return 0;
+}
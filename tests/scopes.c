@@ -0,0 +1,60 @@
+/* Identifiers shadowed in nested blocks, for-loop scopes and parameters,
+   typedef names hidden by objects, and tags, labels and members sharing a
+   name with ordinary identifiers. */
+#include <stdio.h>
+
+typedef int T;
+int x = 1;
+struct x {
+  int x;
+};
+
+static int shadow_param (int x) {
+  {
+    int x = 40;
+    x += 2;
+  }
+  return x;
+}
+
+int main (void) {
+  int total = x;
+  struct x s = {5};
+
+  {
+    int x = 10;
+    total += x;
+    {
+      long x = 100;
+      total += (int) x;
+    }
+    total += x;
+  }
+  total += x;
+  for (int x = 0; x < 3; x++) total += x;
+  for (int i = 0; i < 2; i++) {
+    int x = i * 1000;
+    total += x;
+  }
+  {
+    T T = 7; /* the object hides the typedef name in this block */
+    total += T;
+  }
+  T after = 3; /* the typedef is visible again */
+  total += after + s.x + shadow_param (20);
+  goto x;
+x:
+  printf ("total %d x %d\n", total, x);
+  {
+    int n = 0;
+    for (int k = 0; k < 4; k++) {
+      int k2 = k;
+      {
+        int k = k2 * 2;
+        n += k;
+      }
+    }
+    printf ("n %d\n", n);
+  }
+  return 0;
+}
@@ -0,0 +1,50 @@
+/* Global aggregates whose initial values are built at compile time:
+   nested structs and arrays, designators, strings, unions and addresses of
+   other globals, read back through rows and array members. */
+#include <stdio.h>
+
+struct point {
+  short x, y;
+};
+struct shape {
+  const char *name;
+  struct point pts[3];
+  double scale;
+  unsigned char flags, kind;
+};
+union num {
+  int i;
+  float f;
+};
+
+int table[2][3] = {{1, 2, 3}, {4, 5}};
+char word[] = "hello";
+char fixed[8] = "ab";
+struct shape shapes[] = {
+  {"tri", {{0, 0}, {4, 0}, {0, 3}}, 1.5, 5, 17},
+  {.name = "seg", .pts[1] = {.y = -2}, .kind = 3},
+};
+union num un = {.i = 0x41};
+int arr[10] = {[2] = 7, [8] = 9, 11};
+int *ptrs[] = {&table[1][1], &arr[2], 0};
+const char *names[] = {"alpha", "beta", word};
+struct point *sp = &shapes[0].pts[2];
+long big = 1L << 40;
+unsigned char bytes[] = {255, 256 - 1, 'z'};
+
+int main (void) {
+  int i, sum = 0;
+
+  for (i = 0; i < 6; i++) sum += table[i / 3][i % 3];
+  for (i = 0; i < 3; i++) sum += shapes[0].pts[i].x * 100 + (&shapes[1])->pts[i].y;
+  printf ("table %d word %s fixed %s %d\n", sum, word, fixed, fixed[5]);
+  printf ("shape0 %s %d %d %d %d\n", shapes[0].name, shapes[0].pts[1].x, sp[-1].y,
+          shapes[0].flags, shapes[0].kind);
+  printf ("shape0 scale x10 %d\n", (int) (shapes[0].scale * 10));
+  printf ("shape1 %s %d %d %d\n", shapes[1].name, shapes[1].pts[1].y, shapes[1].flags, shapes[1].kind);
+  printf ("union %d arr %d %d %d %d\n", un.i, arr[2], arr[8], arr[9], arr[0]);
+  printf ("ptrs %d %d %d\n", *ptrs[0], *ptrs[1], ptrs[2] == 0);
+  printf ("names %s %s %s\n", names[0], names[1], names[2]);
+  printf ("sp %d big %ld bytes %d %d %c\n", sp->y, big, bytes[0], bytes[1], bytes[2]);
+  return 0;
+}
@@ -0,0 +1,29 @@
+/* A statement expression has the value of its last statement, also in
+   the middle of an expression whose temps and call results are live, in
+   a compound assignment, an index, a return and a nested one. */
+#include <stdio.h>
+
+int g = 4;
+
+static int f (int x) { return x * 3; }
+
+static double half (double d) { return d / 2; }
+
+static int ret (int n) { return ({ int t = n * 2; t + 1; }); }
+
+int main (void) {
+  int x = 10, a[3] = {0};
+  double d = 1.5 + ({ double h = half (5.0); h * 2; });
+  long l = ({ long m = 1L << 40; m; });
+
+  x += ({ int y = f (2); y + 1; });
+  int z = f (1) + ({ int q = f (4); q - f (1); }) * 2;
+  int w = ({ int s = 0; for (int i = 0; i < 5; i++) s += i; s; }) + ({ g; });
+  int n = ({ int o = ({ int p = 3; p * p; }); o + 1; });
+  a[({ int k = 1; k + 1; })] = 7;
+  ({ g++; });
+  printf ("%d %d %d %d %d\n", x, z, w, n, ret (20));
+  printf ("%d %d %ld\n", (int) (d * 10), a[2], l);
+  printf ("%d\n", g);
+  return 0;
+}
@@ -0,0 +1,52 @@
+/* Generated function by function (-fstream): calls to functions defined
+   later, small functions inlined after their bodies are gone, and globals
+   and types defined between functions. */
+#include <stdio.h>
+
+static int later (int x);
+int counter = 4;
+
+static int square (int x) { return x * x; }
+
+int fib (int n) { return n < 2 ? n : fib (n - 1) + fib (n - 2); }
+
+struct point {
+  int x, y;
+};
+
+static int manhattan (struct point *p) {
+  int dx = p->x, dy = p->y;
+
+  if (dx < 0) dx = -dx;
+  if (dy < 0) dy = -dy;
+  return dx + dy;
+}
+
+int call_later (void) {
+  counter += 3;
+  return later (counter);
+}
+
+int table[4] = {10, 20, 30, 40};
+
+typedef long offset_t;
+offset_t offset = 5;
+
+static int later (int x) { return square (x) + offset; }
+
+int sum_table (void) {
+  int s = 0;
+  for (int i = 0; i < 4; i++) s += square (table[i] / 10);
+  return s;
+}
+
+int main (void) {
+  struct point p = {-3, 7};
+  printf ("fib %d\n", fib (15));
+  printf ("later %d\n", call_later ());
+  printf ("counter %d\n", counter);
+  printf ("squares %d\n", sum_table ());
+  printf ("manhattan %d\n", manhattan (&p));
+  printf ("offset %ld\n", offset * 2);
+  return 0;
+}
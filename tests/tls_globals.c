@@ -0,0 +1,29 @@
+/* __thread and _Thread_local globals: initial values, updates, addresses and
+   arrays in the block of the running thread. */
+#include <stdio.h>
+
+__thread int counter = 5;
+_Thread_local long big = -7;
+static __thread char tag[8] = "tls";
+__thread int zeroed[4];
+int plain = 100;
+
+static void bump (int n) {
+  counter += n;
+  zeroed[n & 3]++;
+}
+
+int main (void) {
+  int *p = &counter;
+  long *q = &big;
+
+  bump (1);
+  bump (2);
+  *p *= 3;
+  *q = *q * 2 + counter;
+  tag[3] = '!';
+  printf ("counter %d big %ld plain %d\n", counter, big, plain);
+  printf ("tag %s zeroed %d %d %d %d\n", tag, zeroed[0], zeroed[1], zeroed[2], zeroed[3]);
+  printf ("same %d\n", p == &counter && q == &big);
+  return 0;
+}
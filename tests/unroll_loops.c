@@ -0,0 +1,78 @@
+/* Counted loops the linear IR unrolls (-O2) and ones it must leave alone. */
+#include <stdio.h>
+
+int a[16];
+int n = 7;
+
+static int sum_const (void) {
+  int s = 0;
+
+  for (int i = 0; i < 4; i++) s += a[i];
+  return s;
+}
+
+static int sum_step (void) {
+  int s = 0;
+
+  for (int i = 1; i <= 9; i += 2) s += a[i] * i;
+  return s;
+}
+
+static int sum_down (void) {
+  int s = 0;
+
+  for (int i = 5; i > 0; i--) s = s * 3 + a[i];
+  return s;
+}
+
+static int sum_break (void) {
+  int s = 0;
+
+  for (int i = 0; i < 8; i++) {
+    if (a[i] > 20) break;
+    s += a[i];
+  }
+  return s;
+}
+
+static int sum_var (void) {
+  int s = 0;
+
+  for (int i = 0; i < n; i++) s += a[i];
+  return s;
+}
+
+static int sum_modified (void) {
+  int s = 0;
+
+  for (int i = 0; i < 6; i++) {
+    s += a[i];
+    if (a[i] == 9) i++; /* the counter changes in the body */
+  }
+  return s;
+}
+
+static int sum_nested (void) {
+  int s = 0;
+
+  for (int i = 0; i < 3; i++)
+    for (int j = 0; j < 3; j++) s += a[i * 3 + j] * (i + 1);
+  return s;
+}
+
+int main (void) {
+  int i;
+
+  for (i = 0; i < 16; i++) a[i] = i * i;
+  printf ("const %d\n", sum_const ());
+  printf ("step %d\n", sum_step ());
+  printf ("down %d\n", sum_down ());
+  printf ("break %d\n", sum_break ());
+  printf ("var %d\n", sum_var ());
+  printf ("modified %d\n", sum_modified ());
+  printf ("nested %d\n", sum_nested ());
+  i = 0;
+  for (int k = 0; k < 5; k++) i += k; /* the counter of an empty-bodied loop */
+  printf ("after %d\n", i);
+  return 0;
+}
@@ -0,0 +1,31 @@
+/* Unsigned comparisons, shifts and divisions, and left operands that must
+   survive a call or a division on the right side. */
+#include <stdio.h>
+
+unsigned u = 4294967295u;
+unsigned long ul = 18446744073709551615ul;
+unsigned char uc = 200;
+int a = 5, b = 7;
+
+static int one (void) { return 1; }
+
+int main (void) {
+  unsigned v = u, w = 3;
+  unsigned long lv = ul;
+
+  printf ("cmp %d %d %d %d\n", v > 5, v < 5, lv >= 6, lv <= 6);
+  printf ("cmp ptr %d\n", &a < &a + 1);
+  if (v > w) printf ("branch gt\n");
+  if (lv < 10) printf ("branch lt\n");
+  printf ("shift %u %lu %u\n", v >> 4, lv >> 60, (unsigned) (uc >> 1));
+  printf ("div %u %u %u %u\n", v / w, v % w, v / 2, v % 16);
+  printf ("div long %lu %lu\n", lv / 10, lv % 10);
+  v /= 7;
+  lv %= 1000;
+  w >>= 1;
+  printf ("assign %u %lu %u\n", v, lv, w);
+  printf ("spill %d %d\n", a * 2 + (b * 3 + one ()), a * 2 + (b * 3 + (a * 4 + one ())));
+  printf ("spill div %u %d\n", w * 2 + (v * 3 + v / 7), a < 72 / b);
+  for (int i = 0; i < 21 / b; i++) printf ("loop %d\n", i);
+  return 0;
+}